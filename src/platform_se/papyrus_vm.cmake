@@ -0,0 +1,179 @@
+# papyrus-vm-lib and its tools. Portable, included by CMakeLists.txt and by
+# papyrus_vm_standalone/CMakeLists.txt, which builds them without the game
+set(papyrus_vm_dir "${CMAKE_CURRENT_LIST_DIR}")
+
+find_package(Threads REQUIRED)
+
+file(GLOB papyrus_vm_lib_src "${papyrus_vm_dir}/skyrim_platform/papyrus-vm-lib/*")
+add_library(papyrus_vm_lib STATIC ${papyrus_vm_lib_src})
+target_include_directories(papyrus_vm_lib PUBLIC "${papyrus_vm_dir}/skyrim_platform/papyrus-vm-lib")
+target_include_directories(papyrus_vm_lib PRIVATE "${third_party}")
+target_link_libraries(papyrus_vm_lib PUBLIC Threads::Threads)
+apply_default_settings(TARGETS papyrus_vm_lib)
+
+# Compiles Papyrus functions to C++, see AotCompiler.h. Only built for the
+# targets of papyrus_vm_add_aot unless PAPYRUS_VM_TOOLS is on
+add_executable(pex_aot_compiler EXCLUDE_FROM_ALL "${papyrus_vm_dir}/pex_aot_compiler/main.cpp")
+target_link_libraries(pex_aot_compiler PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS pex_aot_compiler)
+
+# Builds the functions of the .pex files in pex_directory into target, which
+# passes <table>() to VirtualMachine::RegisterAotFunctions. OPTIMIZE must
+# match the 'optimize' argument of the target's VirtualMachine. FUNCTIONS
+# limits compilation to the named functions, e.g. the hot ones in a profile
+function(papyrus_vm_add_aot target table pex_directory)
+  cmake_parse_arguments(PARSE_ARGV 3 aot "OPTIMIZE" "" "FUNCTIONS")
+  file(GLOB pex_files CONFIGURE_DEPENDS "${pex_directory}/*.pex")
+  set(output "${CMAKE_CURRENT_BINARY_DIR}/${target}_${table}.cpp")
+
+  set(args --table ${table})
+  if (aot_OPTIMIZE)
+    list(APPEND args --optimize)
+  endif()
+  foreach(function ${aot_FUNCTIONS})
+    list(APPEND args --function ${function})
+  endforeach()
+
+  add_custom_command(
+    OUTPUT "${output}"
+    COMMAND pex_aot_compiler ${args} "${output}" ${pex_files}
+    DEPENDS pex_aot_compiler ${pex_files}
+    COMMENT "Compiling Papyrus functions in ${pex_directory} to C++"
+    VERBATIM
+  )
+  target_sources(${target} PRIVATE "${output}")
+endfunction()
+
+# Benches, checks, fuzzers and other tools for working on the VM. The game
+# build only needs papyrus_vm_lib, papyrus_vm_standalone turns them on
+option(PAPYRUS_VM_TOOLS "Build the papyrus-vm-lib benches, checks and fuzzers" OFF)
+if (NOT PAPYRUS_VM_TOOLS)
+  return()
+endif()
+
+set_target_properties(pex_aot_compiler PROPERTIES EXCLUDE_FROM_ALL OFF)
+
+# Heap allocations per script call, with frames from FrameArena and with
+# PAPYRUS_VM_HEAP_FRAMES, which needs a build of the library of its own
+add_library(papyrus_vm_lib_heap_frames STATIC ${papyrus_vm_lib_src})
+target_include_directories(papyrus_vm_lib_heap_frames PUBLIC "${papyrus_vm_dir}/skyrim_platform/papyrus-vm-lib")
+target_include_directories(papyrus_vm_lib_heap_frames PRIVATE "${third_party}")
+target_compile_definitions(papyrus_vm_lib_heap_frames PUBLIC PAPYRUS_VM_HEAP_FRAMES)
+target_link_libraries(papyrus_vm_lib_heap_frames PUBLIC Threads::Threads)
+apply_default_settings(TARGETS papyrus_vm_lib_heap_frames)
+
+add_executable(papyrus_vm_alloc_bench "${papyrus_vm_dir}/papyrus_vm_alloc_bench/main.cpp")
+target_link_libraries(papyrus_vm_alloc_bench PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS papyrus_vm_alloc_bench)
+
+add_executable(papyrus_vm_alloc_bench_heap_frames "${papyrus_vm_dir}/papyrus_vm_alloc_bench/main.cpp")
+target_link_libraries(papyrus_vm_alloc_bench_heap_frames PRIVATE papyrus_vm_lib_heap_frames)
+apply_default_settings(TARGETS papyrus_vm_alloc_bench_heap_frames)
+
+add_executable(papyrus_vm_shard_bench "${papyrus_vm_dir}/papyrus_vm_shard_bench/main.cpp")
+target_link_libraries(papyrus_vm_shard_bench PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS papyrus_vm_shard_bench)
+
+# 10k script threads waiting on latent natives at once, exits with 1 on failure
+add_executable(papyrus_vm_scheduler_check "${papyrus_vm_dir}/papyrus_vm_scheduler_check/main.cpp")
+target_link_libraries(papyrus_vm_scheduler_check PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS papyrus_vm_scheduler_check)
+
+add_executable(papyrus_vm_arith_bench "${papyrus_vm_dir}/papyrus_vm_arith_bench/main.cpp")
+target_link_libraries(papyrus_vm_arith_bench PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS papyrus_vm_arith_bench)
+
+# The same bench with the loop compiled by AotCompiler
+set(arith_bench_aot "${CMAKE_CURRENT_BINARY_DIR}/papyrus_vm_arith_bench_aot")
+add_custom_command(
+  OUTPUT "${arith_bench_aot}_plain.cpp" "${arith_bench_aot}_optimized.cpp"
+  COMMAND papyrus_vm_arith_bench --write-aot "${arith_bench_aot}_plain.cpp" "${arith_bench_aot}_optimized.cpp"
+  DEPENDS papyrus_vm_arith_bench
+  VERBATIM
+)
+add_executable(papyrus_vm_arith_bench_aot
+  "${papyrus_vm_dir}/papyrus_vm_arith_bench/main.cpp"
+  "${arith_bench_aot}_plain.cpp"
+  "${arith_bench_aot}_optimized.cpp"
+)
+target_link_libraries(papyrus_vm_arith_bench_aot PRIVATE papyrus_vm_lib)
+target_compile_definitions(papyrus_vm_arith_bench_aot PRIVATE PAPYRUS_VM_ARITH_BENCH_AOT)
+apply_default_settings(TARGETS papyrus_vm_arith_bench_aot)
+
+# Writes a PexCache file and compares VM construction from it and from .pex
+add_executable(pex_cache_builder "${papyrus_vm_dir}/pex_cache_builder/main.cpp")
+target_link_libraries(pex_cache_builder PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS pex_cache_builder)
+
+add_executable(pex_optimizer_check "${papyrus_vm_dir}/pex_optimizer_check/main.cpp")
+target_link_libraries(pex_optimizer_check PRIVATE papyrus_vm_lib)
+apply_default_settings(TARGETS pex_optimizer_check)
+
+# Google Benchmark suite, the regression gate for VM performance changes.
+# vcpkg installs Google Benchmark with the papyrus-vm-bench feature
+find_package(benchmark CONFIG)
+if (benchmark_FOUND)
+  add_executable(papyrus_vm_bench "${papyrus_vm_dir}/papyrus_vm_bench/main.cpp")
+  target_link_libraries(papyrus_vm_bench PRIVATE papyrus_vm_lib benchmark::benchmark)
+  target_compile_definitions(papyrus_vm_bench PRIVATE PAPYRUS_VM_BENCH_PEX="${papyrus_vm_dir}/pex/TESModPlatform.pex")
+  apply_default_settings(TARGETS papyrus_vm_bench)
+else()
+  message(STATUS "Google Benchmark not found, papyrus_vm_bench is not built")
+endif()
+
+# Fuzzers and the golden output corpus runner
+option(PAPYRUS_VM_LIBFUZZER "Link the fuzzers with libFuzzer (Clang only)" OFF)
+
+add_library(papyrus_vm_script_runner STATIC
+  "${papyrus_vm_dir}/papyrus_vm_fuzz/ScriptRunner.cpp"
+  "${papyrus_vm_dir}/papyrus_vm_fuzz/ScriptRunner.h"
+  "${papyrus_vm_dir}/papyrus_vm_fuzz/PexWriter.cpp"
+  "${papyrus_vm_dir}/papyrus_vm_fuzz/PexWriter.h"
+)
+target_include_directories(papyrus_vm_script_runner PUBLIC "${papyrus_vm_dir}/papyrus_vm_fuzz")
+target_link_libraries(papyrus_vm_script_runner PUBLIC papyrus_vm_lib)
+apply_default_settings(TARGETS papyrus_vm_script_runner)
+
+add_executable(papyrus_vm_corpus_runner "${papyrus_vm_dir}/papyrus_vm_fuzz/CorpusRunner.cpp")
+target_link_libraries(papyrus_vm_corpus_runner PRIVATE papyrus_vm_script_runner)
+apply_default_settings(TARGETS papyrus_vm_corpus_runner)
+
+# Writes the random scripts of papyrus_vm_fuzz/corpus
+add_executable(papyrus_vm_corpus_generator "${papyrus_vm_dir}/papyrus_vm_fuzz/CorpusGenerator.cpp")
+target_link_libraries(papyrus_vm_corpus_generator PRIVATE papyrus_vm_script_runner)
+apply_default_settings(TARGETS papyrus_vm_corpus_generator)
+
+# Differential check of AotCompiler: the corpus runner with every function of
+# the corpus compiled, compared with the golden files of the interpreter
+set(PAPYRUS_VM_AOT_CORPUS "" CACHE PATH "Corpus to build papyrus_vm_aot_corpus_runner for")
+if (PAPYRUS_VM_AOT_CORPUS)
+  add_executable(papyrus_vm_aot_corpus_runner "${papyrus_vm_dir}/papyrus_vm_fuzz/CorpusRunner.cpp")
+  target_link_libraries(papyrus_vm_aot_corpus_runner PRIVATE papyrus_vm_script_runner)
+  target_compile_definitions(papyrus_vm_aot_corpus_runner PRIVATE PAPYRUS_VM_AOT)
+  papyrus_vm_add_aot(papyrus_vm_aot_corpus_runner GetPlainAotFunctions "${PAPYRUS_VM_AOT_CORPUS}")
+  papyrus_vm_add_aot(papyrus_vm_aot_corpus_runner GetOptimizedAotFunctions "${PAPYRUS_VM_AOT_CORPUS}" OPTIMIZE)
+  apply_default_settings(TARGETS papyrus_vm_aot_corpus_runner)
+endif()
+
+foreach(fuzzer Reader Interpreter)
+  string(TOLOWER ${fuzzer} name)
+  set(target papyrus_vm_${name}_fuzzer)
+  if (PAPYRUS_VM_LIBFUZZER)
+    add_executable(${target} "${papyrus_vm_dir}/papyrus_vm_fuzz/${fuzzer}Fuzzer.cpp")
+    target_link_options(${target} PRIVATE -fsanitize=fuzzer)
+  else()
+    # Runs the fuzzer on files or stdin, e.g. under AFL or to replay crashes
+    add_executable(${target}
+      "${papyrus_vm_dir}/papyrus_vm_fuzz/${fuzzer}Fuzzer.cpp"
+      "${papyrus_vm_dir}/papyrus_vm_fuzz/FuzzerMain.cpp"
+    )
+  endif()
+  target_link_libraries(${target} PRIVATE papyrus_vm_script_runner)
+  apply_default_settings(TARGETS ${target})
+endforeach()
+
+if (PAPYRUS_VM_LIBFUZZER)
+  foreach(target papyrus_vm_lib papyrus_vm_script_runner)
+    target_compile_options(${target} PRIVATE -fsanitize=fuzzer-no-link)
+  endforeach()
+endif()
@@ -0,0 +1,262 @@
+#include "VirtualMachine.h"
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <string>
+
+// Usage: papyrus_vm_alloc_bench [calls]
+//
+// Counts heap allocations per script call by replacing operator new. Built
+// twice: papyrus_vm_alloc_bench takes call frames from FrameArena,
+// papyrus_vm_alloc_bench_heap_frames is built with PAPYRUS_VM_HEAP_FRAMES
+// and allocates every frame block on the heap. Calls are made from the host
+// without an argument vector, so every allocation counted is the VM's own.
+
+namespace {
+size_t g_numAllocations = 0;
+}
+
+void* operator new(size_t size)
+{
+  ++g_numAllocations;
+  if (void* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace {
+class BenchObject : public IGameObject
+{
+public:
+  const char* GetStringID() override { return "bench"; }
+};
+
+VarValue Id(const char* name)
+{
+  return VarValue(VarValue::kType_Identifier, name);
+}
+
+FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+{
+  FunctionCode::Instruction instruction;
+  instruction.op = op;
+  instruction.args = std::move(args);
+  return instruction;
+}
+
+// 'While i < n' around the body, which must not touch i, n and ::loop
+FunctionInfo MakeLoop(std::vector<FunctionCode::Instruction> body,
+                      FunctionInfo::ParamTable locals)
+{
+  FunctionInfo function;
+  function.returnType = "None";
+  function.params = { { "n", "Int" } };
+  function.locals = std::move(locals);
+  function.locals.push_back({ "i", "Int" });
+  function.locals.push_back({ "::loop", "Bool" });
+
+  auto bodySize = static_cast<int32_t>(body.size());
+  auto& code = function.code.instructions;
+  code.push_back(Op(FunctionCode::kOp_Assign, { Id("i"), VarValue(0) }));
+  code.push_back(
+    Op(FunctionCode::kOp_CompareLT, { Id("::loop"), Id("i"), Id("n") }));
+  code.push_back(
+    Op(FunctionCode::kOp_JumpF, { Id("::loop"), VarValue(bodySize + 3) }));
+  code.insert(code.end(), body.begin(), body.end());
+  code.push_back(
+    Op(FunctionCode::kOp_IAdd, { Id("i"), Id("i"), VarValue(1) }));
+  code.push_back(Op(FunctionCode::kOp_Jump, { VarValue(-bodySize - 3) }));
+  return function;
+}
+
+// Scriptname AllocBench
+//
+// Int Property Value
+//   Int Function Get()
+//     Return value_
+//   EndFunction
+//   Function Set(Int x)
+//     value_ = x
+//   EndFunction
+// EndProperty
+//
+// Int Function CallSelf(Int n)
+//   If n <= 0
+//     Return 0
+//   EndIf
+//   Return CallSelf(n - 1) + 1
+// EndFunction
+//
+// Function CallNatives(Int n)
+//   ; n times
+//   AllocBenchNative.Add(i, 1, 2)
+// EndFunction
+//
+// Function Loop(Int n)
+//   ; n times
+//   sum += i
+// EndFunction
+//
+// Function Properties(Int n)
+//   ; n times
+//   Value = Value + i
+// EndFunction
+std::shared_ptr<PexScript> MakeBenchScript()
+{
+  ObjectTable::Object::StateInfo state;
+
+  FunctionInfo callSelf;
+  callSelf.returnType = "Int";
+  callSelf.params = { { "n", "Int" } };
+  callSelf.locals = { { "::cond", "Bool" },
+                      { "::temp", "Int" },
+                      { "::result", "Int" } };
+  callSelf.code.instructions = {
+    Op(FunctionCode::kOp_CompareLTE, { Id("::cond"), Id("n"), VarValue(0) }),
+    Op(FunctionCode::kOp_JumpF, { Id("::cond"), VarValue(2) }),
+    Op(FunctionCode::kOp_Return, { VarValue(0) }),
+    Op(FunctionCode::kOp_ISubtract, { Id("::temp"), Id("n"), VarValue(1) }),
+    Op(FunctionCode::kOp_CallMethod,
+       { Id("CallSelf"), Id("self"), Id("::result"), VarValue(1),
+         Id("::temp") }),
+    Op(FunctionCode::kOp_IAdd, { Id("::result"), Id("::result"), VarValue(1) }),
+    Op(FunctionCode::kOp_Return, { Id("::result") }),
+  };
+  state.functions.push_back({ "CallSelf", callSelf });
+
+  state.functions.push_back(
+    { "CallNatives",
+      MakeLoop({ Op(FunctionCode::kOp_CallStatic,
+                    { Id("AllocBenchNative"), Id("Add"), Id("::result"),
+                      VarValue(3), Id("i"), VarValue(1), VarValue(2) }) },
+               { { "::result", "Int" } }) });
+
+  state.functions.push_back(
+    { "Loop",
+      MakeLoop({ Op(FunctionCode::kOp_IAdd, { Id("sum"), Id("sum"), Id("i") }) },
+               {}) });
+
+  state.functions.push_back(
+    { "Properties",
+      MakeLoop(
+        {
+          Op(FunctionCode::kOp_PropGet,
+             { Id("Value"), Id("self"), Id("::temp") }),
+          Op(FunctionCode::kOp_IAdd, { Id("::temp"), Id("::temp"), Id("i") }),
+          Op(FunctionCode::kOp_PropSet,
+             { Id("Value"), Id("self"), Id("::temp") }),
+        },
+        { { "::temp", "Int" } }) });
+
+  ObjectTable::Object::PropInfo property;
+  property.name = "Value";
+  property.type = "Int";
+  property.flags = ObjectTable::Object::PropInfo::kFlags_Read |
+    ObjectTable::Object::PropInfo::kFlags_Write;
+  property.readHandler.returnType = "Int";
+  property.readHandler.code.instructions = {
+    Op(FunctionCode::kOp_Return, { Id("value_") }),
+  };
+  property.writeHandler.returnType = "None";
+  property.writeHandler.params = { { "x", "Int" } };
+  property.writeHandler.code.instructions = {
+    Op(FunctionCode::kOp_Assign, { Id("value_"), Id("x") }),
+  };
+
+  ObjectTable::Object object;
+  object.NameIndex = "AllocBench";
+  object.states = { state };
+  object.properties = { property };
+
+  for (auto name : { "value_", "sum" }) {
+    ObjectTable::Object::VarInfo variable;
+    variable.name = name;
+    variable.typeName = "Int";
+    variable.value = VarValue(0);
+    object.variables.push_back(variable);
+  }
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "AllocBench";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+// Heap allocations per call of the method, after a few calls to warm up the
+// arena, the string pool and the inline caches
+double CountAllocations(VirtualMachine& vm, BenchObject& object,
+                        const char* method, int32_t n, int numCalls)
+{
+  auto instance = vm.GetInstance(&object, "AllocBench");
+  VarValue argument(n);
+
+  for (int i = 0; i < 10; ++i) {
+    vm.CallMethod(instance, &object, method, &argument, 1);
+  }
+
+  size_t start = g_numAllocations;
+  for (int i = 0; i < numCalls; ++i) {
+    vm.CallMethod(instance, &object, method, &argument, 1);
+  }
+  return double(g_numAllocations - start) / numCalls;
+}
+}
+
+int main(int argc, char** argv)
+{
+  int numCalls = argc > 1 ? std::stoi(argv[1]) : 1000;
+
+  try {
+    VirtualMachine vm({ MakeBenchScript() });
+    vm.RegisterFunction("AllocBenchNative", "Add",
+                        FunctionType::GlobalFunction,
+                        [](int32_t a, int32_t b, int32_t c) { return a + b + c; });
+
+    auto object = std::make_shared<BenchObject>();
+    vm.AddObject(object, { "AllocBench" }, {});
+
+    auto instance = vm.GetInstance(object.get(), "AllocBench");
+    VarValue ten(10);
+    auto result = vm.CallMethod(instance, object.get(), "CallSelf", &ten, 1);
+    if (result.GetType() != VarValue::kType_Integer || result.GetInt() != 10)
+      throw std::runtime_error("Wrong result of CallSelf");
+
+#ifdef PAPYRUS_VM_HEAP_FRAMES
+    std::cout << "PAPYRUS_VM_HEAP_FRAMES, ";
+#else
+    std::cout << "FrameArena, ";
+#endif
+    std::cout << "heap allocations per call:" << std::endl;
+
+    std::cout << std::fixed << std::setprecision(1);
+    for (auto [method, n] : { std::make_pair("CallSelf", 10),
+                              std::make_pair("CallNatives", 10),
+                              std::make_pair("Loop", 100),
+                              std::make_pair("Properties", 3) }) {
+      double allocations =
+        CountAllocations(vm, *object, method, n, numCalls);
+      std::cout << "  " << std::left << std::setw(16)
+                << (std::string(method) + '(' + std::to_string(n) + ')')
+                << allocations << std::endl;
+    }
+
+    // Properties(3) adds 0 + 1 + 2 to Value on each of the 10 + numCalls calls
+    if (instance->variables[0].GetInt() != 3 * (10 + numCalls))
+      throw std::runtime_error("Property handlers were not called");
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,175 @@
+#include "AotCompiler.h"
+#include "VirtualMachine.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+// Usage: papyrus_vm_arith_bench [iterations]
+//        papyrus_vm_arith_bench --write-aot <plain .cpp> <optimized .cpp>
+//
+// Measures interpreter speed on a tight Int and Float arithmetic loop, with
+// plain and optimized code. Instructions per second are counted in
+// instructions of the plain code, so all modes are comparable.
+//
+// --write-aot compiles the loop with AotCompiler. papyrus_vm_arith_bench_aot
+// is built with the output and measures the compiled loop as well.
+
+#ifdef PAPYRUS_VM_ARITH_BENCH_AOT
+const std::vector<AotFunction>& GetPlainAotFunctions();
+const std::vector<AotFunction>& GetOptimizedAotFunctions();
+#endif
+
+namespace {
+constexpr int kInstructionsPerIteration = 9;
+
+VarValue Id(const char* name)
+{
+  return VarValue(VarValue::kType_Identifier, name);
+}
+
+FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+{
+  FunctionCode::Instruction instruction;
+  instruction.op = op;
+  instruction.args = std::move(args);
+  return instruction;
+}
+
+// Scriptname ArithBench
+//
+// Float Function Loop(Int n) Global
+//   Int i = 0
+//   Int sum = 0
+//   Float f = 0.0
+//   While i < n
+//     sum += i % 7 * 3
+//     f = f * 0.5 + 1.0
+//     i += 1
+//   EndWhile
+//   Return f + sum as Float
+// EndFunction
+std::shared_ptr<PexScript> MakeBenchScript()
+{
+  FunctionInfo loop;
+  loop.returnType = "Float";
+  loop.flags = 1; // Global
+  loop.params = { { "n", "Int" } };
+  loop.locals = { { "i", "Int" },
+                  { "sum", "Int" },
+                  { "f", "Float" },
+                  { "::temp0", "Bool" },
+                  { "::temp1", "Int" },
+                  { "::temp2", "Float" } };
+  loop.code.instructions = {
+    Op(FunctionCode::kOp_Assign, { Id("i"), VarValue(0) }),
+    Op(FunctionCode::kOp_Assign, { Id("sum"), VarValue(0) }),
+    Op(FunctionCode::kOp_Assign, { Id("f"), VarValue(0.0f) }),
+    Op(FunctionCode::kOp_CompareLT, { Id("::temp0"), Id("i"), Id("n") }),
+    Op(FunctionCode::kOp_JumpF, { Id("::temp0"), VarValue(8) }),
+    Op(FunctionCode::kOp_IMod, { Id("::temp1"), Id("i"), VarValue(7) }),
+    Op(FunctionCode::kOp_IMultiply,
+       { Id("::temp1"), Id("::temp1"), VarValue(3) }),
+    Op(FunctionCode::kOp_IAdd, { Id("sum"), Id("sum"), Id("::temp1") }),
+    Op(FunctionCode::kOp_FMultiply,
+       { Id("::temp2"), Id("f"), VarValue(0.5f) }),
+    Op(FunctionCode::kOp_FAdd, { Id("f"), Id("::temp2"), VarValue(1.0f) }),
+    Op(FunctionCode::kOp_IAdd, { Id("i"), Id("i"), VarValue(1) }),
+    Op(FunctionCode::kOp_Jump, { VarValue(-8) }),
+    Op(FunctionCode::kOp_Cast, { Id("::temp2"), Id("sum") }),
+    Op(FunctionCode::kOp_FAdd, { Id("::temp2"), Id("f"), Id("::temp2") }),
+    Op(FunctionCode::kOp_Return, { Id("::temp2") }),
+  };
+
+  ObjectTable::Object::StateInfo state;
+  state.functions = { { "Loop", loop } };
+
+  ObjectTable::Object object;
+  object.NameIndex = "ArithBench";
+  object.states = { state };
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "ArithBench";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+float ExpectedResult(int32_t numIterations)
+{
+  int32_t sum = 0;
+  float f = 0.0f;
+  for (int32_t i = 0; i < numIterations; ++i) {
+    sum += i % 7 * 3;
+    f = f * 0.5f + 1.0f;
+  }
+  return f + float(sum);
+}
+
+void WriteAotSource(bool optimize, const std::string& path)
+{
+  VirtualMachine vm({ MakeBenchScript() }, optimize);
+  std::ofstream out(path, std::ios::binary);
+  out << AotCompiler::Compile(vm.allLoadedScripts,
+                              optimize ? "GetOptimizedAotFunctions"
+                                       : "GetPlainAotFunctions")
+           .source;
+  if (!out)
+    throw std::runtime_error("Error write file: " + path);
+}
+
+double Run(bool optimize, bool aot, int32_t numIterations)
+{
+  VirtualMachine vm({ MakeBenchScript() }, optimize);
+  std::vector<VarValue> arguments = { VarValue(numIterations) };
+
+#ifdef PAPYRUS_VM_ARITH_BENCH_AOT
+  if (aot &&
+      vm.RegisterAotFunctions(optimize ? GetOptimizedAotFunctions()
+                                       : GetPlainAotFunctions()) != 1)
+    throw std::runtime_error("Compiled code doesn't match");
+#endif
+
+  auto start = std::chrono::steady_clock::now();
+  auto result = vm.CallStatic("ArithBench", "Loop", arguments);
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  if (result.GetType() != VarValue::kType_Float ||
+      result.GetFloat() != ExpectedResult(numIterations))
+    throw std::runtime_error("Wrong result");
+
+  return double(numIterations) * kInstructionsPerIteration / elapsed.count();
+}
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    if (argc == 4 && std::string(argv[1]) == "--write-aot") {
+      WriteAotSource(false, argv[2]);
+      WriteAotSource(true, argv[3]);
+      return 0;
+    }
+
+    int32_t numIterations = argc > 1 ? std::stoi(argv[1]) : 10000000;
+
+#ifdef PAPYRUS_VM_ARITH_BENCH_AOT
+    std::initializer_list<bool> aotModes = { false, true };
+#else
+    std::initializer_list<bool> aotModes = { false };
+#endif
+    for (bool aot : aotModes) {
+      for (bool optimize : { false, true }) {
+        double instructionsPerSecond = Run(optimize, aot, numIterations);
+        std::cout << (optimize ? "optimized" : "plain")
+                  << (aot ? " AOT: " : ": ")
+                  << size_t(instructionsPerSecond / 1e6)
+                  << "M instructions/s" << std::endl;
+      }
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
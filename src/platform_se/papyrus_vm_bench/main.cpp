@@ -0,0 +1,595 @@
+#include "OpcodesImplementation.h"
+#include "Reader.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <tuple>
+
+// Usage: papyrus_vm_bench [Google Benchmark flags] [TESModPlatform.pex]
+//
+// Benchmarks of papyrus-vm-lib: parsing, instance creation, events, calls
+// into natives, strings, properties and arrays. Interpreter benchmarks run
+// plain and optimized code. The regression gate for VM performance changes,
+// compare runs with --benchmark_out and Google Benchmark's compare.py
+
+namespace {
+constexpr int32_t kLoopSize = 1000;
+constexpr int kNumFanOutScripts = 8;
+
+std::string g_pexPath = PAPYRUS_VM_BENCH_PEX;
+
+class BenchObject : public IGameObject
+{
+public:
+  const char* GetStringID() override { return "bench"; }
+};
+
+VarValue Id(const char* name)
+{
+  return VarValue(VarValue::kType_Identifier, name);
+}
+
+VarValue Str(const char* s)
+{
+  return VarValue(s);
+}
+
+FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+{
+  FunctionCode::Instruction instruction;
+  instruction.op = op;
+  instruction.args = std::move(args);
+  return instruction;
+}
+
+// 'While i < n' around the body, which must not touch i, n and ::loop
+FunctionInfo MakeLoop(std::vector<FunctionCode::Instruction> body,
+                      FunctionInfo::ParamTable locals)
+{
+  FunctionInfo function;
+  function.returnType = "None";
+  function.params = { { "n", "Int" } };
+  function.locals = std::move(locals);
+  function.locals.push_back({ "i", "Int" });
+  function.locals.push_back({ "::loop", "Bool" });
+
+  auto bodySize = static_cast<int32_t>(body.size());
+  auto& code = function.code.instructions;
+  code.push_back(Op(FunctionCode::kOp_Assign, { Id("i"), VarValue(0) }));
+  code.push_back(
+    Op(FunctionCode::kOp_CompareLT, { Id("::loop"), Id("i"), Id("n") }));
+  code.push_back(
+    Op(FunctionCode::kOp_JumpF, { Id("::loop"), VarValue(bodySize + 3) }));
+  code.insert(code.end(), body.begin(), body.end());
+  code.push_back(
+    Op(FunctionCode::kOp_IAdd, { Id("i"), Id("i"), VarValue(1) }));
+  code.push_back(Op(FunctionCode::kOp_Jump, { VarValue(-bodySize - 3) }));
+  return function;
+}
+
+// Scriptname VmBench
+//
+// Int Property Value Auto
+// Int[] ints
+// String[] strings
+// String name
+// Int lastInt
+// String lastString
+//
+// Function CallNatives(Int n)
+//   ; n times
+//   TESModPlatform.Add(i, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11)
+// EndFunction
+//
+// Function Concat(Int n)
+//   ; n times
+//   name = "Actor_" + i
+// EndFunction
+//
+// Function Properties(Int n)
+//   ; n times
+//   Value = Value + i
+// EndFunction
+//
+// Function FillArrays(Int n)
+//   ints = new Int[n]
+//   strings = new String[n]
+//   ; n times
+//   ints[i] = i
+//   strings[i] = "Item_" + i
+//   lastInt = i
+//   lastString = strings[i]
+// EndFunction
+//
+// Function FindInts(Int n)
+//   ; n times
+//   ints.Find(lastInt)
+// EndFunction
+//
+// Function FindStrings(Int n)
+//   ; n times
+//   strings.Find(lastString)
+// EndFunction
+std::shared_ptr<PexScript> MakeBenchScript()
+{
+  ObjectTable::Object::StateInfo state;
+
+  std::vector<VarValue> addArguments = { Id("TESModPlatform"), Id("Add"),
+                                         Id("::result"), VarValue(12),
+                                         Id("i") };
+  for (int32_t k = 1; k < 12; ++k) {
+    addArguments.push_back(VarValue(k));
+  }
+  state.functions.push_back(
+    { "CallNatives",
+      MakeLoop({ Op(FunctionCode::kOp_CallStatic, addArguments) },
+               { { "::result", "Int" } }) });
+
+  state.functions.push_back(
+    { "Concat",
+      MakeLoop(
+        {
+          Op(FunctionCode::kOp_Cast, { Id("::temp"), Id("i") }),
+          Op(FunctionCode::kOp_Strcat,
+             { Id("name"), Str("Actor_"), Id("::temp") }),
+        },
+        { { "::temp", "String" } }) });
+
+  state.functions.push_back(
+    { "Properties",
+      MakeLoop(
+        {
+          Op(FunctionCode::kOp_PropGet,
+             { Id("Value"), Id("self"), Id("::temp") }),
+          Op(FunctionCode::kOp_IAdd, { Id("::temp"), Id("::temp"), Id("i") }),
+          Op(FunctionCode::kOp_PropSet,
+             { Id("Value"), Id("self"), Id("::temp") }),
+        },
+        { { "::temp", "Int" } }) });
+
+  auto fillArrays = MakeLoop(
+    {
+      Op(FunctionCode::kOp_ArraySetElement, { Id("ints"), Id("i"), Id("i") }),
+      Op(FunctionCode::kOp_Cast, { Id("::temp"), Id("i") }),
+      Op(FunctionCode::kOp_Strcat,
+         { Id("::temp"), Str("Item_"), Id("::temp") }),
+      Op(FunctionCode::kOp_ArraySetElement,
+         { Id("strings"), Id("i"), Id("::temp") }),
+      Op(FunctionCode::kOp_Assign, { Id("lastInt"), Id("i") }),
+      Op(FunctionCode::kOp_Assign, { Id("lastString"), Id("::temp") }),
+    },
+    { { "::temp", "String" } });
+  // n is the array size here
+  auto& fillCode = fillArrays.code.instructions;
+  fillCode.insert(
+    fillCode.begin(),
+    { Op(FunctionCode::kOp_ArrayCreate, { Id("ints"), Id("n") }),
+      Op(FunctionCode::kOp_ArrayCreate, { Id("strings"), Id("n") }) });
+  state.functions.push_back({ "FillArrays", fillArrays });
+
+  for (auto [name, array, value] :
+       { std::make_tuple("FindInts", "ints", "lastInt"),
+         std::make_tuple("FindStrings", "strings", "lastString") }) {
+    state.functions.push_back(
+      { name,
+        MakeLoop({ Op(OpcodesImplementation::Opcodes::op_Array_FindElement,
+                      { Id(array), Id("::result"), Id(value), VarValue(0) }) },
+                 { { "::result", "Int" } }) });
+  }
+
+  ObjectTable::Object object;
+  object.NameIndex = "VmBench";
+  object.states = { state };
+
+  for (auto [name, type] : { std::make_pair("::Value_var", "Int"),
+                             std::make_pair("ints", "Int[]"),
+                             std::make_pair("strings", "String[]"),
+                             std::make_pair("name", "String"),
+                             std::make_pair("lastInt", "Int"),
+                             std::make_pair("lastString", "String") }) {
+    ObjectTable::Object::VarInfo variable;
+    variable.name = name;
+    variable.typeName = type;
+    object.variables.push_back(variable);
+  }
+
+  ObjectTable::Object::PropInfo property;
+  property.name = "Value";
+  property.type = "Int";
+  property.flags = ObjectTable::Object::PropInfo::kFlags_Read |
+    ObjectTable::Object::PropInfo::kFlags_Write |
+    ObjectTable::Object::PropInfo::kFlags_AutoVar;
+  property.autoVarName = "::Value_var";
+  object.properties.push_back(property);
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "VmBench";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+// Scriptname FanOut<k>
+//
+// Int count
+//
+// Event OnBench(Int delta)
+//   count += delta
+// EndEvent
+std::shared_ptr<PexScript> MakeFanOutScript(int k)
+{
+  FunctionInfo onBench;
+  onBench.returnType = "None";
+  onBench.params = { { "delta", "Int" } };
+  onBench.code.instructions = {
+    Op(FunctionCode::kOp_IAdd, { Id("count"), Id("count"), Id("delta") }),
+  };
+
+  ObjectTable::Object::StateInfo state;
+  state.functions = { { "OnBench", onBench } };
+
+  ObjectTable::Object::VarInfo count;
+  count.name = "count";
+  count.typeName = "Int";
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "FanOut" + std::to_string(k);
+
+  ObjectTable::Object object;
+  object.NameIndex = script->source;
+  object.states = { state };
+  object.variables = { count };
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+std::vector<uint8_t> ReadPex()
+{
+  std::ifstream file(g_pexPath, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Error open file: " + g_pexPath);
+  return { std::istreambuf_iterator<char>(file),
+           std::istreambuf_iterator<char>() };
+}
+
+std::vector<std::shared_ptr<PexScript>> LoadScripts()
+{
+  auto bytes = ReadPex();
+  auto scripts = Reader(bytes.data(), bytes.size()).GetSourceStructures();
+  scripts.push_back(MakeBenchScript());
+  for (int k = 0; k < kNumFanOutScripts; ++k) {
+    scripts.push_back(MakeFanOutScript(k));
+  }
+  return scripts;
+}
+
+// VmBench and natives of TESModPlatform.pex on one object
+struct BenchVm
+{
+  explicit BenchVm(bool optimize)
+    : vm(LoadScripts(), optimize)
+  {
+    vm.RegisterFunction(
+      "TESModPlatform", "Add", FunctionType::GlobalFunction,
+      [](int32_t a1, int32_t a2, int32_t a3, int32_t a4, int32_t a5,
+         int32_t a6, int32_t a7, int32_t a8, int32_t a9, int32_t a10,
+         int32_t a11, int32_t a12) {
+        return a1 + a2 + a3 + a4 + a5 + a6 + a7 + a8 + a9 + a10 + a11 + a12;
+      });
+    vm.RegisterFunction("TESModPlatform", "IsPlayerRunningEnabled",
+                        FunctionType::GlobalFunction, [] { return true; });
+
+    vm.AddObject(object, { "VmBench" }, {});
+    instance = vm.GetInstance(object.get(), "VmBench");
+  }
+
+  void Call(const char* method, int32_t n)
+  {
+    VarValue argument(n);
+    vm.CallMethod(instance, object.get(), method, &argument, 1);
+  }
+
+  VirtualMachine vm;
+  std::shared_ptr<BenchObject> object = std::make_shared<BenchObject>();
+  ActivePexInstance* instance = nullptr;
+};
+
+void BM_ParsePex(benchmark::State& state)
+{
+  auto bytes = ReadPex();
+  for (auto _ : state) {
+    auto scripts = Reader(bytes.data(), bytes.size()).GetSourceStructures();
+    benchmark::DoNotOptimize(scripts);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * bytes.size());
+}
+BENCHMARK(BM_ParsePex);
+
+// Parsing plus linking, what loading a script costs
+void BM_LoadPex(benchmark::State& state)
+{
+  auto bytes = ReadPex();
+  for (auto _ : state) {
+    VirtualMachine vm(Reader(bytes.data(), bytes.size()).GetSourceStructures(),
+                      state.range(0));
+    benchmark::DoNotOptimize(vm);
+  }
+  state.SetBytesProcessed(int64_t(state.iterations()) * bytes.size());
+}
+BENCHMARK(BM_LoadPex)->ArgName("optimize")->Arg(0)->Arg(1);
+
+// Calls of every script function in the .pex, with code linked once or
+// linked again before each call. The latter is what StartFunction did before
+// FunctionLinker: it resolved every operand by name on every call
+void BM_StartFunction(benchmark::State& state)
+{
+  auto bytes = ReadPex();
+  auto scripts = Reader(bytes.data(), bytes.size()).GetSourceStructures();
+  VirtualMachine vm(scripts);
+  bool relink = state.range(0);
+
+  struct Call
+  {
+    ActivePexInstance* instance = nullptr;
+    FunctionInfo* function = nullptr;
+    std::vector<VarValue> arguments;
+  };
+  std::vector<Call> calls;
+
+  std::vector<std::shared_ptr<BenchObject>> objects;
+  for (auto& script : scripts) {
+    auto object = std::make_shared<BenchObject>();
+    vm.AddObject(object, { script->source }, {});
+    objects.push_back(object);
+
+    auto instance = vm.GetInstance(object.get(), script->source);
+    for (auto& scriptObject : script->objectTable.m_data) {
+      for (auto& scriptState : scriptObject.states) {
+        for (auto& function : scriptState.functions) {
+          if (function.function.IsNative())
+            continue;
+          Call call{ instance, &function.function };
+          for (auto& param : function.function.params) {
+            call.arguments.push_back(
+              VarValue(ActivePexInstance::GetTypeByName(param.type)));
+          }
+          calls.push_back(std::move(call));
+        }
+      }
+    }
+  }
+  if (calls.empty()) {
+    state.SkipWithError("No script functions in the .pex");
+    return;
+  }
+
+  for (auto _ : state) {
+    for (auto& call : calls) {
+      if (relink)
+        call.function->linkedCode.reset();
+      auto result = call.instance->StartFunction(
+        *call.function, call.arguments.data(), call.arguments.size());
+      benchmark::DoNotOptimize(result);
+    }
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * calls.size());
+}
+BENCHMARK(BM_StartFunction)->ArgName("relink")->Arg(0)->Arg(1);
+
+void BM_AddObject(benchmark::State& state)
+{
+  BenchVm bench(false);
+  auto numScripts = static_cast<int>(state.range(0));
+
+  std::vector<std::string> scripts = { "VmBench" };
+  for (int k = 0; k + 1 < numScripts; ++k) {
+    scripts.push_back("FanOut" + std::to_string(k));
+  }
+
+  constexpr int kBatchSize = 1000;
+  std::vector<std::shared_ptr<BenchObject>> objects(kBatchSize);
+  for (auto& object : objects) {
+    object = std::make_shared<BenchObject>();
+  }
+
+  for (auto _ : state) {
+    for (auto& object : objects) {
+      bench.vm.AddObject(object, scripts, {});
+    }
+    state.PauseTiming();
+    for (auto& object : objects) {
+      bench.vm.RemoveObject(object);
+    }
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * kBatchSize);
+}
+BENCHMARK(BM_AddObject)->ArgName("scripts")->Arg(1)->Arg(kNumFanOutScripts);
+
+// Removal, addition, an event and a lookup of one object among 1k to 100k
+// others. The time per item should not depend on the number of objects
+void BM_ObjectScaling(benchmark::State& state)
+{
+  VirtualMachine vm(LoadScripts());
+
+  std::vector<std::shared_ptr<BenchObject>> objects(state.range(0));
+  for (auto& object : objects) {
+    object = std::make_shared<BenchObject>();
+    vm.AddObject(object, { "FanOut0" }, {});
+  }
+
+  std::vector<VarValue> arguments = { VarValue(1) };
+  size_t next = 0;
+  for (auto _ : state) {
+    auto& object = objects[next++ % objects.size()];
+    vm.RemoveObject(object);
+    vm.AddObject(object, { "FanOut0" }, {});
+    vm.SendEvent(object, "OnBench", arguments);
+    benchmark::DoNotOptimize(vm.GetInstance(object.get(), "FanOut0"));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ObjectScaling)
+  ->ArgName("objects")
+  ->RangeMultiplier(10)
+  ->Range(1000, 100000);
+
+// One event to objects with FanOut0..k-1 attached, every script handles it
+void BM_SendEvent(benchmark::State& state)
+{
+  VirtualMachine vm(LoadScripts(), state.range(1));
+  auto numScripts = static_cast<int>(state.range(0));
+
+  std::vector<std::string> scripts;
+  for (int k = 0; k < numScripts; ++k) {
+    scripts.push_back("FanOut" + std::to_string(k));
+  }
+
+  constexpr int kNumObjects = 100;
+  std::vector<std::shared_ptr<BenchObject>> objects(kNumObjects);
+  for (auto& object : objects) {
+    object = std::make_shared<BenchObject>();
+    vm.AddObject(object, scripts, {});
+  }
+
+  std::vector<VarValue> arguments = { VarValue(1) };
+  for (auto _ : state) {
+    for (auto& object : objects) {
+      vm.SendEvent(object, "OnBench", arguments);
+    }
+  }
+
+  auto count = vm.GetInstance(objects[0].get(), "FanOut0")->variables[0];
+  if (count.GetInt() != static_cast<int32_t>(state.iterations()))
+    state.SkipWithError("Wrong event count");
+  state.SetItemsProcessed(int64_t(state.iterations()) * kNumObjects *
+                          numScripts);
+}
+BENCHMARK(BM_SendEvent)
+  ->ArgNames({ "scripts", "optimize" })
+  ->ArgsProduct({ { 1, kNumFanOutScripts }, { 0, 1 } });
+
+// Calls of a script function into a 12 argument native
+void BM_CallStaticFromScript(benchmark::State& state)
+{
+  BenchVm bench(state.range(0));
+  for (auto _ : state) {
+    bench.Call("CallNatives", kLoopSize);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * kLoopSize);
+}
+BENCHMARK(BM_CallStaticFromScript)->ArgName("optimize")->Arg(0)->Arg(1);
+
+// What the platform does for every native called from JavaScript
+void BM_CallStaticFromHost(benchmark::State& state)
+{
+  BenchVm bench(false);
+  std::vector<VarValue> arguments;
+  for (auto _ : state) {
+    auto result = bench.vm.CallStatic("TESModPlatform",
+                                      "IsPlayerRunningEnabled", arguments);
+    benchmark::DoNotOptimize(result);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_CallStaticFromHost);
+
+void BM_Strcat(benchmark::State& state)
+{
+  BenchVm bench(state.range(0));
+  for (auto _ : state) {
+    bench.Call("Concat", kLoopSize);
+    state.PauseTiming();
+    bench.vm.CollectStrings();
+    state.ResumeTiming();
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * kLoopSize);
+}
+BENCHMARK(BM_Strcat)->ArgName("optimize")->Arg(0)->Arg(1);
+
+// A long concatenation loop with CollectStrings after every kLoopSize
+// concatenations, as a host collects once per frame. The time per item
+// should not depend on the loop length, and neither should the pool size
+void BM_StrcatStress(benchmark::State& state)
+{
+  BenchVm bench(false);
+  auto numChunks = state.range(0) / kLoopSize;
+  size_t peakPoolSize = 0, collectedPoolSize = 0;
+  for (auto _ : state) {
+    for (int64_t chunk = 0; chunk < numChunks; ++chunk) {
+      bench.Call("Concat", kLoopSize);
+      peakPoolSize = std::max(peakPoolSize, bench.vm.stringPool.GetSize());
+      bench.vm.CollectStrings();
+      collectedPoolSize =
+        std::max(collectedPoolSize, bench.vm.stringPool.GetSize());
+    }
+  }
+  state.counters["pool_peak"] = double(peakPoolSize);
+  state.counters["pool_collected"] = double(collectedPoolSize);
+  state.SetItemsProcessed(int64_t(state.iterations()) * numChunks *
+                          kLoopSize);
+}
+BENCHMARK(BM_StrcatStress)
+  ->ArgName("strcats")
+  ->RangeMultiplier(10)
+  ->Range(kLoopSize, kLoopSize * 1000);
+
+// A get and a set of an auto property per item
+void BM_PropertyGetSet(benchmark::State& state)
+{
+  BenchVm bench(state.range(0));
+  for (auto _ : state) {
+    bench.Call("Properties", kLoopSize);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * kLoopSize);
+}
+BENCHMARK(BM_PropertyGetSet)->ArgName("optimize")->Arg(0)->Arg(1);
+
+// Finds of the last element of arrays of 128 to 1024 elements. Scripts
+// compiled for the game create arrays of up to 128
+template <bool kStrings>
+void BM_ArrayFind(benchmark::State& state)
+{
+  BenchVm bench(state.range(1));
+  auto size = static_cast<int32_t>(state.range(0));
+  bench.Call("FillArrays", size);
+  for (auto _ : state) {
+    bench.Call(kStrings ? "FindStrings" : "FindInts", kLoopSize);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * kLoopSize);
+  state.SetBytesProcessed(int64_t(state.iterations()) * kLoopSize * size *
+                          (kStrings ? sizeof(VarValue) : sizeof(int32_t)));
+}
+BENCHMARK_TEMPLATE(BM_ArrayFind, false)
+  ->ArgNames({ "size", "optimize" })
+  ->ArgsProduct({ { 1024, 512, 256, 128 }, { 0, 1 } });
+BENCHMARK_TEMPLATE(BM_ArrayFind, true)
+  ->ArgNames({ "size", "optimize" })
+  ->ArgsProduct({ { 1024, 512, 256, 128 }, { 0, 1 } });
+}
+
+int main(int argc, char** argv)
+{
+  benchmark::Initialize(&argc, argv);
+  // Flags Google Benchmark doesn't know are left in argv
+  if (argc > 2 || (argc == 2 && argv[1][0] == '-')) {
+    std::cerr << "Usage: papyrus_vm_bench [benchmark flags] "
+                 "[TESModPlatform.pex]"
+              << std::endl;
+    return 1;
+  }
+  if (argc == 2)
+    g_pexPath = argv[1];
+
+  try {
+    benchmark::RunSpecifiedBenchmarks();
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  benchmark::Shutdown();
+  return 0;
+}
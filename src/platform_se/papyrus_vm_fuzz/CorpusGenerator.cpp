@@ -0,0 +1,760 @@
+#include "PexWriter.h"
+#include "Reader.h"
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <set>
+
+// Usage: papyrus_vm_corpus_generator [--seed <n>] <count> <output directory>
+//
+// Writes <count> random well-typed scripts as .pex files. Scripts use
+// arithmetic, casts, string concatenation, nested branches and bounded
+// loops, arrays, properties and calls of their own functions, of their
+// parent script and of natives, return values chosen by a branch and casts
+// of 'self'. A seed gives the same files on every platform.
+// papyrus_vm_fuzz/corpus was made with the default seed:
+//
+//   papyrus_vm_corpus_generator 64 src/platform_se/papyrus_vm_fuzz/corpus
+//   papyrus_vm_corpus_runner --update src/platform_se/papyrus_vm_fuzz/corpus
+//
+// Remove the old .pex files first when the generator changes
+
+namespace {
+// SplitMix64. Distributions of <random> differ between standard libraries
+class Random
+{
+public:
+  explicit Random(uint64_t seed)
+    : state(seed)
+  {
+  }
+
+  uint64_t Next()
+  {
+    uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+
+  int Below(int n) { return int(Next() % uint64_t(n)); }
+
+  bool Chance(int percent) { return Below(100) < percent; }
+
+  template <class T>
+  const T& Pick(const std::vector<T>& items)
+  {
+    return items[Below(int(items.size()))];
+  }
+
+private:
+  uint64_t state;
+};
+
+enum class Type
+{
+  Int,
+  Float,
+  Bool,
+  String,
+  IntArray,
+  StringArray,
+  None,
+};
+
+const std::vector<Type> kScalarTypes = { Type::Int, Type::Float, Type::Bool,
+                                         Type::String };
+
+const char* GetTypeName(Type type)
+{
+  switch (type) {
+    case Type::Int:
+      return "Int";
+    case Type::Float:
+      return "Float";
+    case Type::Bool:
+      return "Bool";
+    case Type::String:
+      return "String";
+    case Type::IntArray:
+      return "Int[]";
+    case Type::StringArray:
+      return "String[]";
+    default:
+      return "None";
+  }
+}
+
+Type GetElementType(Type arrayType)
+{
+  return arrayType == Type::IntArray ? Type::Int : Type::String;
+}
+
+struct Variable
+{
+  std::string name;
+  Type type = Type::None;
+};
+
+struct Signature
+{
+  std::string name;
+  Type returnType = Type::None;
+  std::vector<Type> params;
+  bool isGlobal = false;
+};
+
+struct Property
+{
+  std::string name;
+  Type type = Type::None;
+};
+
+// What scripts extending a generated script can call and access
+struct ScriptInfo
+{
+  std::string name;
+  std::vector<Signature> functions;
+  std::vector<Property> properties;
+};
+
+class ScriptGenerator
+{
+public:
+  ScriptGenerator(Random& random_, std::set<std::string>& names_,
+                  std::string scriptName, const ScriptInfo* parent_)
+    : random(random_)
+    , names(names_)
+    , parent(parent_)
+  {
+    info.name = std::move(scriptName);
+  }
+
+  std::shared_ptr<PexScript> Generate()
+  {
+    ObjectTable::Object object;
+    object.NameIndex = info.name;
+    object.parentClassName = parent ? parent->name : "";
+
+    int numMembers = 2 + random.Below(4);
+    for (int i = 0; i < numMembers; ++i) {
+      ObjectTable::Object::VarInfo variable;
+      auto type = random.Pick(kScalarTypes);
+      variable.name = info.name + "_m" + std::to_string(i);
+      variable.typeName = GetTypeName(type);
+      variable.value = Constant(type);
+      object.variables.push_back(variable);
+      members.push_back({ variable.name, type });
+    }
+
+    object.properties.push_back(MakeAutoProperty());
+    object.properties.push_back(MakeFullProperty());
+
+    ObjectTable::Object::StateInfo state;
+    int numFunctions = 2 + random.Below(4);
+    for (int i = 0; i < numFunctions; ++i) {
+      Signature signature;
+      signature.name = info.name + "_F" + std::to_string(i);
+      signature.returnType =
+        random.Chance(20) ? Type::None : random.Pick(kScalarTypes);
+      signature.isGlobal = random.Chance(25);
+      int numParams = random.Below(4);
+      for (int j = 0; j < numParams; ++j) {
+        signature.params.push_back(random.Pick(kScalarTypes));
+      }
+
+      // Functions only call the ones before them, so there is no recursion
+      state.functions.push_back({ signature.name, MakeFunction(signature) });
+      info.functions.push_back(signature);
+    }
+    object.states = { state };
+
+    auto script = std::make_shared<PexScript>();
+    script->header.Signature = ScriptHeader::kSignature;
+    script->header.VerMajor = ScriptHeader::kVerMajor;
+    script->header.VerMinor = ScriptHeader::kVerMinor;
+    script->header.GameID = ScriptHeader::kGameID;
+    script->source = info.name;
+    script->user = "papyrus_vm_corpus_generator";
+    script->objectTable.m_data = { object };
+    return script;
+  }
+
+  const ScriptInfo& GetInfo() const { return info; }
+
+private:
+  ObjectTable::Object::PropInfo MakeAutoProperty()
+  {
+    using PropInfo = ObjectTable::Object::PropInfo;
+    auto& member = random.Pick(members);
+
+    PropInfo property;
+    property.name = info.name + "_Auto";
+    property.type = GetTypeName(member.type);
+    property.flags =
+      PropInfo::kFlags_Read | PropInfo::kFlags_Write | PropInfo::kFlags_AutoVar;
+    property.autoVarName = member.name;
+    info.properties.push_back({ property.name, member.type });
+    return property;
+  }
+
+  ObjectTable::Object::PropInfo MakeFullProperty()
+  {
+    using PropInfo = ObjectTable::Object::PropInfo;
+    auto& member = random.Pick(members);
+
+    PropInfo property;
+    property.name = info.name + "_Full";
+    property.type = GetTypeName(member.type);
+    property.flags = PropInfo::kFlags_Read | PropInfo::kFlags_Write;
+
+    property.readHandler.returnType = property.type;
+    property.readHandler.code.instructions = {
+      Op(FunctionCode::kOp_Return, { Id(member.name) }),
+    };
+
+    property.writeHandler.returnType = "None";
+    property.writeHandler.params = { { "value", property.type } };
+    property.writeHandler.code.instructions = {
+      Op(FunctionCode::kOp_Assign, { Id(member.name), Id("value") }),
+    };
+
+    info.properties.push_back({ property.name, member.type });
+    return property;
+  }
+
+  FunctionInfo MakeFunction(const Signature& signature)
+  {
+    FunctionInfo function;
+    function.returnType = GetTypeName(signature.returnType);
+    function.flags = signature.isGlobal ? 1 : 0;
+
+    current = &function;
+    currentSignature = &signature;
+    variables.clear();
+    numHelpers = 0;
+
+    for (size_t i = 0; i < signature.params.size(); ++i) {
+      auto name = "p" + std::to_string(i);
+      function.params.push_back({ name, GetTypeName(signature.params[i]) });
+      variables.push_back({ name, signature.params[i] });
+    }
+
+    for (auto type : kScalarTypes) {
+      int numLocals = 1 + random.Below(2);
+      for (int i = 0; i < numLocals; ++i) {
+        AddLocal(std::string(1, GetTypeName(type)[0] + ('a' - 'A')) +
+                   std::to_string(i),
+                 type);
+      }
+    }
+    function.locals.push_back({ "::NoneVar", "None" });
+
+    for (auto type : { Type::IntArray, Type::StringArray }) {
+      if (random.Chance(50)) {
+        auto name = AddLocal(type == Type::IntArray ? "ia" : "sa", type);
+        Emit(FunctionCode::kOp_ArrayCreate,
+             { Id(name), VarValue(int32_t(2 + random.Below(4))) });
+      }
+    }
+
+    if (!signature.isGlobal) {
+      variables.insert(variables.end(), members.begin(), members.end());
+      if (random.Chance(25))
+        SelfCast();
+    }
+
+    Block(0, 3 + random.Below(6));
+    if (signature.returnType != Type::None && random.Chance(50))
+      SelectReturn();
+    else
+      Emit(FunctionCode::kOp_Return, { ReturnValue() });
+    return function;
+  }
+
+  void Block(int depth, int numStatements)
+  {
+    for (int i = 0; i < numStatements; ++i) {
+      Statement(depth);
+    }
+  }
+
+  void Statement(int depth)
+  {
+    switch (random.Below(14)) {
+      case 0:
+      case 1: {
+        static const std::vector<uint8_t> ops = {
+          FunctionCode::kOp_IAdd, FunctionCode::kOp_ISubtract,
+          FunctionCode::kOp_IMultiply, FunctionCode::kOp_IDivide,
+          FunctionCode::kOp_IMod
+        };
+        Emit(random.Pick(ops),
+             { Destination(Type::Int), Operand(Type::Int),
+               Operand(Type::Int) });
+      } break;
+      case 2: {
+        static const std::vector<uint8_t> ops = {
+          FunctionCode::kOp_FAdd, FunctionCode::kOp_FSubtract,
+          FunctionCode::kOp_FMultiply, FunctionCode::kOp_FDivide
+        };
+        Emit(random.Pick(ops),
+             { Destination(Type::Float), Operand(Type::Float),
+               Operand(Type::Float) });
+      } break;
+      case 3: {
+        static const std::vector<std::pair<uint8_t, Type>> ops = {
+          { FunctionCode::kOp_INegate, Type::Int },
+          { FunctionCode::kOp_FNegate, Type::Float },
+          { FunctionCode::kOp_Not, Type::Bool },
+        };
+        auto [op, type] = random.Pick(ops);
+        Emit(op, { Destination(type), Operand(type) });
+      } break;
+      case 4: {
+        static const std::vector<uint8_t> ops = {
+          FunctionCode::kOp_CompareEQ, FunctionCode::kOp_CompareLT,
+          FunctionCode::kOp_CompareLTE, FunctionCode::kOp_CompareGT,
+          FunctionCode::kOp_CompareGTE
+        };
+        auto op = random.Pick(ops);
+        auto type = op == FunctionCode::kOp_CompareEQ
+          ? random.Pick(kScalarTypes)
+          : (random.Chance(50) ? Type::Int : Type::Float);
+        Emit(op, { Destination(Type::Bool), Operand(type), Operand(type) });
+      } break;
+      case 5: {
+        // As compiled scripts, which don't cast a value to its own type. The
+        // VM casts strings only to Bool
+        auto type = random.Pick(kScalarTypes);
+        auto sourceType = random.Pick(kScalarTypes);
+        if (sourceType == type ||
+            (sourceType == Type::String && type != Type::Bool))
+          sourceType = type == Type::Int ? Type::Float : Type::Int;
+        Emit(FunctionCode::kOp_Cast, { Destination(type), Operand(sourceType) });
+      } break;
+      case 6:
+        Emit(FunctionCode::kOp_Strcat,
+             { Destination(Type::String), Operand(Type::String),
+               Operand(Type::String) });
+        break;
+      case 7: {
+        auto type = random.Pick(kScalarTypes);
+        Emit(FunctionCode::kOp_Assign, { Destination(type), Operand(type) });
+      } break;
+      case 8:
+        if (depth < 2)
+          If(depth);
+        break;
+      case 9:
+        if (depth < 2)
+          While(depth);
+        break;
+      case 10:
+        Call();
+        break;
+      case 11:
+        Native();
+        break;
+      case 12:
+        PropertyAccess();
+        break;
+      case 13:
+        if (depth > 0 && random.Chance(30))
+          Emit(FunctionCode::kOp_Return, { ReturnValue() });
+        else
+          ArrayAccess();
+        break;
+    }
+  }
+
+  void If(int depth)
+  {
+    auto jumpToElse =
+      Emit(FunctionCode::kOp_JumpF, { Operand(Type::Bool), VarValue(0) });
+    Block(depth + 1, 1 + random.Below(4));
+
+    if (random.Chance(50)) {
+      auto jumpToEnd = Emit(FunctionCode::kOp_Jump, { VarValue(0) });
+      PatchJump(jumpToElse);
+      Block(depth + 1, 1 + random.Below(4));
+      PatchJump(jumpToEnd);
+    } else {
+      PatchJump(jumpToElse);
+    }
+  }
+
+  // Casts 'self' to the script and the result to Bool, which is only true
+  // if 'self' carries the object type of the script
+  void SelfCast()
+  {
+    auto name = "::self" + std::to_string(numHelpers++);
+    current->locals.push_back({ name, info.name });
+    Emit(FunctionCode::kOp_Cast, { Id(name), Id("self") });
+    Emit(FunctionCode::kOp_Cast, { Destination(Type::Bool), Id(name) });
+  }
+
+  // Returns a local set to a different constant on each side of a branch,
+  // the shape in which FunctionOptimizer copies the Return into the jump
+  // over the else part
+  void SelectReturn()
+  {
+    auto type = currentSignature->returnType;
+    auto result = AddHelper("::result", type);
+
+    auto thenValue = Constant(type);
+    auto elseValue = Constant(type);
+    if (elseValue == thenValue)
+      elseValue = type == Type::Bool ? VarValue(!(bool)thenValue)
+                                     : Constant(type);
+
+    auto jumpToElse =
+      Emit(FunctionCode::kOp_JumpF, { Operand(Type::Bool), VarValue(0) });
+    Emit(FunctionCode::kOp_Assign, { Id(result), thenValue });
+    auto jumpToEnd = Emit(FunctionCode::kOp_Jump, { VarValue(0) });
+    PatchJump(jumpToElse);
+    Emit(FunctionCode::kOp_Assign, { Id(result), elseValue });
+    PatchJump(jumpToEnd);
+    Emit(FunctionCode::kOp_Return, { Id(result) });
+  }
+
+  // The counter is a local of its own, so the body can't change it
+  void While(int depth)
+  {
+    auto counter = AddHelper("::loop", Type::Int);
+    auto condition = AddHelper("::cond", Type::Bool);
+    Emit(FunctionCode::kOp_Assign, { Id(counter), VarValue(0) });
+
+    auto start = Emit(
+      FunctionCode::kOp_CompareLT,
+      { Id(condition), Id(counter), VarValue(int32_t(1 + random.Below(5))) });
+    auto jumpToEnd =
+      Emit(FunctionCode::kOp_JumpF, { Id(condition), VarValue(0) });
+    Block(depth + 1, 1 + random.Below(4));
+    Emit(FunctionCode::kOp_IAdd, { Id(counter), Id(counter), VarValue(1) });
+    auto jump = Emit(FunctionCode::kOp_Jump, { VarValue(0) });
+    current->code.instructions[jump].args[0] =
+      VarValue(int32_t(start) - int32_t(jump));
+    PatchJump(jumpToEnd);
+  }
+
+  // Calls an earlier function of this script or a method of the parent. The
+  // VM finds CallMethod targets only in the script of the instance, so the
+  // parent's methods are called with CallParent
+  void Call()
+  {
+    std::vector<const Signature*> candidates;
+    for (auto& signature : info.functions) {
+      if (!currentSignature->isGlobal || signature.isGlobal)
+        candidates.push_back(&signature);
+    }
+    bool parentCall = false;
+    if (parent && !currentSignature->isGlobal && random.Chance(40)) {
+      candidates.clear();
+      for (auto& signature : parent->functions) {
+        if (!signature.isGlobal)
+          candidates.push_back(&signature);
+      }
+      parentCall = true;
+    }
+    if (candidates.empty())
+      return;
+
+    auto& callee = *random.Pick(candidates);
+    auto result = callee.returnType == Type::None
+      ? Id("::NoneVar")
+      : Destination(callee.returnType);
+
+    std::vector<VarValue> args;
+    if (callee.isGlobal) {
+      args = { Id(info.name), Id(callee.name), result };
+    } else if (parentCall) {
+      args = { Id(callee.name), result };
+    } else {
+      args = { Id(callee.name), Id("self"), result };
+    }
+    args.push_back(VarValue(int32_t(callee.params.size())));
+    for (auto type : callee.params) {
+      args.push_back(Operand(type));
+    }
+
+    uint8_t op = callee.isGlobal ? FunctionCode::kOp_CallStatic
+      : parentCall               ? FunctionCode::kOp_CallParent
+                                 : FunctionCode::kOp_CallMethod;
+    Emit(op, args);
+  }
+
+  // ScriptRunner stubs the natives, their results have the type of the
+  // local receiving them
+  void Native()
+  {
+    auto type = random.Chance(20) ? Type::None : random.Pick(kScalarTypes);
+    auto result = type == Type::None ? Id("::NoneVar") : Local(type);
+
+    std::vector<VarValue> args = {
+      Id("CorpusNative"), Id(std::string(GetTypeName(type)) + "Value"), result
+    };
+    int numArgs = random.Below(3);
+    args.push_back(VarValue(int32_t(numArgs)));
+    for (int i = 0; i < numArgs; ++i) {
+      args.push_back(Operand(random.Pick(kScalarTypes)));
+    }
+    Emit(FunctionCode::kOp_CallStatic, args);
+  }
+
+  void PropertyAccess()
+  {
+    if (currentSignature->isGlobal)
+      return;
+
+    auto properties = info.properties;
+    if (parent) {
+      properties.insert(properties.end(), parent->properties.begin(),
+                        parent->properties.end());
+    }
+    auto& property = random.Pick(properties);
+
+    if (random.Chance(50)) {
+      Emit(FunctionCode::kOp_PropGet,
+           { Id(property.name), Id("self"), Destination(property.type) });
+    } else {
+      Emit(FunctionCode::kOp_PropSet,
+           { Id(property.name), Id("self"), Operand(property.type) });
+    }
+  }
+
+  // Arrays have at least two elements. Indices stay in range, the message of
+  // the error differs between standard libraries
+  void ArrayAccess()
+  {
+    std::vector<Variable> arrays;
+    for (auto& variable : variables) {
+      if (variable.type == Type::IntArray ||
+          variable.type == Type::StringArray)
+        arrays.push_back(variable);
+    }
+    if (arrays.empty())
+      return;
+
+    auto& array = random.Pick(arrays);
+    auto index = VarValue(int32_t(random.Below(2)));
+    switch (random.Below(4)) {
+      case 0:
+        Emit(FunctionCode::kOp_ArrayLength,
+             { Destination(Type::Int), Id(array.name) });
+        break;
+      case 1:
+        Emit(FunctionCode::kOp_ArrayGetElement,
+             { Destination(GetElementType(array.type)), Id(array.name),
+               index });
+        break;
+      case 2:
+        Emit(FunctionCode::kOp_ArraySetElement,
+             { Id(array.name), index,
+               Operand(GetElementType(array.type)) });
+        break;
+      default:
+        Emit(FunctionCode::kOp_ArrayCreate,
+             { Id(array.name), VarValue(int32_t(2 + random.Below(4))) });
+        break;
+    }
+  }
+
+  VarValue ReturnValue()
+  {
+    return currentSignature->returnType == Type::None
+      ? VarValue::None()
+      : Operand(currentSignature->returnType);
+  }
+
+  // A variable or a constant of the type
+  VarValue Operand(Type type)
+  {
+    if (random.Chance(30))
+      return Constant(type);
+
+    std::vector<const Variable*> candidates;
+    for (auto& variable : variables) {
+      if (variable.type == type)
+        candidates.push_back(&variable);
+    }
+    return candidates.empty() ? Constant(type)
+                              : Id(random.Pick(candidates)->name);
+  }
+
+  VarValue Destination(Type type)
+  {
+    std::vector<const Variable*> candidates;
+    for (auto& variable : variables) {
+      if (variable.type == type)
+        candidates.push_back(&variable);
+    }
+    return candidates.empty() ? Local(type)
+                              : Id(random.Pick(candidates)->name);
+  }
+
+  // Natives need a local to get their return type from
+  VarValue Local(Type type)
+  {
+    std::vector<const Variable*> candidates;
+    for (auto& local : current->locals) {
+      for (auto& variable : variables) {
+        if (variable.name == local.name && variable.type == type)
+          candidates.push_back(&variable);
+      }
+    }
+    return candidates.empty() ? Id(AddLocal("l", type))
+                              : Id(random.Pick(candidates)->name);
+  }
+
+  VarValue Constant(Type type)
+  {
+    static const std::vector<int32_t> ints = {
+      0,  1,  2,   3,   5,  7,
+      -1, 10, 100, -42, std::numeric_limits<int32_t>::max(),
+      std::numeric_limits<int32_t>::min()
+    };
+    static const std::vector<float> floats = { 0.0f,  -0.0f, 0.5f, 1.0f,
+                                               -2.5f, 3.75f, 1e10f };
+    static const std::vector<const char*> strings = { "",  "a",       "abc",
+                                                      "1", "Papyrus", "2.5",
+                                                      "x y" };
+    switch (type) {
+      case Type::Int:
+        return VarValue(random.Pick(ints));
+      case Type::Float:
+        return VarValue(random.Pick(floats));
+      case Type::Bool:
+        return VarValue(random.Chance(50));
+      case Type::String:
+        return VarValue(random.Pick(strings));
+      default:
+        return VarValue::None();
+    }
+  }
+
+  std::string AddLocal(const std::string& name, Type type)
+  {
+    current->locals.push_back({ name, GetTypeName(type) });
+    variables.push_back({ name, type });
+    return name;
+  }
+
+  // Locals for the generated control flow, not used by statements
+  std::string AddHelper(const std::string& prefix, Type type)
+  {
+    auto name = prefix + std::to_string(numHelpers++);
+    current->locals.push_back({ name, GetTypeName(type) });
+    return name;
+  }
+
+  size_t Emit(uint8_t op, std::vector<VarValue> args)
+  {
+    current->code.instructions.push_back(Op(op, std::move(args)));
+    return current->code.instructions.size() - 1;
+  }
+
+  // Makes the jump at 'index' go to the next instruction emitted
+  void PatchJump(size_t index)
+  {
+    auto& instruction = current->code.instructions[index];
+    instruction.args.back() =
+      VarValue(int32_t(current->code.instructions.size() - index));
+  }
+
+  FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+  {
+    FunctionCode::Instruction instruction;
+    instruction.op = op;
+    instruction.args = std::move(args);
+    return instruction;
+  }
+
+  // Identifiers point to their name, which must outlive the script
+  VarValue Id(const std::string& name)
+  {
+    return VarValue(VarValue::kType_Identifier,
+                    names.insert(name).first->c_str());
+  }
+
+  Random& random;
+  std::set<std::string>& names;
+  const ScriptInfo* parent = nullptr;
+  ScriptInfo info;
+  std::vector<Variable> members;
+
+  FunctionInfo* current = nullptr;
+  const Signature* currentSignature = nullptr;
+  std::vector<Variable> variables;
+  int numHelpers = 0;
+};
+
+void WriteFile(const std::filesystem::path& path,
+               const std::vector<uint8_t>& bytes)
+{
+  std::ofstream file(path, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+  if (!file)
+    throw std::runtime_error("Error write file: " + path.string());
+}
+}
+
+int main(int argc, char** argv)
+{
+  uint64_t seed = 1;
+  std::vector<std::string> positional;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--seed" && i + 1 < argc)
+      seed = std::stoull(argv[++i]);
+    else
+      positional.push_back(arg);
+  }
+
+  if (positional.size() != 2) {
+    std::cerr << "Usage: papyrus_vm_corpus_generator [--seed <n>] <count> "
+                 "<output directory>"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    int count = std::stoi(positional[0]);
+    std::filesystem::path directory = positional[1];
+    std::filesystem::create_directories(directory);
+
+    Random random(seed);
+    std::set<std::string> names;
+    std::vector<ScriptInfo> infos;
+
+    for (int i = 0; i < count; ++i) {
+      char scriptName[32];
+      std::snprintf(scriptName, sizeof(scriptName), "Corpus%03d", i);
+
+      // Every fourth script extends the one before it
+      const ScriptInfo* parent =
+        i % 4 == 3 ? &infos.back() : static_cast<const ScriptInfo*>(nullptr);
+      ScriptGenerator generator(random, names, scriptName, parent);
+      auto script = generator.Generate();
+      infos.push_back(generator.GetInfo());
+
+      // The file must read back to the same script
+      auto bytes = PexWriter::Write(*script);
+      auto reread = Reader(bytes.data(), bytes.size()).GetSourceStructures();
+      if (reread.size() != 1 || PexWriter::Write(*reread[0]) != bytes)
+        throw std::runtime_error(std::string(scriptName) +
+                                 " doesn't read back");
+
+      WriteFile(directory / (std::string(scriptName) + ".pex"), bytes);
+    }
+
+    std::cout << count << " scripts written to " << directory.string()
+              << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,158 @@
+#include "Reader.h"
+#include "ScriptRunner.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+// Usage: papyrus_vm_corpus_runner [--update] [--optimize]
+//                                 <pex directory> [psc directory]
+//
+// Runs every function of every script in the directory with ScriptRunner and
+// compares the output with <script>.golden next to the .pex file. Natives
+// declared in the .psc files get stubs as well, so scripts calling into the
+// game run without it. --update rewrites the golden files. --optimize runs
+// optimized code, which must give the same output as plain code.
+//
+// Built with PAPYRUS_VM_AOT, the runner binds the functions of a corpus
+// compiled by AotCompiler and checks them against the golden files of the
+// interpreter. See PAPYRUS_VM_AOT_CORPUS in papyrus_vm.cmake
+
+namespace {
+std::string ReadFile(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Error open file: " + path.string());
+  std::ostringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+
+std::vector<std::filesystem::path> ListFiles(const std::string& directory,
+                                             const char* extension)
+{
+  std::vector<std::filesystem::path> paths;
+  for (auto& entry : std::filesystem::directory_iterator(directory)) {
+    if (entry.is_regular_file() && entry.path().extension() == extension)
+      paths.push_back(entry.path());
+  }
+  std::sort(paths.begin(), paths.end());
+  return paths;
+}
+
+// Prints the first line that differs
+void PrintMismatch(const std::string& expected, const std::string& actual)
+{
+  std::istringstream expectedLines(expected), actualLines(actual);
+  std::string expectedLine, actualLine;
+  for (size_t line = 1;; ++line) {
+    bool hasExpected = bool(std::getline(expectedLines, expectedLine));
+    bool hasActual = bool(std::getline(actualLines, actualLine));
+    if (!hasExpected && !hasActual)
+      return;
+    if (hasExpected != hasActual || expectedLine != actualLine) {
+      std::cerr << "  line " << line << '\n'
+                << "  expected: " << (hasExpected ? expectedLine : "<end>")
+                << '\n'
+                << "  actual:   " << (hasActual ? actualLine : "<end>")
+                << '\n';
+      return;
+    }
+  }
+}
+}
+
+#ifdef PAPYRUS_VM_AOT
+// Generated by papyrus_vm_add_aot
+const std::vector<AotFunction>& GetPlainAotFunctions();
+const std::vector<AotFunction>& GetOptimizedAotFunctions();
+#endif
+
+int main(int argc, char** argv)
+{
+  bool update = false, optimize = false;
+  std::vector<std::string> directories;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--update")
+      update = true;
+    else if (arg == "--optimize")
+      optimize = true;
+    else
+      directories.push_back(arg);
+  }
+
+  if (directories.empty() || directories.size() > 2) {
+    std::cerr << "Usage: papyrus_vm_corpus_runner [--update] [--optimize] "
+                 "<pex directory> [psc directory]"
+              << std::endl;
+    return 1;
+  }
+
+  try {
+    std::vector<ScriptRunner::NativeDeclaration> natives;
+    if (directories.size() == 2) {
+      for (auto& path : ListFiles(directories[1], ".psc")) {
+        auto fileNatives = ScriptRunner::ParseNatives(ReadFile(path));
+        natives.insert(natives.end(), fileNatives.begin(), fileNatives.end());
+      }
+    }
+
+    auto pexPaths = ListFiles(directories[0], ".pex");
+    std::vector<std::string> pathStrings;
+    for (auto& path : pexPaths) {
+      pathStrings.push_back(path.string());
+    }
+
+    ScriptRunner runner(Reader(pathStrings).GetSourceStructures(), optimize,
+                        ScriptRunner::Limits(), natives);
+
+#ifdef PAPYRUS_VM_AOT
+    std::cout << runner.RegisterAotFunctions(optimize
+                                               ? GetOptimizedAotFunctions()
+                                               : GetPlainAotFunctions())
+              << " compiled functions" << std::endl;
+#endif
+
+    size_t numMismatches = 0;
+    for (size_t i = 0; i < pexPaths.size(); ++i) {
+      std::ostringstream out;
+      runner.Run(*runner.GetScripts()[i], out);
+
+      auto goldenPath = pexPaths[i];
+      goldenPath.replace_extension(".golden");
+
+      if (update) {
+        std::ofstream(goldenPath, std::ios::binary) << out.str();
+        continue;
+      }
+
+      if (!std::filesystem::exists(goldenPath)) {
+        std::cerr << "No " << goldenPath.string() << ", run with --update"
+                  << std::endl;
+        ++numMismatches;
+        continue;
+      }
+
+      auto expected = ReadFile(goldenPath);
+      if (expected != out.str()) {
+        std::cerr << "Mismatch in " << pexPaths[i].filename().string()
+                  << '\n';
+        PrintMismatch(expected, out.str());
+        ++numMismatches;
+      }
+    }
+
+    std::cout << pexPaths.size() << " scripts, " << natives.size()
+              << " natives from .psc, "
+              << (update ? "golden files updated"
+                         : std::to_string(numMismatches) + " mismatches")
+              << std::endl;
+    return numMismatches ? 2 : 0;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
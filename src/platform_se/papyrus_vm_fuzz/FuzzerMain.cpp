@@ -0,0 +1,60 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// Replaces libFuzzer where it isn't available. Runs the fuzz target on
+// every file given, directories included, or on stdin if there are none,
+// which is how AFL passes inputs. Also useful to replay crashes
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+namespace {
+void Run(std::istream& input)
+{
+  std::vector<uint8_t> bytes{ std::istreambuf_iterator<char>(input),
+                              std::istreambuf_iterator<char>() };
+  LLVMFuzzerTestOneInput(bytes.data(), bytes.size());
+}
+
+void RunFile(const std::filesystem::path& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    throw std::runtime_error("Error open file: " + path.string());
+  Run(file);
+}
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    if (argc < 2) {
+      Run(std::cin);
+      return 0;
+    }
+
+    size_t numInputs = 0;
+    for (int i = 1; i < argc; ++i) {
+      if (!std::filesystem::is_directory(argv[i])) {
+        RunFile(argv[i]);
+        ++numInputs;
+        continue;
+      }
+      for (auto& entry :
+           std::filesystem::recursive_directory_iterator(argv[i])) {
+        if (entry.is_regular_file()) {
+          RunFile(entry.path());
+          ++numInputs;
+        }
+      }
+    }
+    std::cout << numInputs << " inputs" << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,27 @@
+#include "Reader.h"
+#include "ScriptRunner.h"
+#include <sstream>
+
+// Runs every function of the script with plain and optimized code. Errors
+// of the script are part of the output, crashes and sanitizer reports are
+// bugs
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  ScriptRunner::Limits limits;
+  limits.maxSteps = 1000;
+
+  for (bool optimize : { false, true }) {
+    try {
+      // Linking changes the scripts, so each VM gets its own copy
+      ScriptRunner runner(Reader(data, size).GetSourceStructures(), optimize,
+                          limits);
+      std::ostringstream out;
+      for (auto& script : runner.GetScripts()) {
+        runner.Run(*script, out);
+      }
+    } catch (std::runtime_error&) {
+      return 0;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,225 @@
+#include "PexWriter.h"
+#include <cstring>
+#include <stdexcept>
+
+std::vector<uint8_t> PexWriter::Write(const PexScript& script)
+{
+  PexWriter writer;
+
+  // The string table comes first in the file, but is only complete once
+  // everything else is written
+  writer.Write8_bit(0); // debug info flags, no debug info
+  writer.Write64_bit(0);
+  writer.Write16_bit(0);
+  writer.WriteUserFlagTable(script.userFlagTable);
+  writer.Write16_bit(uint16_t(script.objectTable.m_data.size()));
+  for (auto& object : script.objectTable.m_data) {
+    writer.WriteObject(object);
+  }
+  auto body = std::move(writer.bytes);
+
+  writer.bytes.clear();
+  writer.Write32_bit(ScriptHeader::kSignature);
+  writer.Write8_bit(ScriptHeader::kVerMajor);
+  writer.Write8_bit(ScriptHeader::kVerMinor);
+  writer.Write16_bit(ScriptHeader::kGameID);
+  writer.Write64_bit(script.header.BuildTime);
+
+  writer.WriteString(script.source + ".psc");
+  writer.WriteString(script.user);
+  writer.WriteString(script.machine);
+
+  writer.Write16_bit(uint16_t(writer.strings.size()));
+  for (auto& str : writer.strings) {
+    writer.WriteString(str);
+  }
+
+  writer.bytes.insert(writer.bytes.end(), body.begin(), body.end());
+  return std::move(writer.bytes);
+}
+
+void PexWriter::WriteUserFlagTable(const UserFlagTable& table)
+{
+  Write16_bit(uint16_t(table.m_data.size()));
+  for (auto& flag : table.m_data) {
+    WriteStringTableEntry(flag.name);
+    Write8_bit(flag.idx);
+  }
+}
+
+void PexWriter::WriteObject(const ObjectTable::Object& object)
+{
+  WriteStringTableEntry(object.NameIndex);
+
+  // The size of the object includes the size field itself
+  auto sizePosition = bytes.size();
+  Write32_bit(0);
+
+  WriteStringTableEntry(object.parentClassName);
+  WriteStringTableEntry(object.docstring);
+  Write32_bit(object.userFlags);
+  WriteStringTableEntry(object.autoStateName);
+
+  Write16_bit(uint16_t(object.variables.size()));
+  for (auto& variable : object.variables) {
+    WriteVariable(variable);
+  }
+
+  Write16_bit(uint16_t(object.properties.size()));
+  for (auto& property : object.properties) {
+    WriteProperty(property);
+  }
+
+  Write16_bit(uint16_t(object.states.size()));
+  for (auto& state : object.states) {
+    WriteState(state);
+  }
+
+  auto size = uint32_t(bytes.size() - sizePosition);
+  for (int i = 0; i < 4; ++i) {
+    bytes[sizePosition + i] = uint8_t(size >> (24 - 8 * i));
+  }
+}
+
+void PexWriter::WriteVariable(const ObjectTable::Object::VarInfo& variable)
+{
+  WriteStringTableEntry(variable.name);
+  WriteStringTableEntry(variable.typeName);
+  Write32_bit(variable.userFlags);
+  WriteVariableData(variable.value);
+}
+
+void PexWriter::WriteVariableData(const VarValue& value)
+{
+  if (value.IsArray()) {
+    Write8_bit(VarValue::kType_Object);
+    return;
+  }
+
+  Write8_bit(value.GetType());
+
+  switch (value.GetType()) {
+    case VarValue::kType_Object:
+      if ((IGameObject*)value)
+        throw std::runtime_error("Objects can't be written to .pex files");
+      break;
+    case VarValue::kType_Identifier:
+    case VarValue::kType_String: {
+      auto str = (const char*)value;
+      WriteStringTableEntry(str ? str : "");
+    } break;
+    case VarValue::kType_Integer:
+      Write32_bit(uint32_t(value.GetInt()));
+      break;
+    case VarValue::kType_Float: {
+      float f = value.GetFloat();
+      uint32_t v;
+      std::memcpy(&v, &f, sizeof(v));
+      Write32_bit(v);
+    } break;
+    case VarValue::kType_Bool:
+      Write8_bit(value.GetBool());
+      break;
+  }
+}
+
+void PexWriter::WriteProperty(const ObjectTable::Object::PropInfo& property)
+{
+  using PropInfo = ObjectTable::Object::PropInfo;
+
+  WriteStringTableEntry(property.name);
+  WriteStringTableEntry(property.type);
+  WriteStringTableEntry(property.docstring);
+  Write32_bit(property.userFlags);
+  Write8_bit(property.flags);
+
+  // Same conditions as in Reader::FillProperty
+  if ((property.flags & 4) == PropInfo::kFlags_AutoVar)
+    WriteStringTableEntry(property.autoVarName);
+  if ((property.flags & 5) == PropInfo::kFlags_Read)
+    WriteFuncInfo(property.readHandler);
+  if ((property.flags & 6) == PropInfo::kFlags_Write)
+    WriteFuncInfo(property.writeHandler);
+}
+
+void PexWriter::WriteState(const ObjectTable::Object::StateInfo& state)
+{
+  WriteStringTableEntry(state.name);
+  Write16_bit(uint16_t(state.functions.size()));
+  for (auto& function : state.functions) {
+    WriteStringTableEntry(function.name);
+    WriteFuncInfo(function.function);
+  }
+}
+
+void PexWriter::WriteFuncInfo(const FunctionInfo& function)
+{
+  WriteStringTableEntry(function.returnType);
+  WriteStringTableEntry(function.docstring);
+  Write32_bit(function.userFlags);
+  Write8_bit(function.flags);
+  WriteParams(function.params);
+  WriteParams(function.locals);
+
+  // Variadic opcodes keep the number of extra arguments in their last fixed
+  // argument, so writing every argument in order is enough
+  Write16_bit(uint16_t(function.code.instructions.size()));
+  for (auto& instruction : function.code.instructions) {
+    Write8_bit(instruction.op);
+    for (auto& arg : instruction.args) {
+      WriteVariableData(arg);
+    }
+  }
+}
+
+void PexWriter::WriteParams(const FunctionInfo::ParamTable& params)
+{
+  Write16_bit(uint16_t(params.size()));
+  for (auto& param : params) {
+    WriteStringTableEntry(param.name);
+    WriteStringTableEntry(param.type);
+  }
+}
+
+void PexWriter::Write8_bit(uint8_t value)
+{
+  bytes.push_back(value);
+}
+
+void PexWriter::Write16_bit(uint16_t value)
+{
+  Write8_bit(uint8_t(value >> 8));
+  Write8_bit(uint8_t(value));
+}
+
+void PexWriter::Write32_bit(uint32_t value)
+{
+  Write16_bit(uint16_t(value >> 16));
+  Write16_bit(uint16_t(value));
+}
+
+void PexWriter::Write64_bit(uint64_t value)
+{
+  Write32_bit(uint32_t(value >> 32));
+  Write32_bit(uint32_t(value));
+}
+
+void PexWriter::WriteString(const std::string& str)
+{
+  if (str.size() > 0xFFFF)
+    throw std::runtime_error("String too long for a .pex file");
+  Write16_bit(uint16_t(str.size()));
+  bytes.insert(bytes.end(), str.begin(), str.end());
+}
+
+void PexWriter::WriteStringTableEntry(const std::string& str)
+{
+  auto it = stringIndices.find(str);
+  if (it == stringIndices.end()) {
+    if (strings.size() >= 0xFFFF)
+      throw std::runtime_error("Too many strings for a .pex file");
+    it = stringIndices.insert({ str, uint16_t(strings.size()) }).first;
+    strings.push_back(str);
+  }
+  Write16_bit(it->second);
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "Structures.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Writes a PexScript in the format Reader parses, e.g. for generated test
+// scripts. The string table is rebuilt from the strings the script uses.
+// Debug info is left out and array values are written as None
+class PexWriter
+{
+public:
+  static std::vector<uint8_t> Write(const PexScript& script);
+
+private:
+  PexWriter() = default;
+
+  void WriteUserFlagTable(const UserFlagTable& table);
+  void WriteObject(const ObjectTable::Object& object);
+  void WriteVariable(const ObjectTable::Object::VarInfo& variable);
+  void WriteVariableData(const VarValue& value);
+  void WriteProperty(const ObjectTable::Object::PropInfo& property);
+  void WriteState(const ObjectTable::Object::StateInfo& state);
+  void WriteFuncInfo(const FunctionInfo& function);
+  void WriteParams(const FunctionInfo::ParamTable& params);
+
+  void Write8_bit(uint8_t value);
+  void Write16_bit(uint16_t value);
+  void Write32_bit(uint32_t value);
+  void Write64_bit(uint64_t value);
+  void WriteString(const std::string& str);
+  void WriteStringTableEntry(const std::string& str);
+
+  std::vector<uint8_t> bytes;
+  std::vector<std::string> strings;
+  std::unordered_map<std::string, uint16_t> stringIndices;
+};
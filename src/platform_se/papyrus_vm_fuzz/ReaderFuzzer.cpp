@@ -0,0 +1,12 @@
+#include "Reader.h"
+
+// Malformed input must make the Reader throw std::runtime_error, anything
+// else is a bug
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+  try {
+    Reader reader(data, size);
+  } catch (std::runtime_error&) {
+  }
+  return 0;
+}
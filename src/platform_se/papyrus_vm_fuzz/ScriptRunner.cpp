@@ -0,0 +1,312 @@
+#include "ScriptRunner.h"
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace {
+constexpr int kNumArgumentSets = 3;
+
+std::string Describe(const VarValue& value)
+{
+  std::ostringstream out;
+  out << int(value.GetType()) << ':';
+
+  switch (value.GetType()) {
+    case VarValue::kType_Object: {
+      auto object = (IGameObject*)value;
+      out << (object ? object->GetStringID() : "None");
+    } break;
+    case VarValue::kType_Identifier:
+    case VarValue::kType_String:
+      out << ((const char*)value ? (const char*)value : "");
+      break;
+    case VarValue::kType_Integer:
+      out << value.GetInt();
+      break;
+    case VarValue::kType_Float:
+      // Exact, and tells -0 from 0
+      out << std::hexfloat << value.GetFloat();
+      break;
+    case VarValue::kType_Bool:
+      out << value.GetBool();
+      break;
+    default:
+      if (auto array = value.GetArray()) {
+        out << '[';
+        for (size_t i = 0; i < array->GetSize(); ++i) {
+          out << Describe(array->Get(i)) << ',';
+        }
+        out << ']';
+      } else {
+        out << "None";
+      }
+  }
+  return out.str();
+}
+
+std::vector<VarValue> MakeArguments(const FunctionInfo& function, int set)
+{
+  static const int32_t ints[] = { 1, 4, 9 };
+  static const float floats[] = { 0.0f, 2.5f, -1.25f };
+  static const char* strings[] = { "", "abc", "x" };
+
+  std::vector<VarValue> arguments;
+  for (auto& param : function.params) {
+    switch (ActivePexInstance::GetTypeByName(param.type)) {
+      case VarValue::kType_Integer:
+        arguments.push_back(VarValue(ints[set]));
+        break;
+      case VarValue::kType_Float:
+        arguments.push_back(VarValue(floats[set]));
+        break;
+      case VarValue::kType_Bool:
+        arguments.push_back(VarValue(set != 0));
+        break;
+      case VarValue::kType_String:
+        arguments.push_back(VarValue(strings[set]));
+        break;
+      default:
+        arguments.push_back(
+          VarValue(ActivePexInstance::GetTypeByName(param.type)));
+        arguments.back().SetObjectType(param.type);
+    }
+  }
+  return arguments;
+}
+
+// Declared type of a local or parameter, None for anything else
+uint8_t GetVariableType(const FunctionInfo& function, const char* name)
+{
+  for (auto* vars : { &function.locals, &function.params }) {
+    for (auto& var : *vars) {
+      if (name && var.name == name)
+        return ActivePexInstance::GetTypeByName(var.type);
+    }
+  }
+  return VarValue::kType_Object;
+}
+
+std::string ToLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return char(std::tolower(c)); });
+  return s;
+}
+}
+
+class ScriptRunner::Object : public IGameObject
+{
+public:
+  const char* GetStringID() override { return "runner"; }
+};
+
+std::vector<ScriptRunner::NativeDeclaration> ScriptRunner::ParseNatives(
+  const std::string& pscSource)
+{
+  std::vector<NativeDeclaration> natives;
+  std::string className;
+
+  std::istringstream lines(pscSource);
+  std::string line;
+  while (std::getline(lines, line)) {
+    line = line.substr(0, line.find(';'));
+
+    // Everything before '(' are words, everything after ')' flags
+    auto open = line.find('('), close = line.rfind(')');
+    std::istringstream head(line.substr(0, open));
+    std::vector<std::string> words;
+    for (std::string word; head >> word;) {
+      words.push_back(word);
+    }
+
+    if (words.size() >= 2 && ToLower(words[0]) == "scriptname") {
+      className = words[1];
+      continue;
+    }
+    if (open == std::string::npos || close == std::string::npos ||
+        close < open || words.empty() || className.empty())
+      continue;
+
+    auto function = std::find_if(words.begin(), words.end(), [](auto& word) {
+      return ToLower(word) == "function";
+    });
+    if (function == words.end() || function + 2 != words.end())
+      continue;
+
+    std::istringstream tail(ToLower(line.substr(close + 1)));
+    bool isNative = false, isGlobal = false;
+    for (std::string flag; tail >> flag;) {
+      isNative |= flag == "native";
+      isGlobal |= flag == "global";
+    }
+    if (!isNative)
+      continue;
+
+    NativeDeclaration native;
+    native.className = className;
+    native.functionName = *(function + 1);
+    native.returnType = function == words.begin() ? "" : words[0];
+    native.isGlobal = isGlobal;
+    natives.push_back(native);
+  }
+  return natives;
+}
+
+ScriptRunner::ScriptRunner(std::vector<std::shared_ptr<PexScript>> scripts_,
+                           bool optimize, const Limits& limits_,
+                           const std::vector<NativeDeclaration>& natives)
+  : scripts(std::move(scripts_))
+  , limits(limits_)
+{
+  vm = std::make_unique<VirtualMachine>(scripts, optimize);
+  vm->maxCallDepth = limits.maxCallDepth;
+  vm->maxSteps = limits.maxSteps;
+  vm->maxArraySize = limits.maxArraySize;
+  vm->maxStringLength = limits.maxStringLength;
+
+  for (auto& native : natives) {
+    RegisterStub(native.className, native.functionName,
+                 native.isGlobal ? FunctionType::GlobalFunction
+                                 : FunctionType::Method,
+                 ActivePexInstance::GetTypeByName(native.returnType));
+  }
+
+  for (auto& script : scripts) {
+    for (auto& object : script->objectTable.m_data) {
+      for (auto& state : object.states) {
+        for (auto& function : state.functions) {
+          auto& info = function.function;
+          if (info.IsNative()) {
+            RegisterStub(script->source, function.name,
+                         info.IsGlobal() ? FunctionType::GlobalFunction
+                                         : FunctionType::Method,
+                         ActivePexInstance::GetTypeByName(info.returnType));
+          }
+          RegisterCallStaticStubs(info);
+        }
+      }
+      for (auto& property : object.properties) {
+        RegisterCallStaticStubs(property.readHandler);
+        RegisterCallStaticStubs(property.writeHandler);
+      }
+    }
+  }
+}
+
+// Logs the call and returns a value of the declared type if there is one.
+// The value changes with every call so that loops over it terminate
+void ScriptRunner::RegisterStub(const std::string& className,
+                                const std::string& functionName,
+                                FunctionType type, uint8_t returnType)
+{
+  auto name = className + '.' + functionName;
+  auto stub = [this, name, returnType](const VarValue&,
+                                       const VarValue* arguments,
+                                       size_t numArguments) {
+    if (calls.size() >= limits.maxNativeCalls)
+      throw std::runtime_error("Too many native calls");
+
+    std::string call = name + '(';
+    for (size_t i = 0; i < numArguments; ++i) {
+      call += Describe(arguments[i]) + ',';
+    }
+    calls.push_back(call + ')');
+
+    auto n = static_cast<int32_t>(calls.size());
+    switch (returnType) {
+      case VarValue::kType_Integer:
+        return VarValue(n);
+      case VarValue::kType_Float:
+        return VarValue(n * 0.5f);
+      case VarValue::kType_Bool:
+        return VarValue(n % 2 == 0);
+      case VarValue::kType_String:
+        return VarValue(n % 2 == 0 ? "even" : "odd");
+      default:
+        return VarValue::None();
+    }
+  };
+  vm->RegisterNative(className, functionName, type, stub);
+}
+
+void ScriptRunner::RegisterCallStaticStubs(const FunctionInfo& function)
+{
+  for (auto& instruction : function.code.instructions) {
+    auto& args = instruction.args;
+    if (instruction.op != FunctionCode::kOp_CallStatic || args.size() < 3 ||
+        !(const char*)args[0] || !(const char*)args[1])
+      continue;
+
+    std::string className = (const char*)args[0];
+    std::string functionName = (const char*)args[1];
+    if (vm->GetScript(className))
+      continue;
+
+    // Typed arithmetic on the result relies on the type being right
+    RegisterStub(className, functionName, FunctionType::GlobalFunction,
+                 GetVariableType(function, (const char*)args[2]));
+  }
+}
+
+void ScriptRunner::Run(PexScript& script, std::ostream& out)
+{
+  for (auto& object : script.objectTable.m_data) {
+    for (auto& state : object.states) {
+      for (auto& function : state.functions) {
+        if (!function.function.IsNative())
+          Run(script.source, state.name + '.' + function.name,
+              function.function, out);
+      }
+    }
+    for (auto& property : object.properties) {
+      if (property.readHandler.linkedCode)
+        Run(script.source, property.name + ".get", property.readHandler,
+            out);
+      if (property.writeHandler.linkedCode)
+        Run(script.source, property.name + ".set", property.writeHandler,
+            out);
+    }
+  }
+}
+
+void ScriptRunner::Run(const std::string& scriptName,
+                       const std::string& functionName,
+                       FunctionInfo& function, std::ostream& out)
+{
+  for (int set = 0; set < kNumArgumentSets; ++set) {
+    out << scriptName << '.' << functionName << " #" << set << ": ";
+
+    calls.clear();
+    vm->numSteps = 0;
+
+    auto object = std::make_shared<Object>();
+    try {
+      vm->AddObject(object, { scriptName }, {});
+      auto instance = vm->GetInstance(object.get(), scriptName);
+      if (!instance)
+        throw std::runtime_error("no instance");
+
+      auto arguments = MakeArguments(function, set);
+      out << Describe(instance->StartFunction(function, arguments)) << '\n';
+
+      for (auto& call : calls) {
+        out << "  call " << call << '\n';
+      }
+      for (auto it = instance; it; it = it->parentInstance.get()) {
+        auto& names = it->sourcePex->instanceTemplate.variableNames;
+        for (size_t i = 0; i < it->variables.size(); ++i) {
+          out << "  var " << names[i] << '=' << Describe(it->variables[i])
+              << '\n';
+        }
+      }
+    } catch (std::exception& e) {
+      out << "error: " << e.what() << '\n';
+      for (auto& call : calls) {
+        out << "  call " << call << '\n';
+      }
+    }
+
+    vm->RemoveObject(object);
+    vm->CollectStrings();
+  }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "VirtualMachine.h"
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Runs every function of a set of scripts, property handlers included, and
+// prints what each run did: the result or error, the native calls and the
+// script variables afterwards. Natives are replaced by stubs that log their
+// calls, so the output depends on nothing but the scripts. Runs are bounded
+// by the VM limits, so malformed scripts terminate too
+class ScriptRunner
+{
+public:
+  // A native function declared in a .psc file
+  struct NativeDeclaration
+  {
+    std::string className;
+    std::string functionName;
+    std::string returnType;
+    bool isGlobal = false;
+  };
+
+  struct Limits
+  {
+    size_t maxCallDepth = 64;
+    uint64_t maxSteps = 10000;
+    // The game's limit for arrays created by scripts
+    size_t maxArraySize = 128;
+    size_t maxStringLength = 65536;
+    size_t maxNativeCalls = 1000;
+  };
+
+  // Finds '[Type] Function Name(...) [Global] Native' declarations
+  static std::vector<NativeDeclaration> ParseNatives(
+    const std::string& pscSource);
+
+  // Natives of the scripts and of 'natives' get stubs, as do targets of
+  // 'callstatic' that no script implements
+  ScriptRunner(std::vector<std::shared_ptr<PexScript>> scripts,
+               bool optimize, const Limits& limits,
+               const std::vector<NativeDeclaration>& natives = {});
+
+  const std::vector<std::shared_ptr<PexScript>>& GetScripts() const
+  {
+    return scripts;
+  }
+
+  void Run(PexScript& script, std::ostream& out);
+
+  size_t RegisterAotFunctions(const std::vector<AotFunction>& functions)
+  {
+    return vm->RegisterAotFunctions(functions);
+  }
+
+private:
+  class Object;
+
+  void RegisterStub(const std::string& className,
+                    const std::string& functionName, FunctionType type,
+                    uint8_t returnType);
+  void RegisterCallStaticStubs(const FunctionInfo& function);
+  void Run(const std::string& scriptName, const std::string& functionName,
+           FunctionInfo& function, std::ostream& out);
+
+  std::vector<std::shared_ptr<PexScript>> scripts;
+  std::unique_ptr<VirtualMachine> vm;
+  Limits limits;
+  std::vector<std::string> calls;
+};
@@ -0,0 +1,292 @@
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Usage: papyrus_vm_scheduler_check [threads]
+//
+// Runs 10k script threads at once, one per object, each waiting on a timer
+// and on a latent native completed from another OS thread. Exits with 1 if a
+// thread is lost, returns a wrong value or is still parked after 60 seconds,
+// or if CollectStrings frees the string of a completed latent result.
+
+namespace {
+constexpr int kNumRounds = 3;
+constexpr std::chrono::microseconds kTickBudget(2000);
+constexpr std::chrono::seconds kTimeout(60);
+
+class CheckObject : public IGameObject
+{
+public:
+  explicit CheckObject(std::string id_)
+    : id(std::move(id_))
+  {
+  }
+
+  const char* GetStringID() override { return id.c_str(); }
+
+private:
+  std::string id;
+};
+
+VarValue Id(const char* name)
+{
+  return VarValue(VarValue::kType_Identifier, name);
+}
+
+FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+{
+  FunctionCode::Instruction instruction;
+  instruction.op = op;
+  instruction.args = std::move(args);
+  return instruction;
+}
+
+// Scriptname SchedulerCheck
+//
+// Int Function Run(Int id)
+//   Int sum = 0
+//   Int i = 0
+//   While i < 3
+//     SchedulerCheckNative.Wait()
+//     sum += SchedulerCheckNative.Latent(id)
+//     i += 1
+//   EndWhile
+//   Return sum
+// EndFunction
+std::shared_ptr<PexScript> MakeCheckScript()
+{
+  FunctionInfo run;
+  run.returnType = "Int";
+  run.params = { { "id", "Int" } };
+  run.locals = { { "i", "Int" },
+                 { "sum", "Int" },
+                 { "::loop", "Bool" },
+                 { "::temp", "Int" },
+                 { "::NoneVar", "None" } };
+  run.code.instructions = {
+    Op(FunctionCode::kOp_Assign, { Id("sum"), VarValue(0) }),
+    Op(FunctionCode::kOp_Assign, { Id("i"), VarValue(0) }),
+    Op(FunctionCode::kOp_CompareLT,
+       { Id("::loop"), Id("i"), VarValue(kNumRounds) }),
+    Op(FunctionCode::kOp_JumpF, { Id("::loop"), VarValue(6) }),
+    Op(FunctionCode::kOp_CallStatic,
+       { Id("SchedulerCheckNative"), Id("Wait"), Id("::NoneVar"),
+         VarValue(0) }),
+    Op(FunctionCode::kOp_CallStatic,
+       { Id("SchedulerCheckNative"), Id("Latent"), Id("::temp"), VarValue(1),
+         Id("id") }),
+    Op(FunctionCode::kOp_IAdd, { Id("sum"), Id("sum"), Id("::temp") }),
+    Op(FunctionCode::kOp_IAdd, { Id("i"), Id("i"), VarValue(1) }),
+    Op(FunctionCode::kOp_Jump, { VarValue(-6) }),
+    Op(FunctionCode::kOp_Return, { Id("sum") }),
+  };
+
+  ObjectTable::Object::StateInfo state;
+  state.functions = { { "Run", run } };
+
+  ObjectTable::Object object;
+  object.NameIndex = "SchedulerCheck";
+  object.states = { state };
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "SchedulerCheck";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+// Scriptname SchedulerCheckStrings
+//
+// String Function Run()
+//   Return SchedulerCheckNative.LatentString()
+// EndFunction
+std::shared_ptr<PexScript> MakeStringsScript()
+{
+  FunctionInfo run;
+  run.returnType = "String";
+  run.locals = { { "::temp", "String" } };
+  run.code.instructions = {
+    Op(FunctionCode::kOp_CallStatic,
+       { Id("SchedulerCheckNative"), Id("LatentString"), Id("::temp"),
+         VarValue(0) }),
+    Op(FunctionCode::kOp_Return, { Id("::temp") }),
+  };
+
+  ObjectTable::Object::StateInfo state;
+  state.functions = { { "Run", run } };
+
+  ObjectTable::Object object;
+  object.NameIndex = "SchedulerCheckStrings";
+  object.states = { state };
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "SchedulerCheckStrings";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+// Completes latent calls from its own thread, as a game callback would
+class Completer
+{
+public:
+  Completer()
+    : thread([this] { Work(); })
+  {
+  }
+
+  ~Completer()
+  {
+    stop = true;
+    thread.join();
+  }
+
+  void Add(LatentResult latent, int32_t value)
+  {
+    std::lock_guard lock(mutex);
+    pending.push_back({ std::move(latent), value });
+  }
+
+private:
+  void Work()
+  {
+    std::vector<std::pair<LatentResult, int32_t>> batch;
+    while (!stop) {
+      {
+        std::lock_guard lock(mutex);
+        batch.swap(pending);
+      }
+      for (auto& [latent, value] : batch) {
+        latent.Complete(VarValue(value));
+      }
+      batch.clear();
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+
+  std::mutex mutex;
+  std::vector<std::pair<LatentResult, int32_t>> pending;
+  std::atomic<bool> stop = false;
+  std::thread thread;
+};
+
+bool Check(int numThreads)
+{
+  VirtualMachine vm({ MakeCheckScript() });
+  Completer completer;
+
+  vm.RegisterFunction(
+    "SchedulerCheckNative", "Wait", FunctionType::GlobalFunction,
+    [&vm] { vm.scheduler.SuspendFor(std::chrono::milliseconds(1)); });
+  vm.RegisterFunction("SchedulerCheckNative", "Latent",
+                      FunctionType::GlobalFunction,
+                      [&vm, &completer](int32_t id) {
+                        completer.Add(vm.scheduler.Suspend(), id + 1);
+                      });
+
+  std::vector<std::shared_ptr<CheckObject>> objects;
+  for (int i = 0; i < numThreads; ++i) {
+    objects.push_back(std::make_shared<CheckObject>(std::to_string(i)));
+    vm.AddObject(objects.back(), { "SchedulerCheck" }, {});
+  }
+
+  int numDone = 0, numWrong = 0;
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < numThreads; ++i) {
+    auto instance = vm.GetInstance(objects[i].get(), "SchedulerCheck");
+    auto function =
+      instance->GetFunctionByName("Run", instance->GetActiveStateName());
+    if (!function)
+      throw std::runtime_error("Run not found");
+
+    VarValue id(i);
+    vm.scheduler.Spawn(instance, *function, &id, 1,
+                       [&numDone, &numWrong, i](const VarValue& result) {
+                         if (result.GetType() != VarValue::kType_Integer ||
+                             result.GetInt() != kNumRounds * (i + 1))
+                           ++numWrong;
+                         ++numDone;
+                       });
+  }
+
+  size_t numParkedAtStart = vm.scheduler.GetNumParked();
+  size_t maxResumedPerTick = 0;
+
+  while (numDone < numThreads &&
+         std::chrono::steady_clock::now() - start < kTimeout) {
+    maxResumedPerTick =
+      std::max(maxResumedPerTick, vm.scheduler.Tick(kTickBudget));
+  }
+
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+
+  std::cout << numThreads << " script threads, " << numParkedAtStart
+            << " parked after spawning, " << numDone << " finished, "
+            << numWrong << " wrong results in " << size_t(elapsed.count())
+            << " ms, at most " << maxResumedPerTick << " resumed per tick"
+            << std::endl;
+
+  return numDone == numThreads && numWrong == 0 &&
+    numParkedAtStart == size_t(numThreads) &&
+    vm.scheduler.GetNumParked() == 0;
+}
+}
+
+// A latent result holding a runtime string must survive CollectStrings
+// between its completion and the Tick resuming the script
+bool CheckCollectStrings()
+{
+  VirtualMachine vm({ MakeStringsScript() });
+
+  LatentResult latent;
+  vm.RegisterFunction("SchedulerCheckNative", "LatentString",
+                      FunctionType::GlobalFunction,
+                      [&vm, &latent] { latent = vm.scheduler.Suspend(); });
+
+  auto object = std::make_shared<CheckObject>("strings");
+  vm.AddObject(object, { "SchedulerCheckStrings" }, {});
+  auto instance = vm.GetInstance(object.get(), "SchedulerCheckStrings");
+  auto function =
+    instance->GetFunctionByName("Run", instance->GetActiveStateName());
+  if (!function)
+    throw std::runtime_error("Run not found");
+
+  std::string result;
+  vm.scheduler.Spawn(instance, *function, nullptr, 0,
+                     [&result](const VarValue& value) {
+                       if (auto str = (const char*)value)
+                         result = str;
+                     });
+
+  const std::string expected(64, 'x');
+  latent.Complete(VarValue(vm.stringPool.Intern(expected)));
+  // The result is the only runtime string, nothing may be freed
+  size_t numFreed = vm.CollectStrings();
+  vm.scheduler.Tick(kTickBudget);
+
+  bool kept = numFreed == 0 && result == expected;
+  std::cout << "Latent string result after CollectStrings: "
+            << (kept ? "kept" : "freed") << std::endl;
+  return kept;
+}
+
+int main(int argc, char** argv)
+{
+  int numThreads = argc > 1 ? std::stoi(argv[1]) : 10000;
+
+  try {
+    if (!Check(numThreads) || !CheckCollectStrings()) {
+      std::cerr << "FAILED" << std::endl;
+      return 1;
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,157 @@
+#include "ShardedVirtualMachine.h"
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Usage: papyrus_vm_shard_bench [objects] [events per object] [loop size]
+//
+// Measures event throughput of ShardedVirtualMachine at 1, 2, 4 and 8
+// shards. Every event runs a small loop, then calls a method of another
+// object, which usually lives on another shard.
+
+namespace {
+class BenchObject : public IGameObject
+{
+public:
+  explicit BenchObject(std::string id_)
+    : id(std::move(id_))
+  {
+  }
+
+  const char* GetStringID() override { return id.c_str(); }
+
+private:
+  std::string id;
+};
+
+VarValue Id(const char* name)
+{
+  return VarValue(VarValue::kType_Identifier, name);
+}
+
+FunctionCode::Instruction Op(uint8_t op, std::vector<VarValue> args)
+{
+  FunctionCode::Instruction instruction;
+  instruction.op = op;
+  instruction.args = std::move(args);
+  return instruction;
+}
+
+// Scriptname ShardBench
+//
+// Event OnBench(ShardBench other, Int n)
+//   Int sum = 0
+//   Int i = 0
+//   While i < n
+//     sum += i
+//     i += 1
+//   EndWhile
+//   ShardBenchNative.Done(other.Echo(sum))
+// EndEvent
+//
+// Int Function Echo(Int x)
+//   Return x
+// EndFunction
+std::shared_ptr<PexScript> MakeBenchScript()
+{
+  FunctionInfo onBench;
+  onBench.params = { { "other", "ShardBench" }, { "n", "Int" } };
+  onBench.locals = {
+    { "i", "Int" }, { "sum", "Int" }, { "::temp0", "Bool" },
+    { "::temp1", "Int" }, { "::NoneVar", "None" }
+  };
+  onBench.code.instructions = {
+    Op(FunctionCode::kOp_Assign, { Id("i"), VarValue(0) }),
+    Op(FunctionCode::kOp_Assign, { Id("sum"), VarValue(0) }),
+    Op(FunctionCode::kOp_CompareLT, { Id("::temp0"), Id("i"), Id("n") }),
+    Op(FunctionCode::kOp_JumpF, { Id("::temp0"), VarValue(4) }),
+    Op(FunctionCode::kOp_IAdd, { Id("sum"), Id("sum"), Id("i") }),
+    Op(FunctionCode::kOp_IAdd, { Id("i"), Id("i"), VarValue(1) }),
+    Op(FunctionCode::kOp_Jump, { VarValue(-4) }),
+    Op(FunctionCode::kOp_CallMethod,
+       { Id("Echo"), Id("other"), Id("::temp1"), VarValue(1), Id("sum") }),
+    Op(FunctionCode::kOp_CallStatic,
+       { Id("ShardBenchNative"), Id("Done"), Id("::NoneVar"), VarValue(1),
+         Id("::temp1") }),
+  };
+
+  FunctionInfo echo;
+  echo.returnType = "Int";
+  echo.params = { { "x", "Int" } };
+  echo.code.instructions = { Op(FunctionCode::kOp_Return, { Id("x") }) };
+
+  ObjectTable::Object::StateInfo state;
+  state.functions = { { "OnBench", onBench }, { "Echo", echo } };
+
+  ObjectTable::Object object;
+  object.NameIndex = "ShardBench";
+  object.states = { state };
+
+  auto script = std::make_shared<PexScript>();
+  script->source = "ShardBench";
+  script->objectTable.m_data = { object };
+  return script;
+}
+
+double Run(size_t numShards, int numObjects, int eventsPerObject,
+           int loopSize)
+{
+  ShardedVirtualMachine vm({ MakeBenchScript() }, numShards);
+
+  std::atomic<int64_t> numDone = 0;
+  vm.RegisterFunction("ShardBenchNative", "Done",
+                      FunctionType::GlobalFunction,
+                      [&numDone](int32_t) { ++numDone; });
+
+  std::vector<std::shared_ptr<BenchObject>> objects;
+  for (int i = 0; i < numObjects; ++i) {
+    objects.push_back(std::make_shared<BenchObject>(std::to_string(i)));
+    vm.AddObject(objects.back(), { "ShardBench" }, {});
+  }
+
+  vm.Start();
+  vm.Flush();
+
+  auto start = std::chrono::steady_clock::now();
+
+  for (int k = 0; k < eventsPerObject; ++k) {
+    for (int i = 0; i < numObjects; ++i) {
+      auto& other = objects[(i + 1) % numObjects];
+      vm.SendEvent(objects[i], "OnBench",
+                   { VarValue((IGameObject*)other.get()),
+                     VarValue(loopSize) });
+    }
+  }
+
+  int64_t numEvents = int64_t(numObjects) * eventsPerObject;
+  while (numDone < numEvents) {
+    vm.Flush();
+  }
+
+  std::chrono::duration<double> elapsed =
+    std::chrono::steady_clock::now() - start;
+  vm.Stop();
+  return numEvents / elapsed.count();
+}
+}
+
+int main(int argc, char** argv)
+{
+  int numObjects = argc > 1 ? std::stoi(argv[1]) : 1000;
+  int eventsPerObject = argc > 2 ? std::stoi(argv[2]) : 100;
+  int loopSize = argc > 3 ? std::stoi(argv[3]) : 100;
+
+  try {
+    for (size_t numShards : { 1, 2, 4, 8 }) {
+      double eventsPerSecond =
+        Run(numShards, numObjects, eventsPerObject, loopSize);
+      std::cout << numShards << " threads: " << size_t(eventsPerSecond)
+                << " events/s" << std::endl;
+    }
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,112 @@
+#include "AotCompiler.h"
+#include "Reader.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+// Usage: pex_aot_compiler [--optimize] [--table <name>]
+//                         [--function <name>]... <output .cpp>
+//                         <.pex files or directories>...
+//
+// Compiles the functions of the scripts to C++, see AotCompiler.h. The
+// output is built into the host, which passes <name>() (by default
+// GetPapyrusAotFunctions) to VirtualMachine::RegisterAotFunctions. Code is
+// only bound if the host links the scripts the same way, so --optimize must
+// match the host's VirtualMachine. --function limits compilation to hot
+// functions, named as in Profiler reports, e.g. Script.Foo or
+// Script.State.Foo.
+
+namespace {
+std::string ToLower(std::string s)
+{
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return char(std::tolower(c)); });
+  return s;
+}
+
+void PrintUsage()
+{
+  std::cerr << "Usage: pex_aot_compiler [--optimize] [--table <name>] "
+               "[--function <name>]... <output .cpp> <.pex files or "
+               "directories>..."
+            << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+  bool optimize = false;
+  std::string table = "GetPapyrusAotFunctions";
+  std::set<std::string> functions;
+  std::vector<std::string> paths;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--optimize") {
+      optimize = true;
+    } else if ((arg == "--table" || arg == "--function") && i + 1 < argc) {
+      if (arg == "--table")
+        table = argv[++i];
+      else
+        functions.insert(ToLower(argv[++i]));
+    } else if (arg.size() > 1 && arg[0] == '-') {
+      PrintUsage();
+      return 1;
+    } else {
+      paths.push_back(arg);
+    }
+  }
+
+  if (paths.size() < 2) {
+    PrintUsage();
+    return 1;
+  }
+
+  try {
+    std::vector<std::string> pexPaths;
+    for (size_t i = 1; i < paths.size(); ++i) {
+      if (!std::filesystem::is_directory(paths[i])) {
+        pexPaths.push_back(paths[i]);
+        continue;
+      }
+      std::vector<std::string> directoryPaths;
+      for (auto& entry : std::filesystem::directory_iterator(paths[i])) {
+        if (entry.is_regular_file() && entry.path().extension() == ".pex")
+          directoryPaths.push_back(entry.path().string());
+      }
+      std::sort(directoryPaths.begin(), directoryPaths.end());
+      pexPaths.insert(pexPaths.end(), directoryPaths.begin(),
+                      directoryPaths.end());
+    }
+
+    // Links the scripts
+    VirtualMachine vm(Reader(pexPaths).GetSourceStructures(), optimize);
+
+    std::function<bool(const std::string&)> filter;
+    if (!functions.empty()) {
+      filter = [&](const std::string& name) {
+        return functions.count(ToLower(name)) > 0;
+      };
+    }
+    auto output = AotCompiler::Compile(vm.allLoadedScripts, table, filter);
+
+    std::ofstream out(paths[0], std::ios::binary);
+    out << output.source;
+    if (!out)
+      throw std::runtime_error("Error write file: " + paths[0]);
+
+    std::cout << "Compiled " << output.numFunctions << " functions, "
+              << output.numInstructions << " instructions, "
+              << output.numFallbacks << " hand-overs to the interpreter"
+              << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
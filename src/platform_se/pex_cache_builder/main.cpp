@@ -0,0 +1,77 @@
+#include "PexCache.h"
+#include "Reader.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: pex_cache_builder [--optimize] <pex directory> <cache file>
+//
+// Writes the scripts of the directory to a PexCache file, unless the cache
+// is up to date. Then constructs a VirtualMachine from the .pex files and
+// one from the cache and prints how long each took. --optimize is passed
+// to both VirtualMachines.
+
+namespace {
+template <class F>
+double MeasureMs(F fn)
+{
+  auto start = std::chrono::steady_clock::now();
+  fn();
+  std::chrono::duration<double, std::milli> elapsed =
+    std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+}
+
+int main(int argc, char** argv)
+{
+  bool optimize = argc > 1 && !std::strcmp(argv[1], "--optimize");
+  if (argc != 3 + optimize) {
+    std::cerr
+      << "Usage: pex_cache_builder [--optimize] <pex directory> <cache file>"
+      << std::endl;
+    return 1;
+  }
+  std::string pexDirectory = argv[1 + optimize];
+  std::string cachePath = argv[2 + optimize];
+
+  try {
+    std::vector<std::string> pexPaths;
+    for (auto& entry : std::filesystem::directory_iterator(pexDirectory)) {
+      if (entry.is_regular_file() && entry.path().extension() == ".pex")
+        pexPaths.push_back(entry.path().string());
+    }
+    std::sort(pexPaths.begin(), pexPaths.end());
+
+    int numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    if (PexCache::IsUpToDate(cachePath, pexPaths)) {
+      std::cout << "Cache is up to date" << std::endl;
+    } else {
+      PexCache::Build(pexPaths, cachePath, numThreads);
+      std::cout << "Cached " << pexPaths.size() << " scripts" << std::endl;
+    }
+
+    double fromPex = MeasureMs([&] {
+      VirtualMachine vm(Reader(pexPaths, numThreads).GetSourceStructures(),
+                        optimize);
+    });
+    double fromCache =
+      MeasureMs([&] { VirtualMachine vm(cachePath, optimize); });
+
+    std::cout << "VirtualMachine from .pex files (" << numThreads
+              << " threads): " << fromPex << " ms" << std::endl;
+    std::cout << "VirtualMachine from the cache: " << fromCache << " ms"
+              << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,367 @@
+#include "Reader.h"
+#include "VirtualMachine.h"
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Usage: pex_optimizer_check <directory with .pex files>
+//
+// Differential test of FunctionOptimizer. Every function of every script,
+// property handlers included, runs on a VM with plain code and on a VM with
+// optimized code, with the same arguments. Natives are replaced by stubs
+// that log their calls. The result or error, the native calls and the
+// script variables afterwards must be the same on both. A script looping
+// forever without calling natives hangs the check.
+
+namespace {
+constexpr int kNumArgumentSets = 3;
+
+// Stops loops waiting on a native to return something else
+constexpr size_t kMaxNativeCalls = 10000;
+
+class CheckObject : public IGameObject
+{
+public:
+  const char* GetStringID() override { return "check"; }
+};
+
+std::string Describe(const VarValue& value)
+{
+  std::ostringstream out;
+  out << int(value.GetType()) << ':';
+
+  switch (value.GetType()) {
+    case VarValue::kType_Object: {
+      auto object = (IGameObject*)value;
+      out << (object ? object->GetStringID() : "None");
+    } break;
+    case VarValue::kType_Identifier:
+    case VarValue::kType_String:
+      out << ((const char*)value ? (const char*)value : "");
+      break;
+    case VarValue::kType_Integer:
+      out << value.GetInt();
+      break;
+    case VarValue::kType_Float:
+      // Exact, and tells -0 from 0
+      out << std::hexfloat << value.GetFloat();
+      break;
+    case VarValue::kType_Bool:
+      out << value.GetBool();
+      break;
+    default:
+      if (auto array = value.GetArray()) {
+        out << '[';
+        for (size_t i = 0; i < array->GetSize(); ++i) {
+          out << Describe(array->Get(i)) << ',';
+        }
+        out << ']';
+      } else {
+        out << "None";
+      }
+  }
+  return out.str();
+}
+
+struct NativeLog
+{
+  std::vector<std::string> calls;
+};
+
+// Logs the call and returns a value of the declared type if there is one.
+// The value changes with every call so that loops over it terminate
+NativeCallback MakeStub(NativeLog& log, std::string name, uint8_t returnType)
+{
+  return [&log, name, returnType](const VarValue&, const VarValue* arguments,
+                                  size_t numArguments) {
+    if (log.calls.size() >= kMaxNativeCalls)
+      throw std::runtime_error("Too many native calls");
+
+    std::string call = name + '(';
+    for (size_t i = 0; i < numArguments; ++i) {
+      call += Describe(arguments[i]) + ',';
+    }
+    log.calls.push_back(call + ')');
+
+    auto n = static_cast<int32_t>(log.calls.size());
+    switch (returnType) {
+      case VarValue::kType_Integer:
+        return VarValue(n);
+      case VarValue::kType_Float:
+        return VarValue(n * 0.5f);
+      case VarValue::kType_Bool:
+        return VarValue(n % 2 == 0);
+      case VarValue::kType_String:
+        return VarValue(n % 2 == 0 ? "even" : "odd");
+      default:
+        return VarValue::None();
+    }
+  };
+}
+
+std::vector<VarValue> MakeArguments(const FunctionInfo& function, int set)
+{
+  // Positive, array sizes below 1 assert in debug builds
+  static const int32_t ints[] = { 1, 4, 9 };
+  static const float floats[] = { 0.0f, 2.5f, -1.25f };
+  static const char* strings[] = { "", "abc", "x" };
+
+  std::vector<VarValue> arguments;
+  for (auto& param : function.params) {
+    switch (ActivePexInstance::GetTypeByName(param.type)) {
+      case VarValue::kType_Integer:
+        arguments.push_back(VarValue(ints[set]));
+        break;
+      case VarValue::kType_Float:
+        arguments.push_back(VarValue(floats[set]));
+        break;
+      case VarValue::kType_Bool:
+        arguments.push_back(VarValue(set != 0));
+        break;
+      case VarValue::kType_String:
+        arguments.push_back(VarValue(strings[set]));
+        break;
+      default:
+        arguments.push_back(
+          VarValue(ActivePexInstance::GetTypeByName(param.type)));
+        arguments.back().SetObjectType(param.type);
+    }
+  }
+  return arguments;
+}
+
+// Everything a run of a function may affect
+struct Outcome
+{
+  std::string result;
+  std::vector<std::string> calls;
+  std::vector<std::string> variables;
+
+  bool operator==(const Outcome& other) const
+  {
+    return result == other.result && calls == other.calls &&
+      variables == other.variables;
+  }
+};
+
+// One of the two VMs. Each has its own copy of the scripts
+struct Side
+{
+  std::vector<std::shared_ptr<PexScript>> scripts;
+  std::unique_ptr<VirtualMachine> vm;
+  NativeLog log;
+
+  Side(const std::vector<std::string>& pexPaths, bool optimize)
+  {
+    scripts = Reader(pexPaths).GetSourceStructures();
+    vm = std::make_unique<VirtualMachine>(scripts, optimize);
+    RegisterStubs();
+  }
+
+  void RegisterStubs()
+  {
+    for (auto& script : scripts) {
+      for (auto& object : script->objectTable.m_data) {
+        for (auto& state : object.states) {
+          for (auto& function : state.functions) {
+            auto& info = function.function;
+            if (info.IsNative()) {
+              vm->RegisterNative(
+                script->source, function.name,
+                info.IsGlobal() ? FunctionType::GlobalFunction
+                                : FunctionType::Method,
+                MakeStub(log, script->source + '.' + function.name,
+                         ActivePexInstance::GetTypeByName(info.returnType)));
+            }
+            RegisterCallStaticStubs(info);
+          }
+        }
+        for (auto& property : object.properties) {
+          RegisterCallStaticStubs(property.readHandler);
+          RegisterCallStaticStubs(property.writeHandler);
+        }
+      }
+    }
+  }
+
+  // Targets of 'callstatic' that no loaded script implements
+  void RegisterCallStaticStubs(const FunctionInfo& function)
+  {
+    for (auto& instruction : function.code.instructions) {
+      auto& args = instruction.args;
+      if (instruction.op != FunctionCode::kOp_CallStatic ||
+          args.size() < 3 || !(const char*)args[0] || !(const char*)args[1])
+        continue;
+
+      std::string className = (const char*)args[0];
+      std::string functionName = (const char*)args[1];
+      if (vm->GetScript(className))
+        continue;
+
+      vm->RegisterNative(
+        className, functionName, FunctionType::GlobalFunction,
+        MakeStub(log, className + '.' + functionName,
+                 GetVariableType(function, (const char*)args[2])));
+    }
+  }
+
+  // Declared type of a local or parameter, None for anything else. Stubs
+  // of unknown functions return it, as typed arithmetic on the result
+  // relies on the type being right
+  static uint8_t GetVariableType(const FunctionInfo& function,
+                                 const char* name)
+  {
+    for (auto* vars : { &function.locals, &function.params }) {
+      for (auto& var : *vars) {
+        if (name && var.name == name)
+          return ActivePexInstance::GetTypeByName(var.type);
+      }
+    }
+    return VarValue::kType_Object;
+  }
+
+  Outcome Run(const std::string& scriptName, FunctionInfo& function,
+              int argumentSet)
+  {
+    Outcome outcome;
+    log.calls.clear();
+
+    auto object = std::make_shared<CheckObject>();
+    vm->AddObject(object, { scriptName }, {});
+
+    auto instance = vm->GetInstance(object.get(), scriptName);
+    if (!instance) {
+      outcome.result = "no instance";
+      return outcome;
+    }
+
+    try {
+      auto arguments = MakeArguments(function, argumentSet);
+      outcome.result = Describe(instance->StartFunction(function, arguments));
+    } catch (std::exception& e) {
+      outcome.result = std::string("error: ") + e.what();
+    }
+
+    outcome.calls = log.calls;
+    for (auto it = instance; it; it = it->parentInstance.get()) {
+      auto& names = it->sourcePex->instanceTemplate.variableNames;
+      for (size_t i = 0; i < it->variables.size(); ++i) {
+        outcome.variables.push_back(names[i] + '=' +
+                                    Describe(it->variables[i]));
+      }
+    }
+
+    vm->RemoveObject(object);
+    vm->CollectStrings();
+    return outcome;
+  }
+};
+
+void Print(const char* title, const Outcome& outcome)
+{
+  std::cerr << "  " << title << ": " << outcome.result << '\n';
+  for (auto& call : outcome.calls) {
+    std::cerr << "    call " << call << '\n';
+  }
+  for (auto& var : outcome.variables) {
+    std::cerr << "    var " << var << '\n';
+  }
+}
+
+// Calls f(script name, function name, plain function, optimized function)
+// for every function of the matching scripts
+template <class F>
+void ForEachFunction(Side& plain, Side& optimized, F f)
+{
+  for (size_t i = 0; i < plain.scripts.size(); ++i) {
+    auto& name = plain.scripts[i]->source;
+    auto& plainObjects = plain.scripts[i]->objectTable.m_data;
+    auto& optimizedObjects = optimized.scripts[i]->objectTable.m_data;
+
+    for (size_t j = 0; j < plainObjects.size(); ++j) {
+      auto& plainObject = plainObjects[j];
+      auto& optimizedObject = optimizedObjects[j];
+
+      for (size_t k = 0; k < plainObject.states.size(); ++k) {
+        auto& plainState = plainObject.states[k];
+        auto& optimizedState = optimizedObject.states[k];
+        for (size_t m = 0; m < plainState.functions.size(); ++m) {
+          f(name, plainState.name + '.' + plainState.functions[m].name,
+            plainState.functions[m].function,
+            optimizedState.functions[m].function);
+        }
+      }
+
+      for (size_t k = 0; k < plainObject.properties.size(); ++k) {
+        auto& plainProperty = plainObject.properties[k];
+        auto& optimizedProperty = optimizedObject.properties[k];
+        f(name, plainProperty.name + ".get", plainProperty.readHandler,
+          optimizedProperty.readHandler);
+        f(name, plainProperty.name + ".set", plainProperty.writeHandler,
+          optimizedProperty.writeHandler);
+      }
+    }
+  }
+}
+}
+
+int main(int argc, char** argv)
+{
+  if (argc != 2) {
+    std::cerr << "Usage: pex_optimizer_check <pex directory>" << std::endl;
+    return 1;
+  }
+
+  try {
+    std::vector<std::string> pexPaths;
+    for (auto& entry : std::filesystem::directory_iterator(argv[1])) {
+      if (entry.is_regular_file() && entry.path().extension() == ".pex")
+        pexPaths.push_back(entry.path().string());
+    }
+    std::sort(pexPaths.begin(), pexPaths.end());
+
+    Side plain(pexPaths, false);
+    Side optimized(pexPaths, true);
+
+    size_t numInstructions = 0, numOptimizedInstructions = 0;
+    size_t numRuns = 0, numMismatches = 0;
+
+    ForEachFunction(
+      plain, optimized,
+      [&](const std::string& scriptName, const std::string& functionName,
+          FunctionInfo& plainFunction, FunctionInfo& optimizedFunction) {
+        if (plainFunction.IsNative() || !plainFunction.linkedCode)
+          return;
+
+        numInstructions += plainFunction.linkedCode->instructions.size();
+        numOptimizedInstructions +=
+          optimizedFunction.linkedCode->instructions.size();
+
+        for (int set = 0; set < kNumArgumentSets; ++set) {
+          auto expected = plain.Run(scriptName, plainFunction, set);
+          auto actual = optimized.Run(scriptName, optimizedFunction, set);
+          ++numRuns;
+
+          if (!(expected == actual)) {
+            ++numMismatches;
+            std::cerr << "Mismatch in " << scriptName << '.' << functionName
+                      << " with arguments #" << set << '\n';
+            Print("plain", expected);
+            Print("optimized", actual);
+          }
+        }
+      });
+
+    std::cout << pexPaths.size() << " scripts, " << numRuns << " runs, "
+              << numMismatches << " mismatches. Instructions: "
+              << numInstructions << " -> " << numOptimizedInstructions
+              << std::endl;
+    return numMismatches ? 2 : 0;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+}
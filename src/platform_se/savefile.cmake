@@ -0,0 +1,23 @@
+# The savefile library and its tools. Portable, included by CMakeLists.txt
+# and by savefile_standalone/CMakeLists.txt, which builds them without the game
+set(savefile_dir "${CMAKE_CURRENT_LIST_DIR}")
+
+find_package(ZLIB REQUIRED)
+find_package(Threads REQUIRED)
+
+file(GLOB savefile_lib_src "${savefile_dir}/skyrim_platform/savefile/*")
+list(REMOVE_ITEM savefile_lib_src "${savefile_dir}/skyrim_platform/savefile/template.ess")
+add_library(savefile_lib STATIC ${savefile_lib_src})
+target_include_directories(savefile_lib PUBLIC "${savefile_dir}/skyrim_platform/savefile")
+target_link_libraries(savefile_lib PUBLIC ZLIB::ZLIB Threads::Threads)
+apply_default_settings(TARGETS savefile_lib)
+
+# The game build only needs savefile_lib, savefile_standalone turns this on
+option(SAVEFILE_TOOLS "Build the savefile bench" OFF)
+if (NOT SAVEFILE_TOOLS)
+  return()
+endif()
+
+add_executable(savefile_bench "${savefile_dir}/savefile_bench/main.cpp")
+target_link_libraries(savefile_bench PRIVATE savefile_lib)
+apply_default_settings(TARGETS savefile_bench)
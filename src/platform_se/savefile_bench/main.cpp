@@ -0,0 +1,636 @@
+#include "SFCompression.h"
+#include "SFReader.h"
+#include "SFSaveTemplate.h"
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+
+#ifdef _WIN32
+#  include <windows.h>
+// windows.h must come first
+#  include <psapi.h>
+#else
+#  include <sys/resource.h>
+#endif
+
+// Usage: savefile_bench --generate <output .ess> [change forms]
+//        savefile_bench [--from-memory] [--lazy] <.ess file> [iterations]
+//        savefile_bench --template <.ess file> [iterations]
+//        savefile_bench --compression [--level <0-9>] [--threads <n>]
+//                       <.ess file> [iterations]
+//
+// The first form writes a synthetic save for machines without a late-game
+// one. It has the global data LoadGame edits, quest, crime and detection
+// tables, a few MB of Papyrus data and change forms of varying size, about a
+// third of them compressed.
+//
+// The second form parses the file with Reader(path), or with
+// Reader(data, size) after reading it into memory, then gets the records
+// LoadGame::Run edits. It prints the time per parse and the peak memory of
+// the process.
+//
+// The third form reads the file as a SaveTemplate and builds saves with the
+// changes LoadGame::Run makes from it.
+//
+// The fourth form decompresses the compressed change forms of the file and
+// compresses them again with CompressionPipeline, Z_BEST_COMPRESSION and a
+// thread per core by default.
+
+namespace {
+class Emitter
+{
+public:
+  template <class T>
+  void Write(T value)
+  {
+    uint8_t bytes[sizeof(T)];
+    std::memcpy(bytes, &value, sizeof(T));
+    data.insert(data.end(), bytes, bytes + sizeof(T));
+  }
+
+  void WriteBytes(const std::vector<uint8_t>& bytes)
+  {
+    data.insert(data.end(), bytes.begin(), bytes.end());
+  }
+
+  void WriteString(const std::string& s)
+  {
+    Write(uint16_t(s.size()));
+    data.insert(data.end(), s.begin(), s.end());
+  }
+
+  void WriteRefID(uint32_t formID)
+  {
+    Write(uint8_t(formID >> 16));
+    Write(uint8_t(formID >> 8));
+    Write(uint8_t(formID));
+  }
+
+  void WriteVsval(uint32_t value)
+  {
+    if (value <= 0x3f)
+      Write(uint8_t(value << 2));
+    else if (value <= 0x3fff)
+      Write(uint16_t((value << 2) | 1));
+    else
+      Write((value << 2) | 2);
+  }
+
+  void WriteGlobalData(uint32_t type, const Emitter& contents)
+  {
+    Write(type);
+    Write(uint32_t(contents.data.size()));
+    WriteBytes(contents.data);
+  }
+
+  void Patch(size_t offset, uint32_t value)
+  {
+    std::memcpy(data.data() + offset, &value, sizeof(value));
+  }
+
+  std::vector<uint8_t> data;
+};
+
+// Compresses well, like real change forms
+std::vector<uint8_t> MakeChangeFormData(std::mt19937& random, size_t size)
+{
+  std::vector<uint8_t> data(size);
+  for (auto& byte : data)
+    byte = random() % 4 ? 0 : uint8_t(random());
+  return data;
+}
+
+std::vector<uint8_t> Compress(const std::vector<uint8_t>& data)
+{
+  uLongf size = compressBound(uLong(data.size()));
+  std::vector<uint8_t> compressed(size);
+  if (compress(compressed.data(), &size, data.data(), uLong(data.size())) !=
+      Z_OK)
+    throw std::runtime_error("compress failed");
+  compressed.resize(size);
+  return compressed;
+}
+
+void WriteChangeForm(Emitter& e, uint32_t formID, uint8_t type,
+                     const std::vector<uint8_t>& data, bool compressed)
+{
+  auto stored = compressed ? Compress(data) : data;
+  uint32_t length2 = compressed ? uint32_t(data.size()) : 0;
+
+  // The upper 2 bits of the type are the size of the lengths
+  size_t maxLength = std::max(stored.size(), size_t(length2));
+  uint8_t sizeBits = maxLength > 0xffff ? 0x80 : maxLength > 0xff ? 0x40 : 0;
+
+  e.WriteRefID(formID);
+  e.Write(uint32_t(1)); // changeFlags
+  e.Write(uint8_t(type | sizeBits));
+  e.Write(uint8_t(74)); // version
+  if (sizeBits == 0x80) {
+    e.Write(uint32_t(stored.size()));
+    e.Write(length2);
+  } else if (sizeBits == 0x40) {
+    e.Write(uint16_t(stored.size()));
+    e.Write(uint16_t(length2));
+  } else {
+    e.Write(uint8_t(stored.size()));
+    e.Write(uint8_t(length2));
+  }
+  e.WriteBytes(stored);
+}
+
+std::vector<uint8_t> GenerateSave(size_t numChangeForms)
+{
+  std::mt19937 random(1);
+  Emitter e;
+
+  e.data.assign({ 'T', 'E', 'S', 'V', '_', 'S', 'A', 'V', 'E', 'G', 'A', 'M',
+                  'E' });
+  Emitter header;
+  header.Write(uint32_t(9)); // version
+  header.Write(uint32_t(1)); // saveNumber
+  header.WriteString("Prisoner");
+  header.Write(uint32_t(81)); // playerLevel
+  header.WriteString("Whiterun");
+  header.WriteString("Day 812, 17:02");
+  header.WriteString("NordRace");
+  header.Write(uint16_t(0));
+  header.Write(0.f);
+  header.Write(1000.f);
+  header.Write(uint64_t(0)); // filetime
+  header.Write(uint32_t(320));
+  header.Write(uint32_t(192));
+  e.Write(uint32_t(header.data.size()));
+  e.WriteBytes(header.data);
+  e.WriteBytes(MakeChangeFormData(random, 320 * 192 * 3));
+
+  e.Write(uint8_t(74)); // formVersion
+  std::vector<std::string> plugins = { "Skyrim.esm", "Update.esm",
+                                       "Dawnguard.esm", "HearthFires.esm",
+                                       "Dragonborn.esm" };
+  Emitter pluginInfo;
+  pluginInfo.Write(uint8_t(plugins.size()));
+  for (auto& plugin : plugins)
+    pluginInfo.WriteString(plugin);
+  e.Write(uint32_t(pluginInfo.data.size()));
+  e.WriteBytes(pluginInfo.data);
+
+  // File location table, patched below
+  size_t fileLocationTable = e.data.size();
+  for (int i = 0; i < 25; ++i)
+    e.Write(uint32_t(0));
+
+  // Global data table 1: types 0 to 8, at their indices
+  e.Patch(fileLocationTable + 8, uint32_t(e.data.size()));
+  {
+    Emitter miscStats;
+    miscStats.Write(uint32_t(200));
+    for (int i = 0; i < 200; ++i) {
+      miscStats.WriteString("Stat " + std::to_string(i));
+      miscStats.Write(uint8_t(i % 7));
+      miscStats.Write(int32_t(i));
+    }
+    e.WriteGlobalData(0, miscStats);
+
+    Emitter playerLocation;
+    playerLocation.Write(uint32_t(0xff000800));
+    playerLocation.WriteRefID(0x40003c);
+    playerLocation.Write(int32_t(4));
+    playerLocation.Write(int32_t(-3));
+    playerLocation.WriteRefID(0x40003c);
+    playerLocation.Write(19000.f);
+    playerLocation.Write(-11000.f);
+    playerLocation.Write(-4400.f);
+    playerLocation.Write(uint8_t(0));
+    e.WriteGlobalData(1, playerLocation);
+
+    Emitter tes;
+    tes.Write(uint8_t(0));
+    tes.Write(uint32_t(0));
+    tes.Write(uint8_t(0));
+    e.WriteGlobalData(2, tes);
+
+    // GameHour (0x38) among other globals
+    Emitter globalVariables;
+    globalVariables.WriteVsval(300);
+    for (uint32_t i = 0; i < 300; ++i) {
+      globalVariables.WriteRefID(0x400000 + (i == 0 ? 0x38 : 0x1000 + i));
+      globalVariables.Write(float(i));
+    }
+    e.WriteGlobalData(3, globalVariables);
+
+    Emitter createdObjects;
+    for (int i = 0; i < 4; ++i)
+      createdObjects.Write(uint8_t(0));
+    e.WriteGlobalData(4, createdObjects);
+
+    Emitter effects;
+    effects.Write(uint8_t(0));
+    effects.Write(0.f);
+    effects.Write(0.f);
+    e.WriteGlobalData(5, effects);
+
+    Emitter weather;
+    for (int i = 0; i < 6; ++i)
+      weather.WriteRefID(0x400000 + 0x81a + i);
+    for (int i = 0; i < 3; ++i)
+      weather.Write(0.5f);
+    for (int i = 0; i < 6; ++i)
+      weather.Write(uint32_t(0));
+    weather.Write(0.f);
+    weather.Write(uint32_t(0));
+    weather.Write(uint8_t(0));
+    e.WriteGlobalData(6, weather);
+
+    Emitter audio;
+    audio.WriteRefID(0);
+    audio.Write(uint8_t(0));
+    audio.WriteRefID(0);
+    e.WriteGlobalData(7, audio);
+
+    Emitter skyCells;
+    skyCells.Write(uint8_t(0));
+    e.WriteGlobalData(8, skyCells);
+  }
+  e.Patch(fileLocationTable + 24, 9);
+
+  // Global data table 2. Quests, crimes and detection data make up most of
+  // it in a late-game save
+  e.Patch(fileLocationTable + 12, uint32_t(e.data.size()));
+  {
+    Emitter processList;
+    for (int i = 0; i < 3; ++i)
+      processList.Write(0.f);
+    processList.Write(uint32_t(500));
+    for (int crimeType = 0; crimeType < 7; ++crimeType) {
+      processList.WriteVsval(50);
+      for (int i = 0; i < 50; ++i) {
+        processList.Write(uint32_t(i));
+        processList.Write(uint32_t(crimeType));
+        processList.Write(uint8_t(0));
+        processList.Write(uint32_t(1));
+        processList.Write(uint32_t(i));
+        processList.Write(uint8_t(0));
+        processList.Write(uint32_t(0));
+        processList.Write(100.f);
+        for (int j = 0; j < 4; ++j)
+          processList.WriteRefID(0x400000 + 0x2000 + i);
+        processList.WriteVsval(3);
+        for (int j = 0; j < 3; ++j)
+          processList.WriteRefID(0x400000 + 0x3000 + j);
+        processList.Write(uint32_t(40));
+        processList.WriteRefID(0x400000 + 0x267ea);
+        processList.Write(uint8_t(0));
+        processList.Write(uint16_t(0));
+      }
+    }
+    e.WriteGlobalData(100, processList);
+
+    Emitter actorCauses;
+    actorCauses.Write(uint32_t(2000));
+    actorCauses.WriteVsval(2000);
+    for (uint32_t i = 0; i < 2000; ++i) {
+      for (int j = 0; j < 3; ++j)
+        actorCauses.Write(float(i));
+      actorCauses.Write(i);
+      actorCauses.WriteRefID(0x400000 + 0x4000 + i);
+    }
+    e.WriteGlobalData(103, actorCauses);
+
+    Emitter unknown104;
+    unknown104.WriteBytes(MakeChangeFormData(random, 4096));
+    e.WriteGlobalData(104, unknown104);
+
+    Emitter detectionManager;
+    detectionManager.WriteVsval(1000);
+    for (uint32_t i = 0; i < 1000; ++i) {
+      detectionManager.WriteRefID(0x400000 + 0x5000 + i);
+      detectionManager.Write(i);
+      detectionManager.Write(i);
+    }
+    e.WriteGlobalData(105, detectionManager);
+
+    Emitter locationMetaData;
+    locationMetaData.WriteVsval(3000);
+    for (uint32_t i = 0; i < 3000; ++i) {
+      locationMetaData.WriteRefID(0x400000 + 0x6000 + i);
+      locationMetaData.Write(int32_t(i));
+    }
+    e.WriteGlobalData(106, locationMetaData);
+
+    Emitter questStaticData;
+    for (int table = 0; table < 2; ++table) {
+      questStaticData.Write(uint32_t(1500));
+      for (uint32_t i = 0; i < 1500; ++i) {
+        questStaticData.Write(i);
+        questStaticData.Write(0.f);
+        questStaticData.Write(uint32_t(8));
+        for (uint32_t j = 0; j < 8; ++j) {
+          uint32_t type = 1 + j % 4;
+          questStaticData.Write(type);
+          if (type == 3)
+            questStaticData.Write(j);
+          else
+            questStaticData.WriteRefID(0x400000 + 0x7000 + j);
+        }
+      }
+    }
+    for (int table = 0; table < 3; ++table) {
+      questStaticData.Write(uint32_t(1000));
+      for (uint32_t i = 0; i < 1000; ++i)
+        questStaticData.WriteRefID(0x400000 + 0x8000 + i);
+    }
+    questStaticData.WriteVsval(1000);
+    for (uint32_t i = 0; i < 1000; ++i) {
+      questStaticData.WriteRefID(0x400000 + 0x9000 + i);
+      questStaticData.WriteVsval(4);
+      for (uint32_t j = 0; j < 4; ++j) {
+        questStaticData.Write(j);
+        questStaticData.Write(i);
+      }
+    }
+    questStaticData.Write(uint8_t(0));
+    e.WriteGlobalData(107, questStaticData);
+
+    Emitter unknown111;
+    unknown111.WriteBytes(MakeChangeFormData(random, 4096));
+    e.WriteGlobalData(111, unknown111);
+  }
+  e.Patch(fileLocationTable + 28, 7);
+
+  e.Patch(fileLocationTable + 16, uint32_t(e.data.size()));
+  WriteChangeForm(e, 0x400014, 1, MakeChangeFormData(random, 600), true);
+  WriteChangeForm(e, 0x400007, 9, MakeChangeFormData(random, 900), false);
+  for (size_t i = 2; i < numChangeForms; ++i) {
+    uint32_t formID = 0x400000 + 0x10000 + uint32_t(i);
+    size_t size = random() % 8 ? 8 + random() % 120 : 200 + random() % 4000;
+    WriteChangeForm(e, formID, uint8_t(random() % 60),
+                    MakeChangeFormData(random, size), random() % 3 == 0);
+  }
+  e.Patch(fileLocationTable + 36, uint32_t(numChangeForms));
+
+  // Global data table 3, with Papyrus data taking most of the space
+  e.Patch(fileLocationTable + 20, uint32_t(e.data.size()));
+  for (uint32_t type : { 1000, 1001, 1002, 1003, 1004, 1005 }) {
+    Emitter contents;
+    if (type == 1001)
+      contents.WriteBytes(MakeChangeFormData(random, 8 * 1024 * 1024));
+    else if (type == 1002)
+      contents.Write(uint32_t(0));
+    else if (type == 1003)
+      contents.Write(uint64_t(0));
+    else if (type != 1005)
+      contents.WriteBytes(MakeChangeFormData(random, 1024));
+    e.WriteGlobalData(type, contents);
+  }
+  e.Patch(fileLocationTable + 32, 6);
+  e.Write(uint64_t(0)); // SaveFile::fixForBag
+
+  e.Patch(fileLocationTable + 0, uint32_t(e.data.size()));
+  e.Write(uint32_t(3000));
+  for (uint32_t i = 0; i < 3000; ++i)
+    e.Write(0x01000000 + i);
+  e.Write(uint32_t(20));
+  for (uint32_t i = 0; i < 20; ++i)
+    e.Write(0x3c + i);
+
+  e.Patch(fileLocationTable + 4, uint32_t(e.data.size()));
+  Emitter unknown3Table;
+  unknown3Table.Write(uint32_t(100));
+  for (int i = 0; i < 100; ++i)
+    unknown3Table.WriteString("Unknown " + std::to_string(i));
+  e.Write(uint32_t(unknown3Table.data.size()));
+  e.WriteBytes(unknown3Table.data);
+
+  return e.data;
+}
+
+bool GetLoadGameRecords(SaveFile_::SaveFile& save)
+{
+  using namespace SaveFile_;
+  RefID gameHour(0x38);
+  RefID player(RefID::Player), playerBase(RefID::PlayerBase);
+  auto& table = save.globalDataTable1;
+  return table.size() > SaveFile::WEATHER_INDEX &&
+    table[PlayerLocation::GlobalDataType].Get<PlayerLocation>() &&
+    table[SaveFile::WEATHER_INDEX].Get<Weather>() &&
+    save.GetGlobalvariableByRefID(gameHour) &&
+    save.GetChangeFormByRefID(player, uint8_t(ChangeForm::Type::ACHR)) &&
+    save.GetChangeFormByRefID(playerBase, uint8_t(ChangeForm::Type::NPC));
+}
+
+// The changes LoadGame::Run makes, without recompressing the player
+SaveFile_::SaveTemplate::Output BuildLoadGameSave(
+  const SaveFile_::SaveTemplate& saveTemplate)
+{
+  using namespace SaveFile_;
+  auto& save = saveTemplate.GetSave();
+  SaveTemplate::Changes changes;
+
+  changes.plugins = { "Skyrim.esm", "Update.esm", "Dawnguard.esm",
+                      "HearthFires.esm", "Dragonborn.esm", "MyMod.esp" };
+
+  auto& table = save.globalDataTable1;
+  auto& weather = changes.weather.emplace(*static_cast<const Weather*>(
+    table[SaveFile::WEATHER_INDEX].data.get()));
+  weather.weatherPct = 0.5f;
+
+  changes.globalVariables.push_back({ RefID(0x38), 13.5f });
+
+  auto world = saveTemplate.GetNewFormRefID(0);
+  changes.newFormIDs.push_back(0x3c);
+  auto& location = changes.playerLocation.emplace(
+    *static_cast<const PlayerLocation*>(
+      table[PlayerLocation::GlobalDataType].data.get()));
+  location.worldspace1 = location.worldspace2 = world;
+
+  for (auto [refID, type] :
+       { std::pair(RefID(RefID::Player), ChangeForm::Type::ACHR),
+         std::pair(RefID(RefID::PlayerBase), ChangeForm::Type::NPC) }) {
+    auto form = save.GetChangeFormByRefID(refID, uint8_t(type));
+    if (!form)
+      throw std::runtime_error("The save lacks records LoadGame edits");
+    changes.changeForms.push_back({ form - save.changeForms.data(), *form });
+  }
+
+  return saveTemplate.Build(changes);
+}
+
+size_t GetPeakMemory()
+{
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+#  ifdef __APPLE__
+  return size_t(usage.ru_maxrss);
+#  else
+  return size_t(usage.ru_maxrss) * 1024;
+#  endif
+#endif
+}
+
+std::vector<uint8_t> ReadFile(const std::string& path)
+{
+  std::ifstream file(path, std::ios::binary | std::ios::ate);
+  if (!file)
+    throw std::runtime_error("Error open file: " + path);
+  std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+  file.seekg(0);
+  file.read(reinterpret_cast<char*>(data.data()), data.size());
+  return data;
+}
+
+void BenchCompression(const std::string& path, int iterations, int level,
+                      size_t numThreads)
+{
+  auto data = ReadFile(path);
+  auto save = SaveFile_::Reader(data.data(), data.size()).GetStructure();
+
+  size_t numCompressed = 0, compressedSize = 0, uncompressedSize = 0;
+  for (auto& form : save->changeForms) {
+    if (form.length2 != 0) {
+      ++numCompressed;
+      uncompressedSize += form.length2;
+    }
+  }
+
+  SaveFile_::CompressionPipeline pipeline(level, numThreads);
+  std::chrono::duration<double, std::milli> decompression{}, compression{};
+  for (int i = 0; i < iterations; ++i) {
+    auto forms = save->changeForms;
+
+    auto start = std::chrono::steady_clock::now();
+    auto contents = pipeline.Decompress(forms);
+    auto decompressed = std::chrono::steady_clock::now();
+    pipeline.Compress(forms, std::move(contents));
+    auto compressed = std::chrono::steady_clock::now();
+
+    decompression += decompressed - start;
+    compression += compressed - decompressed;
+    compressedSize = 0;
+    for (auto& form : forms) {
+      if (form.length2 != 0)
+        compressedSize += form.data.size();
+    }
+  }
+
+  std::cout << numCompressed << " of " << save->changeForms.size()
+            << " change forms compressed, " << pipeline.GetNumThreads()
+            << " threads, level " << level << ": "
+            << decompression.count() / iterations
+            << " ms per decompression, " << compression.count() / iterations
+            << " ms per compression to " << compressedSize << " of "
+            << uncompressedSize << " bytes" << std::endl;
+}
+}
+
+int main(int argc, char** argv)
+{
+  try {
+    std::vector<std::string> args(argv + 1, argv + argc);
+
+    if (!args.empty() && args[0] == "--generate" && args.size() >= 2) {
+      size_t numChangeForms = args.size() >= 3 ? std::stoul(args[2]) : 40000;
+      auto data = GenerateSave(numChangeForms);
+      std::ofstream(args[1], std::ios::binary)
+        .write(reinterpret_cast<const char*>(data.data()), data.size());
+      std::cout << "Wrote " << data.size() << " bytes" << std::endl;
+      return 0;
+    }
+
+    if (!args.empty() && args[0] == "--template" && args.size() >= 2) {
+      int iterations = args.size() >= 3 ? std::stoi(args[2]) : 1000;
+      auto data = ReadFile(args[1]);
+
+      auto start = std::chrono::steady_clock::now();
+      SaveFile_::SaveTemplate saveTemplate(data.data(), data.size());
+      std::chrono::duration<double, std::milli> prepared =
+        std::chrono::steady_clock::now() - start;
+
+      start = std::chrono::steady_clock::now();
+      size_t size = 0;
+      for (int i = 0; i < iterations; ++i)
+        size = BuildLoadGameSave(saveTemplate).size();
+      std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - start;
+
+      std::cout << "Template read in " << prepared.count() << " ms, "
+                << elapsed.count() / iterations << " ms per build of "
+                << size << " bytes" << std::endl;
+      return 0;
+    }
+
+    if (!args.empty() && args[0] == "--compression") {
+      args.erase(args.begin());
+      int level = Z_BEST_COMPRESSION;
+      size_t numThreads = 0;
+      while (args.size() >= 2 &&
+             (args[0] == "--level" || args[0] == "--threads")) {
+        if (args[0] == "--level")
+          level = std::stoi(args[1]);
+        else
+          numThreads = std::stoul(args[1]);
+        args.erase(args.begin(), args.begin() + 2);
+      }
+      if (!args.empty()) {
+        int iterations = args.size() >= 2 ? std::stoi(args[1]) : 3;
+        BenchCompression(args[0], iterations, level, numThreads);
+        return 0;
+      }
+    }
+
+    bool fromMemory = false, lazy = false;
+    while (!args.empty() &&
+           (args[0] == "--from-memory" || args[0] == "--lazy")) {
+      (args[0] == "--lazy" ? lazy : fromMemory) = true;
+      args.erase(args.begin());
+    }
+    if (args.empty()) {
+      std::cerr << "Usage: savefile_bench --generate <output .ess> "
+                   "[change forms]\n"
+                   "       savefile_bench [--from-memory] [--lazy] "
+                   "<.ess file> [iterations]\n"
+                   "       savefile_bench --template <.ess file> "
+                   "[iterations]\n"
+                   "       savefile_bench --compression [--level <0-9>] "
+                   "[--threads <n>] <.ess file> [iterations]"
+                << std::endl;
+      return 1;
+    }
+    int iterations = args.size() >= 2 ? std::stoi(args[1]) : 10;
+
+    std::vector<uint8_t> data;
+    if (fromMemory)
+      data = ReadFile(args[0]);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t numChangeForms = 0;
+    for (int i = 0; i < iterations; ++i) {
+      auto structure = fromMemory
+        ? SaveFile_::Reader(data.data(), data.size(), lazy).GetStructure()
+        : SaveFile_::Reader(args[0], lazy).GetStructure();
+      numChangeForms = structure->changeForms.size();
+      if (!GetLoadGameRecords(*structure))
+        throw std::runtime_error("The save lacks records LoadGame edits");
+    }
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+    std::cout << numChangeForms << " change forms, "
+              << elapsed.count() / iterations << " ms per parse, peak memory "
+              << GetPeakMemory() / (1024 * 1024) << " MB" << std::endl;
+  } catch (std::exception& e) {
+    std::cerr << e.what() << std::endl;
+    return 1;
+  }
+  return 0;
+}
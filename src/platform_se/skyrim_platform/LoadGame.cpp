@@ -3,9 +3,7 @@
 #include "PapyrusTESModPlatform.h"
 #include "cmrc/cmrc.hpp"
 #include "savefile/SFChangeFormNPC.h"
-#include "savefile/SFReader.h"
 #include "savefile/SFSeekerOfDifferences.h"
-#include "savefile/SFWriter.h"
 #include <GameData.h>
 #include <RE/ScriptEventSourceHolder.h>
 #include <RE/TESLoadGameEvent.h>
@@ -74,43 +72,49 @@ public:
 
 extern bool g_allowHideMainMenu;
 
-std::shared_ptr<SaveFile_::SaveFile> LoadGame::PrepareSaveFile()
+const SaveFile_::SaveTemplate& LoadGame::GetTemplate()
 {
-  cmrc::file file;
-  try {
-    file = cmrc::skyrim_plugin_resources::get_filesystem().open(
-      "savefile/template.ess");
-  } catch (std::exception& e) {
-    auto dir =
-      cmrc::skyrim_plugin_resources::get_filesystem().iterate_directory("");
-    std::stringstream ss;
-    ss << e.what() << std::endl << std::endl;
-    ss << "Root directory contents is: " << std::endl;
-    for (auto& entry : dir)
-      ss << entry.filename() << std::endl;
-    throw std::runtime_error(ss.str());
-  }
-  return SaveFile_::Reader((uint8_t*)(file.begin()), file.size())
-    .GetStructure();
+  static const SaveFile_::SaveTemplate g_template = [] {
+    cmrc::file file;
+    try {
+      file = cmrc::skyrim_plugin_resources::get_filesystem().open(
+        "savefile/template.ess");
+    } catch (std::exception& e) {
+      auto dir =
+        cmrc::skyrim_plugin_resources::get_filesystem().iterate_directory("");
+      std::stringstream ss;
+      ss << e.what() << std::endl << std::endl;
+      ss << "Root directory contents is: " << std::endl;
+      for (auto& entry : dir)
+        ss << entry.filename() << std::endl;
+      throw std::runtime_error(ss.str());
+    }
+    // Embedded resources live as long as the process
+    return SaveFile_::SaveTemplate((const uint8_t*)(file.begin()),
+                                   file.size());
+  }();
+  return g_template;
 }
 
-void LoadGame::Run(std::shared_ptr<SaveFile_::SaveFile> save,
-                   const std::array<float, 3>& pos,
+void LoadGame::Run(const std::array<float, 3>& pos,
                    const std::array<float, 3>& angle, uint32_t cellOrWorld,
                    Time* time, SaveFile_::Weather* _weather,
                    SaveFile_::ChangeFormNPC_* changeFormNPC)
 {
-  if (!save)
-    throw std::runtime_error("Bad SaveFile");
+  auto& saveTemplate = GetTemplate();
+  Changes changes;
 
-  ModifySaveTime(save, time);
-  ModifySaveWeather(save, _weather);
-  ModifyPluginInfo(save);
-  ModifyPlayerFormNPC(save, changeFormNPC);
-  ModifyEssStructure(save, pos, angle, cellOrWorld);
+  ModifySaveTime(saveTemplate, changes, time);
+  ModifySaveWeather(saveTemplate, changes, _weather);
+  ModifyPluginInfo(changes);
+  ModifyPlayerFormNPC(saveTemplate, changes, changeFormNPC);
+  ModifyEssStructure(saveTemplate, changes, pos, angle, cellOrWorld);
 
   auto name = g_saveFilePrefix + GenerateGuid();
-  if (!SaveFile_::Writer(save).CreateSaveFile(GetSaveFullPath(name)))
+  std::ofstream file(GetSaveFullPath(name), std::ios::binary);
+  saveTemplate.Build(changes).Write(file);
+  file.close();
+  if (!file)
     throw std::runtime_error("CreateSaveFile failed");
 
   TESModPlatform::BlockMoveRefrToPosition(true);
@@ -140,7 +144,7 @@ std::wstring LoadGame::GetPathToMyDocuments()
   return myPath;
 }
 
-void LoadGame::ModifyPluginInfo(std::shared_ptr<SaveFile_::SaveFile>& save)
+void LoadGame::ModifyPluginInfo(Changes& changes)
 {
   std::vector<std::string> newPlugins;
   auto dataHandler = DataHandler::GetSingleton();
@@ -152,11 +156,11 @@ void LoadGame::ModifyPluginInfo(std::shared_ptr<SaveFile_::SaveFile>& save)
     newPlugins.push_back(
       std::string(dataHandler->modList.loadedMods[i]->name));
 
-  save->OverwritePluginInfo(newPlugins);
+  changes.plugins = std::move(newPlugins);
 }
 
-void LoadGame::ModifySaveTime(std::shared_ptr<SaveFile_::SaveFile>& save,
-                              LoadGame::Time* time)
+void LoadGame::ModifySaveTime(const SaveFile_::SaveTemplate& saveTemplate,
+                              Changes& changes, LoadGame::Time* time)
 {
   if (!time)
     return;
@@ -166,98 +170,81 @@ void LoadGame::ModifySaveTime(std::shared_ptr<SaveFile_::SaveFile>& save,
 
   SaveFile_::RefID gameHourID = 0x38;
 
-  auto index = save->FindIndexInFormIdArray(0x38);
+  auto index = saveTemplate.GetSave().FindIndexInFormIdArray(0x38);
 
   if (index >= 0) {
     gameHourID = SaveFile_::RefID((uint32_t)index);
   }
 
-  auto var = save->GetGlobalvariableByRefID(gameHourID);
-
-  if (!var)
-    throw std::runtime_error("Global Varible not found");
-
-  var->value =
+  float value =
     time->GetHours() + time->GetMinutes() / 60.0 + time->GetSeconds() / 3600.0;
+  changes.globalVariables.push_back({ gameHourID, value });
 }
 
-void LoadGame::ModifySaveWeather(std::shared_ptr<SaveFile_::SaveFile>& save,
+void LoadGame::ModifySaveWeather(const SaveFile_::SaveTemplate& saveTemplate,
+                                 Changes& changes,
                                  SaveFile_::Weather* _weather)
 {
   if (!_weather)
     return;
 
-  SaveFile_::GlobalData& gData =
-    save->globalDataTable1[SaveFile_::SaveFile::WEATHER_INDEX];
+  auto& table1 = saveTemplate.GetSave().globalDataTable1;
+  const SaveFile_::GlobalData& gData =
+    table1[SaveFile_::SaveFile::WEATHER_INDEX];
 
   if (gData.type != SaveFile_::SaveFile::WEATHER_INDEX)
     throw std::runtime_error("Wrong weather index");
 
-  SaveFile_::Weather* weather =
-    reinterpret_cast<SaveFile_::Weather*>(gData.data.get());
+  auto templateWeather =
+    static_cast<const SaveFile_::Weather*>(gData.data.get());
 
-  if (!weather)
+  if (!templateWeather)
     throw std::runtime_error("weather == nullptr");
 
-  weather->climate = _weather->climate;
-  weather->weather = _weather->weather;
-  weather->regnWeather = _weather->regnWeather;
-  weather->weatherPct = _weather->weatherPct;
+  auto& weather = changes.weather.emplace(*templateWeather);
+  weather.climate = _weather->climate;
+  weather.weather = _weather->weather;
+  weather.regnWeather = _weather->regnWeather;
+  weather.weatherPct = _weather->weatherPct;
 }
 
-void LoadGame::ModifyPlayerFormNPC(std::shared_ptr<SaveFile_::SaveFile> save,
+void LoadGame::ModifyPlayerFormNPC(const SaveFile_::SaveTemplate& saveTemplate,
+                                   Changes& changes,
                                    SaveFile_::ChangeFormNPC_* changeFormNPC)
 {
   using namespace SaveFile_;
   if (!changeFormNPC)
     return;
 
-  auto form = save->GetChangeFormByRefID(RefID(RefID::PlayerBase),
-                                         uint8_t(ChangeForm::Type::NPC));
+  auto& save = saveTemplate.GetSave();
+  auto form = save.GetChangeFormByRefID(RefID(RefID::PlayerBase),
+                                        uint8_t(ChangeForm::Type::NPC));
 
   if (form) {
-    auto newForm = changeFormNPC->ToBinary();
-    FillChangeForm(save, form, newForm);
-    return;
+    auto [changeFlags, data] = changeFormNPC->ToBinary();
+    ChangeForm newForm = *form;
+    newForm.length2 = 0;
+    newForm.length1 = data.size();
+    newForm.data = std::move(data);
+    newForm.changeFlags = changeFlags;
+    changes.changeForms.push_back({ form - save.changeForms.data(), newForm });
   }
 }
 
-void LoadGame::FillChangeForm(
-  std::shared_ptr<SaveFile_::SaveFile> save, SaveFile_::ChangeForm* form,
-  std::pair<uint32_t, std::vector<uint8_t>>& newValues)
-{
-
-  save->fileLocationTable.formIDArrayCountOffset -= form->length1;
-  save->fileLocationTable.formIDArrayCountOffset += newValues.second.size();
-
-  save->fileLocationTable.unknownTable3Offset -= form->length1;
-  save->fileLocationTable.unknownTable3Offset += newValues.second.size();
-
-  save->fileLocationTable.globalDataTable3Offset -= form->length1;
-  save->fileLocationTable.globalDataTable3Offset += newValues.second.size();
-
-  form->length2 = 0;
-  form->length1 = newValues.second.size();
-  form->data = newValues.second;
-  form->changeFlags = newValues.first;
-}
-
-void LoadGame::ModifyEssStructure(std::shared_ptr<SaveFile_::SaveFile> save,
-                                  std::array<float, 3> pos,
+void LoadGame::ModifyEssStructure(const SaveFile_::SaveTemplate& saveTemplate,
+                                  Changes& changes, std::array<float, 3> pos,
                                   std::array<float, 3> angle,
                                   uint32_t cellOrWorld)
 {
-  auto playerLoc = FindSectionWithPlayerLocation(save);
-  if (!playerLoc)
-    throw std::runtime_error("Couldn't find PlayerLocation in the save file");
-
-  auto worldRefId = SaveFile_::RefID::CreateRefId(*save, cellOrWorld);
-  *playerLoc = CreatePlayerLocation(pos, worldRefId);
+  auto worldRefId = saveTemplate.GetNewFormRefID(changes.newFormIDs.size());
+  changes.newFormIDs.push_back(cellOrWorld);
+  changes.playerLocation = CreatePlayerLocation(pos, worldRefId);
 
+  auto& forms = saveTemplate.GetSave().changeForms;
   auto player = std::find_if(
-    save->changeForms.begin(), save->changeForms.end(),
+    forms.begin(), forms.end(),
     [](auto& changeForm) { return changeForm.formID.IsPlayerID(); });
-  if (player == save->changeForms.end())
+  if (player == forms.end())
     throw std::runtime_error("Unable to find Player's change form");
   bool isCompressed = player->length2 > 0;
   if (!isCompressed)
@@ -266,20 +253,12 @@ void LoadGame::ModifyEssStructure(std::shared_ptr<SaveFile_::SaveFile> save,
   auto uncompressed = Decompress(*player);
   EditChangeForm(uncompressed, pos, angle, worldRefId);
   auto compressed = Compress(uncompressed);
-  WriteChangeForm(save, *player, compressed, uncompressed.size());
-}
 
-SaveFile_::PlayerLocation* LoadGame::FindSectionWithPlayerLocation(
-  std::shared_ptr<SaveFile_::SaveFile> save)
-{
-  auto& c = save->globalDataTable1;
-  auto it = std::find_if(
-    c.begin(), c.end(), [](const SaveFile_::GlobalData& globalData) {
-      return globalData.type == SaveFile_::PlayerLocation::GlobalDataType;
-    });
-  if (it == c.end())
-    return nullptr;
-  return static_cast<SaveFile_::PlayerLocation*>(it->data.get());
+  SaveFile_::ChangeForm newForm = *player;
+  newForm.length1 = compressed.size();
+  newForm.length2 = uncompressed.size();
+  newForm.data = std::move(compressed);
+  changes.changeForms.push_back({ player - forms.begin(), newForm });
 }
 
 SaveFile_::PlayerLocation LoadGame::CreatePlayerLocation(
@@ -337,25 +316,6 @@ std::vector<uint8_t> LoadGame::Compress(
   return newCompressed;
 }
 
-void LoadGame::WriteChangeForm(std::shared_ptr<SaveFile_::SaveFile> save,
-                               SaveFile_::ChangeForm& changeForm,
-                               const std::vector<uint8_t>& compressed,
-                               size_t uncompressedSize)
-{
-  auto previousSize = changeForm.length1;
-
-  changeForm.length1 = compressed.size();
-  changeForm.length2 = uncompressedSize;
-  changeForm.data.resize(changeForm.length1);
-  std::copy(compressed.begin(), compressed.end(), changeForm.data.begin());
-
-  // fix offsets
-  const auto diff = (int64_t)previousSize - (int64_t)compressed.size();
-  save->fileLocationTable.formIDArrayCountOffset -= diff;
-  save->fileLocationTable.unknownTable3Offset -= diff;
-  save->fileLocationTable.globalDataTable3Offset -= diff;
-}
-
 std::wstring LoadGame::StringToWstring(std::string s)
 {
   std::wstring ws(s.size(), L' ');
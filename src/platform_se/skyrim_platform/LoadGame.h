@@ -5,14 +5,10 @@
 #include <string>
 #include <vector>
 
+#include "savefile/SFSaveTemplate.h"
+
 namespace SaveFile_ {
-struct PlayerLocation;
-struct RefID;
-struct SaveFile;
-struct ChangeForm;
 struct ChangeFormNPC_;
-struct Weather;
-struct GlobalVariables;
 }
 
 class LoadGame
@@ -40,10 +36,10 @@ public:
     bool hasData = false;
   };
 
-  static std::shared_ptr<SaveFile_::SaveFile> PrepareSaveFile();
+  // The embedded template.ess, read on first use
+  static const SaveFile_::SaveTemplate& GetTemplate();
 
-  static void Run(std::shared_ptr<SaveFile_::SaveFile> baseSavefile,
-                  const std::array<float, 3>& pos,
+  static void Run(const std::array<float, 3>& pos,
                   const std::array<float, 3>& angle, uint32_t cellOrWorld,
                   Time* time = nullptr, SaveFile_::Weather* _weather = nullptr,
                   SaveFile_::ChangeFormNPC_* changeFormNPC = nullptr);
@@ -57,9 +53,6 @@ private:
 
   static std::filesystem::path GetSaveFullPath(const std::string& name);
 
-  static SaveFile_::PlayerLocation* FindSectionWithPlayerLocation(
-    std::shared_ptr<SaveFile_::SaveFile> save);
-
   static SaveFile_::PlayerLocation CreatePlayerLocation(
     const std::array<float, 3>& pos, const SaveFile_::RefID& world);
 
@@ -74,28 +67,23 @@ private:
   static std::vector<uint8_t> Compress(
     const std::vector<uint8_t>& uncompressed);
 
-  static void WriteChangeForm(std::shared_ptr<SaveFile_::SaveFile> save,
-                              SaveFile_::ChangeForm& changeForm,
-                              const std::vector<uint8_t>& compressed,
-                              size_t uncompressedSize);
+  using Changes = SaveFile_::SaveTemplate::Changes;
 
-  static void ModifyEssStructure(std::shared_ptr<SaveFile_::SaveFile> save,
-                                 std::array<float, 3> pos,
+  static void ModifyEssStructure(const SaveFile_::SaveTemplate& saveTemplate,
+                                 Changes& changes, std::array<float, 3> pos,
                                  std::array<float, 3> angle,
                                  uint32_t cellOrWorld);
 
-  static void ModifyPluginInfo(std::shared_ptr<SaveFile_::SaveFile>& save);
+  static void ModifyPluginInfo(Changes& changes);
 
-  static void ModifySaveTime(std::shared_ptr<SaveFile_::SaveFile>& save,
-                             Time* time);
+  static void ModifySaveTime(const SaveFile_::SaveTemplate& saveTemplate,
+                             Changes& changes, Time* time);
 
-  static void ModifySaveWeather(std::shared_ptr<SaveFile_::SaveFile>& save,
+  static void ModifySaveWeather(const SaveFile_::SaveTemplate& saveTemplate,
+                                Changes& changes,
                                 SaveFile_::Weather* _weather);
 
-  static void ModifyPlayerFormNPC(std::shared_ptr<SaveFile_::SaveFile> save,
+  static void ModifyPlayerFormNPC(const SaveFile_::SaveTemplate& saveTemplate,
+                                  Changes& changes,
                                   SaveFile_::ChangeFormNPC_* changeFormNPC);
-
-  static void FillChangeForm(
-    std::shared_ptr<SaveFile_::SaveFile> save, SaveFile_::ChangeForm* form,
-    std::pair<uint32_t, std::vector<uint8_t>>& newValues);
 };
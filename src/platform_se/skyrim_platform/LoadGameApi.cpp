@@ -48,7 +48,7 @@ SaveFile_::RefID FormIdToRefId(uint32_t formId)
 }
 
 std::unique_ptr<SaveFile_::ChangeFormNPC_> CreateChangeFormNpc(
-  std::shared_ptr<SaveFile_::SaveFile> save, JsValue npcData)
+  JsValue npcData)
 {
   if (npcData.GetType() != JsValue::Type::Object)
     return nullptr;
@@ -119,14 +119,10 @@ JsValue LoadGameApi::LoadGame(const JsFunctionArguments& args)
   uint32_t cellOrWorld = (uint32_t)(double)args[3];
   auto npcData = args[4];
 
-  auto save = LoadGame::PrepareSaveFile();
-  if (!save)
-    throw NullPointerException("save");
-
   std::unique_ptr<SaveFile_::ChangeFormNPC_> changeFormNpc =
-    CreateChangeFormNpc(save, npcData);
+    CreateChangeFormNpc(npcData);
 
-  LoadGame::Run(save, pos, angle, cellOrWorld, nullptr, nullptr,
+  LoadGame::Run(pos, angle, cellOrWorld, nullptr, nullptr,
                 changeFormNpc.get());
   return JsValue::Undefined();
 }
\ No newline at end of file
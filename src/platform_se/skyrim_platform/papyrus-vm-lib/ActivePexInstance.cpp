@@ -1,7 +1,9 @@
+#include "FunctionLinker.h"
 #include "OpcodesImplementation.h"
 #include "VirtualMachine.h"
 #include <algorithm>
 #include <cctype> // tolower
+#include <cstring>
 #include <functional>
 
 ActivePexInstance::ActivePexInstance()
@@ -10,187 +12,149 @@ ActivePexInstance::ActivePexInstance()
   this->sourcePex = nullptr;
 }
 
-ActivePexInstance::ActivePexInstance(std::shared_ptr<PexScript> sourcePex,
-                                     VarForBuildActivePex mapForFillPropertys,
-                                     VirtualMachine* parentVM,
-                                     VarValue activeInstanceOwner,
-                                     std::string childrenName)
+ActivePexInstance::ActivePexInstance(
+  std::shared_ptr<PexScript> sourcePex,
+  std::shared_ptr<const VarForBuildActivePex> propertyValues,
+  VirtualMachine* parentVM, VarValue activeInstanceOwner,
+  std::string childrenName)
 {
   this->childrenName = childrenName;
   this->activeInstanceOwner = activeInstanceOwner;
+  this->activeInstanceOwner.SetObjectTypeId(
+    sourcePex->instanceTemplate.selfObjectTypeId);
   this->parentVM = parentVM;
   this->sourcePex = sourcePex;
-  this->parentInstance =
-    FillParentInstanse(sourcePex->objectTable.m_data[0].parentClassName,
-                       activeInstanceOwner, mapForFillPropertys);
-
-  auto at = mapForFillPropertys.find(sourcePex->source);
-
-  std::vector<std::pair<std::string, VarValue>> argsForFillPropertys;
-
-  if (at != mapForFillPropertys.end()) {
-    argsForFillPropertys = at->second;
-  }
+  this->propertyValues = std::move(propertyValues);
 
-  variables = FillVariables(sourcePex, argsForFillPropertys);
+  variables = sourcePex->instanceTemplate.variables;
+  FillProperties();
 }
 
-std::shared_ptr<ActivePexInstance> ActivePexInstance::FillParentInstanse(
-  std::string nameNeedScript, VarValue activeInstanceOwner,
-  VarForBuildActivePex mapForFillPropertys)
+ActivePexInstance* ActivePexInstance::GetParentInstance()
 {
-  for (auto& baseScript : parentVM->allLoadedScripts) {
-    if (baseScript->source == nameNeedScript) {
-      ActivePexInstance scriptInstance(baseScript, mapForFillPropertys,
-                                       parentVM, activeInstanceOwner,
-                                       this->sourcePex->source);
-      return std::make_shared<ActivePexInstance>(scriptInstance);
-    }
-  }
+  if (parentInstance || !sourcePex)
+    return parentInstance.get();
 
-  if (nameNeedScript != "")
-    assert(0);
-  return nullptr;
-}
+  auto& parentName = sourcePex->objectTable.m_data[0].parentClassName;
+  if (parentName.empty())
+    return nullptr;
 
-std::vector<ObjectTable::Object::VarInfo> ActivePexInstance::FillVariables(
-  std::shared_ptr<PexScript> sourcePex,
-  std::vector<std::pair<std::string, VarValue>> argsForFillPropertys)
-{
-  std::vector<ObjectTable::Object::VarInfo> result;
-
-  for (auto object : sourcePex->objectTable.m_data) {
-    for (auto var : object.variables) {
-      ObjectTable::Object::VarInfo varInfo;
-      varInfo = var;
-      if ((const char*)varInfo.value == nullptr) {
-        varInfo.value = VarValue(GetTypeByName(var.typeName));
-      }
-      result.push_back(varInfo);
-    }
+  if (auto parentScript = parentVM->GetScript(parentName)) {
+    parentInstance = std::make_shared<ActivePexInstance>(
+      parentScript, propertyValues, parentVM, activeInstanceOwner,
+      sourcePex->source);
+  } else {
+    throw std::runtime_error("Parent script not found: " + parentName);
   }
-
-  // Creating temp variable for save State ActivePexInstance and
-  // transition between them
-  ObjectTable::Object::VarInfo variableForState = { "::State", "String", 0,
-                                                    VarValue("") };
-
-  result.push_back(variableForState);
-
-  for (auto& object : sourcePex->objectTable.m_data) {
-    for (auto& prop : object.properties) {
-      for (auto var : argsForFillPropertys) {
-        if (prop.name == var.first) {
-          for (auto& varInfo : result) {
-            if (prop.autoVarName == varInfo.name) {
-              varInfo.value = var.second;
-              varInfo.value.objectType = varInfo.typeName;
-              break;
-            }
-          }
-        }
-      }
-    }
-  }
-
-  return result;
+  return parentInstance.get();
 }
 
-FunctionInfo ActivePexInstance::GetFunctionByName(const char* name,
-                                                  std::string stateName)
+void ActivePexInstance::FillProperties()
 {
-
-  FunctionInfo function;
-  for (auto& object : sourcePex->objectTable.m_data) {
-    for (auto& state : object.states) {
-      if (state.name == stateName) {
-        for (auto& func : state.functions) {
-          if (func.name == name) {
-            function = func.function;
-            function.valid = true;
-            return function;
-          }
-        }
+  if (!propertyValues)
+    return;
+
+  auto it = propertyValues->find(sourcePex->source);
+  if (it == propertyValues->end())
+    return;
+
+  auto& instanceTemplate = sourcePex->instanceTemplate;
+  for (auto& [name, value] : it->second) {
+    for (auto& property : instanceTemplate.autoProperties) {
+      if (property.name == name) {
+        auto& var = variables[property.variableIndex];
+        var = value;
+        var.SetObjectType(
+          instanceTemplate.variableTypes[property.variableIndex]);
       }
     }
   }
-  return function;
 }
 
-std::string ActivePexInstance::GetActiveStateName()
+FunctionInfo* ActivePexInstance::GetFunctionByName(const char* name,
+                                                   std::string_view stateName)
 {
-  std::string stateName;
+  return sourcePex->functionTable.Find(stateName, name);
+}
 
-  for (auto var : this->variables) {
-    if (var.name == "::State") {
-      stateName = (const char*)var.value;
-      break;
-    }
-  }
+const char* ActivePexInstance::GetActiveStateName()
+{
+  // InstanceTemplate always puts "::State" last
+  if (variables.empty() || !(const char*)variables.back())
+    return "";
 
-  return stateName;
+  return (const char*)variables.back();
 }
 
-ObjectTable::Object::PropInfo* ActivePexInstance::GetProperty(
-  ActivePexInstance* scriptInstance, std::string nameProperty, uint8_t flag)
+LinkedFunctionCode::PropertyAccess ActivePexInstance::GetPropertyAccess(
+  LinkedFunctionCode& code, const LinkedFunctionCode::Instruction& instruction,
+  const VarValue& propertyName, const VarValue& object, uint8_t flag)
 {
+  // Sites seeing more receiver types than this stop caching
+  constexpr uint32_t kMaxMisses = 4;
 
-  if (scriptInstance != nullptr) {
-
-    if (flag == ObjectTable::Object::PropInfo::kFlags_Read) {
+  auto& cache = code.propertyCaches[instruction.cacheIndex];
 
-      for (auto& object : scriptInstance->sourcePex->objectTable.m_data) {
-        for (auto& prop : object.properties) {
-          if (prop.name == nameProperty &&
-              (prop.flags & 5) == prop.kFlags_Read) {
-            return &prop;
-          }
-        }
-      }
-    }
+  auto cached = cache.access.load(std::memory_order_acquire);
+  if (cached && cached->objectTypeId == object.GetObjectTypeId() &&
+      cached->script == parentVM->GetScriptOfType(object)) {
+    return *cached;
+  }
 
-    if (flag == ObjectTable::Object::PropInfo::kFlags_Write) {
+  auto access = ResolvePropertyAccess(propertyName, object, flag);
 
-      for (auto& object : scriptInstance->sourcePex->objectTable.m_data) {
-        for (auto& prop : object.properties) {
-          if (prop.name == nameProperty &&
-              (prop.flags & 6) == prop.kFlags_Write) {
-            return &prop;
-          }
-        }
-      }
-    }
+  if (cache.numMisses.fetch_add(1, std::memory_order_relaxed) < kMaxMisses) {
+    auto entry = std::make_unique<LinkedFunctionCode::PropertyAccess>(access);
+    std::lock_guard lock(code.propertyAccessesMutex);
+    cache.access.store(entry.get(), std::memory_order_release);
+    code.propertyAccesses.push_back(std::move(entry));
   }
-
-  return nullptr;
+  return access;
 }
 
-ActivePexInstance* ActivePexInstance::GetActivePexInObject(
-  VarValue* object, std::string& scriptType)
+LinkedFunctionCode::PropertyAccess ActivePexInstance::ResolvePropertyAccess(
+  const VarValue& propertyName, const VarValue& object, uint8_t flag)
 {
+  LinkedFunctionCode::PropertyAccess access;
+  access.objectTypeId = object.GetObjectTypeId();
+  access.script = parentVM->GetScriptOfType(object);
 
-  auto itObject = std::find_if(
-    parentVM->gameObjects.begin(), parentVM->gameObjects.end(),
-    [&](std::pair<std::shared_ptr<IGameObject>, std::vector<ActivePexInstance>>
-          i) { return ((IGameObject*)object == i.first.get()); });
+  if (!access.script || !(const char*)propertyName)
+    return access;
 
-  if (itObject != parentVM->gameObjects.end()) {
+  CaseInsensitiveEqual equal;
 
-    for (auto& instance : itObject->second) {
-      if (instance.sourcePex->source == scriptType) {
-        return &instance;
-        break;
+  for (auto& scriptObject : access.script->objectTable.m_data) {
+    for (auto& prop : scriptObject.properties) {
+      if (!equal(prop.name, (const char*)propertyName))
+        continue;
+
+      if (prop.flags & prop.kFlags_AutoVar) {
+        access.found = FunctionLinker::FindMember(
+          *access.script, prop.autoVarName, access.autoVarIndex);
+        return access;
+      }
+
+      if (flag == prop.kFlags_Read && (prop.flags & prop.kFlags_Read)) {
+        access.handler = &prop.readHandler;
+        access.found = true;
+        return access;
+      }
+
+      if (flag == prop.kFlags_Write && (prop.flags & prop.kFlags_Write)) {
+        access.handler = &prop.writeHandler;
+        access.found = true;
+        return access;
       }
     }
   }
 
-  return nullptr;
+  return access;
 }
 
 VarValue ActivePexInstance::CastToString(const VarValue& var)
 {
   std::string temp;
-  size_t _size = this->sourcePex->stringTable.m_data.size();
 
   switch (var.GetType()) {
 
@@ -210,26 +174,12 @@ VarValue ActivePexInstance::CastToString(const VarValue& var)
     case var.kType_Integer:
 
       temp = std::to_string((int)var);
-      for (auto& str : this->sourcePex->stringTable.m_data) {
-        if (str.data() == temp) {
-          return VarValue(str.data());
-        }
-      }
-
-      this->sourcePex->stringTable.m_data.push_back(temp);
-      return VarValue(this->sourcePex->stringTable.m_data[_size].data());
+      return VarValue(parentVM->stringPool.Intern(temp));
 
     case var.kType_Float:
 
       temp = std::to_string((float)var);
-      for (auto& str : this->sourcePex->stringTable.m_data) {
-        if (str.data() == temp) {
-          return VarValue(str.data());
-        }
-      }
-
-      this->sourcePex->stringTable.m_data.push_back(temp);
-      return VarValue(this->sourcePex->stringTable.m_data[_size].data());
+      return VarValue(parentVM->stringPool.Intern(temp));
 
     case var.kType_Bool: {
 
@@ -266,30 +216,38 @@ VarValue ActivePexInstance::CastToString(const VarValue& var)
 VarValue ActivePexInstance::GetElementsArrayAtString(const VarValue& array,
                                                      uint8_t type)
 {
+  if (!array.GetArray()) {
+    const static std::string noneString = "None";
+    return VarValue(noneString.c_str());
+  }
+
   std::string returnValue = "[";
+  auto& elements = *array.GetArray();
 
-  for (size_t i = 0; i < array.pArray->size(); ++i) {
+  for (size_t i = 0; i < elements.GetSize(); ++i) {
     // returnValue += " ";
 
     switch (type) {
-      case array.kType_ObjectArray:
-        returnValue += ((IGameObject*)((*array.pArray)[i]))->GetStringID();
-        break;
+      case array.kType_ObjectArray: {
+        auto object = (IGameObject*)(elements.Get(i));
+        returnValue += object ? object->GetStringID() : "None";
+      } break;
 
       case array.kType_StringArray:
-        returnValue += (const char*)((*array.pArray)[i]);
+        if (auto string = (const char*)(elements.Get(i)))
+          returnValue += string;
         break;
 
       case array.kType_IntArray:
-        returnValue += std::to_string((int)((*array.pArray)[i]));
+        returnValue += std::to_string((int)(elements.Get(i)));
         break;
 
       case array.kType_FloatArray:
-        returnValue += std::to_string((float)((*array.pArray)[i]));
+        returnValue += std::to_string((float)(elements.Get(i)));
         break;
 
       case array.kType_BoolArray: {
-        VarValue& temp = ((*array.pArray)[i]);
+        VarValue temp = elements.Get(i);
         returnValue += (const char*)(CastToString(temp));
         break;
       }
@@ -297,238 +255,364 @@ VarValue ActivePexInstance::GetElementsArrayAtString(const VarValue& array,
         assert(false);
     }
 
-    if (i < array.pArray->size() - 1)
+    if (i < elements.GetSize() - 1)
       returnValue += " , ";
     else
       returnValue += "]";
   }
 
-  instanceStringTable.push_back(std::make_shared<std::string>(returnValue));
-  return VarValue(
-    instanceStringTable[instanceStringTable.size() - 1]->c_str());
+  return VarValue(parentVM->stringPool.Intern(returnValue));
+}
+
+VarValue& ActivePexInstance::GetOperandValue(
+  LinkedFunctionCode& code, VarValue* locals,
+  const LinkedFunctionCode::Operand& operand)
+{
+  switch (operand.source) {
+    case LinkedFunctionCode::kSource_Local:
+      return locals[operand.index];
+    case LinkedFunctionCode::kSource_Member:
+      return variables[operand.index];
+    case LinkedFunctionCode::kSource_Self:
+      return activeInstanceOwner;
+    default:
+      return code.constants[operand.index];
+  }
+}
+
+namespace {
+using OpcodesImplementation::compareValues;
+using OpcodesImplementation::fDiv;
+using OpcodesImplementation::iAdd;
+using OpcodesImplementation::iDiv;
+using OpcodesImplementation::iMod;
+using OpcodesImplementation::iMul;
+using OpcodesImplementation::iNeg;
+using OpcodesImplementation::isTrue;
+using OpcodesImplementation::iSub;
+
+// Call instructions keep their arguments after 'first' fixed operands
+size_t GetNumCallArguments(const LinkedFunctionCode::Instruction& instruction,
+                           size_t first)
+{
+  return instruction.numOperands > first ? instruction.numOperands - first
+                                         : 0;
+}
+
+// Operand receiving the result of a call instruction, -1 if there is none
+int GetCallResultOperand(uint8_t op)
+{
+  switch (op) {
+    case OpcodesImplementation::Opcodes::op_CallMethod:
+    case OpcodesImplementation::Opcodes::op_CallStatic:
+    case OpcodesImplementation::Opcodes::op_PropGet:
+      return 2;
+    case OpcodesImplementation::Opcodes::op_CallParent:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+// Counts a script function call against the limits of the VM. Resumed
+// frames count towards the depth but not the steps. Objects retired while
+// scripts ran are released once the outermost frame returns
+class CallScope
+{
+public:
+  explicit CallScope(VirtualMachine& vm, bool countStep = true)
+    : vm(vm)
+  {
+    if (vm.maxCallDepth && vm.callDepth >= vm.maxCallDepth)
+      throw std::runtime_error("Call depth limit exceeded");
+    if (countStep)
+      vm.CountStep();
+    ++vm.callDepth;
+  }
+
+  ~CallScope()
+  {
+    if (--vm.callDepth == 0 && !vm.retiredObjects.empty())
+      vm.ReleaseRetiredObjects();
+  }
+
+  CallScope(const CallScope&) = delete;
+  CallScope& operator=(const CallScope&) = delete;
+
+private:
+  VirtualMachine& vm;
+};
+
+// Function and class names of the call opcodes. Strings in compiled scripts
+const char* GetName(const VarValue& value)
+{
+  auto name = (const char*)value;
+  if (!name)
+    throw std::runtime_error("Function or class name is not a string");
+  return name;
+}
+
 }
 
 VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
                                           std::vector<VarValue>& arguments)
 {
-  std::vector<std::pair<std::string, VarValue>> locals;
+  return StartFunction(function, arguments.data(), arguments.size());
+}
 
-  bool needReturn = false;
-  bool needJump = false;
-  int jumpStep = 0;
-  VarValue returnValue = VarValue::None();
+VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
+                                          const VarValue* arguments,
+                                          size_t numArguments)
+{
+  CallScope callScope(*parentVM);
 
-  for (auto& var : function.locals) {
-    VarValue temp = VarValue(GetTypeByName(var.type));
-    temp.objectType = var.type;
-    locals.push_back({ var.name, temp });
+  // Scripts are linked on load, so this is only reached for functions built
+  // by hand. Loaded scripts stay read-only and can be shared between threads
+  if (!function.linkedCode) {
+    function.linkedCode = FunctionLinker::Link(function, *sourcePex);
   }
+  // Keep the code alive even if the function is relinked during the call
+  std::shared_ptr<LinkedFunctionCode> linkedCode = function.linkedCode;
+  auto& code = *linkedCode;
 
-  for (size_t i = 0; i < arguments.size(); ++i) {
-    VarValue temp = arguments[i];
-    temp.objectType = function.params[i].type;
+  FrameArena::Frame frame(parentVM->frameArena);
+  VarValue* locals = frame.PushValues(code.frame.data(), code.frame.size());
 
-    locals.push_back({ function.params[i].name, temp });
-    assert(locals.back().second.GetType() == arguments[i].GetType());
+  for (size_t i = 0; i < numArguments && i < function.params.size(); ++i) {
+    locals[code.numLocals + i] = arguments[i];
   }
 
-  for (size_t i = arguments.size(); i < function.params.size(); ++i) {
-    const auto& var_ = function.params[i];
+  // Compiled code continues in the interpreter at calls. The profiler counts
+  // instructions, so it sees interpreted code only
+  size_t firstLine = 0;
+  if (code.aot && !parentVM->profiler) {
+    VarValue result;
+    firstLine = code.aot(*this, code, locals, result);
+    if (firstLine == LinkedFunctionCode::kAotDone)
+      return result;
+  }
 
-    VarValue temp = VarValue(GetTypeByName(var_.type));
-    temp.objectType = var_.type;
+  Profiler::Scope scope(parentVM->profiler, code);
+  return Execute(function, linkedCode, locals, firstLine);
+}
+
+VarValue ActivePexInstance::ResumeFunction(SuspendedFrame* frames,
+                                           size_t depth,
+                                           const VarValue& latentResult)
+{
+  CallScope callScope(*parentVM, false);
+
+  auto& saved = frames[depth];
+  std::shared_ptr<LinkedFunctionCode> linkedCode = saved.code;
+  auto keepAlive = std::move(saved.keepAlive);
+  auto& code = *linkedCode;
 
-    locals.push_back({ var_.name, temp });
+  FrameArena::Frame frame(parentVM->frameArena);
+  VarValue* locals =
+    frame.PushValues(saved.locals.data(), saved.locals.size());
+
+  Profiler::Scope scope(parentVM->profiler, code);
+
+  VarValue result = depth == 0
+    ? latentResult
+    : frames[depth - 1].instance->ResumeFunction(frames, depth - 1,
+                                                 latentResult);
+
+  auto& instruction = code.instructions[saved.line];
+  int resultOperand = GetCallResultOperand(instruction.op);
+  if (resultOperand >= 0) {
+    GetOperandValue(
+      code, locals,
+      code.operands[instruction.firstOperand + resultOperand]) = result;
   }
 
-  for (auto& var : locals) {
-    var.second = GetIndentifierValue(locals, var.second);
+  if (parentVM->scheduler.IsSuspending()) {
+    // Suspended again by an inner frame
+    ParkFrame(*saved.function, linkedCode, saved.line, locals);
+    result = VarValue::None();
+  } else {
+    result = Execute(*saved.function, linkedCode, locals, saved.line + 1);
   }
 
-  auto& sourceOpCode = function.code.instructions;
+  if (keepAlive && parentVM->scheduler.IsSuspending())
+    parentVM->scheduler.KeepAlive(std::move(keepAlive));
+  return result;
+}
 
-  std::vector<std::pair<uint8_t, std::vector<VarValue*>>> opCode;
+void ActivePexInstance::ParkFrame(
+  FunctionInfo& function,
+  const std::shared_ptr<LinkedFunctionCode>& linkedCode, size_t line,
+  const VarValue* locals)
+{
+  SuspendedFrame frame;
+  frame.instance = this;
+  frame.function = &function;
+  frame.code = linkedCode;
+  frame.line = line;
+  frame.locals.assign(locals, locals + linkedCode->frame.size());
+  parentVM->scheduler.PushFrame(std::move(frame));
+}
 
-  for (size_t i = 0; i < sourceOpCode.size(); ++i) {
+VarValue ActivePexInstance::Execute(
+  FunctionInfo& function,
+  const std::shared_ptr<LinkedFunctionCode>& linkedCode, VarValue* locals,
+  size_t firstLine)
+{
+  auto& code = *linkedCode;
 
-    std::pair<uint8_t, std::vector<VarValue*>> temp;
-    temp.first = sourceOpCode[i].op;
+  FrameArena::Frame frame(parentVM->frameArena);
 
-    for (size_t j = 0; j < sourceOpCode[i].args.size(); ++j) {
-      temp.second.push_back(&sourceOpCode[i].args[j]);
-    }
-    opCode.push_back(temp);
-  }
+  bool needReturn = false;
+  bool needJump = false;
+  bool needSuspend = false;
+  int64_t jumpStep = 0;
+  VarValue returnValue = VarValue::None();
 
-  for (auto& op : opCode) {
+  VarValue** operands = frame.PushPointers(code.operands.size());
 
-    for (auto& arg : op.second) {
-      arg = &(GetIndentifierValue(locals, *arg));
-    }
+  for (size_t i = 0; i < code.operands.size(); ++i) {
+    operands[i] = &GetOperandValue(code, locals, code.operands[i]);
   }
 
-  for (size_t line = 0; line < opCode.size(); ++line) {
+  Profiler* profiler = parentVM->profiler;
+  uint64_t* instructionCounts =
+    profiler ? profiler->GetInstructionCounts() : nullptr;
 
-    std::vector<VarValue> argsForCall;
+  for (size_t line = firstLine; line < code.instructions.size();
+       ++line) {
 
-    if (opCode[line].second.size() > 4) {
-      for (size_t i = 4; i < opCode[line].second.size(); ++i) {
-        argsForCall.push_back(*opCode[line].second[i]);
-      }
+    if (instructionCounts) {
+      ++instructionCounts[line];
+      profiler->SetInstruction(line);
     }
 
-    if (opCode[line].first == FunctionCode::kOp_CallParent &&
-        opCode[line].second.size() > 3) {
-      for (size_t i = 3; i < opCode[line].second.size(); ++i) {
-        argsForCall.push_back(*opCode[line].second[i]);
-      }
-    }
+    auto& instruction = code.instructions[line];
+    VarValue** args = operands + instruction.firstOperand;
 
-    switch (opCode[line].first) {
+    switch (instruction.op) {
       case OpcodesImplementation::Opcodes::op_Nop:
         break;
 
       case OpcodesImplementation::Opcodes::op_iAdd:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] + (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Int_Add:
+        args[0]->SetInt(iAdd(args[1]->GetInt(), args[2]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_fAdd:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] + (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Float_Add:
+        args[0]->SetFloat(args[1]->GetFloat() + args[2]->GetFloat());
         break;
 
       case OpcodesImplementation::Opcodes::op_iSub:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] - (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Int_Sub:
+        args[0]->SetInt(iSub(args[1]->GetInt(), args[2]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_fSub:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] - (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Float_Sub:
+        args[0]->SetFloat(args[1]->GetFloat() - args[2]->GetFloat());
         break;
 
       case OpcodesImplementation::Opcodes::op_iMul:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] * (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Int_Mul:
+        args[0]->SetInt(iMul(args[1]->GetInt(), args[2]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_fMul:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] * (*opCode[line].second[2]);
+      case OpcodesImplementation::Opcodes::op_Float_Mul:
+        args[0]->SetFloat(args[1]->GetFloat() * args[2]->GetFloat());
         break;
 
       case OpcodesImplementation::Opcodes::op_iDiv:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] / (*opCode[line].second[2]);
+        args[0]->SetInt(iDiv(args[1]->GetInt(), args[2]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_fDiv:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] / (*opCode[line].second[2]);
+        args[0]->SetFloat(fDiv(args[1]->GetFloat(), args[2]->GetFloat()));
         break;
 
       case OpcodesImplementation::Opcodes::op_iMod:
-
-        *opCode[line].second[0] =
-          *opCode[line].second[1] % (*opCode[line].second[2]);
+        args[0]->SetInt(iMod(args[1]->GetInt(), args[2]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Not:
-
-        *opCode[line].second[0] = !(*opCode[line].second[1]);
+        args[0]->SetBool(!isTrue(*args[1]));
         break;
 
       case OpcodesImplementation::Opcodes::op_iNeg:
-
-        *opCode[line].second[0] = *opCode[line].second[1] * VarValue(-1);
+      case OpcodesImplementation::Opcodes::op_Int_Neg:
+        args[0]->SetInt(iNeg(args[1]->GetInt()));
         break;
 
       case OpcodesImplementation::Opcodes::op_fNeg:
-
-        *opCode[line].second[0] = *opCode[line].second[1] * VarValue(-1.0f);
+      case OpcodesImplementation::Opcodes::op_Float_Neg:
+        // Not unary minus, which would flip the sign of NaN differently
+        args[0]->SetFloat(args[1]->GetFloat() * -1.0f);
         break;
 
       case OpcodesImplementation::Opcodes::op_Assign:
 
-        *opCode[line].second[0] = *opCode[line].second[1];
+        *args[0] = *args[1];
         break;
 
       case OpcodesImplementation::Opcodes::op_Cast:
 
-        switch ((*opCode[line].second[0]).GetType()) {
+        switch ((*args[0]).GetType()) {
           case VarValue::kType_Object:
 
-            CastObjectToObject(opCode[line].second[0], opCode[line].second[1],
-                               locals);
+            CastObjectToObject(args[0], args[1], function);
             break;
           case VarValue::kType_Integer:
-            *opCode[line].second[0] = (*opCode[line].second[1]).CastToInt();
+            *args[0] = (*args[1]).CastToInt();
             break;
           case VarValue::kType_Float:
-            *opCode[line].second[0] = (*opCode[line].second[1]).CastToFloat();
+            *args[0] = (*args[1]).CastToFloat();
             break;
           case VarValue::kType_Bool:
-            *opCode[line].second[0] = (*opCode[line].second[1]).CastToBool();
+            *args[0] = (*args[1]).CastToBool();
             break;
           case VarValue::kType_String:
-            *opCode[line].second[0] = CastToString(*opCode[line].second[1]);
+            *args[0] = CastToString(*args[1]);
             break;
           default:
-            assert(0);
+            throw std::runtime_error("Wrong type in Cast");
         }
 
         break;
 
-      case OpcodesImplementation::op_Cmp_eq:
-
-        *opCode[line].second[0] =
-          VarValue((*opCode[line].second[1]) == (*opCode[line].second[2]));
+      case OpcodesImplementation::Opcodes::op_Cmp_eq:
+        args[0]->SetBool(compareValues(*args[1], *args[2], std::equal_to<>()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Cmp_lt:
-
-        *opCode[line].second[0] =
-          VarValue(*opCode[line].second[1] < *opCode[line].second[2]);
+        args[0]->SetBool(compareValues(*args[1], *args[2], std::less<>()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Cmp_le:
-
-        *opCode[line].second[0] =
-          VarValue(*opCode[line].second[1] <= *opCode[line].second[2]);
+        args[0]->SetBool(
+          compareValues(*args[1], *args[2], std::less_equal<>()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Cmp_gt:
-
-        *opCode[line].second[0] =
-          VarValue(*opCode[line].second[1] > *opCode[line].second[2]);
+        args[0]->SetBool(compareValues(*args[1], *args[2], std::greater<>()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Cmp_ge:
-
-        *opCode[line].second[0] =
-          VarValue(*opCode[line].second[1] >= *opCode[line].second[2]);
+        args[0]->SetBool(
+          compareValues(*args[1], *args[2], std::greater_equal<>()));
         break;
 
       case OpcodesImplementation::Opcodes::op_Jmp:
 
-        jumpStep = (int)(*opCode[line].second[0]) - 1;
+        jumpStep = int64_t((int)(*args[0])) - 1;
 
         needJump = true;
         break;
 
       case OpcodesImplementation::Opcodes::op_Jmpt:
 
-        if ((bool)(*opCode[line].second[0])) {
-          jumpStep = (int)(*opCode[line].second[1]) - 1;
+        if (isTrue(*args[0])) {
+          jumpStep = int64_t((int)(*args[1])) - 1;
 
           needJump = true;
         }
@@ -536,75 +620,95 @@ VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
 
       case OpcodesImplementation::Opcodes::op_Jmpf:
 
-        if ((bool)(!(*opCode[line].second[0]))) {
-          jumpStep = (int)(*opCode[line].second[1]) - 1;
+        if (!isTrue(*args[0])) {
+          jumpStep = int64_t((int)(*args[1])) - 1;
           needJump = true;
         }
         break;
 
       case OpcodesImplementation::Opcodes::op_CallMethod: {
 
-        IGameObject* object = (IGameObject*)(*opCode[line].second[1]);
-        std::string functionName = (const char*)(*opCode[line].second[0]);
+        IGameObject* object = (IGameObject*)(*args[1]);
+        const char* functionName = GetName(*args[0]);
 
-        static const std::string nameOnBeginState = "onBeginState";
-        static const std::string nameOnEndState = "onEndState";
+        FrameArena::Frame callFrame(parentVM->frameArena);
+        size_t numArgs = GetNumCallArguments(instruction, 4);
+        VarValue* argsForCall = callFrame.PushValues(args + 4, numArgs);
 
-        if (functionName == nameOnBeginState ||
-            functionName == nameOnEndState) {
-          parentVM->SendEvent(this, functionName.c_str(), argsForCall);
+        if (!std::strcmp(functionName, "onBeginState") ||
+            !std::strcmp(functionName, "onEndState")) {
+          std::vector<VarValue> eventArgs(argsForCall, argsForCall + numArgs);
+          parentVM->SendEvent(this, functionName, eventArgs);
           break;
         } else
-          *opCode[line].second[2] = parentVM->CallMethod(
-            this, (IGameObject*)object, functionName.c_str(), argsForCall);
+          *args[2] = parentVM->CallMethod(this, (IGameObject*)object,
+                                          functionName, argsForCall, numArgs);
+        needSuspend = parentVM->scheduler.IsSuspending();
       }
 
       break;
 
-      case OpcodesImplementation::Opcodes::op_CallParent:
+      case OpcodesImplementation::Opcodes::op_CallParent: {
 
-        *opCode[line].second[1] = parentVM->CallMethod(
-          parentInstance.get(), (IGameObject*)activeInstanceOwner,
-          (const char*)(*opCode[line].second[0]), argsForCall);
+        FrameArena::Frame callFrame(parentVM->frameArena);
+        size_t numArgs = GetNumCallArguments(instruction, 3);
+        VarValue* argsForCall = callFrame.PushValues(args + 3, numArgs);
 
-        break;
+        auto parent = GetParentInstance();
+        if (!parent)
+          throw std::runtime_error("CallParent without a parent script");
+
+        *args[1] =
+          parentVM->CallMethod(parent, (IGameObject*)activeInstanceOwner,
+                               GetName(*args[0]), argsForCall, numArgs);
+        needSuspend = parentVM->scheduler.IsSuspending();
+      } break;
 
       case OpcodesImplementation::Opcodes::op_CallStatic: {
 
-        const char* className = (const char*)(*opCode[line].second[0]);
-        const char* functionName = (const char*)(*opCode[line].second[1]);
+        const char* className = GetName(*args[0]);
+        const char* functionName = GetName(*args[1]);
+
+        FrameArena::Frame callFrame(parentVM->frameArena);
+        size_t numArgs = GetNumCallArguments(instruction, 4);
+        VarValue* argsForCall = callFrame.PushValues(args + 4, numArgs);
 
-        *opCode[line].second[2] =
-          parentVM->CallStatic(className, functionName, argsForCall);
+        *args[2] = parentVM->CallStatic(instruction.native, className,
+                                        functionName, argsForCall, numArgs);
+        needSuspend = parentVM->scheduler.IsSuspending();
       } break;
 
       case OpcodesImplementation::Opcodes::op_Return:
 
-        returnValue = *opCode[line].second[0];
+        returnValue = *args[0];
         needReturn = true;
         break;
 
       case OpcodesImplementation::Opcodes::op_StrCat:
 
-        OpcodesImplementation::strCat(
-          *opCode[line].second[0], *opCode[line].second[1],
-          *opCode[line].second[2], this->sourcePex->stringTable);
+        OpcodesImplementation::strCat(*args[0], *args[1], *args[2],
+                                      parentVM->stringPool,
+                                      parentVM->maxStringLength);
         break;
       case OpcodesImplementation::Opcodes::op_PropGet:
 
-        if (opCode[line].second[1] != nullptr) {
+        if (args[1] != nullptr) {
 
-          std::string nameProperty = (const char*)*opCode[line].second[0];
+          auto access = GetPropertyAccess(
+            code, instruction, *args[0], *args[1],
+            ObjectTable::Object::PropInfo::kFlags_Read);
 
-          ActivePexInstance* ptrPex = GetActivePexInObject(
-            opCode[line].second[1], opCode[line].second[1]->objectType);
+          ActivePexInstance* ptrPex = access.found
+            ? parentVM->GetInstance((IGameObject*)*args[1], access.script)
+            : nullptr;
 
-          ObjectTable::Object::PropInfo* runProperty = GetProperty(
-            ptrPex, nameProperty, ObjectTable::Object::PropInfo::kFlags_Read);
-
-          if (runProperty != nullptr) {
-            *opCode[line].second[2] =
-              ptrPex->StartFunction(runProperty->readHandler, argsForCall);
+          if (ptrPex != nullptr) {
+            if (access.handler) {
+              *args[2] = ptrPex->StartFunction(*access.handler, nullptr, 0);
+              needSuspend = parentVM->scheduler.IsSuspending();
+            } else {
+              *args[2] = ptrPex->variables[access.autoVarIndex];
+            }
           }
 
         } else
@@ -613,19 +717,23 @@ VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
 
       case OpcodesImplementation::Opcodes::op_PropSet:
 
-        if (opCode[line].second[1] != nullptr) {
-          argsForCall.push_back(*opCode[line].second[2]);
+        if (args[1] != nullptr) {
 
-          std::string nameProperty = (const char*)*opCode[line].second[0];
+          auto access = GetPropertyAccess(
+            code, instruction, *args[0], *args[1],
+            ObjectTable::Object::PropInfo::kFlags_Write);
 
-          ActivePexInstance* ptrPex = GetActivePexInObject(
-            opCode[line].second[1], opCode[line].second[1]->objectType);
+          ActivePexInstance* ptrPex = access.found
+            ? parentVM->GetInstance((IGameObject*)*args[1], access.script)
+            : nullptr;
 
-          ObjectTable::Object::PropInfo* runProperty = GetProperty(
-            ptrPex, nameProperty, ObjectTable::Object::PropInfo::kFlags_Write);
-
-          if (runProperty != nullptr) {
-            ptrPex->StartFunction(runProperty->writeHandler, argsForCall);
+          if (ptrPex != nullptr) {
+            if (access.handler) {
+              ptrPex->StartFunction(*access.handler, args[2], 1);
+              needSuspend = parentVM->scheduler.IsSuspending();
+            } else {
+              ptrPex->variables[access.autoVarIndex] = *args[2];
+            }
           }
 
         } else
@@ -634,72 +742,98 @@ VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
 
       case OpcodesImplementation::Opcodes::op_Array_Create:
 
-        (*opCode[line].second[0]).pArray =
-          std::shared_ptr<std::vector<VarValue>>(new std::vector<VarValue>);
-        if ((int32_t)(*opCode[line].second[1]) > 0) {
+        OpcodesImplementation::arrayCreate(*args[0], *args[1],
+                                           parentVM->maxArraySize);
+        break;
 
-          (*opCode[line].second[0])
-            .pArray->resize((int32_t)(*opCode[line].second[1]));
+      case OpcodesImplementation::Opcodes::op_Array_Length:
 
-          uint8_t type =
-            GetArrayElementType((*opCode[line].second[0]).GetType());
+        OpcodesImplementation::arrayLength(*args[0], *args[1]);
+        break;
 
-          for (auto& element : *(*opCode[line].second[0]).pArray) {
-            element = VarValue(type);
-          }
+      case OpcodesImplementation::Opcodes::op_Array_GetElement:
 
-        } else
-          assert(0);
+        OpcodesImplementation::arrayGetElement(*args[0], *args[1], *args[2]);
+        break;
 
+      case OpcodesImplementation::Opcodes::op_Array_SetElement:
+
+        OpcodesImplementation::arraySetElement(*args[0], *args[1], *args[2]);
         break;
 
-      case OpcodesImplementation::Opcodes::op_Array_Length:
+      case OpcodesImplementation::Opcodes::op_Array_FindElement:
 
-        if ((*opCode[line].second[1]).pArray != nullptr) {
-          if ((*opCode[line].second[0]).GetType() == VarValue::kType_Integer)
-            *opCode[line].second[0] =
-              VarValue((int32_t)(*opCode[line].second[1]).pArray->size());
+        OpcodesImplementation::arrayFindElement(*args[0], *args[1], *args[2],
+                                                *args[3]);
+        break;
 
-        } else
-          *opCode[line].second[0] = VarValue((int32_t)0);
+      case OpcodesImplementation::Opcodes::op_Array_RfindElement:
+
+        OpcodesImplementation::arrayRFindElement(*args[0], *args[1], *args[2],
+                                                 *args[3]);
         break;
 
-      case OpcodesImplementation::Opcodes::op_Array_GetElement:
+      case OpcodesImplementation::Opcodes::op_Int_Cmp_eq:
+        args[0]->SetBool(args[1]->GetInt() == args[2]->GetInt());
+        break;
 
-        if ((*opCode[line].second[1]).pArray != nullptr) {
-          *opCode[line].second[0] =
-            (*opCode[line].second[1])
-              .pArray->at((int32_t)(*opCode[line].second[2]));
-        } else
-          assert(0);
+      case OpcodesImplementation::Opcodes::op_Int_Cmp_lt:
+        args[0]->SetBool(args[1]->GetInt() < args[2]->GetInt());
         break;
 
-      case OpcodesImplementation::Opcodes::op_Array_SetElement:
+      case OpcodesImplementation::Opcodes::op_Int_Cmp_le:
+        args[0]->SetBool(args[1]->GetInt() <= args[2]->GetInt());
+        break;
 
-        if ((*opCode[line].second[0]).pArray != nullptr) {
-          (*opCode[line].second[0])
-            .pArray->at((int32_t)(*opCode[line].second[1])) =
-            *opCode[line].second[2];
-        } else
-          assert(0);
+      case OpcodesImplementation::Opcodes::op_Int_Cmp_gt:
+        args[0]->SetBool(args[1]->GetInt() > args[2]->GetInt());
         break;
 
-      case OpcodesImplementation::Opcodes::op_Array_FindElement:
+      case OpcodesImplementation::Opcodes::op_Int_Cmp_ge:
+        args[0]->SetBool(args[1]->GetInt() >= args[2]->GetInt());
+        break;
 
-        OpcodesImplementation::arrayFindElement(
-          *opCode[line].second[0], *opCode[line].second[1],
-          *opCode[line].second[2], *opCode[line].second[3]);
+      case OpcodesImplementation::Opcodes::op_Float_Cmp_eq:
+        args[0]->SetBool(args[1]->GetFloat() == args[2]->GetFloat());
         break;
 
-      case OpcodesImplementation::Opcodes::op_Array_RfindElement:
+      case OpcodesImplementation::Opcodes::op_Float_Cmp_lt:
+        args[0]->SetBool(args[1]->GetFloat() < args[2]->GetFloat());
+        break;
+
+      case OpcodesImplementation::Opcodes::op_Float_Cmp_le:
+        args[0]->SetBool(args[1]->GetFloat() <= args[2]->GetFloat());
+        break;
+
+      case OpcodesImplementation::Opcodes::op_Float_Cmp_gt:
+        args[0]->SetBool(args[1]->GetFloat() > args[2]->GetFloat());
+        break;
+
+      case OpcodesImplementation::Opcodes::op_Float_Cmp_ge:
+        args[0]->SetBool(args[1]->GetFloat() >= args[2]->GetFloat());
+        break;
+
+      case OpcodesImplementation::Opcodes::op_Bool_Not:
+        args[0]->SetBool(!args[1]->GetBool());
+        break;
 
-        OpcodesImplementation::arrayRFindElement(
-          *opCode[line].second[0], *opCode[line].second[1],
-          *opCode[line].second[2], *opCode[line].second[3]);
+      case OpcodesImplementation::Opcodes::op_Bool_Jmpt:
+        if (args[0]->GetBool()) {
+          jumpStep = int64_t((int)(*args[1])) - 1;
+          needJump = true;
+        }
+        break;
+
+      case OpcodesImplementation::Opcodes::op_Bool_Jmpf:
+        if (!args[0]->GetBool()) {
+          jumpStep = int64_t((int)(*args[1])) - 1;
+          needJump = true;
+        }
         break;
 
       default:
-        assert(0);
+        throw std::runtime_error("Unknown opcode " +
+                                 std::to_string(instruction.op));
     }
 
     if (needReturn) {
@@ -707,26 +841,21 @@ VarValue ActivePexInstance::StartFunction(FunctionInfo& function,
       return returnValue;
     }
 
+    if (needSuspend) {
+      ParkFrame(function, linkedCode, line, locals);
+      return VarValue::None();
+    }
+
     if (needJump) {
       needJump = false;
+      if (jumpStep < 0)
+        parentVM->CountStep();
       line += jumpStep;
     }
   }
   return returnValue;
 }
 
-VarValue& ActivePexInstance::GetIndentifierValue(
-  std::vector<std::pair<std::string, VarValue>>& locals, VarValue& value)
-{
-  if (value.GetType() == VarValue::kType_Identifier &&
-      (const char*)value != nullptr) {
-    std::string temp;
-    temp = temp + (const char*)value;
-    return GetVariableValueByName(locals, temp);
-  } else
-    return value;
-}
-
 uint8_t ActivePexInstance::GetTypeByName(std::string typeRef)
 {
 
@@ -769,71 +898,32 @@ uint8_t ActivePexInstance::GetTypeByName(std::string typeRef)
   return VarValue::kType_Object;
 }
 
-uint8_t ActivePexInstance::GetArrayElementType(uint8_t type)
+void ActivePexInstance::CastObjectToObject(VarValue* result,
+                                           VarValue* scriptToCastOwner,
+                                           const FunctionInfo& function)
 {
-  uint8_t returnType;
-
-  switch (type) {
-    case VarValue::kType_ObjectArray:
-      returnType = VarValue::kType_Object;
-
-      break;
-    case VarValue::kType_StringArray:
-      returnType = VarValue::kType_String;
-
-      break;
-    case VarValue::kType_IntArray:
-      returnType = VarValue::kType_Integer;
-
-      break;
-    case VarValue::kType_FloatArray:
-      returnType = VarValue::kType_Float;
-
-      break;
-    case VarValue::kType_BoolArray:
-      returnType = VarValue::kType_Bool;
+  std::string objectToCastTypeName = scriptToCastOwner->GetObjectType();
+  std::string resultTypeName = result->GetObjectType();
 
+  bool found = false;
+  for (auto& var : function.locals) {
+    if (resultTypeName == var.name) {
+      resultTypeName = var.type;
+      found = true;
       break;
-    default:
-      assert(false);
+    }
   }
-
-  return returnType;
-}
-
-void ActivePexInstance::CastObjectToObject(
-  VarValue* result, VarValue* scriptToCastOwner,
-  std::vector<std::pair<std::string, VarValue>>& locals)
-{
-  std::string objectToCastTypeName = scriptToCastOwner->objectType;
-  std::string resultTypeName = result->objectType;
-
-  for (auto& var : locals) {
-    if (resultTypeName == var.first) {
-      resultTypeName = var.second.objectType;
+  for (size_t i = 0; !found && i < function.params.size(); ++i) {
+    if (resultTypeName == function.params[i].name) {
+      resultTypeName = function.params[i].type;
       break;
     }
   }
 
   if (resultTypeName != "" && objectToCastTypeName != "") {
 
-    auto scriptOwner = std::find_if(
-      parentVM->gameObjects.begin(), parentVM->gameObjects.end(),
-      [&](
-        std::pair<std::shared_ptr<IGameObject>, std::vector<ActivePexInstance>>
-          i) { return ((IGameObject*)*scriptToCastOwner) == i.first.get(); });
-
-    ActivePexInstance* ptrScriptToCast = nullptr;
-
-    if (scriptOwner != parentVM->gameObjects.end()) {
-
-      for (auto& activeScript : scriptOwner->second) {
-        if (activeScript.sourcePex->source == objectToCastTypeName) {
-          ptrScriptToCast = &activeScript;
-          break;
-        }
-      }
-    }
+    ActivePexInstance* ptrScriptToCast = parentVM->GetInstance(
+      (IGameObject*)*scriptToCastOwner, objectToCastTypeName);
 
     if (HasParent(ptrScriptToCast, resultTypeName) ||
         HasChild(ptrScriptToCast, resultTypeName)) {
@@ -848,21 +938,19 @@ void ActivePexInstance::CastObjectToObject(
 bool ActivePexInstance::HasParent(ActivePexInstance* script,
                                   std::string castToTypeName)
 {
-
-  if (script != nullptr) {
-
-    if (script->sourcePex->source == castToTypeName)
+  if (script == nullptr)
+    return false;
+
+  // Follows the scripts since parent instances may not exist yet. Bounded
+  // in case of an inheritance cycle
+  auto pex = script->sourcePex.get();
+  for (size_t i = 0; pex && i <= parentVM->allLoadedScripts.size(); ++i) {
+    if (pex->source == castToTypeName)
       return true;
 
-    if (script->parentInstance != nullptr &&
-        script->parentInstance->sourcePex->source != "") {
-      if (script->parentInstance->sourcePex->source == castToTypeName)
-        return true;
-      else
-        return HasParent(script->parentInstance.get(), castToTypeName);
-    }
+    auto& parentName = pex->objectTable.m_data[0].parentClassName;
+    pex = parentName.empty() ? nullptr : parentVM->GetScript(parentName).get();
   }
-
   return false;
 }
 
@@ -882,73 +970,3 @@ bool ActivePexInstance::HasChild(ActivePexInstance* script,
   }
   return false;
 }
-
-VarValue& ActivePexInstance::GetVariableValueByName(
-  std::vector<std::pair<std::string, VarValue>>& locals, std::string name)
-{
-
-  if (name == "self") {
-    return activeInstanceOwner;
-  }
-
-  for (auto& var : locals) {
-    if (var.first == name) {
-      return var.second;
-    }
-  }
-
-  for (auto& var : this->variables) {
-    if (var.name == name) {
-      return var.value;
-    }
-  }
-
-  for (auto& _name : identifiersValueNameCache) {
-    if ((const char*)(*_name) == name) {
-      return *_name;
-    }
-  }
-
-  auto at = parentVM->nativeFunctions.find(this->sourcePex->source);
-
-  if (at != parentVM->nativeFunctions.end()) {
-    for (auto& func : at->second) {
-      if (func.first == name) {
-        identifiersValueNameCache.push_back(
-          std::make_shared<VarValue>(func.first.c_str()));
-        return *identifiersValueNameCache[(identifiersValueNameCache.size() -
-                                           1)];
-      }
-    }
-  }
-
-  auto it = parentVM->nativeStaticFunctions.find(name);
-
-  if (it != parentVM->nativeStaticFunctions.end()) {
-    identifiersValueNameCache.push_back(
-      std::make_shared<VarValue>(it->first.c_str()));
-    return *identifiersValueNameCache[(identifiersValueNameCache.size() - 1)];
-  }
-
-  for (auto& _string : sourcePex->stringTable.m_data) {
-    if (_string == name) {
-      identifiersValueNameCache.push_back(
-        std::make_shared<VarValue>(_string.c_str()));
-      return *identifiersValueNameCache[(identifiersValueNameCache.size() -
-                                         1)];
-    }
-  }
-
-  for (auto& _string : parentInstance->sourcePex->stringTable.m_data) {
-    if (_string == name) {
-      identifiersValueNameCache.push_back(
-        std::make_shared<VarValue>(_string.c_str()));
-      return *identifiersValueNameCache[(identifiersValueNameCache.size() -
-                                         1)];
-    }
-  }
-
-  assert(false);
-  static VarValue _;
-  return _;
-}
\ No newline at end of file
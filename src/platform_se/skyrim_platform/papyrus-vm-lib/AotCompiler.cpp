@@ -0,0 +1,1164 @@
+#include "AotCompiler.h"
+#include "OpcodesImplementation.h"
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace {
+using Opcodes = OpcodesImplementation::Opcodes;
+using Operand = LinkedFunctionCode::Operand;
+
+constexpr uint8_t kUnknownType = 0xff;
+
+// Operands the compiled code uses, -1 for opcodes left to the interpreter
+int GetNumFixedOperands(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_Nop:
+      return 0;
+    case Opcodes::op_Jmp:
+    case Opcodes::op_Return:
+      return 1;
+    case Opcodes::op_Not:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Assign:
+    case Opcodes::op_Cast:
+    case Opcodes::op_Jmpt:
+    case Opcodes::op_Jmpf:
+    case Opcodes::op_Array_Create:
+    case Opcodes::op_Array_Length:
+    case Opcodes::op_Int_Neg:
+    case Opcodes::op_Float_Neg:
+    case Opcodes::op_Bool_Not:
+    case Opcodes::op_Bool_Jmpt:
+    case Opcodes::op_Bool_Jmpf:
+      return 2;
+    case Opcodes::op_iAdd:
+    case Opcodes::op_fAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_fSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_fMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_StrCat:
+    case Opcodes::op_Array_GetElement:
+    case Opcodes::op_Array_SetElement:
+    case Opcodes::op_Int_Add:
+    case Opcodes::op_Int_Sub:
+    case Opcodes::op_Int_Mul:
+    case Opcodes::op_Int_Cmp_eq:
+    case Opcodes::op_Int_Cmp_lt:
+    case Opcodes::op_Int_Cmp_le:
+    case Opcodes::op_Int_Cmp_gt:
+    case Opcodes::op_Int_Cmp_ge:
+    case Opcodes::op_Float_Add:
+    case Opcodes::op_Float_Sub:
+    case Opcodes::op_Float_Mul:
+    case Opcodes::op_Float_Cmp_eq:
+    case Opcodes::op_Float_Cmp_lt:
+    case Opcodes::op_Float_Cmp_le:
+    case Opcodes::op_Float_Cmp_gt:
+    case Opcodes::op_Float_Cmp_ge:
+      return 3;
+    case Opcodes::op_Array_FindElement:
+    case Opcodes::op_Array_RfindElement:
+      return 4;
+    default:
+      return -1;
+  }
+}
+
+// Operand the instruction may store to, -1 if there is none. Includes the
+// instructions left to the interpreter
+int GetResultOperand(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_CallParent:
+    case Opcodes::op_Array_FindElement:
+    case Opcodes::op_Array_RfindElement:
+      return 1;
+    case Opcodes::op_CallMethod:
+    case Opcodes::op_CallStatic:
+    case Opcodes::op_PropGet:
+      return 2;
+    case Opcodes::op_Nop:
+    case Opcodes::op_Jmp:
+    case Opcodes::op_Jmpt:
+    case Opcodes::op_Jmpf:
+    case Opcodes::op_Bool_Jmpt:
+    case Opcodes::op_Bool_Jmpf:
+    case Opcodes::op_Return:
+    case Opcodes::op_PropSet:
+    case Opcodes::op_Array_SetElement:
+      return -1;
+    default:
+      return GetNumFixedOperands(op) > 0 ? 0 : -1;
+  }
+}
+
+// Type every compiled instruction with this opcode stores, kUnknownType if
+// it depends on the operands
+uint8_t GetResultType(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_iAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_Int_Add:
+    case Opcodes::op_Int_Sub:
+    case Opcodes::op_Int_Mul:
+    case Opcodes::op_Int_Neg:
+    case Opcodes::op_Array_FindElement:
+    case Opcodes::op_Array_RfindElement:
+      return VarValue::kType_Integer;
+    case Opcodes::op_fAdd:
+    case Opcodes::op_fSub:
+    case Opcodes::op_fMul:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Float_Add:
+    case Opcodes::op_Float_Sub:
+    case Opcodes::op_Float_Mul:
+    case Opcodes::op_Float_Neg:
+      return VarValue::kType_Float;
+    case Opcodes::op_Not:
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_Int_Cmp_eq:
+    case Opcodes::op_Int_Cmp_lt:
+    case Opcodes::op_Int_Cmp_le:
+    case Opcodes::op_Int_Cmp_gt:
+    case Opcodes::op_Int_Cmp_ge:
+    case Opcodes::op_Float_Cmp_eq:
+    case Opcodes::op_Float_Cmp_lt:
+    case Opcodes::op_Float_Cmp_le:
+    case Opcodes::op_Float_Cmp_gt:
+    case Opcodes::op_Float_Cmp_ge:
+    case Opcodes::op_Bool_Not:
+      return VarValue::kType_Bool;
+    default:
+      return kUnknownType;
+  }
+}
+
+// Type the opcode reads its operands 1 and 2 as without checking it, the
+// way VarValue::GetInt does. kUnknownType for any other opcode
+uint8_t GetOperandType(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_iAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_Int_Add:
+    case Opcodes::op_Int_Sub:
+    case Opcodes::op_Int_Mul:
+    case Opcodes::op_Int_Neg:
+    case Opcodes::op_Int_Cmp_eq:
+    case Opcodes::op_Int_Cmp_lt:
+    case Opcodes::op_Int_Cmp_le:
+    case Opcodes::op_Int_Cmp_gt:
+    case Opcodes::op_Int_Cmp_ge:
+      return VarValue::kType_Integer;
+    case Opcodes::op_fAdd:
+    case Opcodes::op_fSub:
+    case Opcodes::op_fMul:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Float_Add:
+    case Opcodes::op_Float_Sub:
+    case Opcodes::op_Float_Mul:
+    case Opcodes::op_Float_Neg:
+    case Opcodes::op_Float_Cmp_eq:
+    case Opcodes::op_Float_Cmp_lt:
+    case Opcodes::op_Float_Cmp_le:
+    case Opcodes::op_Float_Cmp_gt:
+    case Opcodes::op_Float_Cmp_ge:
+      return VarValue::kType_Float;
+    case Opcodes::op_Bool_Not:
+      return VarValue::kType_Bool;
+    default:
+      return kUnknownType;
+  }
+}
+
+// C++ operator of a comparison, nullptr for other opcodes
+const char* GetComparison(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Int_Cmp_eq:
+    case Opcodes::op_Float_Cmp_eq:
+      return "==";
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Int_Cmp_lt:
+    case Opcodes::op_Float_Cmp_lt:
+      return "<";
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Int_Cmp_le:
+    case Opcodes::op_Float_Cmp_le:
+      return "<=";
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Int_Cmp_gt:
+    case Opcodes::op_Float_Cmp_gt:
+      return ">";
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_Int_Cmp_ge:
+    case Opcodes::op_Float_Cmp_ge:
+      return ">=";
+    default:
+      return nullptr;
+  }
+}
+
+// Function object compareValues takes for a comparison
+const char* GetComparator(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_Cmp_eq:
+      return "std::equal_to<>()";
+    case Opcodes::op_Cmp_lt:
+      return "std::less<>()";
+    case Opcodes::op_Cmp_le:
+      return "std::less_equal<>()";
+    case Opcodes::op_Cmp_gt:
+      return "std::greater<>()";
+    default:
+      return "std::greater_equal<>()";
+  }
+}
+
+bool IsUnboxable(uint8_t type)
+{
+  return type == VarValue::kType_Integer || type == VarValue::kType_Float ||
+    type == VarValue::kType_Bool;
+}
+
+// Suffix of the VarValue accessors for a type, as in GetInt and SetInt
+const char* GetAccessor(uint8_t type)
+{
+  switch (type) {
+    case VarValue::kType_Integer:
+      return "Int";
+    case VarValue::kType_Float:
+      return "Float";
+    default:
+      return "Bool";
+  }
+}
+
+const char* GetCppType(uint8_t type)
+{
+  switch (type) {
+    case VarValue::kType_Integer:
+      return "int32_t";
+    case VarValue::kType_Float:
+      return "float";
+    default:
+      return "bool";
+  }
+}
+
+std::string GetVarValueType(uint8_t type)
+{
+  switch (type) {
+    case VarValue::kType_Integer:
+      return "VarValue::kType_Integer";
+    case VarValue::kType_Float:
+      return "VarValue::kType_Float";
+    default:
+      return "VarValue::kType_Bool";
+  }
+}
+
+// Array type and VarArray member holding elements of an unboxed type
+std::string GetArrayType(uint8_t type)
+{
+  switch (type) {
+    case VarValue::kType_Integer:
+      return "VarValue::kType_IntArray";
+    case VarValue::kType_Float:
+      return "VarValue::kType_FloatArray";
+    default:
+      return "VarValue::kType_BoolArray";
+  }
+}
+
+const char* GetArrayElements(uint8_t type)
+{
+  switch (type) {
+    case VarValue::kType_Integer:
+      return "ints";
+    case VarValue::kType_Float:
+      return "floats";
+    default:
+      return "bools";
+  }
+}
+
+// C++ literal of an Int, Float or Bool constant. Empty if there is none,
+// e.g. for NaN
+std::string GetLiteral(const VarValue& value)
+{
+  switch (value.GetType()) {
+    case VarValue::kType_Integer:
+      // -2147483648 is a negated long
+      if (value.GetInt() == INT32_MIN)
+        return "(-2147483647 - 1)";
+      return std::to_string(value.GetInt());
+    case VarValue::kType_Float: {
+      if (!std::isfinite(value.GetFloat()))
+        return "";
+      // Hexadecimal, so the value is exact
+      std::ostringstream out;
+      out << std::hexfloat << value.GetFloat() << 'f';
+      return out.str();
+    }
+    case VarValue::kType_Bool:
+      return value.GetBool() ? "true" : "false";
+    default:
+      return "";
+  }
+}
+
+// C++ string literal
+std::string Quote(std::string_view str)
+{
+  std::string result = "\"";
+  for (char c : str) {
+    auto byte = static_cast<uint8_t>(c);
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (byte < 0x20 || byte >= 0x7f || c == '?') {
+      // Octal, since hex escapes don't end before the next hex digit. '?'
+      // could start a trigraph
+      char escape[5];
+      snprintf(escape, sizeof(escape), "\\%03o", byte);
+      result += escape;
+    } else {
+      result += c;
+    }
+  }
+  return result + '"';
+}
+
+// 64-bit FNV-1a
+class Hasher
+{
+public:
+  void Add(const void* data, size_t size)
+  {
+    auto bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+  }
+
+  template <class T>
+  void Add(T value)
+  {
+    static_assert(std::is_arithmetic_v<T>);
+    Add(&value, sizeof(value));
+  }
+
+  uint64_t Get() const { return hash; }
+
+private:
+  uint64_t hash = 0xcbf29ce484222325ull;
+};
+
+// Name of a function as Profiler prints it
+std::string GetProfilerName(const LinkedFunctionCode& code)
+{
+  std::string name(code.scriptName);
+  if (!code.stateName.empty())
+    name += '.' + std::string(code.stateName);
+  name += '.' + std::string(code.functionName);
+  if (code.functionType == 1)
+    name += ".get";
+  if (code.functionType == 2)
+    name += ".set";
+  return name;
+}
+
+class FunctionCompiler
+{
+public:
+  explicit FunctionCompiler(const LinkedFunctionCode& code);
+
+  // Writes 'size_t <name>(...)' to out
+  void Compile(const std::string& name, std::ostream& out);
+
+  size_t GetNumFallbacks() const { return numFallbacks; }
+
+private:
+  const Operand& GetOperand(size_t line, int i) const
+  {
+    return code.operands[code.instructions[line].firstOperand + i];
+  }
+
+  bool IsCompiled(size_t line) const;
+  void FindUnboxedLocals();
+  uint8_t GetStaticType(const Operand& operand) const;
+  bool IsUnboxed(const Operand& operand) const
+  {
+    return operand.source == LinkedFunctionCode::kSource_Local &&
+      unboxed[operand.index] != kUnknownType;
+  }
+
+  // Expressions
+  std::string Ref(const Operand& operand);
+  std::string Read(const Operand& operand, uint8_t type);
+  std::string Condition(const Operand& operand);
+
+  // Statements
+  void Line(const std::string& statement);
+  void Store(const Operand& operand, uint8_t type, const std::string& value);
+  void Sync(const Operand& operand);
+  void Reload(const Operand& operand);
+  void Fallback(size_t line);
+  void Jump(size_t line, const Operand& offset);
+  void CompileInstruction(size_t line);
+  void CompileCast(size_t line);
+  void CompileArrayElement(size_t line);
+  void CompileArrayAccess(size_t line);
+
+  const LinkedFunctionCode& code;
+
+  // Declared type of the C++ variable of every local, kUnknownType for
+  // locals that stay in the frame
+  std::vector<uint8_t> unboxed;
+  std::vector<bool> isMutableConstant;
+
+  std::ostringstream body;
+  std::string indent;
+  std::vector<bool> isJumpTarget;
+  std::vector<bool> isUsedLocal;
+  bool usesMembers = false, usesConstants = false, usesVM = false;
+  size_t numFallbacks = 0;
+};
+
+FunctionCompiler::FunctionCompiler(const LinkedFunctionCode& code_)
+  : code(code_)
+{
+  isMutableConstant.resize(code.constants.size());
+  isUsedLocal.resize(code.frame.size());
+  for (size_t line = 0; line < code.instructions.size(); ++line) {
+    auto& instruction = code.instructions[line];
+    for (size_t i = 0; i < instruction.numOperands; ++i) {
+      auto& operand = GetOperand(line, i);
+      if (operand.source == LinkedFunctionCode::kSource_Local)
+        isUsedLocal[operand.index] = true;
+    }
+
+    int result = GetResultOperand(instruction.op);
+    if (result >= 0 && result < instruction.numOperands) {
+      auto& operand = GetOperand(line, result);
+      if (operand.source == LinkedFunctionCode::kSource_Constant)
+        isMutableConstant[operand.index] = true;
+    }
+  }
+  FindUnboxedLocals();
+}
+
+bool FunctionCompiler::IsCompiled(size_t line) const
+{
+  auto& instruction = code.instructions[line];
+  int numOperands = GetNumFixedOperands(instruction.op);
+  return numOperands >= 0 && instruction.numOperands >= numOperands;
+}
+
+// Starts with every Int, Float and Bool local and drops those that some
+// compiled instruction may store another type to, or read as another type,
+// until nothing changes. Instructions left to the interpreter don't count,
+// compiled code never runs after them
+void FunctionCompiler::FindUnboxedLocals()
+{
+  unboxed.resize(code.frame.size(), kUnknownType);
+  for (size_t i = 0; i < code.frame.size(); ++i) {
+    if (IsUnboxable(code.frame[i].GetType()))
+      unboxed[i] = code.frame[i].GetType();
+  }
+
+  auto drop = [&](const Operand& operand, uint8_t type) {
+    if (IsUnboxed(operand) && unboxed[operand.index] != type) {
+      unboxed[operand.index] = kUnknownType;
+      return true;
+    }
+    return false;
+  };
+
+  for (bool changed = true; changed;) {
+    changed = false;
+    for (size_t line = 0; line < code.instructions.size(); ++line) {
+      if (!IsCompiled(line))
+        continue;
+      uint8_t op = code.instructions[line].op;
+
+      uint8_t readType = GetOperandType(op);
+      if (readType != kUnknownType) {
+        changed |= drop(GetOperand(line, 1), readType);
+        if (GetNumFixedOperands(op) == 3)
+          changed |= drop(GetOperand(line, 2), readType);
+      }
+      if (op == Opcodes::op_Bool_Jmpt || op == Opcodes::op_Bool_Jmpf)
+        changed |= drop(GetOperand(line, 0), VarValue::kType_Bool);
+
+      int result = GetResultOperand(op);
+      if (result < 0)
+        continue;
+      auto& operand = GetOperand(line, result);
+
+      uint8_t type = GetResultType(op);
+      if (op == Opcodes::op_Assign)
+        type = GetStaticType(GetOperand(line, 1));
+      if (op == Opcodes::op_Cast)
+        type = GetStaticType(operand);
+      // Stores an Int, or nothing if the result isn't an Int and the array
+      // isn't None
+      if (op == Opcodes::op_Array_Length &&
+          GetStaticType(operand) == VarValue::kType_Integer)
+        type = VarValue::kType_Integer;
+      // Checked at runtime, see CompileArrayElement
+      if (op == Opcodes::op_Array_GetElement &&
+          GetStaticType(GetOperand(line, 2)) == VarValue::kType_Integer)
+        type = GetStaticType(operand);
+      changed |= drop(operand, type);
+    }
+  }
+}
+
+// Type of the operand if it is the same whenever the compiled code reads
+// it, kUnknownType if not
+uint8_t FunctionCompiler::GetStaticType(const Operand& operand) const
+{
+  switch (operand.source) {
+    case LinkedFunctionCode::kSource_Local:
+      return unboxed[operand.index];
+    case LinkedFunctionCode::kSource_Constant: {
+      auto& value = code.constants[operand.index];
+      if (!isMutableConstant[operand.index] && IsUnboxable(value.GetType()))
+        return value.GetType();
+      return kUnknownType;
+    }
+    default:
+      return kUnknownType;
+  }
+}
+
+std::string FunctionCompiler::Ref(const Operand& operand)
+{
+  auto index = std::to_string(operand.index);
+  switch (operand.source) {
+    case LinkedFunctionCode::kSource_Local:
+      return "locals[" + index + "]";
+    case LinkedFunctionCode::kSource_Member:
+      usesMembers = true;
+      return "members[" + index + "]";
+    case LinkedFunctionCode::kSource_Constant:
+      usesConstants = true;
+      return "constants[" + index + "]";
+    default:
+      return "self.activeInstanceOwner";
+  }
+}
+
+std::string FunctionCompiler::Read(const Operand& operand, uint8_t type)
+{
+  if (GetStaticType(operand) == type) {
+    if (operand.source == LinkedFunctionCode::kSource_Local)
+      return 'v' + std::to_string(operand.index);
+    auto literal = GetLiteral(code.constants[operand.index]);
+    if (!literal.empty())
+      return literal;
+  }
+  Sync(operand);
+  return Ref(operand) + ".Get" + GetAccessor(type) + "()";
+}
+
+// Same as isTrue
+std::string FunctionCompiler::Condition(const Operand& operand)
+{
+  switch (GetStaticType(operand)) {
+    case VarValue::kType_Bool:
+      return Read(operand, VarValue::kType_Bool);
+    case VarValue::kType_Integer:
+      return Read(operand, VarValue::kType_Integer) + " != 0";
+    case VarValue::kType_Float:
+      return Read(operand, VarValue::kType_Float) + " != 0.0f";
+    default:
+      Sync(operand);
+      return "isTrue(" + Ref(operand) + ")";
+  }
+}
+
+void FunctionCompiler::Line(const std::string& statement)
+{
+  body << indent << statement << '\n';
+}
+
+void FunctionCompiler::Store(const Operand& operand, uint8_t type,
+                             const std::string& value)
+{
+  if (IsUnboxed(operand)) {
+    assert(unboxed[operand.index] == type);
+    Line('v' + std::to_string(operand.index) + " = " + value + ';');
+  } else {
+    Line(Ref(operand) + ".Set" + GetAccessor(type) + '(' + value + ");");
+  }
+}
+
+// Copies the C++ variable of a local to the frame, before the frame is read
+void FunctionCompiler::Sync(const Operand& operand)
+{
+  if (IsUnboxed(operand)) {
+    auto index = std::to_string(operand.index);
+    Line("locals[" + index + "].Set" + GetAccessor(unboxed[operand.index]) +
+         "(v" + index + ");");
+  }
+}
+
+// The other way round, after the frame is written
+void FunctionCompiler::Reload(const Operand& operand)
+{
+  if (IsUnboxed(operand)) {
+    auto index = std::to_string(operand.index);
+    Line('v' + index + " = locals[" + index + "].Get" +
+         GetAccessor(unboxed[operand.index]) + "();");
+  }
+}
+
+void FunctionCompiler::Fallback(size_t line)
+{
+  Line("resume = " + std::to_string(line) + ';');
+  Line("goto interpret;");
+  ++numFallbacks;
+}
+
+// The interpreter moves to line + offset and counts a step for a backward
+// jump. The offset must be a constant here
+void FunctionCompiler::Jump(size_t line, const Operand& offset)
+{
+  int64_t target = 0;
+  try {
+    if (offset.source != LinkedFunctionCode::kSource_Constant ||
+        isMutableConstant[offset.index])
+      return Fallback(line);
+    target = int64_t(line) + int((code.constants[offset.index]));
+  } catch (std::exception&) {
+    // Not convertible to an Int, the interpreter throws
+    return Fallback(line);
+  }
+
+  if (target <= int64_t(line)) {
+    usesVM = true;
+    Line("vm.CountStep();");
+  }
+  if (target >= 0 && target < int64_t(code.instructions.size())) {
+    isJumpTarget[target] = true;
+    Line("goto L" + std::to_string(target) + ';');
+  } else {
+    Line("result = VarValue::None();");
+    Line("return LinkedFunctionCode::kAotDone;");
+  }
+}
+
+void FunctionCompiler::CompileInstruction(size_t line)
+{
+  if (!IsCompiled(line))
+    return Fallback(line);
+
+  uint8_t op = code.instructions[line].op;
+  auto arg = [&](int i) -> const Operand& { return GetOperand(line, i); };
+
+  switch (op) {
+    case Opcodes::op_Nop:
+      return;
+
+    case Opcodes::op_iAdd:
+    case Opcodes::op_Int_Add:
+    case Opcodes::op_iSub:
+    case Opcodes::op_Int_Sub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_Int_Mul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_iMod: {
+      static const char* functions[] = { "iAdd", "iSub", "iMul", "iDiv",
+                                         "iMod" };
+      size_t function = op == Opcodes::op_iAdd || op == Opcodes::op_Int_Add
+        ? 0
+        : op == Opcodes::op_iSub || op == Opcodes::op_Int_Sub ? 1
+        : op == Opcodes::op_iMul || op == Opcodes::op_Int_Mul ? 2
+        : op == Opcodes::op_iDiv                              ? 3
+                                                              : 4;
+      auto a = Read(arg(1), VarValue::kType_Integer);
+      auto b = Read(arg(2), VarValue::kType_Integer);
+      return Store(arg(0), VarValue::kType_Integer,
+                   std::string(functions[function]) + '(' + a + ", " + b +
+                     ')');
+    }
+
+    case Opcodes::op_iNeg:
+    case Opcodes::op_Int_Neg:
+      return Store(arg(0), VarValue::kType_Integer,
+                   "iNeg(" + Read(arg(1), VarValue::kType_Integer) + ')');
+
+    case Opcodes::op_fAdd:
+    case Opcodes::op_Float_Add:
+    case Opcodes::op_fSub:
+    case Opcodes::op_Float_Sub:
+    case Opcodes::op_fMul:
+    case Opcodes::op_Float_Mul: {
+      char sign = op == Opcodes::op_fAdd || op == Opcodes::op_Float_Add ? '+'
+        : op == Opcodes::op_fSub || op == Opcodes::op_Float_Sub         ? '-'
+                                                                        : '*';
+      auto a = Read(arg(1), VarValue::kType_Float);
+      auto b = Read(arg(2), VarValue::kType_Float);
+      return Store(arg(0), VarValue::kType_Float,
+                   a + ' ' + sign + ' ' + b);
+    }
+
+    case Opcodes::op_fDiv: {
+      auto a = Read(arg(1), VarValue::kType_Float);
+      auto b = Read(arg(2), VarValue::kType_Float);
+      return Store(arg(0), VarValue::kType_Float,
+                   "fDiv(" + a + ", " + b + ')');
+    }
+
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Float_Neg:
+      return Store(arg(0), VarValue::kType_Float,
+                   Read(arg(1), VarValue::kType_Float) + " * -1.0f");
+
+    case Opcodes::op_Not:
+      return Store(arg(0), VarValue::kType_Bool,
+                   "!(" + Condition(arg(1)) + ')');
+
+    case Opcodes::op_Bool_Not:
+      return Store(arg(0), VarValue::kType_Bool,
+                   '!' + Read(arg(1), VarValue::kType_Bool));
+
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge: {
+      uint8_t type = GetStaticType(arg(1));
+      if (type != kUnknownType && type == GetStaticType(arg(2))) {
+        auto a = Read(arg(1), type);
+        auto b = Read(arg(2), type);
+        return Store(arg(0), VarValue::kType_Bool,
+                     a + ' ' + GetComparison(op) + ' ' + b);
+      }
+      Sync(arg(1));
+      Sync(arg(2));
+      return Store(arg(0), VarValue::kType_Bool,
+                   "compareValues(" + Ref(arg(1)) + ", " + Ref(arg(2)) +
+                     ", " + GetComparator(op) + ')');
+    }
+
+    case Opcodes::op_Int_Cmp_eq:
+    case Opcodes::op_Int_Cmp_lt:
+    case Opcodes::op_Int_Cmp_le:
+    case Opcodes::op_Int_Cmp_gt:
+    case Opcodes::op_Int_Cmp_ge:
+    case Opcodes::op_Float_Cmp_eq:
+    case Opcodes::op_Float_Cmp_lt:
+    case Opcodes::op_Float_Cmp_le:
+    case Opcodes::op_Float_Cmp_gt:
+    case Opcodes::op_Float_Cmp_ge: {
+      auto a = Read(arg(1), GetOperandType(op));
+      auto b = Read(arg(2), GetOperandType(op));
+      return Store(arg(0), VarValue::kType_Bool,
+                   a + ' ' + GetComparison(op) + ' ' + b);
+    }
+
+    case Opcodes::op_Assign:
+      if (IsUnboxed(arg(0))) {
+        return Store(arg(0), unboxed[arg(0).index],
+                     Read(arg(1), unboxed[arg(0).index]));
+      }
+      Sync(arg(1));
+      return Line(Ref(arg(0)) + " = " + Ref(arg(1)) + ';');
+
+    case Opcodes::op_Cast:
+      return CompileCast(line);
+
+    case Opcodes::op_Jmp:
+      return Jump(line, arg(0));
+
+    case Opcodes::op_Jmpt:
+    case Opcodes::op_Jmpf:
+    case Opcodes::op_Bool_Jmpt:
+    case Opcodes::op_Bool_Jmpf: {
+      bool isTyped =
+        op == Opcodes::op_Bool_Jmpt || op == Opcodes::op_Bool_Jmpf;
+      auto condition = isTyped ? Read(arg(0), VarValue::kType_Bool)
+                               : Condition(arg(0));
+      bool jumpIfTrue = op == Opcodes::op_Jmpt || op == Opcodes::op_Bool_Jmpt;
+      Line(jumpIfTrue ? "if (" + condition + ") {"
+                      : "if (!(" + condition + ")) {");
+      indent += "  ";
+      Jump(line, arg(1));
+      indent.resize(indent.size() - 2);
+      return Line("}");
+    }
+
+    case Opcodes::op_Return:
+      if (IsUnboxed(arg(0))) {
+        Line("result.Set" + std::string(GetAccessor(unboxed[arg(0).index])) +
+             "(v" + std::to_string(arg(0).index) + ");");
+      } else {
+        Line("result = " + Ref(arg(0)) + ';');
+      }
+      return Line("return LinkedFunctionCode::kAotDone;");
+
+    case Opcodes::op_StrCat:
+      usesVM = true;
+      Sync(arg(1));
+      Sync(arg(2));
+      Line("strCat(" + Ref(arg(0)) + ", " + Ref(arg(1)) + ", " + Ref(arg(2)) +
+           ", vm.stringPool, vm.maxStringLength);");
+      return Reload(arg(0));
+
+    case Opcodes::op_Array_Length:
+      if (IsUnboxed(arg(0))) {
+        auto index = std::to_string(arg(0).index);
+        Line("if (auto elements = " + Ref(arg(1)) + ".GetArray())");
+        Line("  v" + index + " = int32_t(elements->GetSize());");
+        Line("else");
+        return Line("  v" + index + " = 0;");
+      }
+      return CompileArrayAccess(line);
+
+    case Opcodes::op_Array_GetElement:
+    case Opcodes::op_Array_SetElement:
+      return CompileArrayElement(line);
+
+    default:
+      return CompileArrayAccess(line);
+  }
+}
+
+// Elements of Int, Float and Bool arrays are accessed directly if the index
+// is an Int and the type of the value is known. Anything else, e.g. an index
+// out of range, goes the interpreter's way
+void FunctionCompiler::CompileArrayElement(size_t line)
+{
+  bool isGet = code.instructions[line].op == Opcodes::op_Array_GetElement;
+  auto& value = GetOperand(line, isGet ? 0 : 2);
+  auto& array = GetOperand(line, isGet ? 1 : 0);
+  auto& index = GetOperand(line, isGet ? 2 : 1);
+
+  uint8_t type = GetStaticType(value);
+  if (GetStaticType(index) != VarValue::kType_Integer || type == kUnknownType)
+    return CompileArrayAccess(line);
+
+  auto i = Read(index, VarValue::kType_Integer);
+  auto elements = std::string("elements->") + GetArrayElements(type);
+  Line("if (auto elements = " + Ref(array) + ".GetArray();");
+  Line("    elements && elements->type == " + GetArrayType(type) + " &&");
+  Line("    uint32_t(" + i + ") < " + elements + ".size()) {");
+  indent += "  ";
+  if (isGet)
+    Store(value, type, elements + '[' + i + ']');
+  else
+    Line(elements + '[' + i + "] = " + Read(value, type) + ';');
+  indent.resize(indent.size() - 2);
+  Line("} else {");
+  indent += "  ";
+  // A result variable can't take another type
+  if (isGet)
+    Fallback(line);
+  else
+    CompileArrayAccess(line);
+  indent.resize(indent.size() - 2);
+  Line("}");
+}
+
+// Array opcodes, through the interpreter's functions
+void FunctionCompiler::CompileArrayAccess(size_t line)
+{
+  uint8_t op = code.instructions[line].op;
+  std::string call;
+  switch (op) {
+    case Opcodes::op_Array_Create:
+      usesVM = true;
+      call = "arrayCreate(";
+      break;
+    case Opcodes::op_Array_Length:
+      call = "arrayLength(";
+      break;
+    case Opcodes::op_Array_GetElement:
+      call = "arrayGetElement(";
+      break;
+    case Opcodes::op_Array_SetElement:
+      call = "arraySetElement(";
+      break;
+    case Opcodes::op_Array_FindElement:
+      call = "arrayFindElement(";
+      break;
+    default:
+      call = "arrayRFindElement(";
+  }
+
+  int numOperands = GetNumFixedOperands(op);
+  for (int i = 0; i < numOperands; ++i) {
+    Sync(GetOperand(line, i));
+    call += Ref(GetOperand(line, i)) + (i + 1 < numOperands ? ", " : "");
+  }
+  if (op == Opcodes::op_Array_Create)
+    call += ", vm.maxArraySize";
+  Line(call + ");");
+
+  int result = GetResultOperand(op);
+  if (result >= 0)
+    Reload(GetOperand(line, result));
+}
+
+// Casts to Int, Float, Bool and String depend on the type of the result
+// variable, casts to objects are left to the interpreter
+void FunctionCompiler::CompileCast(size_t line)
+{
+  auto& result = GetOperand(line, 0);
+  auto& value = GetOperand(line, 1);
+
+  if (IsUnboxed(result)) {
+    uint8_t type = unboxed[result.index];
+    uint8_t valueType = GetStaticType(value);
+    if (valueType == type)
+      return Store(result, type, Read(value, type));
+    // Float to Int rounds the way VarValue::CastToInt does
+    if (valueType != kUnknownType && type != VarValue::kType_Integer) {
+      return Store(result, type,
+                   std::string(GetCppType(type)) + '(' +
+                     Read(value, valueType) + ')');
+    }
+    Sync(value);
+    return Store(result, type,
+                 Ref(value) + ".CastTo" + GetAccessor(type) + "().Get" +
+                   GetAccessor(type) + "()");
+  }
+
+  Sync(value);
+  auto to = Ref(result), from = Ref(value);
+  Line("switch (" + to + ".GetType()) {");
+  Line("  case VarValue::kType_Object:");
+  indent += "    ";
+  Fallback(line);
+  indent.resize(indent.size() - 4);
+  for (uint8_t type : { VarValue::kType_Integer, VarValue::kType_Float,
+                        VarValue::kType_Bool }) {
+    Line("  case " + GetVarValueType(type) + ':');
+    Line("    " + to + " = " + from + ".CastTo" + GetAccessor(type) + "();");
+    Line("    break;");
+  }
+  Line("  case VarValue::kType_String:");
+  Line("    " + to + " = self.CastToString(" + from + ");");
+  Line("    break;");
+  Line("  default:");
+  Line("    throw std::runtime_error(\"Wrong type in Cast\");");
+  Line("}");
+}
+
+void FunctionCompiler::Compile(const std::string& name, std::ostream& out)
+{
+  size_t numInstructions = code.instructions.size();
+  isJumpTarget.assign(numInstructions, false);
+
+  // Instructions first, they tell which labels and variables are needed
+  std::vector<std::string> instructions(numInstructions);
+  for (size_t line = 0; line < numInstructions; ++line) {
+    body.str("");
+    indent = "  ";
+    CompileInstruction(line);
+    instructions[line] = body.str();
+  }
+
+  out << "size_t " << name << "(ActivePexInstance& self, "
+      << "LinkedFunctionCode& code,\n"
+      << "    VarValue* locals, VarValue& result)\n{\n";
+
+  if (usesVM)
+    out << "  auto& vm = *self.parentVM;\n";
+  if (usesMembers)
+    out << "  VarValue* members = self.variables.data();\n";
+  if (usesConstants)
+    out << "  VarValue* constants = code.constants.data();\n";
+  else
+    out << "  (void)code;\n";
+
+  // The types of parameters aren't checked by the caller
+  for (size_t i = code.numLocals; i < code.frame.size(); ++i) {
+    if (isUsedLocal[i] && unboxed[i] != kUnknownType) {
+      out << "  if (locals[" << i << "].GetType() != "
+          << GetVarValueType(unboxed[i]) << ")\n    return 0;\n";
+    }
+  }
+  for (size_t i = 0; i < code.frame.size(); ++i) {
+    if (isUsedLocal[i] && unboxed[i] != kUnknownType) {
+      out << "  " << GetCppType(unboxed[i]) << " v" << i << " = locals[" << i
+          << "].Get" << GetAccessor(unboxed[i]) << "();\n";
+    }
+  }
+  if (numFallbacks)
+    out << "  size_t resume;\n";
+  out << '\n';
+
+  for (size_t line = 0; line < numInstructions; ++line) {
+    if (isJumpTarget[line])
+      out << 'L' << line << ":\n";
+    out << instructions[line];
+  }
+  out << "  result = VarValue::None();\n"
+      << "  return LinkedFunctionCode::kAotDone;\n";
+
+  if (numFallbacks) {
+    out << "\ninterpret:\n";
+    for (size_t i = 0; i < code.frame.size(); ++i) {
+      if (isUsedLocal[i] && unboxed[i] != kUnknownType) {
+        out << "  locals[" << i << "].Set" << GetAccessor(unboxed[i]) << "(v"
+            << i << ");\n";
+      }
+    }
+    out << "  return resume;\n";
+  }
+  out << "}\n";
+}
+}
+
+uint64_t AotCompiler::Hash(const LinkedFunctionCode& code)
+{
+  Hasher hasher;
+  hasher.Add(uint64_t(code.numLocals));
+  hasher.Add(uint64_t(code.frame.size()));
+  for (auto& value : code.frame) {
+    hasher.Add(value.GetType());
+  }
+
+  hasher.Add(uint64_t(code.instructions.size()));
+  for (auto& instruction : code.instructions) {
+    hasher.Add(instruction.op);
+    hasher.Add(instruction.numOperands);
+    hasher.Add(instruction.firstOperand);
+  }
+
+  hasher.Add(uint64_t(code.operands.size()));
+  for (auto& operand : code.operands) {
+    hasher.Add(operand.source);
+    hasher.Add(operand.index);
+  }
+
+  hasher.Add(uint64_t(code.constants.size()));
+  for (auto& value : code.constants) {
+    hasher.Add(value.GetType());
+    switch (value.GetType()) {
+      case VarValue::kType_Integer:
+        hasher.Add(value.GetInt());
+        break;
+      case VarValue::kType_Float: {
+        uint32_t bits;
+        float f = value.GetFloat();
+        memcpy(&bits, &f, sizeof(bits));
+        hasher.Add(bits);
+      } break;
+      case VarValue::kType_Bool:
+        hasher.Add(value.GetBool());
+        break;
+      case VarValue::kType_String:
+      case VarValue::kType_Identifier:
+        if (auto str = (const char*)value) {
+          hasher.Add(uint64_t(strlen(str)));
+          hasher.Add(str, strlen(str));
+        } else {
+          hasher.Add(uint64_t(-1));
+        }
+        break;
+    }
+  }
+  return hasher.Get();
+}
+
+AotCompiler::Output AotCompiler::Compile(
+  const std::vector<std::shared_ptr<PexScript>>& scripts,
+  const std::string& tableFunction,
+  const std::function<bool(const std::string&)>& filter)
+{
+  std::vector<const LinkedFunctionCode*> functions;
+  for (auto& script : scripts) {
+    for (auto& object : script->objectTable.m_data) {
+      for (auto& state : object.states) {
+        for (auto& function : state.functions) {
+          if (!function.function.IsNative() && function.function.linkedCode)
+            functions.push_back(function.function.linkedCode.get());
+        }
+      }
+      for (auto& property : object.properties) {
+        for (auto* handler :
+             { &property.readHandler, &property.writeHandler }) {
+          if (handler->linkedCode)
+            functions.push_back(handler->linkedCode.get());
+        }
+      }
+    }
+  }
+
+  Output output;
+  std::ostringstream out, table;
+  out << "// Generated by pex_aot_compiler, do not edit\n"
+      << "#include \"AotCompiler.h\"\n"
+      << "#include \"OpcodesImplementation.h\"\n"
+      << "#include \"VirtualMachine.h\"\n"
+      << "#include <functional>\n"
+      << "#include <stdexcept>\n\n"
+      << "namespace {\n"
+      << "using namespace OpcodesImplementation;\n";
+
+  for (auto* code : functions) {
+    auto name = GetProfilerName(*code);
+    if (filter && !filter(name))
+      continue;
+
+    auto functionName = 'F' + std::to_string(output.numFunctions);
+    FunctionCompiler compiler(*code);
+    out << "\n// " << name << '\n';
+    compiler.Compile(functionName, out);
+
+    table << "    { " << Quote(code->scriptName) << ", "
+          << Quote(code->stateName) << ", " << Quote(code->functionName)
+          << ", " << int(code->functionType) << ", 0x" << std::hex
+          << Hash(*code) << std::dec << "ull, &" << functionName << " },\n";
+
+    ++output.numFunctions;
+    output.numInstructions += code->instructions.size();
+    output.numFallbacks += compiler.GetNumFallbacks();
+  }
+
+  out << "}\n\n"
+      << "const std::vector<AotFunction>& " << tableFunction << "()\n"
+      << "{\n"
+      << "  static const std::vector<AotFunction> functions = {\n"
+      << table.str() << "  };\n"
+      << "  return functions;\n"
+      << "}\n";
+  output.source = out.str();
+  return output;
+}
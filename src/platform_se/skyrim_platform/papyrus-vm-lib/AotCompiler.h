@@ -0,0 +1,51 @@
+#pragma once
+#include "Structures.h"
+#include <functional>
+
+// Compiles linked Papyrus functions to C++ ahead of time. The generated code
+// is built into the host and bound to the scripts with
+// VirtualMachine::RegisterAotFunctions.
+//
+// Generated functions work on the interpreter's frame, so the two can hand
+// over at any instruction. Int, Float and Bool locals that can only ever hold
+// their declared type are kept in C++ variables; parameters of those types
+// are checked on entry. Calls and property accesses aren't compiled: the
+// generated code stores its variables back to the frame and the interpreter
+// continues from that instruction. Results, errors and side effects are the
+// same as with the interpreter.
+
+// An entry of the table the generated file defines
+struct AotFunction
+{
+  const char* scriptName;
+  const char* stateName;
+  const char* functionName;
+  uint8_t functionType; // as LinkedFunctionCode::functionType
+  uint64_t codeHash;    // AotCompiler::Hash of the compiled code
+  LinkedFunctionCode::AotEntry entry;
+};
+
+namespace AotCompiler {
+
+struct Output
+{
+  std::string source;
+  size_t numFunctions = 0;
+  size_t numInstructions = 0;
+  // Places where the compiled code hands over to the interpreter: calls,
+  // property accesses and checks that fail
+  size_t numFallbacks = 0;
+};
+
+// Covers everything the generated code depends on. Code linked with and
+// without 'optimize' differs, and so does code of an edited script
+uint64_t Hash(const LinkedFunctionCode& code);
+
+// Compiles the functions of linked scripts. The generated file defines
+//   const std::vector<AotFunction>& <tableFunction>();
+// 'filter' selects functions by the name Profiler prints, e.g. Script.Foo,
+// Script.State.Foo or Script.Property.get
+Output Compile(const std::vector<std::shared_ptr<PexScript>>& scripts,
+               const std::string& tableFunction,
+               const std::function<bool(const std::string&)>& filter = {});
+}
@@ -0,0 +1,109 @@
+#include "FrameArena.h"
+#include <new>
+
+FrameArena::Frame::Frame(FrameArena& arena_)
+  : arena(arena_)
+  , chunkIndex(arena_.chunkIndex)
+  , offset(arena_.offset)
+{
+}
+
+FrameArena::Frame::~Frame()
+{
+  for (auto block = lastBlock; block; block = block->prev) {
+    for (size_t i = 0; i < block->count; ++i) {
+      block->values[i].~VarValue();
+    }
+  }
+
+  arena.chunkIndex = chunkIndex;
+  arena.offset = offset;
+}
+
+VarValue* FrameArena::Frame::PushValues(const VarValue* values, size_t count)
+{
+  VarValue* result = AllocateValues(count);
+  for (size_t i = 0; i < count; ++i) {
+    new (result + i) VarValue(values[i]);
+    ++lastBlock->count;
+  }
+  return result;
+}
+
+VarValue* FrameArena::Frame::PushValues(VarValue* const* values, size_t count)
+{
+  VarValue* result = AllocateValues(count);
+  for (size_t i = 0; i < count; ++i) {
+    new (result + i) VarValue(*values[i]);
+    ++lastBlock->count;
+  }
+  return result;
+}
+
+VarValue** FrameArena::Frame::PushPointers(size_t count)
+{
+  return static_cast<VarValue**>(Allocate(sizeof(VarValue*) * count));
+}
+
+void* FrameArena::Frame::Allocate(size_t size)
+{
+#ifdef PAPYRUS_VM_HEAP_FRAMES
+  heapBlocks.push_back(std::make_unique<uint8_t[]>(size ? size : 1));
+  return heapBlocks.back().get();
+#else
+  return arena.Allocate(size);
+#endif
+}
+
+// The block header goes in front of the values so the destructor can find
+// them without a separate list. count grows as values are constructed, so a
+// throwing copy leaves only constructed values to destroy
+VarValue* FrameArena::Frame::AllocateValues(size_t count)
+{
+  static_assert(sizeof(ValueBlock) % alignof(VarValue) == 0);
+
+  auto memory = static_cast<uint8_t*>(
+    Allocate(sizeof(ValueBlock) + sizeof(VarValue) * count));
+
+  auto block = new (memory) ValueBlock;
+  block->prev = lastBlock;
+  block->values = reinterpret_cast<VarValue*>(memory + sizeof(ValueBlock));
+  lastBlock = block;
+  return block->values;
+}
+
+size_t FrameArena::GetCapacity() const
+{
+  size_t capacity = 0;
+  for (auto& chunk : chunks) {
+    capacity += chunk.size;
+  }
+  return capacity;
+}
+
+void* FrameArena::Allocate(size_t size)
+{
+  size = (size + kAlignment - 1) & ~size_t(kAlignment - 1);
+
+  if (!chunks.empty() && offset + size <= chunks[chunkIndex].size) {
+    void* result = chunks[chunkIndex].data.get() + offset;
+    offset += size;
+    return result;
+  }
+
+  // Chunks above the current one hold no live frames and can be replaced
+  size_t next = chunks.empty() ? 0 : chunkIndex + 1;
+  if (next == chunks.size()) {
+    chunks.emplace_back();
+  }
+
+  auto& chunk = chunks[next];
+  if (chunk.size < size) {
+    chunk.size = std::max<size_t>(kChunkSize, size);
+    chunk.data.reset(new uint8_t[chunk.size]);
+  }
+
+  chunkIndex = next;
+  offset = size;
+  return chunk.data.get();
+}
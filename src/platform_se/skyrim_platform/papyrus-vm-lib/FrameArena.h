@@ -0,0 +1,78 @@
+#pragma once
+#include "Structures.h"
+
+// Stack memory for call frames of one VM: locals, resolved operands and
+// outgoing call arguments. A Frame takes memory on top of the stack and gives
+// it back when destroyed, so frames must be released in LIFO order, which
+// nested StartFunction calls do naturally.
+//
+// Define PAPYRUS_VM_HEAP_FRAMES to allocate every block separately on the
+// heap instead (the old behaviour), e.g. to let ASan check frame accesses.
+class FrameArena
+{
+public:
+  class Frame
+  {
+  public:
+    explicit Frame(FrameArena& arena);
+    ~Frame();
+
+    Frame(const Frame&) = delete;
+    Frame& operator=(const Frame&) = delete;
+
+    // Copies of values[0..count)
+    VarValue* PushValues(const VarValue* values, size_t count);
+
+    // Copies of *values[0..count)
+    VarValue* PushValues(VarValue* const* values, size_t count);
+
+    // Uninitialized
+    VarValue** PushPointers(size_t count);
+
+  private:
+    struct ValueBlock
+    {
+      ValueBlock* prev = nullptr;
+      VarValue* values = nullptr;
+      size_t count = 0;
+    };
+
+    void* Allocate(size_t size);
+    VarValue* AllocateValues(size_t count);
+
+    FrameArena& arena;
+    size_t chunkIndex = 0;
+    size_t offset = 0;
+    ValueBlock* lastBlock = nullptr;
+
+#ifdef PAPYRUS_VM_HEAP_FRAMES
+    std::vector<std::unique_ptr<uint8_t[]>> heapBlocks;
+#endif
+  };
+
+  FrameArena() = default;
+  FrameArena(const FrameArena&) = delete;
+  FrameArena& operator=(const FrameArena&) = delete;
+
+  // Bytes reserved by the arena. Chunks are kept for reuse once allocated
+  size_t GetCapacity() const;
+
+private:
+  enum
+  {
+    kChunkSize = 64 * 1024,
+    kAlignment = 16,
+  };
+
+  struct Chunk
+  {
+    std::unique_ptr<uint8_t[]> data;
+    size_t size = 0;
+  };
+
+  void* Allocate(size_t size);
+
+  std::vector<Chunk> chunks;
+  size_t chunkIndex = 0;
+  size_t offset = 0;
+};
@@ -0,0 +1,237 @@
+#include "FunctionLinker.h"
+#include "FunctionOptimizer.h"
+
+// Must match the layout of InstanceTemplate::variables
+bool FunctionLinker::FindMember(const PexScript& script,
+                                std::string_view name, uint32_t& outIndex)
+{
+  uint32_t index = 0;
+  for (auto& object : script.objectTable.m_data) {
+    for (auto& var : object.variables) {
+      if (var.name == name) {
+        outIndex = index;
+        return true;
+      }
+      ++index;
+    }
+  }
+
+  if (name == "::State") {
+    outIndex = index;
+    return true;
+  }
+  return false;
+}
+
+namespace {
+
+bool FindLocal(const FunctionInfo& function, std::string_view name,
+               uint32_t& outIndex)
+{
+  for (size_t i = 0; i < function.locals.size(); ++i) {
+    if (function.locals[i].name == name) {
+      outIndex = static_cast<uint32_t>(i);
+      return true;
+    }
+  }
+
+  for (size_t i = 0; i < function.params.size(); ++i) {
+    if (function.params[i].name == name) {
+      outIndex = static_cast<uint32_t>(function.locals.size() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+LinkedFunctionCode::Operand ResolveOperand(const VarValue& value,
+                                           const FunctionInfo& function,
+                                           const PexScript& script,
+                                           LinkedFunctionCode& code)
+{
+  LinkedFunctionCode::Operand operand;
+
+  if (value.GetType() == VarValue::kType_Identifier &&
+      (const char*)value != nullptr) {
+    std::string_view name = (const char*)value;
+
+    if (name == "self") {
+      operand.source = LinkedFunctionCode::kSource_Self;
+      return operand;
+    }
+    if (FindLocal(function, name, operand.index)) {
+      operand.source = LinkedFunctionCode::kSource_Local;
+      return operand;
+    }
+    if (FunctionLinker::FindMember(script, name, operand.index)) {
+      operand.source = LinkedFunctionCode::kSource_Member;
+      return operand;
+    }
+
+    // Function and class names are passed to the call opcodes as strings
+    operand.source = LinkedFunctionCode::kSource_Constant;
+    operand.index = static_cast<uint32_t>(code.constants.size());
+    code.constants.push_back(VarValue((const char*)value));
+    return operand;
+  }
+
+  operand.source = LinkedFunctionCode::kSource_Constant;
+  operand.index = static_cast<uint32_t>(code.constants.size());
+  code.constants.push_back(value);
+  return operand;
+}
+
+void LinkFunction(FunctionInfo& function, const PexScript& script,
+                  std::string_view stateName, std::string_view functionName,
+                  uint8_t functionType, bool optimize)
+{
+  auto code = FunctionLinker::Link(function, script);
+  code->scriptName = script.source;
+  code->stateName = stateName;
+  code->functionName = functionName;
+  code->functionType = functionType;
+
+  for (auto& debugFunction : script.debugInfo.m_data) {
+    if (debugFunction.type == functionType &&
+        debugFunction.stateName == stateName &&
+        debugFunction.fnName == functionName &&
+        debugFunction.lineNumbers.size() == code->instructions.size()) {
+      code->lineNumbers = &debugFunction.lineNumbers;
+      break;
+    }
+  }
+
+  if (optimize)
+    FunctionOptimizer::Optimize(*code);
+
+  function.linkedCode = std::move(code);
+}
+
+void BuildInstanceTemplate(PexScript& script)
+{
+  InstanceTemplate instanceTemplate;
+
+  for (auto& object : script.objectTable.m_data) {
+    for (auto& var : object.variables) {
+      VarValue value = var.value;
+      if (value.GetType() == VarValue::kType_Object && !(IGameObject*)value)
+        value = VarValue(ActivePexInstance::GetTypeByName(var.typeName));
+
+      instanceTemplate.variables.push_back(value);
+      instanceTemplate.variableNames.push_back(var.name);
+      instanceTemplate.variableTypes.push_back(var.typeName);
+    }
+  }
+
+  // Current state, for GotoState and GetState
+  instanceTemplate.variables.push_back(VarValue(""));
+  instanceTemplate.variableNames.push_back("::State");
+  instanceTemplate.variableTypes.push_back("String");
+
+  instanceTemplate.selfObjectTypeId = VarValue::InternObjectType(script.source);
+
+  for (auto& object : script.objectTable.m_data) {
+    for (auto& prop : object.properties) {
+      uint32_t index = 0;
+      if (!prop.autoVarName.empty() &&
+          FunctionLinker::FindMember(script, prop.autoVarName, index)) {
+        instanceTemplate.autoProperties.push_back({ prop.name, index });
+      }
+    }
+  }
+
+  script.instanceTemplate = std::move(instanceTemplate);
+}
+}
+
+void FunctionLinker::LinkScript(PexScript& script, bool optimize)
+{
+  BuildInstanceTemplate(script);
+
+  script.functionTable.functions.clear();
+
+  for (auto& object : script.objectTable.m_data) {
+    for (auto& state : object.states) {
+      for (auto& func : state.functions) {
+        LinkFunction(func.function, script, state.name, func.name, 0,
+                     optimize);
+        if (func.function.IsNative()) {
+          func.function.native = NativeSlot::Get(script.source, func.name);
+        }
+        script.functionTable.functions.insert(
+          { { state.name, func.name }, &func.function });
+      }
+    }
+    for (auto& prop : object.properties) {
+      if ((prop.flags & 5) == prop.kFlags_Read) {
+        LinkFunction(prop.readHandler, script, "", prop.name, 1, optimize);
+      }
+      if ((prop.flags & 6) == prop.kFlags_Write) {
+        LinkFunction(prop.writeHandler, script, "", prop.name, 2, optimize);
+      }
+    }
+  }
+}
+
+std::shared_ptr<LinkedFunctionCode> FunctionLinker::Link(
+  const FunctionInfo& function, const PexScript& script)
+{
+  auto code = std::make_shared<LinkedFunctionCode>();
+
+  code->numLocals = function.locals.size();
+  code->frame.reserve(function.locals.size() + function.params.size());
+
+  for (auto& var : function.locals) {
+    VarValue temp = VarValue(ActivePexInstance::GetTypeByName(var.type));
+    temp.SetObjectType(var.type);
+    code->frame.push_back(temp);
+  }
+
+  for (auto& var : function.params) {
+    VarValue temp = VarValue(ActivePexInstance::GetTypeByName(var.type));
+    temp.SetObjectType(var.type);
+    code->frame.push_back(temp);
+  }
+
+  auto& sourceOpCode = function.code.instructions;
+  code->instructions.reserve(sourceOpCode.size());
+
+  size_t numOperands = 0;
+  for (auto& sourceInstruction : sourceOpCode) {
+    numOperands += sourceInstruction.args.size();
+  }
+  code->operands.reserve(numOperands);
+
+  uint32_t numPropertyCaches = 0;
+
+  for (auto& sourceInstruction : sourceOpCode) {
+    LinkedFunctionCode::Instruction instruction;
+    instruction.op = sourceInstruction.op;
+    instruction.firstOperand = static_cast<uint32_t>(code->operands.size());
+    instruction.numOperands =
+      static_cast<uint16_t>(sourceInstruction.args.size());
+
+    for (auto& arg : sourceInstruction.args) {
+      code->operands.push_back(ResolveOperand(arg, function, script, *code));
+    }
+
+    // Class and function names of 'callstatic' are always identifiers
+    auto& args = sourceInstruction.args;
+    if (instruction.op == FunctionCode::kOp_CallStatic && args.size() >= 2 &&
+        (const char*)args[0] && (const char*)args[1]) {
+      instruction.native =
+        NativeSlot::Get((const char*)args[0], (const char*)args[1]);
+    }
+
+    if (instruction.op == FunctionCode::kOp_PropGet ||
+        instruction.op == FunctionCode::kOp_PropSet) {
+      instruction.cacheIndex = numPropertyCaches++;
+    }
+    code->instructions.push_back(instruction);
+  }
+
+  code->propertyCaches =
+    std::make_unique<LinkedFunctionCode::PropertyCache[]>(numPropertyCaches);
+
+  return code;
+}
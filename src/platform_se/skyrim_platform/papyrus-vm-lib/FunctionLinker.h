@@ -0,0 +1,17 @@
+#pragma once
+#include "Structures.h"
+
+namespace FunctionLinker {
+
+// Links every function of the script including property handlers and
+// fills its FunctionTable and InstanceTemplate. See FunctionOptimizer for
+// 'optimize'
+void LinkScript(PexScript& script, bool optimize = false);
+
+std::shared_ptr<LinkedFunctionCode> Link(const FunctionInfo& function,
+                                         const PexScript& script);
+
+// Index of a script variable in ActivePexInstance::variables
+bool FindMember(const PexScript& script, std::string_view name,
+                uint32_t& outIndex);
+}
@@ -0,0 +1,955 @@
+#include "FunctionOptimizer.h"
+#include "OpcodesImplementation.h"
+
+namespace {
+using Opcodes = OpcodesImplementation::Opcodes;
+using Operand = LinkedFunctionCode::Operand;
+
+constexpr uint8_t kUnknownType = 0xff;
+
+// Passes are repeated while they find something, each one may enable others
+constexpr int kMaxRounds = 8;
+
+// Operands before the arguments of call instructions, -1 for opcodes the
+// optimizer doesn't know
+int GetNumFixedOperands(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_Nop:
+      return 0;
+    case Opcodes::op_Jmp:
+    case Opcodes::op_Return:
+      return 1;
+    case Opcodes::op_Not:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Assign:
+    case Opcodes::op_Cast:
+    case Opcodes::op_Jmpt:
+    case Opcodes::op_Jmpf:
+    case Opcodes::op_Array_Create:
+    case Opcodes::op_Array_Length:
+      return 2;
+    case Opcodes::op_iAdd:
+    case Opcodes::op_fAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_fSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_fMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_CallParent:
+    case Opcodes::op_StrCat:
+    case Opcodes::op_PropGet:
+    case Opcodes::op_PropSet:
+    case Opcodes::op_Array_GetElement:
+    case Opcodes::op_Array_SetElement:
+      return 3;
+    case Opcodes::op_CallMethod:
+    case Opcodes::op_CallStatic:
+    case Opcodes::op_Array_FindElement:
+    case Opcodes::op_Array_RfindElement:
+      return 4;
+    default:
+      return -1;
+  }
+}
+
+// Operand the instruction may store to, -1 if there is none
+int GetResultOperand(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_iAdd:
+    case Opcodes::op_fAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_fSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_fMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_Not:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Assign:
+    case Opcodes::op_Cast:
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_StrCat:
+    case Opcodes::op_Array_Create:
+    case Opcodes::op_Array_Length:
+    case Opcodes::op_Array_GetElement:
+      return 0;
+    case Opcodes::op_CallParent:
+    case Opcodes::op_Array_FindElement:
+    case Opcodes::op_Array_RfindElement:
+      return 1;
+    case Opcodes::op_CallMethod:
+    case Opcodes::op_CallStatic:
+    case Opcodes::op_PropGet:
+      return 2;
+    default:
+      return -1;
+  }
+}
+
+// Always stores its result and does nothing else, though it may throw on
+// operands of the wrong type
+bool IsPure(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_iAdd:
+    case Opcodes::op_fAdd:
+    case Opcodes::op_iSub:
+    case Opcodes::op_fSub:
+    case Opcodes::op_iMul:
+    case Opcodes::op_fMul:
+    case Opcodes::op_iDiv:
+    case Opcodes::op_fDiv:
+    case Opcodes::op_iMod:
+    case Opcodes::op_Not:
+    case Opcodes::op_iNeg:
+    case Opcodes::op_fNeg:
+    case Opcodes::op_Assign:
+    case Opcodes::op_Cmp_eq:
+    case Opcodes::op_Cmp_lt:
+    case Opcodes::op_Cmp_le:
+    case Opcodes::op_Cmp_gt:
+    case Opcodes::op_Cmp_ge:
+    case Opcodes::op_StrCat:
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Overwrites the result operand on every path, so its old value is dead
+bool KillsResult(uint8_t op)
+{
+  return IsPure(op) || op == Opcodes::op_Array_FindElement ||
+    op == Opcodes::op_Array_RfindElement;
+}
+
+// These look at the type of the result operand before storing to it
+bool ReadsResult(uint8_t op)
+{
+  return op == Opcodes::op_Cast || op == Opcodes::op_Array_Create ||
+    op == Opcodes::op_Array_Length;
+}
+
+// Operand holding the jump offset, -1 for other instructions
+int GetOffsetOperand(uint8_t op)
+{
+  switch (op) {
+    case Opcodes::op_Jmp:
+      return 0;
+    case Opcodes::op_Jmpt:
+    case Opcodes::op_Jmpf:
+      return 1;
+    default:
+      return -1;
+  }
+}
+
+bool IsScalarType(uint8_t type)
+{
+  return type == VarValue::kType_Integer || type == VarValue::kType_Float ||
+    type == VarValue::kType_Bool || type == VarValue::kType_String;
+}
+
+// Same as the interpreter does for the instruction. Returns false if it
+// throws, so the error is left for run time
+bool Evaluate(uint8_t op, VarValue a, VarValue b, VarValue& outResult)
+{
+  try {
+    switch (op) {
+      case Opcodes::op_iAdd:
+      case Opcodes::op_fAdd:
+        outResult = a + b;
+        return true;
+      case Opcodes::op_iSub:
+      case Opcodes::op_fSub:
+        outResult = a - b;
+        return true;
+      case Opcodes::op_iMul:
+      case Opcodes::op_fMul:
+        outResult = a * b;
+        return true;
+      case Opcodes::op_iDiv:
+      case Opcodes::op_fDiv:
+        outResult = a / b;
+        return true;
+      case Opcodes::op_iMod:
+        outResult = a % b;
+        return true;
+      case Opcodes::op_Not:
+        outResult = !a;
+        return true;
+      case Opcodes::op_iNeg:
+        outResult = a * VarValue(-1);
+        return true;
+      case Opcodes::op_fNeg:
+        outResult = a * VarValue(-1.0f);
+        return true;
+      case Opcodes::op_Cmp_eq:
+        outResult = VarValue(a == b);
+        return true;
+      case Opcodes::op_Cmp_lt:
+        outResult = VarValue(a < b);
+        return true;
+      case Opcodes::op_Cmp_le:
+        outResult = VarValue(a <= b);
+        return true;
+      case Opcodes::op_Cmp_gt:
+        outResult = VarValue(a > b);
+        return true;
+      case Opcodes::op_Cmp_ge:
+        outResult = VarValue(a >= b);
+        return true;
+      default:
+        return false;
+    }
+  } catch (std::exception&) {
+    return false;
+  }
+}
+
+// Typed opcode doing the same as 'op' for operands of 'type', or 'op'
+uint8_t GetTypedOpcode(uint8_t op, uint8_t type)
+{
+  if (type == VarValue::kType_Integer) {
+    switch (op) {
+      case Opcodes::op_iAdd:
+      case Opcodes::op_fAdd:
+        return Opcodes::op_Int_Add;
+      case Opcodes::op_iSub:
+      case Opcodes::op_fSub:
+        return Opcodes::op_Int_Sub;
+      case Opcodes::op_iMul:
+      case Opcodes::op_fMul:
+        return Opcodes::op_Int_Mul;
+      case Opcodes::op_iNeg:
+        return Opcodes::op_Int_Neg;
+      case Opcodes::op_Cmp_eq:
+        return Opcodes::op_Int_Cmp_eq;
+      case Opcodes::op_Cmp_lt:
+        return Opcodes::op_Int_Cmp_lt;
+      case Opcodes::op_Cmp_le:
+        return Opcodes::op_Int_Cmp_le;
+      case Opcodes::op_Cmp_gt:
+        return Opcodes::op_Int_Cmp_gt;
+      case Opcodes::op_Cmp_ge:
+        return Opcodes::op_Int_Cmp_ge;
+    }
+  }
+  if (type == VarValue::kType_Float) {
+    switch (op) {
+      case Opcodes::op_iAdd:
+      case Opcodes::op_fAdd:
+        return Opcodes::op_Float_Add;
+      case Opcodes::op_iSub:
+      case Opcodes::op_fSub:
+        return Opcodes::op_Float_Sub;
+      case Opcodes::op_iMul:
+      case Opcodes::op_fMul:
+        return Opcodes::op_Float_Mul;
+      case Opcodes::op_fNeg:
+        return Opcodes::op_Float_Neg;
+      case Opcodes::op_Cmp_eq:
+        return Opcodes::op_Float_Cmp_eq;
+      case Opcodes::op_Cmp_lt:
+        return Opcodes::op_Float_Cmp_lt;
+      case Opcodes::op_Cmp_le:
+        return Opcodes::op_Float_Cmp_le;
+      case Opcodes::op_Cmp_gt:
+        return Opcodes::op_Float_Cmp_gt;
+      case Opcodes::op_Cmp_ge:
+        return Opcodes::op_Float_Cmp_ge;
+    }
+  }
+  if (type == VarValue::kType_Bool) {
+    switch (op) {
+      case Opcodes::op_Not:
+        return Opcodes::op_Bool_Not;
+      case Opcodes::op_Jmpt:
+        return Opcodes::op_Bool_Jmpt;
+      case Opcodes::op_Jmpf:
+        return Opcodes::op_Bool_Jmpf;
+    }
+  }
+  return op;
+}
+
+class Optimizer
+{
+public:
+  explicit Optimizer(LinkedFunctionCode& code_)
+    : code(code_)
+  {
+  }
+
+  bool Run()
+  {
+    if (!Validate())
+      return false;
+
+    for (int round = 0; round < kMaxRounds; ++round) {
+      bool changed = PropagateConstants();
+      changed |= ThreadJumps();
+      changed |= RemoveDeadTemps();
+      changed |= RemoveUnreachable();
+      if (!changed)
+        break;
+    }
+
+    Compact();
+    Specialize();
+    return true;
+  }
+
+private:
+  size_t GetNumInstructions() const { return code.instructions.size(); }
+
+  Operand& GetOperand(size_t line, size_t index)
+  {
+    return code.operands[code.instructions[line].firstOperand + index];
+  }
+
+  const VarValue* GetConstant(const Operand& operand) const
+  {
+    return operand.source == LinkedFunctionCode::kSource_Constant
+      ? &code.constants[operand.index]
+      : nullptr;
+  }
+
+  Operand AddConstant(const VarValue& value)
+  {
+    Operand operand;
+    operand.source = LinkedFunctionCode::kSource_Constant;
+    operand.index = static_cast<uint32_t>(code.constants.size());
+    code.constants.push_back(value);
+    return operand;
+  }
+
+  void MakeNop(size_t line)
+  {
+    code.instructions[line].op = Opcodes::op_Nop;
+    code.instructions[line].numOperands = 0;
+  }
+
+  // Validate has checked that every jump offset is a constant that stays
+  // within the function. Jumping to the end returns None
+  size_t GetTarget(size_t line)
+  {
+    int offsetOperand = GetOffsetOperand(code.instructions[line].op);
+    return line + (int)*GetConstant(GetOperand(line, offsetOperand));
+  }
+
+  void SetTarget(size_t line, size_t target)
+  {
+    int offsetOperand = GetOffsetOperand(code.instructions[line].op);
+    int32_t offset = static_cast<int32_t>(target) - static_cast<int32_t>(line);
+    GetOperand(line, offsetOperand) = AddConstant(VarValue(offset));
+  }
+
+  // First instruction at or after 'line' that isn't a Nop
+  size_t SkipNops(size_t line) const
+  {
+    while (line < GetNumInstructions() &&
+           code.instructions[line].op == Opcodes::op_Nop) {
+      ++line;
+    }
+    return line;
+  }
+
+  size_t GetSuccessors(size_t line, size_t (&outSuccessors)[2])
+  {
+    size_t numSuccessors = 0;
+    auto op = code.instructions[line].op;
+
+    if (op != Opcodes::op_Return && op != Opcodes::op_Jmp)
+      outSuccessors[numSuccessors++] = line + 1;
+    if (GetOffsetOperand(op) >= 0)
+      outSuccessors[numSuccessors++] = GetTarget(line);
+
+    // Falling off the end or jumping there leaves the function
+    if (numSuccessors > 1 && outSuccessors[1] >= GetNumInstructions())
+      --numSuccessors;
+    if (numSuccessors > 0 && outSuccessors[0] >= GetNumInstructions())
+      outSuccessors[0] = outSuccessors[--numSuccessors];
+    return numSuccessors;
+  }
+
+  std::vector<bool> GetJumpTargets()
+  {
+    std::vector<bool> targets(GetNumInstructions());
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      if (GetOffsetOperand(code.instructions[line].op) >= 0) {
+        size_t target = GetTarget(line);
+        if (target < targets.size())
+          targets[target] = true;
+      }
+    }
+    return targets;
+  }
+
+  uint8_t GetKnownType(const std::vector<bool>& stableLocals,
+                       const Operand& operand) const
+  {
+    if (auto constant = GetConstant(operand))
+      return constant->GetType();
+    if (operand.source == LinkedFunctionCode::kSource_Local &&
+        stableLocals[operand.index])
+      return code.frame[operand.index].GetType();
+    return kUnknownType;
+  }
+
+  // Type of the value the instruction stores whenever it stores something
+  uint8_t GetResultType(const std::vector<bool>& stableLocals, size_t line)
+  {
+    auto typeOf = [&](size_t index) {
+      return GetKnownType(stableLocals, GetOperand(line, index));
+    };
+
+    switch (code.instructions[line].op) {
+      case Opcodes::op_iAdd:
+      case Opcodes::op_fAdd:
+      case Opcodes::op_iSub:
+      case Opcodes::op_fSub:
+      case Opcodes::op_iMul:
+      case Opcodes::op_fMul:
+      case Opcodes::op_iDiv:
+      case Opcodes::op_fDiv:
+        // Operands of different types throw
+        return typeOf(1) != kUnknownType ? typeOf(1) : typeOf(2);
+      case Opcodes::op_iMod:
+      case Opcodes::op_iNeg:
+      case Opcodes::op_Array_Length:
+      case Opcodes::op_Array_FindElement:
+      case Opcodes::op_Array_RfindElement:
+        return VarValue::kType_Integer;
+      case Opcodes::op_fNeg:
+        return VarValue::kType_Float;
+      case Opcodes::op_Not:
+      case Opcodes::op_Cmp_eq:
+      case Opcodes::op_Cmp_lt:
+      case Opcodes::op_Cmp_le:
+      case Opcodes::op_Cmp_gt:
+      case Opcodes::op_Cmp_ge:
+        return VarValue::kType_Bool;
+      case Opcodes::op_StrCat:
+        return VarValue::kType_String;
+      case Opcodes::op_Assign:
+        return typeOf(1);
+      case Opcodes::op_Cast:
+        // Converts to the type the result already has
+        return IsScalarType(typeOf(0)) ? typeOf(0) : kUnknownType;
+      default:
+        return kUnknownType;
+    }
+  }
+
+  // Locals that always hold a value of their declared type. Parameters get
+  // whatever the caller passes
+  std::vector<bool> GetStableLocals()
+  {
+    std::vector<bool> stable(code.frame.size());
+    for (size_t i = 0; i < code.numLocals; ++i) {
+      stable[i] = IsScalarType(code.frame[i].GetType());
+    }
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t line = 0; line < GetNumInstructions(); ++line) {
+        int result = GetResultOperand(code.instructions[line].op);
+        if (result < 0)
+          continue;
+
+        auto& operand = GetOperand(line, result);
+        if (operand.source != LinkedFunctionCode::kSource_Local ||
+            !stable[operand.index])
+          continue;
+
+        if (GetResultType(stable, line) !=
+            code.frame[operand.index].GetType()) {
+          stable[operand.index] = false;
+          changed = true;
+        }
+      }
+    }
+    return stable;
+  }
+
+  bool Validate()
+  {
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      auto& instruction = code.instructions[line];
+      int numFixedOperands = GetNumFixedOperands(instruction.op);
+      if (numFixedOperands < 0 || instruction.numOperands < numFixedOperands)
+        return false;
+
+      int offsetOperand = GetOffsetOperand(instruction.op);
+      if (offsetOperand >= 0) {
+        auto offset = GetConstant(GetOperand(line, offsetOperand));
+        if (!offset || offset->GetType() != VarValue::kType_Integer)
+          return false;
+        int64_t target = static_cast<int64_t>(line) + (int)*offset;
+        if (target < 0 ||
+            target > static_cast<int64_t>(GetNumInstructions()))
+          return false;
+      }
+    }
+    return true;
+  }
+
+  // Whether a constant can stand in for the local read by the operand.
+  // Constants have no declared object type, so only operands that don't
+  // look at it qualify
+  bool CanPropagateInto(const std::vector<bool>& stableLocals, size_t line,
+                        size_t index)
+  {
+    auto op = code.instructions[line].op;
+    if (IsPure(op))
+      return index != 0;
+
+    switch (op) {
+      case Opcodes::op_Jmpt:
+      case Opcodes::op_Jmpf:
+      case Opcodes::op_Return:
+        return index == 0;
+      case Opcodes::op_Cast:
+        // Casts to objects check the declared type of the source
+        return index == 1 &&
+          IsScalarType(GetKnownType(stableLocals, GetOperand(line, 0)));
+      default:
+        return false;
+    }
+  }
+
+  // Replaces locals known to hold a constant within a basic block and
+  // folds instructions whose operands are all constants
+  bool PropagateConstants()
+  {
+    bool changed = false;
+    auto stable = GetStableLocals();
+    auto targets = GetJumpTargets();
+    std::unordered_map<uint32_t, uint32_t> knownLocals; // -> constant index
+
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      if (targets[line])
+        knownLocals.clear();
+
+      auto& instruction = code.instructions[line];
+      for (size_t i = 0; i < instruction.numOperands; ++i) {
+        auto& operand = GetOperand(line, i);
+        if (operand.source != LinkedFunctionCode::kSource_Local)
+          continue;
+
+        auto known = knownLocals.find(operand.index);
+        if (known != knownLocals.end() &&
+            CanPropagateInto(stable, line, i)) {
+          operand.source = LinkedFunctionCode::kSource_Constant;
+          operand.index = known->second;
+          changed = true;
+        }
+      }
+
+      if (Fold(stable, line))
+        changed = true;
+
+      int result = GetResultOperand(instruction.op);
+      if (result >= 0) {
+        auto& operand = GetOperand(line, result);
+        if (operand.source == LinkedFunctionCode::kSource_Local) {
+          knownLocals.erase(operand.index);
+
+          auto& source = GetOperand(line, 1);
+          if (instruction.op == Opcodes::op_Assign &&
+              source.source == LinkedFunctionCode::kSource_Constant)
+            knownLocals[operand.index] = source.index;
+        }
+      }
+    }
+    return changed;
+  }
+
+  bool Fold(const std::vector<bool>& stableLocals, size_t line)
+  {
+    auto& instruction = code.instructions[line];
+    VarValue result;
+
+    switch (instruction.op) {
+      case Opcodes::op_iAdd:
+      case Opcodes::op_fAdd:
+      case Opcodes::op_iSub:
+      case Opcodes::op_fSub:
+      case Opcodes::op_iMul:
+      case Opcodes::op_fMul:
+      case Opcodes::op_iDiv:
+      case Opcodes::op_fDiv:
+      case Opcodes::op_iMod:
+      case Opcodes::op_Cmp_eq:
+      case Opcodes::op_Cmp_lt:
+      case Opcodes::op_Cmp_le:
+      case Opcodes::op_Cmp_gt:
+      case Opcodes::op_Cmp_ge: {
+        auto a = GetConstant(GetOperand(line, 1));
+        auto b = GetConstant(GetOperand(line, 2));
+        if (!a || !b || !Evaluate(instruction.op, *a, *b, result))
+          return false;
+      } break;
+
+      case Opcodes::op_Not:
+      case Opcodes::op_iNeg:
+      case Opcodes::op_fNeg: {
+        auto a = GetConstant(GetOperand(line, 1));
+        if (!a || !Evaluate(instruction.op, *a, VarValue(), result))
+          return false;
+      } break;
+
+      case Opcodes::op_Cast: {
+        auto a = GetConstant(GetOperand(line, 1));
+        if (!a)
+          return false;
+        try {
+          switch (GetKnownType(stableLocals, GetOperand(line, 0))) {
+            case VarValue::kType_Integer:
+              result = a->CastToInt();
+              break;
+            case VarValue::kType_Float:
+              result = a->CastToFloat();
+              break;
+            case VarValue::kType_Bool:
+              result = a->CastToBool();
+              break;
+            default:
+              // Casts to strings allocate in the VM's string pool
+              return false;
+          }
+        } catch (std::exception&) {
+          return false;
+        }
+      } break;
+
+      case Opcodes::op_Jmpt:
+      case Opcodes::op_Jmpf: {
+        auto condition = GetConstant(GetOperand(line, 0));
+        if (!condition)
+          return false;
+
+        bool taken;
+        try {
+          taken = instruction.op == Opcodes::op_Jmpt
+            ? (bool)*condition
+            : (bool)!VarValue(*condition);
+        } catch (std::exception&) {
+          return false;
+        }
+
+        if (taken) {
+          GetOperand(line, 0) = GetOperand(line, 1);
+          instruction.op = Opcodes::op_Jmp;
+          instruction.numOperands = 1;
+        } else {
+          MakeNop(line);
+        }
+        return true;
+      }
+
+      default:
+        return false;
+    }
+
+    instruction.op = Opcodes::op_Assign;
+    instruction.numOperands = 2;
+    GetOperand(line, 1) = AddConstant(result);
+    return true;
+  }
+
+  // Retargets jumps landing on unconditional jumps, replaces jumps to a
+  // Return with the Return and drops jumps to the next instruction
+  bool ThreadJumps()
+  {
+    bool changed = false;
+
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      auto& instruction = code.instructions[line];
+      if (GetOffsetOperand(instruction.op) < 0)
+        continue;
+
+      size_t target = SkipNops(GetTarget(line));
+      for (size_t i = 0; i < GetNumInstructions(); ++i) {
+        if (target >= GetNumInstructions() ||
+            code.instructions[target].op != Opcodes::op_Jmp)
+          break;
+        target = SkipNops(GetTarget(target));
+      }
+
+      if (target != GetTarget(line)) {
+        SetTarget(line, target);
+        changed = true;
+      }
+
+      if (instruction.op != Opcodes::op_Jmp)
+        continue;
+
+      if (target == SkipNops(line + 1)) {
+        MakeNop(line);
+        changed = true;
+      } else if (target < GetNumInstructions() &&
+                 code.instructions[target].op == Opcodes::op_Return) {
+        // The copy gets operands of its own, passes rewrite them in place
+        auto returnInstruction = code.instructions[target];
+        auto firstOperand = static_cast<uint32_t>(code.operands.size());
+        for (size_t i = 0; i < returnInstruction.numOperands; ++i) {
+          auto operand = GetOperand(target, i);
+          code.operands.push_back(operand);
+        }
+        instruction = returnInstruction;
+        instruction.firstOperand = firstOperand;
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Live locals after every instruction
+  std::vector<std::vector<bool>> GetLiveLocals()
+  {
+    size_t numSlots = code.frame.size();
+    std::vector<std::vector<bool>> liveIn(GetNumInstructions(),
+                                          std::vector<bool>(numSlots));
+    std::vector<std::vector<bool>> liveOut = liveIn;
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t line = GetNumInstructions(); line-- > 0;) {
+        auto& instruction = code.instructions[line];
+
+        std::vector<bool> live(numSlots);
+        size_t successors[2];
+        size_t numSuccessors = GetSuccessors(line, successors);
+        for (size_t i = 0; i < numSuccessors; ++i) {
+          auto& successorLive = liveIn[successors[i]];
+          for (size_t slot = 0; slot < numSlots; ++slot) {
+            if (successorLive[slot])
+              live[slot] = true;
+          }
+        }
+        liveOut[line] = live;
+
+        int result = GetResultOperand(instruction.op);
+        if (result >= 0 && KillsResult(instruction.op)) {
+          auto& operand = GetOperand(line, result);
+          if (operand.source == LinkedFunctionCode::kSource_Local)
+            live[operand.index] = false;
+        }
+        for (size_t i = 0; i < instruction.numOperands; ++i) {
+          auto& operand = GetOperand(line, i);
+          bool isRead = static_cast<int>(i) != result ||
+            ReadsResult(instruction.op);
+          if (isRead && operand.source == LinkedFunctionCode::kSource_Local)
+            live[operand.index] = true;
+        }
+
+        if (live != liveIn[line]) {
+          liveIn[line] = std::move(live);
+          changed = true;
+        }
+      }
+    }
+    return liveOut;
+  }
+
+  // Drops assignments to dead locals. Then 'op ::temp, a, b' followed by
+  // 'assign x, ::temp' becomes 'op x, a, b' when nothing else reads ::temp.
+  // Liveness is computed once: both only make fewer locals live
+  bool RemoveDeadTemps()
+  {
+    bool changed = false;
+    auto liveOut = GetLiveLocals();
+    auto targets = GetJumpTargets();
+
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      if (code.instructions[line].op != Opcodes::op_Assign)
+        continue;
+
+      auto& destination = GetOperand(line, 0);
+      auto& source = GetOperand(line, 1);
+      if (destination.source != LinkedFunctionCode::kSource_Local)
+        continue;
+
+      bool isSelfCopy = source.source == destination.source &&
+        source.index == destination.index;
+      if (isSelfCopy || !liveOut[line][destination.index]) {
+        MakeNop(line);
+        changed = true;
+      }
+    }
+
+    for (size_t line = 0; line + 1 < GetNumInstructions(); ++line) {
+      auto& instruction = code.instructions[line];
+      if (!IsPure(instruction.op) ||
+          code.instructions[line + 1].op != Opcodes::op_Assign ||
+          targets[line + 1])
+        continue;
+
+      auto& temp = GetOperand(line, 0);
+      auto& copyDestination = GetOperand(line + 1, 0);
+      auto& copySource = GetOperand(line + 1, 1);
+
+      if (temp.source != LinkedFunctionCode::kSource_Local ||
+          copySource.source != LinkedFunctionCode::kSource_Local ||
+          copySource.index != temp.index || liveOut[line + 1][temp.index])
+        continue;
+
+      if (copyDestination.source == LinkedFunctionCode::kSource_Constant ||
+          copyDestination.source == LinkedFunctionCode::kSource_Self)
+        continue;
+
+      temp = copyDestination;
+      MakeNop(line + 1);
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool RemoveUnreachable()
+  {
+    if (GetNumInstructions() == 0)
+      return false;
+
+    std::vector<bool> reachable(GetNumInstructions());
+    std::vector<size_t> pending = { 0 };
+    reachable[0] = true;
+
+    while (!pending.empty()) {
+      size_t line = pending.back();
+      pending.pop_back();
+
+      size_t successors[2];
+      size_t numSuccessors = GetSuccessors(line, successors);
+      for (size_t i = 0; i < numSuccessors; ++i) {
+        if (!reachable[successors[i]]) {
+          reachable[successors[i]] = true;
+          pending.push_back(successors[i]);
+        }
+      }
+    }
+
+    bool changed = false;
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      if (!reachable[line] && code.instructions[line].op != Opcodes::op_Nop) {
+        MakeNop(line);
+        changed = true;
+      }
+    }
+    return changed;
+  }
+
+  // Removes Nops, fixing up jump offsets and the line table
+  void Compact()
+  {
+    size_t numInstructions = GetNumInstructions();
+
+    // For a removed instruction, the index of the next one kept
+    std::vector<size_t> newIndex(numInstructions + 1);
+    size_t numKept = 0;
+    for (size_t line = 0; line < numInstructions; ++line) {
+      newIndex[line] = numKept;
+      if (code.instructions[line].op != Opcodes::op_Nop)
+        ++numKept;
+    }
+    newIndex[numInstructions] = numKept;
+
+    if (numKept == numInstructions)
+      return;
+
+    std::vector<LinkedFunctionCode::Instruction> instructions;
+    std::vector<uint16_t> lineNumbers;
+    instructions.reserve(numKept);
+
+    for (size_t line = 0; line < numInstructions; ++line) {
+      auto& instruction = code.instructions[line];
+      if (instruction.op == Opcodes::op_Nop)
+        continue;
+
+      int offsetOperand = GetOffsetOperand(instruction.op);
+      if (offsetOperand >= 0) {
+        int32_t offset = static_cast<int32_t>(newIndex[GetTarget(line)]) -
+          static_cast<int32_t>(newIndex[line]);
+        GetOperand(line, offsetOperand) = AddConstant(VarValue(offset));
+      }
+
+      instructions.push_back(instruction);
+      if (code.lineNumbers)
+        lineNumbers.push_back((*code.lineNumbers)[line]);
+    }
+
+    code.instructions = std::move(instructions);
+    if (code.lineNumbers) {
+      code.optimizedLineNumbers = std::move(lineNumbers);
+      code.lineNumbers = &code.optimizedLineNumbers;
+    }
+  }
+
+  void Specialize()
+  {
+    auto stable = GetStableLocals();
+
+    for (size_t line = 0; line < GetNumInstructions(); ++line) {
+      auto& instruction = code.instructions[line];
+      auto typeOf = [&](size_t index) {
+        return GetKnownType(stable, GetOperand(line, index));
+      };
+
+      uint8_t type = kUnknownType;
+      switch (instruction.op) {
+        case Opcodes::op_iAdd:
+        case Opcodes::op_fAdd:
+        case Opcodes::op_iSub:
+        case Opcodes::op_fSub:
+        case Opcodes::op_iMul:
+        case Opcodes::op_fMul:
+        case Opcodes::op_Cmp_eq:
+        case Opcodes::op_Cmp_lt:
+        case Opcodes::op_Cmp_le:
+        case Opcodes::op_Cmp_gt:
+        case Opcodes::op_Cmp_ge:
+          if (typeOf(1) == typeOf(2))
+            type = typeOf(1);
+          break;
+        case Opcodes::op_Not:
+        case Opcodes::op_iNeg:
+        case Opcodes::op_fNeg:
+          type = typeOf(1);
+          break;
+        case Opcodes::op_Jmpt:
+        case Opcodes::op_Jmpf:
+          type = typeOf(0);
+          break;
+      }
+
+      instruction.op = GetTypedOpcode(instruction.op, type);
+    }
+  }
+
+  LinkedFunctionCode& code;
+};
+}
+
+bool FunctionOptimizer::Optimize(LinkedFunctionCode& code)
+{
+  return Optimizer(code).Run();
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include "Structures.h"
+
+// Optional pass over linked code, enabled with the 'optimize' argument of
+// VirtualMachine. It runs once per function when the script is linked:
+//  - propagates constants assigned to locals inside a basic block and folds
+//    arithmetic, comparisons and casts of constants
+//  - threads jumps to jumps and drops jumps that can't be taken
+//  - writes results straight to their final variable instead of going
+//    through a '::temp' local, and drops assignments nobody reads
+//  - removes unreachable code and Nops
+//  - replaces arithmetic, comparisons and conditional jumps whose operand
+//    types are known with the typed opcodes of OpcodesImplementation
+//
+// A local's type is known if it isn't a parameter and no instruction can
+// store a value of another type into it. Results, errors and calls made are
+// the same as for the unoptimized code; only the values of dead locals may
+// differ.
+namespace FunctionOptimizer {
+
+// Returns false if the code is left as is since it contains an unknown
+// opcode or a jump out of the function
+bool Optimize(LinkedFunctionCode& code);
+}
@@ -0,0 +1,79 @@
+#include "NativeFunctions.h"
+#include <mutex>
+
+namespace {
+struct NativeSlotTable
+{
+  struct Key
+  {
+    std::string className;
+    std::string functionName;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      CaseInsensitiveHash hash;
+      return hash(key.className) * 31 + hash(key.functionName);
+    }
+  };
+
+  struct KeyEqual
+  {
+    bool operator()(const Key& a, const Key& b) const
+    {
+      CaseInsensitiveEqual equal;
+      return equal(a.className, b.className) &&
+        equal(a.functionName, b.functionName);
+    }
+  };
+
+  std::mutex mutex;
+  std::unordered_map<Key, uint32_t, KeyHash, KeyEqual> ids;
+
+  uint32_t Get(std::string_view className, std::string_view functionName)
+  {
+    Key key{ std::string(className), std::string(functionName) };
+    auto id = static_cast<uint32_t>(ids.size());
+    return ids.insert({ std::move(key), id }).first->second;
+  }
+
+  uint32_t Find(std::string_view className, std::string_view functionName)
+  {
+    auto it =
+      ids.find({ std::string(className), std::string(functionName) });
+    return it != ids.end() ? it->second : NativeSlot::kInvalid;
+  }
+};
+
+NativeSlotTable& GetNativeSlotTable()
+{
+  static NativeSlotTable table;
+  return table;
+}
+}
+
+NativeSlot NativeSlot::Get(std::string_view className,
+                           std::string_view functionName)
+{
+  auto& table = GetNativeSlotTable();
+  std::lock_guard lock(table.mutex);
+
+  NativeSlot slot;
+  slot.id = table.Get(className, functionName);
+  slot.fallbackId = table.Get("", functionName);
+  return slot;
+}
+
+NativeSlot NativeSlot::Find(std::string_view className,
+                            std::string_view functionName)
+{
+  auto& table = GetNativeSlotTable();
+  std::lock_guard lock(table.mutex);
+
+  NativeSlot slot;
+  slot.id = table.Find(className, functionName);
+  slot.fallbackId = table.Find("", functionName);
+  return slot;
+}
@@ -0,0 +1,161 @@
+#pragma once
+#include "StringPool.h"
+#include "Structures.h"
+#include <type_traits>
+#include <utility>
+
+// Adapters from plain C++ callables to NativeCallback. Arguments are
+// converted straight from the VM frame, no vector is built.
+// Supported parameter and return types: VarValue, bool, integers, floats,
+// const char*, std::string and pointers to IGameObject or its subclasses.
+// Strings returned by a native are interned in the VM's StringPool
+namespace NativeFunctions {
+
+template <class... T>
+struct TypeList
+{
+};
+
+template <class F>
+struct FunctionTraits : FunctionTraits<decltype(&F::operator())>
+{
+};
+
+template <class R, class... Args>
+struct FunctionTraits<R (*)(Args...)>
+{
+  using Result = R;
+  using Arguments = TypeList<std::decay_t<Args>...>;
+  static constexpr size_t kArity = sizeof...(Args);
+};
+
+template <class C, class R, class... Args>
+struct FunctionTraits<R (C::*)(Args...) const> : FunctionTraits<R (*)(Args...)>
+{
+};
+
+template <class C, class R, class... Args>
+struct FunctionTraits<R (C::*)(Args...)> : FunctionTraits<R (*)(Args...)>
+{
+};
+
+template <class T>
+struct AlwaysFalse : std::false_type
+{
+};
+
+template <class T>
+T FromVarValue(const VarValue& value)
+{
+  if constexpr (std::is_same_v<T, VarValue>) {
+    return value;
+  } else if constexpr (std::is_same_v<T, bool>) {
+    return static_cast<bool>(value);
+  } else if constexpr (std::is_integral_v<T>) {
+    return static_cast<T>(static_cast<int>(value));
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<T>(static_cast<float>(value));
+  } else if constexpr (std::is_same_v<T, const char*>) {
+    return static_cast<const char*>(value);
+  } else if constexpr (std::is_same_v<T, std::string>) {
+    auto str = static_cast<const char*>(value);
+    return str ? std::string(str) : std::string();
+  } else if constexpr (std::is_pointer_v<T> &&
+                       std::is_base_of_v<IGameObject,
+                                         std::remove_pointer_t<T>>) {
+    return dynamic_cast<T>(static_cast<IGameObject*>(value));
+  } else {
+    static_assert(AlwaysFalse<T>::value, "Unsupported native argument type");
+  }
+}
+
+template <class T>
+VarValue ToVarValue(T&& result, StringPool& stringPool)
+{
+  using Type = std::decay_t<T>;
+
+  if constexpr (std::is_same_v<Type, VarValue>) {
+    return std::forward<T>(result);
+  } else if constexpr (std::is_same_v<Type, bool>) {
+    return VarValue(result);
+  } else if constexpr (std::is_integral_v<Type>) {
+    return VarValue(static_cast<int32_t>(result));
+  } else if constexpr (std::is_floating_point_v<Type>) {
+    return VarValue(static_cast<float>(result));
+  } else if constexpr (std::is_same_v<Type, const char*> ||
+                       std::is_same_v<Type, char*>) {
+    return VarValue(stringPool.Intern(result ? result : ""));
+  } else if constexpr (std::is_same_v<Type, std::string>) {
+    return VarValue(stringPool.Intern(result));
+  } else if constexpr (std::is_pointer_v<Type> &&
+                       std::is_base_of_v<IGameObject,
+                                         std::remove_pointer_t<Type>>) {
+    return VarValue(static_cast<IGameObject*>(result));
+  } else {
+    static_assert(AlwaysFalse<T>::value, "Unsupported native return type");
+  }
+}
+
+template <class R, class Call>
+VarValue Invoke(Call&& call, StringPool& stringPool)
+{
+  if constexpr (std::is_void_v<R>) {
+    call();
+    return VarValue::None();
+  } else {
+    return ToVarValue(call(), stringPool);
+  }
+}
+
+template <class R, class F, class... Args, size_t... I>
+VarValue CallGlobal(F& fn, const VarValue* arguments, StringPool& stringPool,
+                    TypeList<Args...>, std::index_sequence<I...>)
+{
+  return Invoke<R>([&] { return fn(FromVarValue<Args>(arguments[I])...); },
+                   stringPool);
+}
+
+template <class R, class F, class Self, class... Args, size_t... I>
+VarValue CallMethod(F& fn, const VarValue& self, const VarValue* arguments,
+                    StringPool& stringPool, TypeList<Self, Args...>,
+                    std::index_sequence<I...>)
+{
+  return Invoke<R>(
+    [&] {
+      return fn(FromVarValue<Self>(self), FromVarValue<Args>(arguments[I])...);
+    },
+    stringPool);
+}
+
+// Methods receive self as their first parameter
+template <bool kIsMethod, class F>
+NativeCallback Bind(F fn, StringPool& stringPool)
+{
+  using Traits = FunctionTraits<F>;
+  using R = typename Traits::Result;
+
+  if constexpr (kIsMethod && Traits::kArity == 0) {
+    static_assert(AlwaysFalse<F>::value,
+                  "Native method must take self as parameter");
+  } else {
+    constexpr size_t kNumArguments = kIsMethod ? Traits::kArity - 1
+                                               : Traits::kArity;
+
+    return [fn, &stringPool](const VarValue& self, const VarValue* arguments,
+                             size_t numArguments) mutable {
+      if (numArguments < kNumArguments)
+        throw std::runtime_error("Not enough arguments for native function");
+
+      if constexpr (kIsMethod) {
+        return CallMethod<R>(fn, self, arguments, stringPool,
+                             typename Traits::Arguments(),
+                             std::make_index_sequence<kNumArguments>());
+      } else {
+        return CallGlobal<R>(fn, arguments, stringPool,
+                             typename Traits::Arguments(),
+                             std::make_index_sequence<kNumArguments>());
+      }
+    };
+  }
+}
+}
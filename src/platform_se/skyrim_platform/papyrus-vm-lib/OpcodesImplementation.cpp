@@ -1,43 +1,76 @@
 #include "OpcodesImplementation.h"
 
 void OpcodesImplementation::strCat(VarValue& result, VarValue& s1,
-                                   VarValue& s2, StringTable& table)
+                                   VarValue& s2, StringPool& pool,
+                                   size_t maxLength)
 {
+  // Compiled scripts cast operands to strings first
+  if (!(const char*)s1 || !(const char*)s2)
+    throw std::runtime_error("Wrong type in StrCat");
 
   std::string temp;
   temp = temp + (const char*)s1 + (const char*)s2;
 
-  for (auto& str : table.m_data) {
-    if (str == temp) {
-      result = VarValue(str.data());
-      return;
-    }
+  result = VarValue(pool.Intern(temp));
+
+  if (maxLength && temp.size() > maxLength)
+    throw std::runtime_error("String length limit exceeded");
+}
+
+void OpcodesImplementation::arrayCreate(VarValue& array, VarValue& size,
+                                        size_t maxSize)
+{
+  if (maxSize && (int32_t)size > int64_t(maxSize))
+    throw std::runtime_error("Array size limit exceeded");
+
+  if ((int32_t)size > 0) {
+    array.CreateArray((int32_t)size);
+  } else {
+    array.CreateArray(0);
+    assert(0);
   }
+}
 
-  size_t _size = table.m_data.size();
-  table.m_data.push_back(temp);
-  result = VarValue(table.m_data[_size].data());
+void OpcodesImplementation::arrayLength(VarValue& result, VarValue& array)
+{
+  if (auto elements = array.GetArray()) {
+    if (result.GetType() == VarValue::kType_Integer)
+      result = VarValue((int32_t)elements->GetSize());
+  } else
+    result = VarValue((int32_t)0);
+}
+
+void OpcodesImplementation::arrayGetElement(VarValue& result,
+                                            VarValue& array, VarValue& index)
+{
+  if (auto elements = array.GetArray()) {
+    result = elements->Get((int32_t)index);
+  } else
+    assert(0);
+}
+
+void OpcodesImplementation::arraySetElement(VarValue& array,
+                                            VarValue& index, VarValue& value)
+{
+  if (auto elements = array.GetArray()) {
+    elements->Set((int32_t)index, value);
+  } else
+    assert(0);
 }
 
 void OpcodesImplementation::arrayFindElement(VarValue& array, VarValue& result,
                                              VarValue& needValue,
                                              VarValue& startIndex)
 {
+  auto elements = array.GetArray();
 
-  if (array.pArray == nullptr || (int)startIndex < 0 ||
-      (int)startIndex >= array.pArray->size()) {
+  if (elements == nullptr || (int)startIndex < 0 ||
+      (int)startIndex >= elements->GetSize()) {
     result = VarValue(-1);
     return;
   }
 
-  auto res = std::find(array.pArray->begin() + (int)startIndex,
-                       array.pArray->end(), needValue);
-
-  if (res != array.pArray->end()) {
-    result = VarValue(int32_t(res - array.pArray->begin()));
-  } else {
-    result = VarValue(-1);
-  }
+  result = VarValue(elements->Find(needValue, (int)startIndex));
 }
 
 void OpcodesImplementation::arrayRFindElement(VarValue& array,
@@ -45,26 +78,21 @@ void OpcodesImplementation::arrayRFindElement(VarValue& array,
                                               VarValue& needValue,
                                               VarValue& startIndex)
 {
-  if (array.pArray != nullptr) {
+  auto elements = array.GetArray();
+
+  if (elements != nullptr) {
 
-    int32_t indexForStart = array.pArray->size() - 1;
+    int32_t indexForStart = elements->GetSize() - 1;
 
     if ((int)startIndex < -1)
-      indexForStart = array.pArray->size() + (int)startIndex;
+      indexForStart = elements->GetSize() + (int)startIndex;
 
-    if (indexForStart >= array.pArray->size() || indexForStart < 0) {
+    if (indexForStart >= elements->GetSize() || indexForStart < 0) {
       result = VarValue(-1);
       return;
     }
 
-    auto res =
-      std::find(array.pArray->rbegin() + array.pArray->size() - indexForStart,
-                array.pArray->rend(), needValue);
-    if (res == array.pArray->rend()) {
-      result = VarValue(-1);
-    } else {
-      result = VarValue(int32_t(array.pArray->rend() - res - 1));
-    }
+    result = VarValue(elements->RFind(needValue, indexForStart));
   } else {
     result = VarValue(-1);
     return;
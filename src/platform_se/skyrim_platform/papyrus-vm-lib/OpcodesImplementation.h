@@ -1,4 +1,5 @@
 #pragma once
+#include "StringPool.h"
 #include "Structures.h"
 
 namespace OpcodesImplementation {
@@ -40,10 +41,108 @@ enum Opcodes
   op_Array_GetElement = 0x20,
   op_Array_SetElement = 0x21,
   op_Array_FindElement = 0x22,
-  op_Array_RfindElement = 0x23
+  op_Array_RfindElement = 0x23,
+
+  // Never found in .pex files. FunctionOptimizer uses these where the types
+  // of the operands are known, so no runtime type dispatch is needed
+  op_Int_Add = 0x24,
+  op_Int_Sub = 0x25,
+  op_Int_Mul = 0x26,
+  op_Int_Neg = 0x27,
+  op_Int_Cmp_eq = 0x28,
+  op_Int_Cmp_lt = 0x29,
+  op_Int_Cmp_le = 0x2A,
+  op_Int_Cmp_gt = 0x2B,
+  op_Int_Cmp_ge = 0x2C,
+  op_Float_Add = 0x2D,
+  op_Float_Sub = 0x2E,
+  op_Float_Mul = 0x2F,
+  op_Float_Neg = 0x30,
+  op_Float_Cmp_eq = 0x31,
+  op_Float_Cmp_lt = 0x32,
+  op_Float_Cmp_le = 0x33,
+  op_Float_Cmp_gt = 0x34,
+  op_Float_Cmp_ge = 0x35,
+  op_Bool_Not = 0x36,
+  op_Bool_Jmpt = 0x37,
+  op_Bool_Jmpf = 0x38
 };
 
-void strCat(VarValue& result, VarValue& s1, VarValue& s2, StringTable& table);
+// Arithmetic shared by the interpreter and AOT code. Int arithmetic wraps
+// around on overflow. Division by 0 gives 1 and modulo by 0 gives 0, like
+// VarValue's operators. INT_MIN / -1 wraps to INT_MIN
+inline int32_t iAdd(int32_t a, int32_t b)
+{
+  return static_cast<int32_t>(uint32_t(a) + uint32_t(b));
+}
+
+inline int32_t iSub(int32_t a, int32_t b)
+{
+  return static_cast<int32_t>(uint32_t(a) - uint32_t(b));
+}
+
+inline int32_t iMul(int32_t a, int32_t b)
+{
+  return static_cast<int32_t>(uint32_t(a) * uint32_t(b));
+}
+
+inline int32_t iNeg(int32_t a)
+{
+  return static_cast<int32_t>(0u - uint32_t(a));
+}
+
+inline int32_t iDiv(int32_t a, int32_t b)
+{
+  if (a == 0 || b == 0)
+    return 1;
+  return b == -1 ? iNeg(a) : a / b;
+}
+
+inline int32_t iMod(int32_t a, int32_t b)
+{
+  return b != 0 && b != -1 ? a % b : 0;
+}
+
+inline float fDiv(float a, float b)
+{
+  return a != 0.0f && b != 0.0f ? a / b : 1.0f;
+}
+
+// Condition of Not, Jmpt and Jmpf, usually a Bool already
+inline bool isTrue(const VarValue& value)
+{
+  return value.GetType() == VarValue::kType_Bool ? value.GetBool()
+                                                 : bool(value);
+}
+
+// Cmp opcodes don't tell the type of their operands. Ints, floats and bools
+// are compared directly, anything else through the VarValue operators
+template <class Compare>
+bool compareValues(VarValue& a, VarValue& b, Compare compare)
+{
+  if (a.GetType() == b.GetType()) {
+    switch (a.GetType()) {
+      case VarValue::kType_Integer:
+        return compare(a.GetInt(), b.GetInt());
+      case VarValue::kType_Float:
+        return compare(a.GetFloat(), b.GetFloat());
+      case VarValue::kType_Bool:
+        return compare(a.GetBool(), b.GetBool());
+    }
+  }
+  return compare(a, b);
+}
+
+// maxLength is VirtualMachine::maxStringLength. The result is stored before
+// the limit is checked
+void strCat(VarValue& result, VarValue& s1, VarValue& s2, StringPool& pool,
+            size_t maxLength);
+
+// maxSize is VirtualMachine::maxArraySize
+void arrayCreate(VarValue& array, VarValue& size, size_t maxSize);
+void arrayLength(VarValue& result, VarValue& array);
+void arrayGetElement(VarValue& result, VarValue& array, VarValue& index);
+void arraySetElement(VarValue& array, VarValue& index, VarValue& value);
 
 void arrayFindElement(VarValue& array, VarValue& result, VarValue& needValue,
                       VarValue& startIndex);
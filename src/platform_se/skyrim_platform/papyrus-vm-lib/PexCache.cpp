@@ -0,0 +1,468 @@
+#include "PexCache.h"
+#include "Reader.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+struct Header
+{
+  uint32_t signature = PexCache::kSignature;
+  uint32_t version = PexCache::kVersion;
+  uint64_t sourcesHash = 0;
+  uint32_t numScripts = 0;
+  uint32_t stringsSize = 0;
+};
+
+uint64_t Fnv1a(uint64_t hash, const void* data, size_t size)
+{
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+std::vector<uint8_t> ReadFile(const std::string& path)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("Error open file: " + path);
+
+  file.seekg(0, std::ios_base::end);
+  std::vector<uint8_t> bytes(static_cast<size_t>(file.tellg()));
+  file.seekg(0, std::ios_base::beg);
+  file.read(reinterpret_cast<char*>(bytes.data()), bytes.size());
+  return bytes;
+}
+
+uint64_t ComputeSourcesHash(const std::vector<std::string>& pexPaths)
+{
+  uint64_t hash = 14695981039346656037ull;
+
+  for (auto& path : pexPaths) {
+    auto name = std::filesystem::path(path).filename().string();
+    auto bytes = ReadFile(path);
+    uint64_t size = bytes.size();
+
+    hash = Fnv1a(hash, name.data(), name.size());
+    hash = Fnv1a(hash, &size, sizeof(size));
+    hash = Fnv1a(hash, bytes.data(), bytes.size());
+  }
+  return hash;
+}
+
+class CacheWriter
+{
+public:
+  void PutScript(const PexScript& script)
+  {
+    Put(script.header);
+    PutString(script.source);
+    PutString(script.user);
+    PutString(script.machine);
+
+    Put(script.debugInfo.m_flags);
+    Put(script.debugInfo.m_sourceModificationTime);
+    Put<uint32_t>(script.debugInfo.m_data.size());
+    for (auto& function : script.debugInfo.m_data) {
+      PutString(function.objName);
+      PutString(function.stateName);
+      PutString(function.fnName);
+      Put(function.type);
+      Put<uint32_t>(function.lineNumbers.size());
+      Put(function.lineNumbers.data(),
+          function.lineNumbers.size() * sizeof(uint16_t));
+    }
+
+    Put<uint32_t>(script.userFlagTable.m_data.size());
+    for (auto& flag : script.userFlagTable.m_data) {
+      PutString(flag.name);
+      Put(flag.idx);
+    }
+
+    Put<uint32_t>(script.objectTable.m_data.size());
+    for (auto& object : script.objectTable.m_data) {
+      PutObject(object);
+    }
+  }
+
+  std::vector<uint8_t> Finish(uint64_t sourcesHash, uint32_t numScripts)
+  {
+    Header header;
+    header.sourcesHash = sourcesHash;
+    header.numScripts = numScripts;
+    header.stringsSize = static_cast<uint32_t>(strings.size());
+
+    std::vector<uint8_t> out(sizeof(header));
+    std::memcpy(out.data(), &header, sizeof(header));
+    out.insert(out.end(), strings.begin(), strings.end());
+    out.insert(out.end(), records.begin(), records.end());
+    return out;
+  }
+
+private:
+  void Put(const void* data, size_t size)
+  {
+    auto bytes = reinterpret_cast<const uint8_t*>(data);
+    records.insert(records.end(), bytes, bytes + size);
+  }
+
+  template <class T>
+  void Put(const T& value)
+  {
+    Put(&value, sizeof(T));
+  }
+
+  void PutString(const std::string& str)
+  {
+    auto [it, inserted] = stringOffsets.try_emplace(str, 0);
+    if (inserted) {
+      auto size = static_cast<uint32_t>(str.size());
+      auto bytes = reinterpret_cast<const uint8_t*>(&size);
+      strings.insert(strings.end(), bytes, bytes + sizeof(size));
+      it->second = static_cast<uint32_t>(strings.size());
+      strings.insert(strings.end(), str.begin(), str.end());
+      strings.push_back(0);
+    }
+    Put(it->second);
+  }
+
+  // Arrays can't be constants, Reader leaves them None
+  void PutValue(const VarValue& value)
+  {
+    uint8_t type = value.IsArray() ? VarValue::kType_Object : value.GetType();
+    Put(type);
+
+    switch (type) {
+      case VarValue::kType_Identifier:
+      case VarValue::kType_String:
+        PutString(static_cast<const char*>(value));
+        break;
+      case VarValue::kType_Integer:
+        Put(value.GetInt());
+        break;
+      case VarValue::kType_Float:
+        Put(value.GetFloat());
+        break;
+      case VarValue::kType_Bool:
+        Put<uint8_t>(value.GetBool());
+        break;
+    }
+  }
+
+  void PutParams(const FunctionInfo::ParamTable& params)
+  {
+    Put<uint16_t>(params.size());
+    for (auto& param : params) {
+      PutString(param.name);
+      PutString(param.type);
+    }
+  }
+
+  void PutFunction(const FunctionInfo& function)
+  {
+    PutString(function.returnType);
+    PutString(function.docstring);
+    Put(function.userFlags);
+    Put(function.flags);
+    PutParams(function.params);
+    PutParams(function.locals);
+
+    Put<uint32_t>(function.code.instructions.size());
+    for (auto& instruction : function.code.instructions) {
+      Put(instruction.op);
+      Put<uint16_t>(instruction.args.size());
+      for (auto& arg : instruction.args) {
+        PutValue(arg);
+      }
+    }
+  }
+
+  void PutObject(const ObjectTable::Object& object)
+  {
+    PutString(object.NameIndex);
+    PutString(object.parentClassName);
+    PutString(object.docstring);
+    Put(object.userFlags);
+    PutString(object.autoStateName);
+
+    Put<uint16_t>(object.variables.size());
+    for (auto& var : object.variables) {
+      PutString(var.name);
+      PutString(var.typeName);
+      Put(var.userFlags);
+      PutValue(var.value);
+    }
+
+    Put<uint16_t>(object.properties.size());
+    for (auto& prop : object.properties) {
+      PutString(prop.name);
+      PutString(prop.type);
+      PutString(prop.docstring);
+      Put(prop.userFlags);
+      Put(prop.flags);
+      PutString(prop.autoVarName);
+      PutFunction(prop.readHandler);
+      PutFunction(prop.writeHandler);
+    }
+
+    Put<uint16_t>(object.states.size());
+    for (auto& state : object.states) {
+      PutString(state.name);
+      Put<uint16_t>(state.functions.size());
+      for (auto& function : state.functions) {
+        PutString(function.name);
+        PutFunction(function.function);
+      }
+    }
+  }
+
+  std::vector<uint8_t> records;
+  std::vector<uint8_t> strings;
+  std::unordered_map<std::string, uint32_t> stringOffsets;
+};
+
+// Truncated and malformed caches throw std::runtime_error
+class CacheReader
+{
+public:
+  CacheReader(std::shared_ptr<const std::vector<uint8_t>> data_)
+    : data(std::move(data_))
+    , pos(data->data())
+    , end(data->data() + data->size())
+  {
+  }
+
+  Header GetHeader()
+  {
+    auto header = Get<Header>();
+    if (header.signature != PexCache::kSignature ||
+        header.version != PexCache::kVersion)
+      throw std::runtime_error("Unsupported pex cache format");
+
+    CheckAvailable(header.stringsSize);
+    strings = reinterpret_cast<const char*>(pos);
+    stringsSize = header.stringsSize;
+    pos += stringsSize;
+    return header;
+  }
+
+  std::shared_ptr<PexScript> GetScript()
+  {
+    auto script = std::make_shared<PexScript>();
+    script->cacheData = data;
+
+    script->header = Get<ScriptHeader>();
+    script->source = GetString();
+    script->user = GetString();
+    script->machine = GetString();
+
+    script->debugInfo.m_flags = Get<uint8_t>();
+    script->debugInfo.m_sourceModificationTime = Get<uint64_t>();
+    script->debugInfo.m_data.resize(Get<uint32_t>());
+    for (auto& function : script->debugInfo.m_data) {
+      function.objName = GetString();
+      function.stateName = GetString();
+      function.fnName = GetString();
+      function.type = Get<uint8_t>();
+
+      function.lineNumbers.resize(Get<uint32_t>());
+      size_t size = function.lineNumbers.size() * sizeof(uint16_t);
+      CheckAvailable(size);
+      std::memcpy(function.lineNumbers.data(), pos, size);
+      pos += size;
+    }
+
+    script->userFlagTable.m_data.resize(Get<uint32_t>());
+    for (auto& flag : script->userFlagTable.m_data) {
+      flag.name = GetString();
+      flag.idx = Get<uint8_t>();
+    }
+
+    script->objectTable.m_data.resize(Get<uint32_t>());
+    for (auto& object : script->objectTable.m_data) {
+      GetObject(object);
+    }
+    return script;
+  }
+
+private:
+  void CheckAvailable(size_t size)
+  {
+    if (static_cast<size_t>(end - pos) < size)
+      throw std::runtime_error("Pex cache is truncated");
+  }
+
+  template <class T>
+  T Get()
+  {
+    CheckAvailable(sizeof(T));
+    T value;
+    std::memcpy(&value, pos, sizeof(T));
+    pos += sizeof(T);
+    return value;
+  }
+
+  std::string_view GetStringView()
+  {
+    auto offset = Get<uint32_t>();
+    if (offset < sizeof(uint32_t) || offset >= stringsSize)
+      throw std::runtime_error("Bad string offset in pex cache");
+
+    uint32_t size;
+    std::memcpy(&size, strings + offset - sizeof(size), sizeof(size));
+    if (size >= stringsSize - offset || strings[offset + size] != 0)
+      throw std::runtime_error("Bad string offset in pex cache");
+    return std::string_view(strings + offset, size);
+  }
+
+  std::string GetString() { return std::string(GetStringView()); }
+
+  VarValue GetValue()
+  {
+    switch (Get<uint8_t>()) {
+      case VarValue::kType_Object:
+        return VarValue::None();
+      case VarValue::kType_Identifier:
+        return VarValue(VarValue::kType_Identifier, GetStringView().data());
+      case VarValue::kType_String:
+        return VarValue(GetStringView().data());
+      case VarValue::kType_Integer:
+        return VarValue(Get<int32_t>());
+      case VarValue::kType_Float:
+        return VarValue(Get<float>());
+      case VarValue::kType_Bool:
+        return VarValue(Get<uint8_t>() != 0);
+      default:
+        throw std::runtime_error("Unknown value type in pex cache");
+    }
+  }
+
+  void GetParams(FunctionInfo::ParamTable& params)
+  {
+    params.resize(Get<uint16_t>());
+    for (auto& param : params) {
+      param.name = GetString();
+      param.type = GetString();
+    }
+  }
+
+  void GetFunction(FunctionInfo& function)
+  {
+    function.returnType = GetString();
+    function.docstring = GetString();
+    function.userFlags = Get<uint32_t>();
+    function.flags = Get<uint8_t>();
+    GetParams(function.params);
+    GetParams(function.locals);
+
+    function.code.instructions.resize(Get<uint32_t>());
+    for (auto& instruction : function.code.instructions) {
+      instruction.op = Get<uint8_t>();
+      auto numArgs = Get<uint16_t>();
+      instruction.args.reserve(numArgs);
+      for (uint16_t i = 0; i < numArgs; ++i) {
+        instruction.args.push_back(GetValue());
+      }
+    }
+  }
+
+  void GetObject(ObjectTable::Object& object)
+  {
+    object.NameIndex = GetString();
+    object.parentClassName = GetString();
+    object.docstring = GetString();
+    object.userFlags = Get<uint32_t>();
+    object.autoStateName = GetString();
+
+    object.variables.resize(Get<uint16_t>());
+    for (auto& var : object.variables) {
+      var.name = GetString();
+      var.typeName = GetString();
+      var.userFlags = Get<uint32_t>();
+      var.value = GetValue();
+    }
+
+    object.properties.resize(Get<uint16_t>());
+    for (auto& prop : object.properties) {
+      prop.name = GetString();
+      prop.type = GetString();
+      prop.docstring = GetString();
+      prop.userFlags = Get<uint32_t>();
+      prop.flags = Get<uint8_t>();
+      prop.autoVarName = GetString();
+      GetFunction(prop.readHandler);
+      GetFunction(prop.writeHandler);
+    }
+
+    object.states.resize(Get<uint16_t>());
+    for (auto& state : object.states) {
+      state.name = GetString();
+      state.functions.resize(Get<uint16_t>());
+      for (auto& function : state.functions) {
+        function.name = GetString();
+        GetFunction(function.function);
+      }
+    }
+  }
+
+  std::shared_ptr<const std::vector<uint8_t>> data;
+  const uint8_t* pos = nullptr;
+  const uint8_t* end = nullptr;
+
+  const char* strings = nullptr;
+  uint32_t stringsSize = 0;
+};
+}
+
+void PexCache::Build(const std::vector<std::string>& pexPaths,
+                     const std::string& cachePath, int numThreads)
+{
+  auto scripts = Reader(pexPaths, numThreads).GetSourceStructures();
+
+  CacheWriter writer;
+  for (auto& script : scripts) {
+    writer.PutScript(*script);
+  }
+  auto out = writer.Finish(ComputeSourcesHash(pexPaths),
+                           static_cast<uint32_t>(scripts.size()));
+
+  std::ofstream file(cachePath, std::ios::binary);
+  if (!file.is_open())
+    throw std::runtime_error("Error open file: " + cachePath);
+  file.write(reinterpret_cast<const char*>(out.data()), out.size());
+}
+
+bool PexCache::IsUpToDate(const std::string& cachePath,
+                          const std::vector<std::string>& pexPaths)
+{
+  std::ifstream file(cachePath, std::ios::binary);
+  if (!file.is_open())
+    return false;
+
+  Header header;
+  file.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (static_cast<size_t>(file.gcount()) != sizeof(header))
+    return false;
+
+  return header.signature == kSignature && header.version == kVersion &&
+    header.sourcesHash == ComputeSourcesHash(pexPaths);
+}
+
+std::vector<std::shared_ptr<PexScript>> PexCache::Load(
+  const std::string& cachePath)
+{
+  CacheReader reader(
+    std::make_shared<const std::vector<uint8_t>>(ReadFile(cachePath)));
+  Header header = reader.GetHeader();
+
+  std::vector<std::shared_ptr<PexScript>> result;
+  result.reserve(header.numScripts);
+  for (uint32_t i = 0; i < header.numScripts; ++i) {
+    result.push_back(reader.GetScript());
+  }
+  return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "Structures.h"
+
+// A set of parsed scripts in one file, so the VM starts with a single read
+// instead of opening and parsing every .pex file. Layout (native byte order,
+// the cache is meant for the machine that built it):
+//   Header, strings, one record per script
+// Strings are stored once for the whole set, each as a 32-bit length, the
+// characters and a terminating zero. Records refer to them by offset, and
+// the loaded scripts' VarValues point straight into the file contents, which
+// PexScript::cacheData keeps alive. stringTable stays empty.
+//
+// sourcesHash covers the name and full contents of every source file.
+// Scripts are cached as parsed, VirtualMachine links them as usual.
+namespace PexCache {
+
+enum : uint32_t
+{
+  kSignature = 0x48435850, // "PXCH"
+  kVersion = 2,
+};
+
+void Build(const std::vector<std::string>& pexPaths,
+           const std::string& cachePath, int numThreads = 1);
+
+// Reads every source file, not only the cache header
+bool IsUpToDate(const std::string& cachePath,
+                const std::vector<std::string>& pexPaths);
+
+std::vector<std::shared_ptr<PexScript>> Load(const std::string& cachePath);
+}
@@ -0,0 +1,297 @@
+#include "Profiler.h"
+#include <algorithm>
+#include <map>
+#include <ostream>
+
+namespace {
+// Instruction part of a sampled location when none is running yet
+constexpr uint32_t kNoInstruction = 0xffffffff;
+
+int64_t ToMicroseconds(Profiler::Clock::duration duration)
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(duration)
+    .count();
+}
+
+std::string JsonString(std::string_view str)
+{
+  std::string result = "\"";
+  for (char c : str) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (static_cast<uint8_t>(c) < 0x20) {
+      result += ' ';
+    } else {
+      result += c;
+    }
+  }
+  return result + '"';
+}
+}
+
+Profiler::Profiler(std::chrono::microseconds sampleInterval_)
+  : sampleInterval(sampleInterval_)
+{
+  Reset();
+  sampler = std::thread([this] { Sample(); });
+}
+
+Profiler::~Profiler()
+{
+  {
+    std::lock_guard lock(samplerMutex);
+    stopping = true;
+  }
+  samplerCondition.notify_one();
+  sampler.join();
+}
+
+void Profiler::Reset()
+{
+  assert(stack.empty() || stack.size() == 1);
+
+  nodes.clear();
+  nodes.emplace_back();
+
+  stack.clear();
+  stack.push_back(Frame());
+
+  location.store(0, std::memory_order_relaxed);
+
+  std::lock_guard lock(samplesMutex);
+  samples.clear();
+}
+
+void Profiler::EnterFunction(const LinkedFunctionCode& code)
+{
+  Enter(GetChild(&code, [&](Node& node) {
+    node.script = code.scriptName;
+    node.state = code.stateName;
+    node.function = code.functionName;
+    if (code.functionType == 1)
+      node.function += ".get";
+    if (code.functionType == 2)
+      node.function += ".set";
+    node.lineNumbers = code.lineNumbers;
+    node.instructionCounts.resize(code.instructions.size());
+  }));
+}
+
+void Profiler::EnterNative(const void* native, const char* className,
+                           const char* functionName)
+{
+  Enter(GetChild(native, [&](Node& node) {
+    node.isNative = true;
+    node.script = className ? className : "";
+    node.function = functionName ? functionName : "";
+  }));
+}
+
+void Profiler::Enter(uint32_t node)
+{
+  auto& entry = nodes[node];
+  ++entry.numCalls;
+
+  Frame frame;
+  frame.node = node;
+  frame.counts = entry.instructionCounts.data();
+  frame.start = Clock::now();
+  stack.push_back(frame);
+
+  location.store((uint64_t(node) << 32) | kNoInstruction,
+                 std::memory_order_relaxed);
+}
+
+void Profiler::Leave()
+{
+  assert(stack.size() > 1);
+
+  auto frame = stack.back();
+  stack.pop_back();
+
+  auto elapsed = Clock::now() - frame.start;
+  auto& node = nodes[frame.node];
+  node.totalTime += elapsed;
+  node.selfTime += elapsed - frame.childTime;
+
+  auto& parent = stack.back();
+  parent.childTime += elapsed;
+  if (node.isNative)
+    nodes[parent.node].nativeTime += elapsed;
+
+  uint64_t newLocation = stack.size() > 1
+    ? (uint64_t(parent.node) << 32) | kNoInstruction
+    : 0;
+  location.store(newLocation, std::memory_order_relaxed);
+}
+
+uint32_t Profiler::GetChild(const void* key,
+                            const std::function<void(Node&)>& init)
+{
+  uint32_t parent = stack.back().node;
+  for (auto& [childKey, child] : nodes[parent].children) {
+    if (childKey == key)
+      return child;
+  }
+
+  auto child = static_cast<uint32_t>(nodes.size());
+  nodes.emplace_back();
+  nodes.back().parent = parent;
+  nodes.back().key = key;
+  init(nodes.back());
+  nodes[parent].children.push_back({ key, child });
+  return child;
+}
+
+std::string Profiler::GetName(const Node& node)
+{
+  if (node.isNative)
+    return node.script + '.' + node.function + " [native]";
+  if (node.state.empty())
+    return node.script + '.' + node.function;
+  return node.script + '.' + node.state + '.' + node.function;
+}
+
+void Profiler::Sample()
+{
+  std::unique_lock lock(samplerMutex);
+  while (!samplerCondition.wait_for(lock, sampleInterval,
+                                    [this] { return stopping; })) {
+    if (auto sampled = location.load(std::memory_order_relaxed)) {
+      std::lock_guard samplesLock(samplesMutex);
+      ++samples[sampled];
+    }
+  }
+}
+
+void Profiler::WriteCollapsedStacks(std::ostream& out) const
+{
+  std::vector<std::string> paths(nodes.size());
+
+  // Parents are always created before their children
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    auto& node = nodes[i];
+    paths[i] = node.parent ? paths[node.parent] + ';' + GetName(node)
+                           : GetName(node);
+
+    auto selfTime = ToMicroseconds(node.selfTime);
+    if (selfTime > 0)
+      out << paths[i] << ' ' << selfTime << '\n';
+  }
+}
+
+void Profiler::WriteJson(std::ostream& out) const
+{
+  struct LineStats
+  {
+    uint64_t numInstructions = 0;
+    uint64_t numSamples = 0;
+  };
+
+  struct FunctionStats
+  {
+    const Node* node = nullptr;
+    uint64_t numCalls = 0, numInstructions = 0, numSamples = 0;
+    Clock::duration totalTime{}, selfTime{}, nativeTime{};
+    std::map<uint32_t, LineStats> lines; // 0 if there is no debug info
+  };
+
+  // The same function may appear at several places in the call tree
+  std::map<const void*, FunctionStats> functions;
+
+  auto getLine = [](const Node& node, size_t instruction) -> uint32_t {
+    if (!node.lineNumbers || instruction >= node.lineNumbers->size())
+      return 0;
+    return (*node.lineNumbers)[instruction];
+  };
+
+  for (size_t i = 1; i < nodes.size(); ++i) {
+    auto& node = nodes[i];
+    auto& stats = functions[node.key];
+    stats.node = &node;
+    stats.numCalls += node.numCalls;
+    stats.totalTime += node.totalTime;
+    stats.selfTime += node.selfTime;
+    stats.nativeTime += node.nativeTime;
+
+    for (size_t k = 0; k < node.instructionCounts.size(); ++k) {
+      if (node.instructionCounts[k]) {
+        stats.numInstructions += node.instructionCounts[k];
+        stats.lines[getLine(node, k)].numInstructions +=
+          node.instructionCounts[k];
+      }
+    }
+  }
+
+  {
+    std::lock_guard lock(samplesMutex);
+    for (auto& [sampled, count] : samples) {
+      auto nodeIndex = static_cast<uint32_t>(sampled >> 32);
+      auto instruction = static_cast<uint32_t>(sampled);
+      if (nodeIndex == 0 || nodeIndex >= nodes.size())
+        continue;
+
+      auto& node = nodes[nodeIndex];
+      auto& stats = functions[node.key];
+      stats.numSamples += count;
+      if (!node.isNative && instruction != kNoInstruction)
+        stats.lines[getLine(node, instruction)].numSamples += count;
+    }
+  }
+
+  std::vector<const FunctionStats*> sorted;
+  for (auto& [key, stats] : functions) {
+    sorted.push_back(&stats);
+  }
+  std::sort(sorted.begin(), sorted.end(), [](auto a, auto b) {
+    return a->selfTime > b->selfTime;
+  });
+
+  auto writeList = [&](bool natives) {
+    bool first = true;
+    for (auto stats : sorted) {
+      auto& node = *stats->node;
+      if (node.isNative != natives)
+        continue;
+
+      out << (first ? "\n" : ",\n") << "    { ";
+      first = false;
+
+      if (natives) {
+        out << "\"class\": " << JsonString(node.script);
+      } else {
+        out << "\"script\": " << JsonString(node.script)
+            << ", \"state\": " << JsonString(node.state);
+      }
+      out << ", \"function\": " << JsonString(node.function)
+          << ", \"calls\": " << stats->numCalls
+          << ", \"totalUs\": " << ToMicroseconds(stats->totalTime)
+          << ", \"samples\": " << stats->numSamples;
+
+      if (!natives) {
+        out << ", \"selfUs\": " << ToMicroseconds(stats->selfTime)
+            << ", \"nativeUs\": " << ToMicroseconds(stats->nativeTime)
+            << ", \"instructions\": " << stats->numInstructions
+            << ", \"lines\": [";
+        bool firstLine = true;
+        for (auto& [line, lineStats] : stats->lines) {
+          out << (firstLine ? "" : ", ") << "{ \"line\": " << line
+              << ", \"instructions\": " << lineStats.numInstructions
+              << ", \"samples\": " << lineStats.numSamples << " }";
+          firstLine = false;
+        }
+        out << "]";
+      }
+      out << " }";
+    }
+    out << "\n  ]";
+  };
+
+  out << "{\n  \"sampleIntervalUs\": " << sampleInterval.count() << ",\n";
+  out << "  \"functions\": [";
+  writeList(false);
+  out << ",\n  \"natives\": [";
+  writeList(true);
+  out << "\n}\n";
+}
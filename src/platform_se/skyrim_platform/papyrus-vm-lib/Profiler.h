@@ -0,0 +1,132 @@
+#pragma once
+#include "Structures.h"
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+
+// Opt-in profiler for one VirtualMachine, attached with vm.profiler = &p.
+// Records the call tree with wall time, native call time, and instruction
+// counts per instruction. A background thread samples the running line at a
+// fixed interval to estimate where the time goes inside a function. Time of
+// parked script threads is not counted.
+//
+// When no profiler is attached the VM only tests a pointer per function
+// call and per instruction.
+class Profiler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+
+  explicit Profiler(std::chrono::microseconds sampleInterval =
+                      std::chrono::microseconds(1000));
+  ~Profiler();
+
+  Profiler(const Profiler&) = delete;
+  Profiler& operator=(const Profiler&) = delete;
+
+  // Enters a script function or a native for as long as it lives
+  class Scope
+  {
+  public:
+    Scope(Profiler* profiler, const LinkedFunctionCode& code)
+      : profiler(profiler)
+    {
+      if (profiler)
+        profiler->EnterFunction(code);
+    }
+
+    Scope(Profiler* profiler, const void* native, const char* className,
+          const char* functionName)
+      : profiler(profiler)
+    {
+      if (profiler)
+        profiler->EnterNative(native, className, functionName);
+    }
+
+    ~Scope()
+    {
+      if (profiler)
+        profiler->Leave();
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    Profiler* const profiler;
+  };
+
+  // Counters of the current function, indexed by instruction
+  uint64_t* GetInstructionCounts() { return stack.back().counts; }
+
+  // Called before every instruction of the current function
+  void SetInstruction(size_t instruction)
+  {
+    location.store((uint64_t(stack.back().node) << 32) | instruction,
+                   std::memory_order_relaxed);
+  }
+
+  // The functions below must not be called while a script of the VM runs
+
+  // Flamegraph input: one line per call stack with its self time in
+  // microseconds, e.g. "Quest.OnUpdate;Quest.Tick;Debug.Trace [native] 42"
+  void WriteCollapsedStacks(std::ostream& out) const;
+
+  // Totals per function with per-line details, and per native
+  void WriteJson(std::ostream& out) const;
+
+  void Reset();
+
+private:
+  struct Node
+  {
+    uint32_t parent = 0;
+    const void* key = nullptr;
+    bool isNative = false;
+
+    // Class name for natives, state and lineNumbers are for scripts only
+    std::string script, state, function;
+    const std::vector<uint16_t>* lineNumbers = nullptr;
+
+    std::vector<std::pair<const void*, uint32_t>> children;
+
+    uint64_t numCalls = 0;
+    Clock::duration totalTime{}, selfTime{}, nativeTime{};
+    std::vector<uint64_t> instructionCounts;
+  };
+
+  struct Frame
+  {
+    uint32_t node = 0;
+    Clock::time_point start;
+    Clock::duration childTime{};
+    uint64_t* counts = nullptr;
+  };
+
+  void EnterFunction(const LinkedFunctionCode& code);
+  void EnterNative(const void* native, const char* className,
+                   const char* functionName);
+  void Enter(uint32_t node);
+  void Leave();
+
+  // Child of the current node, created by init on first use
+  uint32_t GetChild(const void* key, const std::function<void(Node&)>& init);
+  static std::string GetName(const Node& node);
+
+  void Sample();
+
+  std::vector<Node> nodes; // nodes[0] is the root
+  std::vector<Frame> stack;
+
+  // (node << 32) | instruction of the running code, 0 when idle
+  std::atomic<uint64_t> location{ 0 };
+
+  const std::chrono::microseconds sampleInterval;
+  mutable std::mutex samplesMutex;
+  std::unordered_map<uint64_t, uint64_t> samples; // location -> count
+
+  std::mutex samplerMutex;
+  std::condition_variable samplerCondition;
+  bool stopping = false;
+  std::thread sampler;
+};
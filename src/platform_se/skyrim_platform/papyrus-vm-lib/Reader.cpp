@@ -1,11 +1,10 @@
 #include "Reader.h"
+#include <ctpl/ctpl_stl.h>
+#include <cstring>
 #include <fstream>
 
 void Reader::Read()
 {
-
-  char temp;
-
   arrayBytes.clear();
 
   std::ifstream File(path, std::ios::binary);
@@ -13,11 +12,11 @@ void Reader::Read()
   if (File.is_open()) {
 
     File.seekg(0, std::ios_base::end);
+    auto size = static_cast<size_t>(File.tellg());
     File.seekg(0, std::ios_base::beg);
 
-    while (File.get(temp)) {
-      arrayBytes.push_back(temp);
-    }
+    arrayBytes.resize(size);
+    File.read(reinterpret_cast<char*>(arrayBytes.data()), size);
 
   } else {
     throw std::runtime_error("Error open file: " + path);
@@ -31,24 +30,56 @@ std::vector<std::shared_ptr<PexScript>> Reader::GetSourceStructures()
   return sourceStructures;
 }
 
-Reader::Reader(std::vector<std::string> vectorPath)
+Reader::Reader(std::vector<std::string> vectorPath, int numThreads)
 {
-  for (auto path : vectorPath) {
-    this->currentReadPositionInFile = 0;
-    this->path = path;
-    Read();
-    CreateScriptStructure(arrayBytes);
+  if (numThreads <= 1 || vectorPath.size() <= 1) {
+    for (auto path : vectorPath) {
+      this->path = path;
+      Read();
+      CreateScriptStructure(arrayBytes.data(), arrayBytes.size());
+    }
+    arrayBytes = std::vector<uint8_t>();
+    return;
   }
+
+  sourceStructures.resize(vectorPath.size());
+
+  ctpl::thread_pool pool(numThreads);
+  std::vector<std::future<void>> results;
+
+  for (size_t i = 0; i < vectorPath.size(); ++i) {
+    results.push_back(pool.push([&, i](int) {
+      Reader fileReader;
+      fileReader.path = vectorPath[i];
+      fileReader.Read();
+      fileReader.CreateScriptStructure(fileReader.arrayBytes.data(),
+                                       fileReader.arrayBytes.size());
+      sourceStructures[i] = fileReader.structure;
+    }));
+  }
+
+  // Rethrows the first parse error
+  for (auto& result : results) {
+    result.get();
+  }
+}
+
+Reader::Reader(const uint8_t* data, size_t size)
+{
+  CreateScriptStructure(data, size);
 }
 
-void Reader::CreateScriptStructure(std::vector<uint8_t> arrayBytes)
+void Reader::CreateScriptStructure(const uint8_t* data, size_t size)
 {
-  this->arrayBytes = arrayBytes;
+  this->data = data;
+  this->dataSize = size;
   currentReadPositionInFile = 0;
 
   this->structure = std::shared_ptr<PexScript>(new PexScript);
 
   structure->header = FillHeader();
+  if (structure->header.Signature != 0xFA57C0DE)
+    throw std::runtime_error("Not a .pex file");
 
   structure->source = FillSource();
   structure->user = FillUser();
@@ -58,7 +89,13 @@ void Reader::CreateScriptStructure(std::vector<uint8_t> arrayBytes)
   structure->debugInfo = FillDebugInfo();
   structure->userFlagTable = FillUserFlagTable();
   structure->objectTable = FillObjectTable();
+  // Scripts are used as if they had exactly one
+  if (structure->objectTable.m_data.empty())
+    throw std::runtime_error("No object in .pex file");
   sourceStructures.push_back(structure);
+
+  this->data = nullptr;
+  this->dataSize = 0;
 }
 
 ScriptHeader Reader::FillHeader()
@@ -80,9 +117,10 @@ std::string Reader::FillSource()
   int SizeString = Read16_bit();
   source = ReadString(SizeString);
 
-  for (int i = 0; i < 4; ++i) {
-    source.pop_back();
-  }
+  // Without ".psc"
+  if (source.size() < 4)
+    throw std::runtime_error("Bad source name in .pex file");
+  source.resize(source.size() - 4);
 
   return source;
 }
@@ -143,9 +181,9 @@ DebugInfo::DebugFunction Reader::FillDebugFunction()
 {
   DebugInfo::DebugFunction Fdebug = DebugInfo::DebugFunction();
 
-  Fdebug.objName = this->structure->stringTable.m_data[Read16_bit()];
-  Fdebug.stateName = this->structure->stringTable.m_data[Read16_bit()];
-  Fdebug.fnName = this->structure->stringTable.m_data[Read16_bit()];
+  Fdebug.objName = ReadStringTableEntry();
+  Fdebug.stateName = ReadStringTableEntry();
+  Fdebug.fnName = ReadStringTableEntry();
   Fdebug.type = Read8_bit();
 
   int InstrunctionCount = Read16_bit();
@@ -175,7 +213,7 @@ UserFlagTable::UserFlag Reader::FillUserFlag()
 {
   UserFlagTable::UserFlag flag = UserFlagTable::UserFlag();
 
-  flag.name = this->structure->stringTable.m_data[Read16_bit()];
+  flag.name = ReadStringTableEntry();
   flag.idx = Read8_bit();
 
   return flag;
@@ -200,15 +238,15 @@ ObjectTable::Object Reader::FillObject()
 {
   ObjectTable::Object object = ObjectTable::Object();
 
-  object.NameIndex = this->structure->stringTable.m_data[Read16_bit()];
+  object.NameIndex = ReadStringTableEntry();
 
   Read32_bit(); //	Dont remove!   size includes itself for some reason,
                 // hence size-4
 
-  object.parentClassName = this->structure->stringTable.m_data[Read16_bit()];
-  object.docstring = this->structure->stringTable.m_data[Read16_bit()];
+  object.parentClassName = ReadStringTableEntry();
+  object.docstring = ReadStringTableEntry();
   object.userFlags = Read32_bit();
-  object.autoStateName = this->structure->stringTable.m_data[Read16_bit()];
+  object.autoStateName = ReadStringTableEntry();
 
   int numVariables = Read16_bit();
 
@@ -235,8 +273,8 @@ ObjectTable::Object::VarInfo Reader::FillVariable()
 {
   ObjectTable::Object::VarInfo Var = ObjectTable::Object::VarInfo();
 
-  Var.name = this->structure->stringTable.m_data[Read16_bit()];
-  Var.typeName = this->structure->stringTable.m_data[Read16_bit()];
+  Var.name = ReadStringTableEntry();
+  Var.typeName = ReadStringTableEntry();
   Var.userFlags = Read32_bit();
   Var.value = FillVariableData();
 
@@ -253,21 +291,19 @@ VarValue Reader::FillVariableData()
       Data = VarValue::None();
       break;
     case Data.kType_Identifier:
-      Data =
-        VarValue(Data.kType_Identifier,
-                 this->structure->stringTable.m_data[Read16_bit()].data());
+      Data = VarValue(Data.kType_Identifier, ReadStringTableEntry().data());
       break;
     case Data.kType_String:
-      Data =
-        VarValue(this->structure->stringTable.m_data[Read16_bit()].data());
+      Data = VarValue(ReadStringTableEntry().data());
       break;
     case Data.kType_Integer:
       Data = VarValue((int32_t)Read32_bit());
       break;
     case Data.kType_Float: {
       uint32_t v = Read32_bit();
-      Data = VarValue(*(float*)&v);
-      // Data.data.f = (int)Read32_bit();
+      float f;
+      std::memcpy(&f, &v, sizeof(f));
+      Data = VarValue(f);
     } break;
     case Data.kType_Bool:
       Data = VarValue((bool)Read8_bit());
@@ -288,7 +324,7 @@ VarValue Reader::FillVariableData()
       Read32_bit();
       break;
     default:
-      assert(false);
+      throw std::runtime_error("Unknown value type in .pex file");
   }
 
   return Data;
@@ -298,8 +334,8 @@ FunctionInfo Reader::FillFuncInfo()
 {
   FunctionInfo info = FunctionInfo();
 
-  info.returnType = this->structure->stringTable.m_data[Read16_bit()];
-  info.docstring = this->structure->stringTable.m_data[Read16_bit()];
+  info.returnType = ReadStringTableEntry();
+  info.docstring = ReadStringTableEntry();
   info.userFlags = Read32_bit();
   info.flags = Read8_bit();
 
@@ -307,8 +343,8 @@ FunctionInfo Reader::FillFuncInfo()
   info.params.resize(CountParams);
   for (int i = 0; i < CountParams; i++) {
     FunctionInfo::ParamInfo temp = FunctionInfo::ParamInfo();
-    temp.name = this->structure->stringTable.m_data[Read16_bit()];
-    temp.type = this->structure->stringTable.m_data[Read16_bit()];
+    temp.name = ReadStringTableEntry();
+    temp.type = ReadStringTableEntry();
     info.params[i] = temp;
   }
 
@@ -316,8 +352,8 @@ FunctionInfo Reader::FillFuncInfo()
   info.locals.resize(CountLocals);
   for (int i = 0; i < CountLocals; i++) {
     FunctionInfo::ParamInfo temp = FunctionInfo::ParamInfo();
-    temp.name = this->structure->stringTable.m_data[Read16_bit()];
-    temp.type = this->structure->stringTable.m_data[Read16_bit()];
+    temp.name = ReadStringTableEntry();
+    temp.type = ReadStringTableEntry();
     info.locals[i] = temp;
   }
 
@@ -359,6 +395,9 @@ FunctionCode Reader::FillFunctionCode(int CountInstructions)
 
 uint8_t Reader::GetCountArguments(uint8_t opcode)
 {
+  // Opcodes past the table are internal to FunctionOptimizer
+  if (opcode >= numArgumentsForOpcodes.size())
+    throw std::runtime_error("Unknown opcode in .pex file");
 
   int count = numArgumentsForOpcodes[opcode];
 
@@ -374,14 +413,14 @@ ObjectTable::Object::PropInfo Reader::FillProperty()
 {
   ObjectTable::Object::PropInfo prop = ObjectTable::Object::PropInfo();
 
-  prop.name = this->structure->stringTable.m_data[Read16_bit()];
-  prop.type = this->structure->stringTable.m_data[Read16_bit()];
-  prop.docstring = this->structure->stringTable.m_data[Read16_bit()];
+  prop.name = ReadStringTableEntry();
+  prop.type = ReadStringTableEntry();
+  prop.docstring = ReadStringTableEntry();
   prop.userFlags = Read32_bit();
   prop.flags = Read8_bit();
 
   if ((prop.flags & 4) == prop.kFlags_AutoVar) { // it exists??
-    prop.autoVarName = this->structure->stringTable.m_data[Read16_bit()];
+    prop.autoVarName = ReadStringTableEntry();
   } else
     prop.autoVarName;
 
@@ -402,7 +441,7 @@ ObjectTable::Object::StateInfo Reader::FillState()
 {
   ObjectTable::Object::StateInfo stateinfo = ObjectTable::Object::StateInfo();
 
-  stateinfo.name = this->structure->stringTable.m_data[Read16_bit()];
+  stateinfo.name = ReadStringTableEntry();
 
   int numFunctions = Read16_bit();
 
@@ -418,17 +457,30 @@ ObjectTable::Object::StateInfo::StateFunction Reader::FillStateFunction()
   ObjectTable::Object::StateInfo::StateFunction temp =
     ObjectTable::Object::StateInfo::StateFunction();
 
-  temp.name = this->structure->stringTable.m_data[Read16_bit()];
+  temp.name = ReadStringTableEntry();
   temp.function = FillFuncInfo();
 
   return temp;
 }
 
-uint8_t Reader::Read8_bit()
+void Reader::CheckAvailable(size_t size)
+{
+  if (dataSize - currentReadPositionInFile < size)
+    throw std::runtime_error("Unexpected end of .pex file");
+}
+
+const std::string& Reader::ReadStringTableEntry()
 {
-  uint8_t temp = NULL;
+  uint16_t index = Read16_bit();
+  if (index >= structure->stringTable.m_data.size())
+    throw std::runtime_error("Bad string index in .pex file");
+  return structure->stringTable.m_data[index];
+}
 
-  temp = arrayBytes[currentReadPositionInFile];
+uint8_t Reader::Read8_bit()
+{
+  CheckAvailable(1);
+  uint8_t temp = data[currentReadPositionInFile];
   currentReadPositionInFile++;
 
   return temp;
@@ -436,10 +488,11 @@ uint8_t Reader::Read8_bit()
 
 uint16_t Reader::Read16_bit()
 {
-  uint16_t temp = NULL;
+  CheckAvailable(2);
+  uint16_t temp = 0;
 
   for (int i = 0; i < 2; i++) {
-    temp = temp * 256 + arrayBytes[currentReadPositionInFile];
+    temp = temp * 256 + data[currentReadPositionInFile];
     currentReadPositionInFile++;
   }
 
@@ -448,10 +501,11 @@ uint16_t Reader::Read16_bit()
 
 uint32_t Reader::Read32_bit()
 {
-  uint32_t temp = NULL;
+  CheckAvailable(4);
+  uint32_t temp = 0;
 
   for (int i = 0; i < 4; i++) {
-    temp = temp * 256 + arrayBytes[currentReadPositionInFile];
+    temp = temp * 256 + data[currentReadPositionInFile];
     currentReadPositionInFile++;
   }
   return temp;
@@ -459,10 +513,11 @@ uint32_t Reader::Read32_bit()
 
 uint64_t Reader::Read64_bit()
 {
-  uint64_t temp = NULL;
+  CheckAvailable(8);
+  uint64_t temp = 0;
 
   for (int i = 0; i < 8; i++) {
-    temp = temp * 256 + arrayBytes[currentReadPositionInFile];
+    temp = temp * 256 + data[currentReadPositionInFile];
     currentReadPositionInFile++;
   }
   return temp;
@@ -470,12 +525,10 @@ uint64_t Reader::Read64_bit()
 
 std::string Reader::ReadString(int Size)
 {
-  std::string temp = "";
-
-  for (int i = 0; i < Size; i++) {
-    temp += (char)arrayBytes[currentReadPositionInFile];
-    currentReadPositionInFile++;
-  }
+  CheckAvailable(Size);
+  std::string temp(
+    reinterpret_cast<const char*>(data + currentReadPositionInFile), Size);
+  currentReadPositionInFile += Size;
 
   return temp;
 }
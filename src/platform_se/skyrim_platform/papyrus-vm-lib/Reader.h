@@ -16,10 +16,15 @@ class Reader
 
   bool additionalArguments = false;
 
-  int currentReadPositionInFile = 0;
+  size_t currentReadPositionInFile = 0;
 
+  // File contents when reading from disk
   std::vector<uint8_t> arrayBytes;
 
+  // Bytes being parsed, either arrayBytes or a caller-owned buffer
+  const uint8_t* data = nullptr;
+  size_t dataSize = 0;
+
   std::string FillSource();
   std::string FillUser();
   std::string FillMachine();
@@ -48,10 +53,21 @@ class Reader
   uint64_t Read64_bit();
   std::string ReadString(int Size);
 
+  // Truncated and malformed files throw std::runtime_error
+  void CheckAvailable(size_t size);
+  const std::string& ReadStringTableEntry();
+
   void Read();
-  void CreateScriptStructure(std::vector<uint8_t> arrayBytes);
+  void CreateScriptStructure(const uint8_t* data, size_t size);
+
+  Reader() = default;
 
 public:
   std::vector<std::shared_ptr<PexScript>> GetSourceStructures();
-  Reader(std::vector<std::string> vectorPath);
+
+  // Files are parsed on numThreads threads, the order of scripts is kept
+  Reader(std::vector<std::string> vectorPath, int numThreads = 1);
+
+  // Parses a .pex image from memory without copying it
+  Reader(const uint8_t* data, size_t size);
 };
\ No newline at end of file
@@ -0,0 +1,192 @@
+#include "Scheduler.h"
+#include <algorithm>
+#include <stdexcept>
+
+void LatentResult::Complete(VarValue result) const
+{
+  if (!queue)
+    return;
+
+  std::lock_guard lock(queue->mutex);
+  queue->completed.push_back({ waitId, std::move(result) });
+}
+
+Scheduler::Scheduler()
+  : completed(std::make_shared<LatentResult::Queue>())
+{
+}
+
+void Scheduler::Spawn(ActivePexInstance* instance, FunctionInfo& function,
+                      const VarValue* arguments, size_t numArguments,
+                      ReturnCallback onReturn)
+{
+  ScriptThread thread;
+  thread.onReturn = std::move(onReturn);
+
+  auto result = Run(thread, [&] {
+    return instance->StartFunction(function, arguments, numArguments);
+  });
+  Finish(thread, result);
+}
+
+size_t Scheduler::Tick(std::chrono::microseconds budget)
+{
+  auto start = Clock::now();
+
+  while (!timers.empty() && timers.top().deadline <= start) {
+    ready.push_back({ timers.top().waitId, VarValue::None() });
+    timers.pop();
+  }
+
+  {
+    std::lock_guard lock(completed->mutex);
+    for (auto& entry : completed->completed) {
+      ready.push_back(std::move(entry));
+    }
+    completed->completed.clear();
+  }
+
+  size_t numResumed = 0;
+
+  while (!ready.empty()) {
+    if (numResumed > 0 && Clock::now() - start >= budget)
+      break;
+
+    auto [waitId, result] = std::move(ready.front());
+    ready.pop_front();
+
+    auto it = parked.find(waitId);
+    if (it == parked.end())
+      continue; // Cancelled or completed twice
+
+    ScriptThread thread;
+    thread.onReturn = std::move(it->second.onReturn);
+    auto frames = std::move(it->second.frames);
+    parked.erase(it);
+
+    // The outermost frame resumes the inner ones, see ResumeFunction
+    result = Run(thread, [&] {
+      return frames.back().instance->ResumeFunction(
+        frames.data(), frames.size() - 1, result);
+    });
+    Finish(thread, result);
+    ++numResumed;
+  }
+
+  return numResumed;
+}
+
+LatentResult Scheduler::Suspend()
+{
+  LatentResult latent;
+  latent.queue = completed;
+  latent.waitId = BeginSuspend();
+  return latent;
+}
+
+void Scheduler::SuspendFor(Clock::duration duration)
+{
+  timers.push({ Clock::now() + duration, BeginSuspend() });
+}
+
+void Scheduler::PushFrame(SuspendedFrame frame)
+{
+  assert(suspending);
+  current->frames.push_back(std::move(frame));
+}
+
+void Scheduler::KeepAlive(std::shared_ptr<ActivePexInstance> instance)
+{
+  assert(suspending && !current->frames.empty());
+  current->frames.back().keepAlive = std::move(instance);
+}
+
+void Scheduler::CancelThreads(IGameObject* object)
+{
+  CancelThreads([&](const SuspendedFrame& frame) {
+    return (IGameObject*)frame.instance->activeInstanceOwner == object;
+  });
+}
+
+void Scheduler::CancelThreads(
+  const std::unordered_set<const ActivePexInstance*>& instances)
+{
+  if (instances.empty())
+    return;
+  CancelThreads([&](const SuspendedFrame& frame) {
+    return instances.count(frame.instance) > 0;
+  });
+}
+
+void Scheduler::CancelThreads(
+  const std::function<bool(const SuspendedFrame& frame)>& uses)
+{
+  for (auto it = parked.begin(); it != parked.end();) {
+    auto& frames = it->second.frames;
+    bool cancel = std::any_of(frames.begin(), frames.end(), uses);
+    it = cancel ? parked.erase(it) : std::next(it);
+  }
+}
+
+void Scheduler::ForEachValue(
+  const std::function<void(const VarValue&)>& fn) const
+{
+  for (auto& [waitId, thread] : parked) {
+    for (auto& frame : thread.frames) {
+      for (auto& value : frame.locals) {
+        fn(value);
+      }
+    }
+  }
+  for (auto& entry : ready) {
+    fn(entry.second);
+  }
+
+  // Results completed since the last Tick, which hasn't moved them to ready
+  std::lock_guard lock(completed->mutex);
+  for (auto& entry : completed->completed) {
+    fn(entry.second);
+  }
+}
+
+uint64_t Scheduler::BeginSuspend()
+{
+  if (!current)
+    throw std::runtime_error("Latent function called outside of a script "
+                             "thread");
+  if (suspending)
+    throw std::runtime_error("Script thread is already suspended");
+
+  suspending = true;
+  suspendedWaitId = nextWaitId++;
+  return suspendedWaitId;
+}
+
+VarValue Scheduler::Run(ScriptThread& thread,
+                        const std::function<VarValue()>& body)
+{
+  auto prev = current;
+  current = &thread;
+  try {
+    auto result = body();
+    current = prev;
+    return result;
+  } catch (...) {
+    // The thread is dropped, the caller's thread continues
+    current = prev;
+    suspending = false;
+    throw;
+  }
+}
+
+void Scheduler::Finish(ScriptThread& thread, const VarValue& result)
+{
+  if (!suspending) {
+    if (thread.onReturn)
+      thread.onReturn(result);
+    return;
+  }
+
+  suspending = false;
+  parked.emplace(suspendedWaitId, std::move(thread));
+}
@@ -0,0 +1,128 @@
+#pragma once
+#include "Structures.h"
+#include <chrono>
+#include <deque>
+#include <queue>
+#include <unordered_set>
+
+// Call stack of a script thread that waits for a latent native, innermost
+// frame first. Each frame stopped at the call instruction that suspended
+struct SuspendedFrame
+{
+  ActivePexInstance* instance = nullptr;
+  FunctionInfo* function = nullptr;
+  std::shared_ptr<LinkedFunctionCode> code;
+  size_t line = 0;
+  std::vector<VarValue> locals;
+
+  // Set when the instance is not owned by a game object (CallStatic)
+  std::shared_ptr<ActivePexInstance> keepAlive;
+};
+
+// Lets a latent native finish later. Complete may be called from any thread,
+// the script continues on the next Scheduler::Tick. Only the first call has
+// an effect
+class LatentResult
+{
+public:
+  void Complete(VarValue result) const;
+
+private:
+  friend class Scheduler;
+
+  struct Queue
+  {
+    std::mutex mutex;
+    std::vector<std::pair<uint64_t, VarValue>> completed;
+  };
+
+  std::shared_ptr<Queue> queue;
+  uint64_t waitId = 0;
+};
+
+// Runs script threads cooperatively on the VM's thread. A thread runs until
+// its function returns or a native suspends it, then parks until its latent
+// result completes. Parked threads cost no OS thread and no native stack.
+class Scheduler
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using ReturnCallback = std::function<void(const VarValue& result)>;
+
+  Scheduler();
+
+  // Runs the function on a new script thread until it returns or suspends.
+  // onReturn, if set, gets the result when the thread finishes
+  void Spawn(ActivePexInstance* instance, FunctionInfo& function,
+             const VarValue* arguments, size_t numArguments,
+             ReturnCallback onReturn = nullptr);
+
+  // Resumes threads whose latent results are ready. Stops once the budget is
+  // spent, the rest is resumed on the next call. Returns the number of
+  // resumed threads
+  size_t Tick(std::chrono::microseconds budget);
+
+  // Called by a native to make its caller wait. The value the native returns
+  // is ignored, the caller gets the value passed to Complete instead
+  LatentResult Suspend();
+
+  // Same as Suspend, but completes with None once the duration has passed
+  void SuspendFor(Clock::duration duration);
+
+  // True between Suspend and the moment the thread is parked
+  bool IsSuspending() const { return suspending; }
+
+  // Used by the interpreter while unwinding a suspending thread
+  void PushFrame(SuspendedFrame frame);
+  void KeepAlive(std::shared_ptr<ActivePexInstance> instance);
+
+  // Drops parked threads running scripts of the object
+  void CancelThreads(IGameObject* object);
+
+  // Drops parked threads with a frame on one of the instances
+  void CancelThreads(
+    const std::unordered_set<const ActivePexInstance*>& instances);
+
+  size_t GetNumParked() const { return parked.size(); }
+
+  // True if the last Tick ran out of budget before resuming every thread
+  bool HasReady() const { return !ready.empty(); }
+
+  // Calls fn for the locals of parked threads and for latent results not
+  // resumed yet, including those completed since the last Tick
+  void ForEachValue(const std::function<void(const VarValue&)>& fn) const;
+
+private:
+  struct ScriptThread
+  {
+    std::vector<SuspendedFrame> frames;
+    ReturnCallback onReturn;
+  };
+
+  struct Timer
+  {
+    Clock::time_point deadline;
+    uint64_t waitId = 0;
+
+    bool operator>(const Timer& rhs) const { return deadline > rhs.deadline; }
+  };
+
+  void CancelThreads(
+    const std::function<bool(const SuspendedFrame& frame)>& uses);
+
+  uint64_t BeginSuspend();
+  VarValue Run(ScriptThread& thread, const std::function<VarValue()>& body);
+  void Finish(ScriptThread& thread, const VarValue& result);
+
+  std::unordered_map<uint64_t, ScriptThread> parked;
+  std::shared_ptr<LatentResult::Queue> completed;
+  std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+
+  // Completed but not resumed yet, in completion order
+  std::deque<std::pair<uint64_t, VarValue>> ready;
+
+  ScriptThread* current = nullptr;
+  bool suspending = false;
+  uint64_t suspendedWaitId = 0;
+  uint64_t nextWaitId = 1;
+};
@@ -0,0 +1,361 @@
+#include "ShardedVirtualMachine.h"
+#include <algorithm>
+
+namespace {
+// How long a shard spends resuming script threads between two message
+// batches, and how often it wakes up to poll latent results completed
+// outside the VM
+constexpr std::chrono::microseconds kTickBudget(2000);
+constexpr std::chrono::microseconds kPollInterval(1000);
+
+// A shard frees its runtime strings between two message batches once its
+// pool holds this many, or twice as many as were left by the last collection
+constexpr size_t kMinStringsToCollect = 4096;
+
+// Values sent to another shard. Strings are copied since each shard frees its
+// runtime strings on its own. Arrays are copied too, as script threads of
+// both shards could modify a shared one
+class PortableValues
+{
+public:
+  PortableValues(const VarValue* values, size_t numValues)
+  {
+    for (size_t i = 0; i < numValues; ++i) {
+      auto& value = values[i];
+      if (value.GetType() == VarValue::kType_String && (const char*)value) {
+        strings.push_back({ this->values.size(), (const char*)value });
+      } else if (auto array = value.GetArray()) {
+        arrays.push_back(CopyArray(this->values.size(), *array));
+
+        // None of the same type, Get attaches the copy
+        VarValue none(value.GetType());
+        none.SetObjectTypeId(value.GetObjectTypeId());
+        this->values.push_back(none);
+        continue;
+      }
+      this->values.push_back(value);
+    }
+  }
+
+  std::vector<VarValue> Get(StringPool& stringPool) const
+  {
+    auto result = values;
+    for (auto& [index, str] : strings) {
+      result[index] = VarValue(stringPool.Intern(str));
+    }
+    for (auto& copy : arrays) {
+      auto& array = result[copy.index].CreateArray(0);
+      array.ints = copy.ints;
+      array.floats = copy.floats;
+      array.bools = copy.bools;
+      array.values = copy.objects;
+      for (auto& str : copy.strings) {
+        array.values.push_back(VarValue(stringPool.Intern(str)));
+      }
+    }
+    return result;
+  }
+
+private:
+  struct ArrayCopy
+  {
+    size_t index = 0;
+    std::vector<int32_t> ints;
+    std::vector<float> floats;
+    std::vector<bool> bools;
+    std::vector<VarValue> objects;
+    std::vector<std::string> strings;
+  };
+
+  static ArrayCopy CopyArray(size_t index, const VarArray& array)
+  {
+    ArrayCopy copy;
+    copy.index = index;
+    copy.ints = array.ints;
+    copy.floats = array.floats;
+    copy.bools = array.bools;
+    if (array.type == VarValue::kType_StringArray) {
+      for (auto& element : array.values) {
+        auto str = (const char*)element;
+        copy.strings.push_back(str ? str : "");
+      }
+    } else {
+      copy.objects = array.values;
+    }
+    return copy;
+  }
+
+  std::vector<VarValue> values;
+  std::vector<std::pair<size_t, std::string>> strings;
+  std::vector<ArrayCopy> arrays;
+};
+
+// Runs the function on the object's instance of 'script' on a new script
+// thread of the owning shard
+void CallMethodAsync(VirtualMachine& vm, IGameObject* object,
+                     const PexScript* script, FunctionInfo& function,
+                     const std::vector<VarValue>& arguments,
+                     Scheduler::ReturnCallback onReturn)
+{
+  auto it = vm.gameObjects.find(object);
+  if (it != vm.gameObjects.end()) {
+    for (auto& scriptInstance : it->second.instances) {
+      for (auto* instance = &scriptInstance; instance != nullptr;
+           instance = instance->GetParentInstance()) {
+        if (instance->sourcePex.get() == script) {
+          vm.scheduler.Spawn(instance, function, arguments.data(),
+                             arguments.size(), std::move(onReturn));
+          return;
+        }
+      }
+    }
+  }
+
+  // Removed after the call was posted
+  onReturn(VarValue::None());
+}
+}
+
+ShardedVirtualMachine::ShardedVirtualMachine(
+  std::vector<std::shared_ptr<PexScript>> loadedScripts, size_t numShards,
+  bool optimize)
+{
+  if (numShards == 0)
+    throw std::runtime_error("ShardedVirtualMachine needs at least 1 shard");
+
+  for (size_t i = 0; i < numShards; ++i) {
+    auto shard = std::make_unique<Shard>();
+    shard->index = i;
+    shard->numStringsToCollect = kMinStringsToCollect;
+    shard->vm = std::make_unique<VirtualMachine>(loadedScripts, optimize);
+
+    auto& ref = *shard;
+    shard->vm->routeCall =
+      [this, &ref](const PexScript& script, FunctionInfo& function,
+                   IGameObject* object, const VarValue* arguments,
+                   size_t numArguments) {
+        return RouteCall(ref, script, function, object, arguments,
+                         numArguments);
+      };
+    shards.push_back(std::move(shard));
+  }
+}
+
+ShardedVirtualMachine::~ShardedVirtualMachine()
+{
+  Stop();
+}
+
+void ShardedVirtualMachine::Start()
+{
+  if (running)
+    return;
+
+  running = true;
+  for (auto& shard : shards) {
+    shard->stopping = false;
+    shard->thread = std::thread([this, &shard = *shard] { Run(shard); });
+  }
+}
+
+void ShardedVirtualMachine::Stop()
+{
+  if (!running)
+    return;
+
+  for (auto& shard : shards) {
+    std::lock_guard lock(shard->mutex);
+    shard->stopping = true;
+    shard->condition.notify_one();
+  }
+  for (auto& shard : shards) {
+    shard->thread.join();
+  }
+  running = false;
+}
+
+void ShardedVirtualMachine::AddObject(std::shared_ptr<IGameObject> self,
+                                      std::vector<std::string> scripts,
+                                      VarForBuildActivePex vars)
+{
+  // Scripts are shared and read-only, any shard can resolve the names
+  auto& vm = *shards[0]->vm;
+  std::vector<const PexScript*> objectScriptList;
+  for (auto& name : scripts) {
+    auto script = vm.GetScript(name);
+    while (script) {
+      objectScriptList.push_back(script.get());
+      auto& objects = script->objectTable.m_data;
+      script =
+        objects.empty() ? nullptr : vm.GetScript(objects[0].parentClassName);
+    }
+  }
+
+  // Updated along with the queue, so a routed call never reaches the owner
+  // before the object does
+  std::lock_guard lock(objectsMutex);
+  objectScripts[self.get()] = std::move(objectScriptList);
+  Post(GetShardIndex(self.get()),
+       [self, scripts = std::move(scripts),
+        vars = std::move(vars)](VirtualMachine& vm) {
+         vm.AddObject(self, scripts, vars);
+       });
+}
+
+void ShardedVirtualMachine::RemoveObject(std::shared_ptr<IGameObject> self)
+{
+  std::lock_guard lock(objectsMutex);
+  objectScripts.erase(self.get());
+  Post(GetShardIndex(self.get()),
+       [self](VirtualMachine& vm) { vm.RemoveObject(self); });
+}
+
+void ShardedVirtualMachine::SendEvent(std::shared_ptr<IGameObject> self,
+                                      std::string eventName,
+                                      std::vector<VarValue> arguments)
+{
+  Post(GetShardIndex(self.get()),
+       [self, eventName = std::move(eventName),
+        arguments = PortableValues(arguments.data(), arguments.size())](
+         VirtualMachine& vm) {
+         auto args = arguments.Get(vm.stringPool);
+         vm.SendEvent(self, eventName.c_str(), args);
+       });
+}
+
+void ShardedVirtualMachine::Flush()
+{
+  // Nothing would handle the markers without the shard threads
+  if (running) {
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t numPending = shards.size();
+
+    for (auto& shard : shards) {
+      Post(shard->index, [&](VirtualMachine&) {
+        std::lock_guard lock(mutex);
+        if (--numPending == 0)
+          condition.notify_one();
+      });
+    }
+
+    std::unique_lock lock(mutex);
+    condition.wait(lock, [&] { return numPending == 0; });
+  }
+
+  std::lock_guard lock(errorsMutex);
+  if (!errors.empty()) {
+    auto error = errors.front();
+    errors.clear();
+    throw std::runtime_error(error);
+  }
+}
+
+size_t ShardedVirtualMachine::GetShardIndex(IGameObject* object) const
+{
+  auto id = object ? object->GetStringID() : nullptr;
+  if (!id)
+    return 0;
+  return std::hash<std::string_view>()(id) % shards.size();
+}
+
+void ShardedVirtualMachine::Post(size_t shardIndex, Message message)
+{
+  auto& shard = *shards[shardIndex];
+  std::lock_guard lock(shard.mutex);
+  shard.messages.push_back(std::move(message));
+  shard.condition.notify_one();
+}
+
+void ShardedVirtualMachine::Run(Shard& shard)
+{
+  auto& vm = *shard.vm;
+  std::vector<Message> messages;
+
+  while (true) {
+    {
+      std::unique_lock lock(shard.mutex);
+      auto hasWork = [&] {
+        return !shard.messages.empty() || shard.stopping;
+      };
+
+      if (vm.scheduler.HasReady()) {
+        // Budget ran out last time, don't sleep
+      } else if (vm.scheduler.GetNumParked() > 0) {
+        shard.condition.wait_for(lock, kPollInterval, hasWork);
+      } else {
+        shard.condition.wait(lock, hasWork);
+      }
+
+      if (shard.stopping && shard.messages.empty())
+        return;
+      messages.swap(shard.messages);
+    }
+
+    for (auto& message : messages) {
+      Handle(message, vm);
+    }
+    messages.clear();
+
+    Handle([](VirtualMachine& vm) { vm.scheduler.Tick(kTickBudget); }, vm);
+
+    // No script is running here, as CollectStrings requires
+    if (vm.stringPool.GetSize() >= shard.numStringsToCollect) {
+      vm.CollectStrings();
+      shard.numStringsToCollect =
+        std::max(kMinStringsToCollect, vm.stringPool.GetSize() * 2);
+    }
+  }
+}
+
+void ShardedVirtualMachine::Handle(const Message& message, VirtualMachine& vm)
+{
+  try {
+    message(vm);
+  } catch (std::exception& e) {
+    std::lock_guard lock(errorsMutex);
+    errors.push_back(e.what());
+  }
+}
+
+bool ShardedVirtualMachine::RouteCall(Shard& caller, const PexScript& script,
+                                      FunctionInfo& function,
+                                      IGameObject* object,
+                                      const VarValue* arguments,
+                                      size_t numArguments)
+{
+  if (caller.vm->gameObjects.count(object))
+    return false;
+
+  size_t owner = GetShardIndex(object);
+  if (owner == caller.index)
+    return false;
+
+  // Without an instance of the script on the owner, the call runs here as
+  // it would in a single VirtualMachine
+  std::shared_lock lock(objectsMutex);
+  auto it = objectScripts.find(object);
+  if (it == objectScripts.end() ||
+      std::find(it->second.begin(), it->second.end(), &script) ==
+        it->second.end())
+    return false;
+
+  auto latent = caller.vm->scheduler.Suspend();
+
+  auto reply = [this, callerIndex = caller.index,
+                latent](const VarValue& result) {
+    Post(callerIndex,
+         [latent, result = PortableValues(&result, 1)](VirtualMachine& vm) {
+           latent.Complete(result.Get(vm.stringPool)[0]);
+         });
+  };
+
+  Post(owner,
+       [object, reply, script = &script, function = &function,
+        arguments = PortableValues(arguments, numArguments)](
+         VirtualMachine& vm) {
+         CallMethodAsync(vm, object, script, *function,
+                         arguments.Get(vm.stringPool), reply);
+       });
+  return true;
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "VirtualMachine.h"
+#include <condition_variable>
+#include <shared_mutex>
+#include <thread>
+
+// Runs scripts on several threads. Game objects are partitioned across shards
+// by the hash of their string id. Each shard is a VirtualMachine with its own
+// thread, string pool, frame arena and scheduler, and only that thread
+// touches it once Start is called. Everything addressed to an object is
+// queued to its shard. A script calling a method of an object owned by
+// another shard waits for the result as it would for a latent native. The
+// method is looked up as VirtualMachine::CallMethod does and runs on the
+// object's instance of the script it was found in. Natives, and objects that
+// weren't added or lack that script, are called on the calling shard. Arrays
+// are copied between shards, so the caller doesn't see the callee's changes.
+//
+// Each shard frees its runtime strings on its own thread when its pool grows.
+// Loaded scripts are shared by all shards and are read-only after linking.
+// Natives are registered on every shard before Start and run on the thread
+// of the calling shard.
+class ShardedVirtualMachine
+{
+public:
+  ShardedVirtualMachine(std::vector<std::shared_ptr<PexScript>> loadedScripts,
+                        size_t numShards, bool optimize = false);
+  ~ShardedVirtualMachine();
+
+  ShardedVirtualMachine(const ShardedVirtualMachine&) = delete;
+  ShardedVirtualMachine& operator=(const ShardedVirtualMachine&) = delete;
+
+  template <class F>
+  void RegisterFunction(std::string className, std::string functionName,
+                        FunctionType type, F fn)
+  {
+    assert(!IsRunning());
+    for (auto& shard : shards) {
+      shard->vm->RegisterFunction(className, functionName, type, fn);
+    }
+  }
+
+  // Linked code is shared, so binding it through one shard is enough
+  size_t RegisterAotFunctions(const std::vector<AotFunction>& functions)
+  {
+    assert(!IsRunning());
+    return shards[0]->vm->RegisterAotFunctions(functions);
+  }
+
+  void Start();
+
+  // Handles messages already queued, then joins the shard threads. Threads
+  // parked at that moment stay parked
+  void Stop();
+
+  bool IsRunning() const { return running; }
+
+  // These only queue the work. Strings and arrays in arguments are copied
+  void AddObject(std::shared_ptr<IGameObject> self,
+                 std::vector<std::string> scripts, VarForBuildActivePex vars);
+  void RemoveObject(std::shared_ptr<IGameObject> self);
+  void SendEvent(std::shared_ptr<IGameObject> self, std::string eventName,
+                 std::vector<VarValue> arguments);
+
+  // Blocks until every shard has handled the messages queued before the
+  // call. Parked script threads are not waited for. Rethrows the first error
+  // a shard ran into since the previous Flush. Before Start and after Stop
+  // it only rethrows, queued messages wait for the next Start
+  void Flush();
+
+  size_t GetNumShards() const { return shards.size(); }
+  size_t GetShardIndex(IGameObject* object) const;
+
+  // Must not be used while running
+  VirtualMachine& GetShard(size_t index) { return *shards[index]->vm; }
+
+private:
+  using Message = std::function<void(VirtualMachine& vm)>;
+
+  struct Shard
+  {
+    size_t index = 0;
+    std::unique_ptr<VirtualMachine> vm;
+    std::thread thread;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    std::vector<Message> messages;
+    bool stopping = false;
+
+    // Pool size at which Run calls CollectStrings next
+    size_t numStringsToCollect = 0;
+  };
+
+  void Post(size_t shardIndex, Message message);
+  void Run(Shard& shard);
+  void Handle(const Message& message, VirtualMachine& vm);
+  bool RouteCall(Shard& caller, const PexScript& script,
+                 FunctionInfo& function, IGameObject* object,
+                 const VarValue* arguments, size_t numArguments);
+
+  std::vector<std::unique_ptr<Shard>> shards;
+  bool running = false;
+
+  // Scripts of every added object with their parents, for RouteCall
+  std::shared_mutex objectsMutex;
+  std::unordered_map<IGameObject*, std::vector<const PexScript*>>
+    objectScripts;
+
+  std::mutex errorsMutex;
+  std::vector<std::string> errors;
+};
@@ -0,0 +1,45 @@
+#include "StringPool.h"
+
+const char* StringPool::Intern(std::string_view str)
+{
+  auto it = strings.find(str);
+  if (it != strings.end()) {
+    return it->second.str->c_str();
+  }
+
+  Entry entry;
+  entry.str = std::make_unique<std::string>(str);
+  const char* result = entry.str->c_str();
+
+  std::string_view key(*entry.str);
+  strings.emplace(key, std::move(entry));
+  return result;
+}
+
+void StringPool::Mark(const char* str)
+{
+  if (str == nullptr)
+    return;
+
+  auto it = strings.find(str);
+  if (it != strings.end() && it->second.str->c_str() == str) {
+    it->second.marked = true;
+  }
+}
+
+size_t StringPool::Sweep()
+{
+  size_t numFreed = 0;
+
+  for (auto it = strings.begin(); it != strings.end();) {
+    if (it->second.marked) {
+      it->second.marked = false;
+      ++it;
+    } else {
+      it = strings.erase(it);
+      ++numFreed;
+    }
+  }
+
+  return numFreed;
+}
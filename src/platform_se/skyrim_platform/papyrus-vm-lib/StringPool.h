@@ -0,0 +1,34 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Storage for strings created at runtime (StrCat, casts to String).
+// Pointers returned by Intern stay valid until a Sweep that doesn't see them
+// marked.
+class StringPool
+{
+public:
+  const char* Intern(std::string_view str);
+
+  // Keeps the string alive through the next Sweep. Strings not owned by the
+  // pool are ignored
+  void Mark(const char* str);
+
+  // Frees every string that wasn't marked since the previous Sweep. Returns
+  // the number of freed strings
+  size_t Sweep();
+
+  size_t GetSize() const { return strings.size(); }
+
+private:
+  struct Entry
+  {
+    std::unique_ptr<std::string> str;
+    bool marked = false;
+  };
+
+  // Keys point into Entry::str
+  std::unordered_map<std::string_view, Entry> strings;
+};
@@ -1,14 +1,23 @@
 #pragma once
 #include <cassert>
+#include <atomic>
+#include <cctype>
 #include <functional>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include <stdexcept>
 
 class VirtualMachine;
 struct PexScript;
+struct ActivePexInstance;
+struct FunctionInfo;
+struct SuspendedFrame;
 
 class IGameObject
 {
@@ -23,12 +32,14 @@ enum class FunctionType
   GlobalFunction, // 'callstatic' opcode
 };
 
+struct VarArray;
+
+// 16 bytes: the payload, the type tag and the id of the declared object type.
+// Arrays are held by a refcounted VarArray, see VarArray::Create
 struct VarValue
 {
 
 private:
-  uint8_t type = 0;
-
   union
   {
     IGameObject* id;
@@ -36,11 +47,13 @@ private:
     int32_t i = 0;
     float f;
     bool b;
+    VarArray* array;
   } data;
 
-public:
-  std::string objectType;
+  uint8_t type = 0;
+  uint32_t objectTypeId = 0;
 
+public:
   enum valueTypes
   {
     kType_Object = 0, // 0 null?
@@ -61,6 +74,14 @@ public:
 
   uint8_t GetType() const { return this->type; }
 
+  uint32_t GetObjectTypeId() const { return this->objectTypeId; }
+  void SetObjectTypeId(uint32_t id) { this->objectTypeId = id; }
+
+  bool IsArray() const
+  {
+    return this->type >= _ArraysStart && this->type < _ArraysEnd;
+  }
+
   VarValue()
   {
     this->type = 0;
@@ -74,21 +95,46 @@ public:
   explicit VarValue(float value);
   explicit VarValue(bool value);
 
-  VarValue::VarValue(uint8_t type, const char* value);
+  VarValue(uint8_t type, const char* value);
+
+  VarValue(const VarValue& other);
+  VarValue(VarValue&& other) noexcept;
+  ~VarValue();
 
   static VarValue None() { return VarValue(); }
 
   explicit operator bool() const { return this->CastToBool().data.b; }
 
-  explicit operator IGameObject*() const { return this->data.id; }
+  // nullptr for other types
+  explicit operator IGameObject*() const
+  {
+    return type == kType_Object ? data.id : nullptr;
+  }
 
   explicit operator int() const { return this->CastToInt().data.i; }
 
   explicit operator float() const { return this->CastToFloat().data.f; }
 
-  explicit operator const char*() const { return this->data.string; }
+  // nullptr for types other than String and Identifier
+  explicit operator const char*() const
+  {
+    return type == kType_String || type == kType_Identifier ? data.string
+                                                            : nullptr;
+  }
+
+  // nullptr for None arrays and non-arrays
+  VarArray* GetArray() const;
+
+  // Replaces the array this value points to with a new one of 'size'
+  // elements. The value keeps its array type
+  VarArray& CreateArray(size_t size);
+
+  // Declared type of the variable this value is stored in. Assignment keeps
+  // the type of the destination
+  const std::string& GetObjectType() const;
+  void SetObjectType(std::string_view objectType);
 
-  std::shared_ptr<std::vector<VarValue>> pArray;
+  static uint32_t InternObjectType(std::string_view objectType);
 
   VarValue operator+(const VarValue& argument2);
   VarValue operator-(const VarValue& argument2);
@@ -98,7 +144,7 @@ public:
   VarValue operator!();
 
   VarValue& operator=(const VarValue& argument2);
-
+  VarValue& operator=(VarValue&& argument2) noexcept;
 
   bool operator==(const VarValue& argument2);
   bool operator>(const VarValue& argument2);
@@ -109,12 +155,167 @@ public:
   VarValue CastToInt() const;
   VarValue CastToFloat() const;
   VarValue CastToBool() const;
+
+  // Payload of a value whose type is known in advance, from the opcode or
+  // from FunctionOptimizer. The type is only checked in debug builds
+  int32_t GetInt() const
+  {
+    assert(this->type == kType_Integer);
+    return this->data.i;
+  }
+
+  float GetFloat() const
+  {
+    assert(this->type == kType_Float);
+    return this->data.f;
+  }
+
+  bool GetBool() const
+  {
+    assert(this->type == kType_Bool);
+    return this->data.b;
+  }
+
+  // Same as assigning VarValue(value) without the temporary
+  void SetInt(int32_t value)
+  {
+    ReleaseArray();
+    this->type = kType_Integer;
+    this->data.i = value;
+  }
+
+  void SetFloat(float value)
+  {
+    ReleaseArray();
+    this->type = kType_Float;
+    this->data.f = value;
+  }
+
+  void SetBool(bool value)
+  {
+    ReleaseArray();
+    this->type = kType_Bool;
+    this->data.b = value;
+  }
+
+private:
+  void RetainArray() const;
+  void ReleaseArray();
+};
+
+static_assert(sizeof(void*) != 8 || sizeof(VarValue) == 16);
+
+// Storage of a Papyrus array shared by every VarValue pointing to it. Int,
+// Float and Bool arrays keep their elements unboxed, Object and String arrays
+// hold VarValues. Freed arrays go to a per-thread pool and keep their capacity
+// for reuse
+struct VarArray
+{
+  uint8_t type = VarValue::kType_ObjectArray;
+
+  std::vector<VarValue> values;
+  std::vector<int32_t> ints;
+  std::vector<float> floats;
+  std::vector<bool> bools;
+
+  std::atomic<uint32_t> refCount{ 1 };
+
+  size_t GetSize() const;
+
+  // New elements get the default value of the element type
+  void Resize(size_t size);
+
+  // Throw std::out_of_range like vector::at
+  VarValue Get(size_t index) const;
+  void Set(size_t index, const VarValue& value);
+
+  // Index of the first element equal to 'value' at or after 'startIndex'
+  // or -1
+  int32_t Find(const VarValue& value, size_t startIndex);
+
+  // Index of the last element equal to 'value' before 'endIndex' or -1
+  int32_t RFind(const VarValue& value, size_t endIndex);
+
+  static uint8_t GetElementType(uint8_t arrayType);
+
+  static VarArray* Create(uint8_t type);
+  static void Destroy(VarArray* array);
 };
 
+inline VarArray* VarValue::GetArray() const
+{
+  return IsArray() ? this->data.array : nullptr;
+}
+
+inline void VarValue::RetainArray() const
+{
+  if (IsArray() && this->data.array)
+    this->data.array->refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void VarValue::ReleaseArray()
+{
+  if (IsArray() && this->data.array) {
+    if (this->data.array->refCount.fetch_sub(1, std::memory_order_acq_rel) ==
+        1)
+      VarArray::Destroy(this->data.array);
+    this->data.array = nullptr;
+  }
+}
+
+inline VarValue::VarValue(const VarValue& other)
+  : data(other.data)
+  , type(other.type)
+  , objectTypeId(other.objectTypeId)
+{
+  RetainArray();
+}
+
+inline VarValue::VarValue(VarValue&& other) noexcept
+  : data(other.data)
+  , type(other.type)
+  , objectTypeId(other.objectTypeId)
+{
+  other.type = kType_Object;
+  other.data.id = nullptr;
+}
+
+inline VarValue::~VarValue()
+{
+  ReleaseArray();
+}
+
 using NativeFunction =
   std::function<VarValue(VarValue self, // will be None for global functions
                          std::vector<VarValue> arguments)>;
 
+// What natives are stored as. Arguments are only valid during the call
+using NativeCallback =
+  std::function<VarValue(const VarValue& self, const VarValue* arguments,
+                         size_t numArguments)>;
+
+// Index of a native in the VirtualMachine tables. One slot is assigned per
+// (class, function) pair, case-insensitive, and shared by every VM, so linked
+// code can keep it. fallbackId is the slot of the same function registered
+// with an empty class name
+struct NativeSlot
+{
+  enum : uint32_t
+  {
+    kInvalid = ~0u
+  };
+
+  uint32_t id = kInvalid;
+  uint32_t fallbackId = kInvalid;
+
+  static NativeSlot Get(std::string_view className,
+                        std::string_view functionName);
+
+  // Same as Get but never assigns new slots
+  static NativeSlot Find(std::string_view className,
+                         std::string_view functionName);
+};
+
 using VarForBuildActivePex =
   std::map<std::string, std::vector<std::pair<std::string, VarValue>>>;
 
@@ -171,10 +372,89 @@ struct FunctionCode
   InstructionList instructions;
 };
 
-struct FunctionInfo
+// FunctionCode with every operand resolved to a slot. Built once per function
+// by FunctionLinker, so StartFunction never has to look up names.
+struct LinkedFunctionCode
 {
+  enum OperandSource : uint8_t
+  {
+    kSource_Local = 0, // locals, then params
+    kSource_Member,    // ActivePexInstance::variables
+    kSource_Constant,
+    kSource_Self,
+  };
+
+  struct Operand
+  {
+    uint8_t source = kSource_Constant;
+    uint32_t index = 0;
+  };
 
-  bool valid = false;
+  struct Instruction
+  {
+    uint8_t op = 0;
+    uint16_t numOperands = 0;
+    uint32_t firstOperand = 0;
+    NativeSlot native;       // CallStatic only
+    uint32_t cacheIndex = 0; // PropGet/PropSet, index in propertyCaches
+  };
+
+  // How a PropGet/PropSet reaches the property for one receiver type. Only
+  // depends on the script of the type, so VMs sharing scripts share entries
+  struct PropertyAccess
+  {
+    uint32_t objectTypeId = 0; // declared type of the receiver
+
+    PexScript* script = nullptr;     // nullptr if the type has no script
+    FunctionInfo* handler = nullptr; // nullptr for auto-properties
+    uint32_t autoVarIndex = 0;       // ActivePexInstance::variables
+    bool found = false;
+  };
+
+  // Monomorphic inline cache. Entries are immutable once published and
+  // owned by propertyAccesses, so the cache can be read from any thread
+  struct PropertyCache
+  {
+    std::atomic<const PropertyAccess*> access{ nullptr };
+    std::atomic<uint32_t> numMisses{ 0 };
+  };
+
+  std::vector<Instruction> instructions;
+  std::vector<Operand> operands;
+  std::vector<VarValue> constants;
+
+  std::unique_ptr<PropertyCache[]> propertyCaches;
+  std::vector<std::unique_ptr<PropertyAccess>> propertyAccesses;
+  std::mutex propertyAccessesMutex;
+
+  // Default values of the frame slots with the object type already filled in
+  std::vector<VarValue> frame;
+  size_t numLocals = 0;
+
+  // Where the function comes from, for Profiler. Views into the script,
+  // empty for functions linked outside of LinkScript
+  std::string_view scriptName, stateName, functionName;
+  uint8_t functionType = 0; // as DebugFunction::type: 1 getter, 2 setter
+
+  // Source line of every instruction, nullptr without debug info
+  const std::vector<uint16_t>* lineNumbers = nullptr;
+
+  // Line table after FunctionOptimizer removed instructions
+  std::vector<uint16_t> optimizedLineNumbers;
+
+  // Native code generated by AotCompiler, set by
+  // VirtualMachine::RegisterAotFunctions. Runs on the interpreter's frame.
+  // Returns kAotDone with the result set, or the line from which the
+  // interpreter continues with the frame
+  using AotEntry = size_t (*)(ActivePexInstance& self,
+                              LinkedFunctionCode& code, VarValue* locals,
+                              VarValue& result);
+  static constexpr size_t kAotDone = static_cast<size_t>(-1);
+  AotEntry aot = nullptr;
+};
+
+struct FunctionInfo
+{
 
   enum
   {
@@ -198,6 +478,8 @@ struct FunctionInfo
   ParamTable locals;
 
   FunctionCode code;
+  std::shared_ptr<LinkedFunctionCode> linkedCode;
+  NativeSlot native; // native functions only
 
   bool IsGlobal() const { return flags & (1 << 0); }
 
@@ -331,6 +613,98 @@ struct ScriptHeader
   uint64_t BuildTime = 0; // 08	uint64_t
 };
 
+// Papyrus identifiers are case-insensitive
+struct CaseInsensitiveHash
+{
+  size_t operator()(std::string_view str) const
+  {
+    size_t hash = 14695981039346656037ull;
+    for (char c : str) {
+      hash ^= static_cast<size_t>(std::tolower(static_cast<uint8_t>(c)));
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+};
+
+struct CaseInsensitiveEqual
+{
+  bool operator()(std::string_view a, std::string_view b) const
+  {
+    if (a.size() != b.size())
+      return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+      if (std::tolower(static_cast<uint8_t>(a[i])) !=
+          std::tolower(static_cast<uint8_t>(b[i])))
+        return false;
+    }
+    return true;
+  }
+};
+
+// (state, function name) -> function of one script. Filled by FunctionLinker,
+// keys point into the script's own ObjectTable
+struct FunctionTable
+{
+  struct Key
+  {
+    std::string_view stateName;
+    std::string_view functionName;
+  };
+
+  struct KeyHash
+  {
+    size_t operator()(const Key& key) const
+    {
+      CaseInsensitiveHash hash;
+      return hash(key.stateName) * 31 + hash(key.functionName);
+    }
+  };
+
+  struct KeyEqual
+  {
+    bool operator()(const Key& a, const Key& b) const
+    {
+      CaseInsensitiveEqual equal;
+      return equal(a.stateName, b.stateName) &&
+        equal(a.functionName, b.functionName);
+    }
+  };
+
+  std::unordered_map<Key, FunctionInfo*, KeyHash, KeyEqual> functions;
+
+  // Functions missing in a state are taken from the empty state
+  FunctionInfo* Find(std::string_view stateName,
+                     std::string_view functionName) const
+  {
+    auto it = functions.find({ stateName, functionName });
+    if (it == functions.end() && !stateName.empty())
+      it = functions.find({ std::string_view(), functionName });
+    return it != functions.end() ? it->second : nullptr;
+  }
+};
+
+// Initial state of every ActivePexInstance of a script. Built once by
+// FunctionLinker::LinkScript
+struct InstanceTemplate
+{
+  // Default values of ActivePexInstance::variables, "::State" is last
+  std::vector<VarValue> variables;
+  std::vector<std::string> variableNames;
+  std::vector<std::string> variableTypes;
+
+  // Object type id of 'self', the script itself
+  uint32_t selfObjectTypeId = 0;
+
+  // Properties that can be set through VarForBuildActivePex
+  struct AutoProperty
+  {
+    std::string name;
+    uint32_t variableIndex = 0;
+  };
+  std::vector<AutoProperty> autoProperties;
+};
+
 struct PexScript
 {
 
@@ -343,6 +717,13 @@ struct PexScript
   std::string source;
   std::string user;
   std::string machine;
+
+  // Contents of the PexCache file the script was loaded from. Identifier and
+  // String values point into it instead of stringTable
+  std::shared_ptr<const std::vector<uint8_t>> cacheData;
+
+  FunctionTable functionTable;
+  InstanceTemplate instanceTemplate;
 };
 
 struct ActivePexInstance
@@ -354,59 +735,72 @@ struct ActivePexInstance
   VarValue activeInstanceOwner = VarValue::None();
   VirtualMachine* parentVM = nullptr;
 
+  // Created on first use, see GetParentInstance
   std::shared_ptr<ActivePexInstance> parentInstance;
 
-  std::vector<ObjectTable::Object::VarInfo> variables;
+  // In the order of InstanceTemplate::variables
+  std::vector<VarValue> variables;
 
-  std::vector<std::shared_ptr<VarValue>> identifiersValueNameCache;
-  std::vector<std::shared_ptr<std::string>> instanceStringTable;
+  // Shared by all instances of an object. nullptr if there are none
+  std::shared_ptr<const VarForBuildActivePex> propertyValues;
 
   ActivePexInstance();
-  ActivePexInstance(std::shared_ptr<PexScript> sourcePex,
-                    VarForBuildActivePex mapForFillPropertys,
-                    VirtualMachine* parentVM, VarValue activeInstanceOwner,
-                    std::string childrenName);
-
-  FunctionInfo GetFunctionByName(const char* name, std::string stateName);
+  ActivePexInstance(
+    std::shared_ptr<PexScript> sourcePex,
+    std::shared_ptr<const VarForBuildActivePex> propertyValues,
+    VirtualMachine* parentVM, VarValue activeInstanceOwner,
+    std::string childrenName);
 
-  VarValue& GetVariableValueByName(
-    std::vector<std::pair<std::string, VarValue>>& locals, std::string name);
+  // Instance of the script this one extends, nullptr if there is none
+  ActivePexInstance* GetParentInstance();
 
-  VarValue& GetIndentifierValue(
-    std::vector<std::pair<std::string, VarValue>>& locals, VarValue& value);
+  FunctionInfo* GetFunctionByName(const char* name,
+                                  std::string_view stateName);
 
   VarValue CastToString(const VarValue& var);
 
   VarValue StartFunction(FunctionInfo& function,
                          std::vector<VarValue>& arguments);
+  VarValue StartFunction(FunctionInfo& function, const VarValue* arguments,
+                         size_t numArguments);
+
+  // Continues frames[depth] of a parked script thread once the latent call
+  // at the bottom of the stack has completed with latentResult. Resumes the
+  // inner frames first. See Scheduler
+  VarValue ResumeFunction(SuspendedFrame* frames, size_t depth,
+                          const VarValue& latentResult);
 
-  uint8_t GetTypeByName(std::string typeRef);
-  std::string GetActiveStateName();
+  static uint8_t GetTypeByName(std::string typeRef);
+  const char* GetActiveStateName();
 
 private:
-  ObjectTable::Object::PropInfo* GetProperty(ActivePexInstance* scriptInstance,
-                                             std::string nameProperty,
-                                             uint8_t flag);
+  LinkedFunctionCode::PropertyAccess GetPropertyAccess(
+    LinkedFunctionCode& code,
+    const LinkedFunctionCode::Instruction& instruction,
+    const VarValue& propertyName, const VarValue& object, uint8_t flag);
 
-  ActivePexInstance* GetActivePexInObject(VarValue* object,
-                                          std::string& scriptType);
+  LinkedFunctionCode::PropertyAccess ResolvePropertyAccess(
+    const VarValue& propertyName, const VarValue& object, uint8_t flag);
 
-  std::vector<ObjectTable::Object::VarInfo> FillVariables(
-    std::shared_ptr<PexScript> sourcePex,
-    std::vector<std::pair<std::string, VarValue>> argsForFillPropertys);
+  void FillProperties();
+
+  VarValue& GetOperandValue(LinkedFunctionCode& code, VarValue* locals,
+                            const LinkedFunctionCode::Operand& operand);
 
-  uint8_t GetArrayElementType(uint8_t type);
+  VarValue Execute(FunctionInfo& function,
+                   const std::shared_ptr<LinkedFunctionCode>& linkedCode,
+                   VarValue* locals, size_t firstLine);
 
-  void CastObjectToObject(
-    VarValue* result, VarValue* objectType,
-    std::vector<std::pair<std::string, VarValue>>& locals);
+  // Saves the frame to the suspending script thread
+  void ParkFrame(FunctionInfo& function,
+                 const std::shared_ptr<LinkedFunctionCode>& linkedCode,
+                 size_t line, const VarValue* locals);
+
+  void CastObjectToObject(VarValue* result, VarValue* objectType,
+                          const FunctionInfo& function);
 
   bool HasParent(ActivePexInstance* script, std::string castToTypeName);
   bool HasChild(ActivePexInstance* script, std::string castToTypeName);
 
-  std::shared_ptr<ActivePexInstance> FillParentInstanse(
-    std::string nameNeedScript, VarValue activeInstanceOwner,
-    VarForBuildActivePex mapForFillPropertys);
-
   VarValue GetElementsArrayAtString(const VarValue& array, uint8_t type);
 };
@@ -0,0 +1,271 @@
+#include "Structures.h"
+#include <algorithm>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#  include <emmintrin.h>
+#  define PAPYRUS_VM_SSE2
+#endif
+
+namespace {
+struct VarArrayPool
+{
+  enum
+  {
+    kMaxFreeArrays = 1024
+  };
+
+  std::vector<VarArray*> freeArrays;
+
+  ~VarArrayPool();
+};
+
+thread_local VarArrayPool g_arrayPool;
+
+// Arrays released by values destroyed after the pool are deleted directly
+thread_local bool g_arrayPoolDestroyed = false;
+
+VarArrayPool::~VarArrayPool()
+{
+  g_arrayPoolDestroyed = true;
+  for (auto array : freeArrays)
+    delete array;
+}
+
+#ifdef PAPYRUS_VM_SSE2
+// Nonzero if any of the 4 elements at 'data' equals the needle
+inline int MatchBlock(const int32_t* data, __m128i needle)
+{
+  auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+  return _mm_movemask_epi8(_mm_cmpeq_epi32(block, needle));
+}
+
+inline int MatchBlock(const float* data, __m128 needle)
+{
+  return _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(data), needle));
+}
+
+inline __m128i Broadcast(int32_t value)
+{
+  return _mm_set1_epi32(value);
+}
+
+inline __m128 Broadcast(float value)
+{
+  return _mm_set1_ps(value);
+}
+#endif
+
+// Blocks of 4 are compared at once, the matching block is rescanned
+// element by element
+template <class T>
+int32_t FindUnboxed(const std::vector<T>& elements, size_t begin, T value)
+{
+  const T* data = elements.data();
+  const size_t end = elements.size();
+  size_t i = begin;
+
+#ifdef PAPYRUS_VM_SSE2
+  const auto needle = Broadcast(value);
+  for (; i + 4 <= end; i += 4) {
+    if (MatchBlock(data + i, needle))
+      break;
+  }
+#endif
+
+  for (; i < end; ++i) {
+    if (data[i] == value)
+      return static_cast<int32_t>(i);
+  }
+  return -1;
+}
+
+template <class T>
+int32_t RFindUnboxed(const std::vector<T>& elements, size_t end, T value)
+{
+  const T* data = elements.data();
+  size_t i = end;
+
+#ifdef PAPYRUS_VM_SSE2
+  const auto needle = Broadcast(value);
+  for (; i >= 4; i -= 4) {
+    if (MatchBlock(data + i - 4, needle))
+      break;
+  }
+#endif
+
+  while (i > 0) {
+    --i;
+    if (data[i] == value)
+      return static_cast<int32_t>(i);
+  }
+  return -1;
+}
+}
+
+VarArray* VarArray::Create(uint8_t type)
+{
+  VarArray* array = nullptr;
+
+  if (g_arrayPoolDestroyed || g_arrayPool.freeArrays.empty()) {
+    array = new VarArray;
+  } else {
+    array = g_arrayPool.freeArrays.back();
+    g_arrayPool.freeArrays.pop_back();
+    array->refCount.store(1, std::memory_order_relaxed);
+  }
+
+  array->type = type;
+  return array;
+}
+
+void VarArray::Destroy(VarArray* array)
+{
+  if (g_arrayPoolDestroyed) {
+    delete array;
+    return;
+  }
+
+  auto& freeArrays = g_arrayPool.freeArrays;
+  if (freeArrays.size() >= VarArrayPool::kMaxFreeArrays) {
+    delete array;
+    return;
+  }
+
+  array->values.clear();
+  array->ints.clear();
+  array->floats.clear();
+  array->bools.clear();
+  freeArrays.push_back(array);
+}
+
+uint8_t VarArray::GetElementType(uint8_t arrayType)
+{
+  switch (arrayType) {
+    case VarValue::kType_ObjectArray:
+      return VarValue::kType_Object;
+    case VarValue::kType_StringArray:
+      return VarValue::kType_String;
+    case VarValue::kType_IntArray:
+      return VarValue::kType_Integer;
+    case VarValue::kType_FloatArray:
+      return VarValue::kType_Float;
+    case VarValue::kType_BoolArray:
+      return VarValue::kType_Bool;
+    default:
+      throw std::runtime_error("Wrong type in VarArray::GetElementType");
+  }
+}
+
+size_t VarArray::GetSize() const
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      return ints.size();
+    case VarValue::kType_FloatArray:
+      return floats.size();
+    case VarValue::kType_BoolArray:
+      return bools.size();
+    default:
+      return values.size();
+  }
+}
+
+void VarArray::Resize(size_t size)
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      ints.resize(size, 0);
+      break;
+    case VarValue::kType_FloatArray:
+      floats.resize(size, 0.0f);
+      break;
+    case VarValue::kType_BoolArray:
+      bools.resize(size, false);
+      break;
+    default:
+      values.resize(size, VarValue(GetElementType(type)));
+      break;
+  }
+}
+
+VarValue VarArray::Get(size_t index) const
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      return VarValue(ints.at(index));
+    case VarValue::kType_FloatArray:
+      return VarValue(floats.at(index));
+    case VarValue::kType_BoolArray:
+      return VarValue(static_cast<bool>(bools.at(index)));
+    default:
+      return values.at(index);
+  }
+}
+
+void VarArray::Set(size_t index, const VarValue& value)
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      ints.at(index) = static_cast<int>(value);
+      break;
+    case VarValue::kType_FloatArray:
+      floats.at(index) = static_cast<float>(value);
+      break;
+    case VarValue::kType_BoolArray:
+      bools.at(index) = static_cast<bool>(value);
+      break;
+    default:
+      // Papyrus has no nested arrays. Ones assigned by malformed scripts
+      // could form reference cycles
+      if (value.IsArray())
+        throw std::runtime_error("Wrong type in VarArray::Set");
+      values.at(index) = value;
+      break;
+  }
+}
+
+int32_t VarArray::Find(const VarValue& value, size_t startIndex)
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      return FindUnboxed(ints, startIndex, static_cast<int32_t>(value));
+    case VarValue::kType_FloatArray:
+      return FindUnboxed(floats, startIndex, static_cast<float>(value));
+    case VarValue::kType_BoolArray: {
+      auto it = std::find(bools.begin() + startIndex, bools.end(),
+                          static_cast<bool>(value));
+      return it != bools.end() ? static_cast<int32_t>(it - bools.begin())
+                               : -1;
+    }
+    default: {
+      auto it = std::find(values.begin() + startIndex, values.end(), value);
+      return it != values.end() ? static_cast<int32_t>(it - values.begin())
+                                : -1;
+    }
+  }
+}
+
+int32_t VarArray::RFind(const VarValue& value, size_t endIndex)
+{
+  switch (type) {
+    case VarValue::kType_IntArray:
+      return RFindUnboxed(ints, endIndex, static_cast<int32_t>(value));
+    case VarValue::kType_FloatArray:
+      return RFindUnboxed(floats, endIndex, static_cast<float>(value));
+    case VarValue::kType_BoolArray: {
+      const bool needle = static_cast<bool>(value);
+      for (size_t i = endIndex; i > 0; --i) {
+        if (bools[i - 1] == needle)
+          return static_cast<int32_t>(i - 1);
+      }
+      return -1;
+    }
+    default: {
+      for (size_t i = endIndex; i > 0; --i) {
+        if (values[i - 1] == value)
+          return static_cast<int32_t>(i - 1);
+      }
+      return -1;
+    }
+  }
+}
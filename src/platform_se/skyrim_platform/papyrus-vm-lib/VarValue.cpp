@@ -1,4 +1,74 @@
 #include "Structures.h"
+#include <deque>
+#include <limits>
+#include <mutex>
+
+namespace {
+struct ObjectTypeTable
+{
+  std::mutex mutex;
+  std::deque<std::string> names{ std::string() };
+  std::unordered_map<std::string_view, uint32_t> ids{ { names[0], 0 } };
+};
+
+ObjectTypeTable& GetObjectTypeTable()
+{
+  static ObjectTypeTable table;
+  return table;
+}
+
+// Int arithmetic wraps around on overflow
+int32_t WrapInt(uint32_t value)
+{
+  return static_cast<int32_t>(value);
+}
+
+// NaN and out of range values give INT_MIN, like the x86 conversion
+int32_t FloatToInt(float value)
+{
+  if (value >= -2147483648.0f && value < 2147483648.0f)
+    return static_cast<int32_t>(value);
+  return std::numeric_limits<int32_t>::min();
+}
+}
+
+uint32_t VarValue::InternObjectType(std::string_view objectType)
+{
+  auto& table = GetObjectTypeTable();
+  std::lock_guard lock(table.mutex);
+
+  auto it = table.ids.find(objectType);
+  if (it != table.ids.end())
+    return it->second;
+
+  uint32_t id = static_cast<uint32_t>(table.names.size());
+  table.names.emplace_back(objectType);
+  table.ids.insert({ table.names.back(), id });
+  return id;
+}
+
+const std::string& VarValue::GetObjectType() const
+{
+  auto& table = GetObjectTypeTable();
+  std::lock_guard lock(table.mutex);
+  return table.names[this->objectTypeId];
+}
+
+void VarValue::SetObjectType(std::string_view objectType)
+{
+  this->objectTypeId = InternObjectType(objectType);
+}
+
+VarArray& VarValue::CreateArray(size_t size)
+{
+  if (!IsArray())
+    throw std::runtime_error("CreateArray called on a non-array value");
+
+  ReleaseArray();
+  this->data.array = VarArray::Create(this->type);
+  this->data.array->Resize(size);
+  return *this->data.array;
+}
 
 VarValue VarValue::CastToInt() const
 {
@@ -13,7 +83,7 @@ VarValue VarValue::CastToInt() const
       return VarValue((int32_t)this->data.i);
 
     case kType_Float:
-      return VarValue((int32_t)this->data.f);
+      return VarValue(FloatToInt(this->data.f));
 
     case kType_Bool:
       return VarValue((int32_t)this->data.b);
@@ -78,7 +148,7 @@ VarValue VarValue::CastToBool() const
     case kType_IntArray:
     case kType_FloatArray:
     case kType_BoolArray:
-      return VarValue(this->pArray && this->pArray->size());
+      return VarValue(GetArray() && GetArray()->GetSize());
     default:
       throw std::runtime_error("Wrong type in CastToBool");
   }
@@ -119,7 +189,7 @@ VarValue::VarValue(uint8_t type)
     case kType_FloatArray:
     case kType_BoolArray:
       this->type = type;
-      this->pArray = nullptr;
+      this->data.array = nullptr;
       break;
 
     default:
@@ -171,7 +241,8 @@ VarValue VarValue::operator+(const VarValue& argument2)
     switch (this->type) {
 
       case VarValue::kType_Integer:
-        var.data.i = this->data.i + argument2.data.i;
+        var.data.i =
+          WrapInt(uint32_t(this->data.i) + uint32_t(argument2.data.i));
         var.type = this->kType_Integer;
         return var;
       case VarValue::kType_Float:
@@ -191,7 +262,8 @@ VarValue VarValue::operator-(const VarValue& argument2)
     switch (this->type) {
 
       case VarValue::kType_Integer:
-        var.data.i = this->data.i - argument2.data.i;
+        var.data.i =
+          WrapInt(uint32_t(this->data.i) - uint32_t(argument2.data.i));
         var.type = this->kType_Integer;
         return var;
       case VarValue::kType_Float:
@@ -210,7 +282,8 @@ VarValue VarValue::operator*(const VarValue& argument2)
 
     switch (this->type) {
       case VarValue::kType_Integer:
-        var.data.i = this->data.i * argument2.data.i;
+        var.data.i =
+          WrapInt(uint32_t(this->data.i) * uint32_t(argument2.data.i));
         var.type = this->kType_Integer;
         return var;
       case VarValue::kType_Float:
@@ -231,8 +304,12 @@ VarValue VarValue::operator/(const VarValue& argument2)
 
       case VarValue::kType_Integer:
         var.data.i = 1;
-        if (argument2.data.i != uint32_t(0) && this->data.i != uint32_t(0))
-          var.data.i = this->data.i / argument2.data.i;
+        if (argument2.data.i != 0 && this->data.i != 0) {
+          // INT_MIN / -1 wraps to INT_MIN
+          var.data.i = argument2.data.i == -1
+            ? WrapInt(0u - uint32_t(this->data.i))
+            : this->data.i / argument2.data.i;
+        }
         var.type = this->kType_Integer;
         return var;
       case VarValue::kType_Float:
@@ -255,7 +332,7 @@ VarValue VarValue::operator%(const VarValue& argument2)
 
       case VarValue::kType_Integer:
         var.data.i = 0;
-        if (argument2.data.i != (uint32_t)0)
+        if (argument2.data.i != 0 && argument2.data.i != -1)
           var.data.i = this->data.i % argument2.data.i;
         var.type = this->kType_Integer;
         return var;
@@ -305,7 +382,7 @@ VarValue VarValue::operator!()
     case kType_FloatArray:
     case kType_BoolArray:
       var.type = this->kType_Bool;
-      var.data.b = (this->pArray->size() < 1);
+      var.data.b = (!GetArray() || GetArray()->GetSize() < 1);
       return var;
     default:
       throw std::runtime_error("Wrong type in operator!");
@@ -314,13 +391,27 @@ VarValue VarValue::operator!()
 
 VarValue& VarValue::operator=(const VarValue& argument2)
 {
-  this->data = argument2.data;
-  this->type = argument2.type;
+  // ReleaseArray clears the array, which is argument2's too on 'x = x'
+  if (this != &argument2) {
+    argument2.RetainArray();
+    ReleaseArray();
+
+    this->data = argument2.data;
+    this->type = argument2.type;
+  }
+  return *this;
+}
 
-  if (argument2.type >= argument2._ArraysStart &&
-      argument2.type < argument2._ArraysEnd)
-    this->pArray = argument2.pArray;
+VarValue& VarValue::operator=(VarValue&& argument2) noexcept
+{
+  if (this != &argument2) {
+    ReleaseArray();
 
+    this->data = argument2.data;
+    this->type = argument2.type;
+    argument2.type = kType_Object;
+    argument2.data.id = nullptr;
+  }
   return *this;
 }
 
@@ -336,8 +427,8 @@ bool VarValue::operator==(const VarValue& argument2)
       if (this->data.id != nullptr)
         id1 = this->data.id;
 
-      if (argument2.data.id != nullptr)
-        id2 = argument2.data.id;
+      if ((IGameObject*)argument2 != nullptr)
+        id2 = (IGameObject*)argument2;
 
       return id1 == id2;
     }
@@ -349,8 +440,8 @@ bool VarValue::operator==(const VarValue& argument2)
       if (this->data.string != NULL)
         s1 = this->data.string;
 
-      if (argument2.data.string != NULL)
-        s2 = argument2.data.string;
+      if ((const char*)argument2 != NULL)
+        s2 = (const char*)argument2;
 
       return s1 == s2;
     }
@@ -1,63 +1,239 @@
 #include "VirtualMachine.h"
+#include "FunctionLinker.h"
+#include "PexCache.h"
 #include <algorithm>
+#include <cctype>
 #include <stdexcept>
+#include <unordered_set>
 
 VirtualMachine::VirtualMachine(
-  std::vector<std::shared_ptr<PexScript>> loadedScripts)
+  std::vector<std::shared_ptr<PexScript>> loadedScripts, bool optimize)
 {
   this->allLoadedScripts = loadedScripts;
+
+  for (auto& script : allLoadedScripts) {
+    FunctionLinker::LinkScript(*script, optimize);
+    scriptsByName.insert({ script->source, script });
+  }
+
+  for (auto& script : allLoadedScripts) {
+    auto id = script->instanceTemplate.selfObjectTypeId;
+    if (scriptsByTypeId.size() <= id)
+      scriptsByTypeId.resize(id + 1, nullptr);
+    scriptsByTypeId[id] = GetScript(script->source).get();
+  }
+}
+
+VirtualMachine::VirtualMachine(const std::string& pexCachePath,
+                               bool optimize)
+  : VirtualMachine(PexCache::Load(pexCachePath), optimize)
+{
+}
+
+std::shared_ptr<PexScript> VirtualMachine::GetScript(
+  const std::string& scriptName)
+{
+  auto it = scriptsByName.find(scriptName);
+  return it != scriptsByName.end() ? it->second : nullptr;
+}
+
+PexScript* VirtualMachine::GetScriptOfType(const VarValue& object)
+{
+  auto id = object.GetObjectTypeId();
+  if (id < scriptsByTypeId.size() && scriptsByTypeId[id])
+    return scriptsByTypeId[id];
+  return GetScript(object.GetObjectType()).get();
+}
+
+size_t VirtualMachine::RegisterAotFunctions(
+  const std::vector<AotFunction>& functions)
+{
+  auto getKey = [](std::string_view scriptName, std::string_view stateName,
+                   std::string_view functionName, uint8_t functionType,
+                   uint64_t codeHash) {
+    std::string key = std::string(scriptName) + '\n' +
+      std::string(stateName) + '\n' + std::string(functionName) + '\n' +
+      std::to_string(functionType) + '\n' + std::to_string(codeHash);
+    std::transform(key.begin(), key.end(), key.begin(),
+                   [](unsigned char c) { return char(std::tolower(c)); });
+    return key;
+  };
+
+  std::unordered_map<std::string, LinkedFunctionCode::AotEntry> entries;
+  for (auto& function : functions) {
+    entries[getKey(function.scriptName, function.stateName,
+                   function.functionName, function.functionType,
+                   function.codeHash)] = function.entry;
+  }
+
+  size_t numBound = 0;
+  auto bind = [&](FunctionInfo& function) {
+    auto& code = function.linkedCode;
+    if (!code || function.IsNative())
+      return;
+    auto it = entries.find(getKey(code->scriptName, code->stateName,
+                                  code->functionName, code->functionType,
+                                  AotCompiler::Hash(*code)));
+    if (it != entries.end()) {
+      code->aot = it->second;
+      ++numBound;
+    }
+  };
+
+  for (auto& script : allLoadedScripts) {
+    for (auto& object : script->objectTable.m_data) {
+      for (auto& state : object.states) {
+        for (auto& function : state.functions) {
+          bind(function.function);
+        }
+      }
+      for (auto& property : object.properties) {
+        bind(property.readHandler);
+        bind(property.writeHandler);
+      }
+    }
+  }
+  return numBound;
 }
 
 void VirtualMachine::RegisterFunction(std::string className,
                                       std::string functionName,
                                       FunctionType type, NativeFunction fn)
 {
+  RegisterNative(className, functionName, type,
+                 [fn](const VarValue& self, const VarValue* arguments,
+                      size_t numArguments) {
+                   return fn(self,
+                             std::vector<VarValue>(arguments,
+                                                   arguments + numArguments));
+                 });
+}
 
-  switch (type) {
-    case FunctionType::GlobalFunction:
+void VirtualMachine::RegisterNative(std::string_view className,
+                                    std::string_view functionName,
+                                    FunctionType type, NativeCallback fn)
+{
+  auto& natives = type == FunctionType::Method ? nativeFunctions
+                                               : nativeStaticFunctions;
 
-      nativeStaticFunctions[className][functionName] = fn;
-      break;
-    case FunctionType::Method:
-      nativeFunctions[className][functionName] = fn;
-      break;
-  }
+  auto slot = NativeSlot::Get(className, functionName);
+  if (slot.id >= natives.size())
+    natives.resize(slot.id + 1);
+  natives[slot.id] = std::move(fn);
+}
+
+const NativeCallback* VirtualMachine::FindNative(FunctionType type,
+                                                 NativeSlot slot) const
+{
+  auto& natives = type == FunctionType::Method ? nativeFunctions
+                                               : nativeStaticFunctions;
+
+  if (slot.id < natives.size() && natives[slot.id])
+    return &natives[slot.id];
+  if (slot.fallbackId < natives.size() && natives[slot.fallbackId])
+    return &natives[slot.fallbackId];
+  return nullptr;
 }
 
 void VirtualMachine::AddObject(std::shared_ptr<IGameObject> self,
                                std::vector<std::string> scripts,
                                VarForBuildActivePex vars)
 {
-  std::vector<ActivePexInstance> scriptsForObject;
+  scheduler.CancelThreads(self.get());
+
+  auto& entry = gameObjects[self.get()];
+  if (callDepth > 0 && !entry.instances.empty())
+    retiredObjects.push_back(std::move(entry));
+  entry = ScriptedObject();
+  entry.object = self;
 
-  for (auto& baseScript : allLoadedScripts) {
-    for (auto& nameNeedScript : scripts) {
-      if (baseScript->source == nameNeedScript) {
+  auto propertyValues = vars.empty()
+    ? nullptr
+    : std::make_shared<const VarForBuildActivePex>(std::move(vars));
 
-        ActivePexInstance scriptInstance(
-          baseScript, vars, this, VarValue((IGameObject*)self.get()), "");
-        scriptsForObject.push_back(scriptInstance);
+  entry.instances.reserve(scripts.size());
+  for (auto& nameNeedScript : scripts) {
+    if (auto baseScript = GetScript(nameNeedScript)) {
+      entry.instances.emplace_back(baseScript, propertyValues, this,
+                                   VarValue((IGameObject*)self.get()), "");
+    }
+  }
+
+  for (auto& instance : entry.instances) {
+    entry.instancesByScript.insert({ instance.sourcePex->source, &instance });
+  }
+}
+
+void VirtualMachine::RemoveObject(std::shared_ptr<IGameObject> self)
+{
+  scheduler.CancelThreads(self.get());
+
+  auto it = gameObjects.find(self.get());
+  if (it == gameObjects.end())
+    return;
+  if (callDepth > 0)
+    retiredObjects.push_back(std::move(it->second));
+  gameObjects.erase(it);
+}
+
+void VirtualMachine::ReleaseRetiredObjects()
+{
+  auto retired = std::move(retiredObjects);
+  retiredObjects.clear();
+
+  // Threads parked by the retired instances after CancelThreads
+  std::unordered_set<const ActivePexInstance*> instances;
+  for (auto& object : retired) {
+    for (auto& scriptInstance : object.instances) {
+      for (auto* instance = &scriptInstance; instance != nullptr;
+           instance = instance->parentInstance.get()) {
+        instances.insert(instance);
       }
     }
   }
+  scheduler.CancelThreads(instances);
+}
+
+ActivePexInstance* VirtualMachine::GetInstance(IGameObject* object,
+                                               std::string_view scriptName)
+{
+  auto it = gameObjects.find(object);
+  if (it == gameObjects.end())
+    return nullptr;
+
+  auto& instancesByScript = it->second.instancesByScript;
+  auto instance = instancesByScript.find(scriptName);
+  return instance != instancesByScript.end() ? instance->second : nullptr;
+}
 
-  gameObjects[self] = scriptsForObject;
+ActivePexInstance* VirtualMachine::GetInstance(IGameObject* object,
+                                               const PexScript* script)
+{
+  auto it = gameObjects.find(object);
+  if (it == gameObjects.end())
+    return nullptr;
+
+  for (auto& instance : it->second.instances) {
+    if (instance.sourcePex.get() == script)
+      return &instance;
+  }
+  return nullptr;
 }
 
 void VirtualMachine::SendEvent(std::shared_ptr<IGameObject> self,
                                const char* eventName,
                                std::vector<VarValue>& arguments)
 {
+  auto object = gameObjects.find(self.get());
+  if (object == gameObjects.end())
+    return;
 
-  for (auto& object : gameObjects) {
-    if (object.first == self) {
-      for (auto& scriptInstance : object.second) {
-        auto fn = scriptInstance.GetFunctionByName(
-          eventName, scriptInstance.GetActiveStateName());
-        if (fn.valid) {
-          scriptInstance.StartFunction(fn, arguments);
-        }
-      }
+  for (auto& scriptInstance : object->second.instances) {
+    auto fn = scriptInstance.GetFunctionByName(
+      eventName, scriptInstance.GetActiveStateName());
+    if (fn) {
+      scheduler.Spawn(&scriptInstance, *fn, arguments.data(),
+                      arguments.size());
     }
   }
 }
@@ -69,8 +245,8 @@ void VirtualMachine::SendEvent(ActivePexInstance* instance,
 
   auto fn =
     instance->GetFunctionByName(eventName, instance->GetActiveStateName());
-  if (fn.valid) {
-    instance->StartFunction(fn, arguments);
+  if (fn) {
+    scheduler.Spawn(instance, *fn, arguments.data(), arguments.size());
   }
 }
 
@@ -78,19 +254,38 @@ VarValue VirtualMachine::CallMethod(ActivePexInstance* instance,
                                     IGameObject* self, const char* methodName,
                                     std::vector<VarValue>& arguments)
 {
-  FunctionInfo function;
+  return CallMethod(instance, self, methodName, arguments.data(),
+                    arguments.size());
+}
+
+VarValue VirtualMachine::CallMethod(ActivePexInstance* instance,
+                                    IGameObject* self, const char* methodName,
+                                    const VarValue* arguments,
+                                    size_t numArguments)
+{
+  FunctionInfo* function;
 
-  std::string nameGoToState = "GotoState";
-  std::string nameGetState = "GetState";
+  CaseInsensitiveEqual equal;
 
-  if (methodName == nameGoToState || methodName == nameGetState) {
+  if (equal(methodName, "GotoState") || equal(methodName, "GetState")) {
     function = instance->GetFunctionByName(methodName, "");
   } else
     function =
       instance->GetFunctionByName(methodName, instance->GetActiveStateName());
 
-  if (function.valid) {
-    return instance->StartFunction(function, arguments);
+  if (function) {
+    if (function->IsNative()) {
+      if (auto native = FindNative(FunctionType::Method, function->native)) {
+        Profiler::Scope scope(profiler, native,
+                              instance->sourcePex->source.c_str(), methodName);
+        return (*native)(VarValue(self), arguments, numArguments);
+      }
+    } else if (routeCall && self &&
+               routeCall(*instance->sourcePex, *function, self, arguments,
+                         numArguments)) {
+      return VarValue::None();
+    }
+    return instance->StartFunction(*function, arguments, numArguments);
   }
   assert(false);
   return VarValue::None();
@@ -100,44 +295,96 @@ VarValue VirtualMachine::CallStatic(std::string className,
                                     std::string functionName,
                                     std::vector<VarValue>& arguments)
 {
+  return CallStatic(className, functionName, arguments.data(),
+                    arguments.size());
+}
+
+VarValue VirtualMachine::CallStatic(std::string className,
+                                    std::string functionName,
+                                    const VarValue* arguments,
+                                    size_t numArguments)
+{
+  // NativeSlot::Find locks the process-wide slot table, so a slot is looked
+  // up once per name. Only assigned slots are kept: they never change, while
+  // a missing one may be assigned later
+  auto classIt = hostNativeSlots.find(className);
+  if (classIt != hostNativeSlots.end()) {
+    auto it = classIt->second.find(functionName);
+    if (it != classIt->second.end()) {
+      return CallStatic(it->second, className.c_str(), functionName.c_str(),
+                        arguments, numArguments);
+    }
+  }
 
-  VarValue result = VarValue::None();
-  FunctionInfo function;
+  auto slot = NativeSlot::Find(className, functionName);
+  if (slot.id != NativeSlot::kInvalid ||
+      slot.fallbackId != NativeSlot::kInvalid) {
+    hostNativeSlots[className].insert({ functionName, slot });
+  }
 
-  auto f = nativeStaticFunctions[className][functionName]
-    ? nativeStaticFunctions[className][functionName]
-    : nativeStaticFunctions[""][functionName];
+  return CallStatic(slot, className.c_str(), functionName.c_str(), arguments,
+                    numArguments);
+}
 
-  if (f) {
-    NativeFunction func = f;
-    result = func(VarValue::None(), arguments);
-    return result;
+VarValue VirtualMachine::CallStatic(NativeSlot native, const char* className,
+                                    const char* functionName,
+                                    const VarValue* arguments,
+                                    size_t numArguments)
+{
+  if (auto f = FindNative(FunctionType::GlobalFunction, native)) {
+    Profiler::Scope scope(profiler, f, className, functionName);
+    return (*f)(VarValue::None(), arguments, numArguments);
   }
 
-  auto it =
-    std::find_if(this->allLoadedScripts.begin(), this->allLoadedScripts.end(),
-                 [&](std::shared_ptr<PexScript> a) -> bool {
-                   return a->source == className;
-                 });
+  auto script = GetScript(className);
 
-  if (it == this->allLoadedScripts.end())
+  if (script == nullptr)
     throw std::runtime_error("script not found");
 
-  ActivePexInstance instance = ActivePexInstance(*it, VarForBuildActivePex({}),
-                                                 this, VarValue::None(), "");
+  auto instance = std::make_shared<ActivePexInstance>(
+    script, nullptr, this, VarValue::None(), "");
 
-  function = instance.GetFunctionByName(functionName.c_str(),
-                                        instance.GetActiveStateName());
+  auto function =
+    instance->GetFunctionByName(functionName, instance->GetActiveStateName());
 
-  if (function.valid) {
-    result = instance.StartFunction(function, arguments);
-  }
-  if (!function.valid)
+  if (!function)
     throw std::runtime_error("function is not valid");
 
+  auto result = instance->StartFunction(*function, arguments, numArguments);
+  if (scheduler.IsSuspending())
+    scheduler.KeepAlive(std::move(instance));
   return result;
 }
 
-void VirtualMachine::RemoveObject(std::shared_ptr<IGameObject> self)
+namespace {
+void MarkStrings(StringPool& pool, const VarValue& value)
 {
-}
\ No newline at end of file
+  if (value.GetType() == VarValue::kType_String) {
+    pool.Mark((const char*)value);
+  } else if (value.GetType() == VarValue::kType_StringArray &&
+             value.GetArray()) {
+    for (auto& element : value.GetArray()->values) {
+      pool.Mark((const char*)element);
+    }
+  }
+}
+}
+
+size_t VirtualMachine::CollectStrings()
+{
+  for (auto& object : gameObjects) {
+    for (auto& scriptInstance : object.second.instances) {
+      for (auto* instance = &scriptInstance; instance != nullptr;
+           instance = instance->parentInstance.get()) {
+        for (auto& var : instance->variables) {
+          MarkStrings(stringPool, var);
+        }
+      }
+    }
+  }
+
+  scheduler.ForEachValue(
+    [&](const VarValue& value) { MarkStrings(stringPool, value); });
+
+  return stringPool.Sweep();
+}
@@ -1,28 +1,139 @@
 #pragma once
+#include "AotCompiler.h"
+#include "FrameArena.h"
+#include "NativeFunctions.h"
+#include "Profiler.h"
+#include "Scheduler.h"
+#include "StringPool.h"
 #include "Structures.h"
 #include <functional>
 #include <map>
 
 class VirtualMachine
 {
-  void RemoveObject(std::shared_ptr<IGameObject> self); // ?
-
 public:
-  std::map<std::shared_ptr<IGameObject>, std::vector<ActivePexInstance>>
-    gameObjects;
-  std::map<std::string, std::map<std::string, NativeFunction>>
-    nativeFunctions, nativeStaticFunctions;
+  struct ScriptedObject
+  {
+    std::shared_ptr<IGameObject> object;
+    std::vector<ActivePexInstance> instances;
+
+    // Points into instances, which is never resized after AddObject
+    std::unordered_map<std::string_view, ActivePexInstance*,
+                       CaseInsensitiveHash, CaseInsensitiveEqual>
+      instancesByScript;
+  };
+
+  std::unordered_map<IGameObject*, ScriptedObject> gameObjects;
+
+  // Objects replaced or removed while a script was running. Their instances
+  // may still have frames on the stack, so they are destroyed when the
+  // outermost frame returns, see ReleaseRetiredObjects
+  std::vector<ScriptedObject> retiredObjects;
+  // Indexed by NativeSlot::id
+  std::vector<NativeCallback> nativeFunctions, nativeStaticFunctions;
+
+  // Slots of natives called by name from the host, see CallStatic
+  std::unordered_map<std::string, std::unordered_map<std::string, NativeSlot>>
+    hostNativeSlots;
+
+  StringPool stringPool;
+  FrameArena frameArena;
+  Scheduler scheduler;
+
+  // Not owned. Attach or detach only while no script is running
+  Profiler* profiler = nullptr;
+
+  // Limits for untrusted scripts, e.g. in fuzzers, 0 is unlimited. Only
+  // script function calls and backward jumps are counted in numSteps, as
+  // nothing else can run long. The owner resets numSteps between runs.
+  // Exceeding a limit throws std::runtime_error
+  size_t maxCallDepth = 0;
+  uint64_t maxSteps = 0;
+  size_t maxArraySize = 0;
+  size_t maxStringLength = 0;
+  size_t callDepth = 0;
+  uint64_t numSteps = 0;
+
+  // Set by ShardedVirtualMachine. Called by CallMethod with the scripted
+  // function it found in 'script'. Returns true if the object belongs to
+  // another VM, in which case the call has been posted there and the calling
+  // script thread is suspended until the result arrives
+  std::function<bool(const PexScript& script, FunctionInfo& function,
+                     IGameObject* object, const VarValue* arguments,
+                     size_t numArguments)>
+    routeCall;
 
   std::vector<std::shared_ptr<PexScript>> allLoadedScripts;
+  std::unordered_map<std::string, std::shared_ptr<PexScript>,
+                     CaseInsensitiveHash, CaseInsensitiveEqual>
+    scriptsByName;
 
-  VirtualMachine(std::vector<std::shared_ptr<PexScript>> loadedScripts);
+  // Indexed by VarValue::GetObjectTypeId, nullptr for other types
+  std::vector<PexScript*> scriptsByTypeId;
+
+  // Scripts are linked here. With 'optimize' FunctionOptimizer runs on every
+  // function
+  VirtualMachine(std::vector<std::shared_ptr<PexScript>> loadedScripts,
+                 bool optimize = false);
+
+  // Loads scripts from a file produced by PexCache::Build
+  explicit VirtualMachine(const std::string& pexCachePath,
+                          bool optimize = false);
 
   void AddObject(std::shared_ptr<IGameObject> self,
                  std::vector<std::string> scripts, VarForBuildActivePex vars);
+  void RemoveObject(std::shared_ptr<IGameObject> self);
+
+  // Destroys retiredObjects and drops the parked script threads that run on
+  // them. Called by the interpreter once no script frame is left
+  void ReleaseRetiredObjects();
+
+  ActivePexInstance* GetInstance(IGameObject* object,
+                                 std::string_view scriptName);
+  ActivePexInstance* GetInstance(IGameObject* object,
+                                 const PexScript* script);
+
+  std::shared_ptr<PexScript> GetScript(const std::string& scriptName);
+
+  // Script of the declared type of the value. Loaded scripts are found by
+  // type id, without a lookup by name
+  PexScript* GetScriptOfType(const VarValue& object);
 
   void RegisterFunction(std::string className, std::string functionName,
                         FunctionType type, NativeFunction fn);
 
+  // Registers a plain callable, e.g. int32_t(float, bool). See
+  // NativeFunctions.h for the supported types
+  template <class F,
+            class = std::enable_if_t<
+              !std::is_invocable_v<F&, VarValue, std::vector<VarValue>>>>
+  void RegisterFunction(std::string className, std::string functionName,
+                        FunctionType type, F fn)
+  {
+    NativeCallback native;
+    if constexpr (NativeFunctions::FunctionTraits<F>::kArity == 0) {
+      // Bind<true> rejects callables without self at compile time, but the
+      // type is only known here
+      if (type == FunctionType::Method)
+        throw std::runtime_error("Native method must take self as parameter");
+      native = NativeFunctions::Bind<false>(std::move(fn), stringPool);
+    } else {
+      native = type == FunctionType::Method
+        ? NativeFunctions::Bind<true>(std::move(fn), stringPool)
+        : NativeFunctions::Bind<false>(std::move(fn), stringPool);
+    }
+    RegisterNative(className, functionName, type, std::move(native));
+  }
+
+  void RegisterNative(std::string_view className,
+                      std::string_view functionName, FunctionType type,
+                      NativeCallback fn);
+
+  // nullptr if nothing is registered for the slot or its fallback
+  const NativeCallback* FindNative(FunctionType type, NativeSlot slot) const;
+
+  // Event handlers run on their own script threads and may suspend, see
+  // Scheduler
   void SendEvent(std::shared_ptr<IGameObject> self, const char* eventName,
                  std::vector<VarValue>& arguments);
   void SendEvent(ActivePexInstance* instance, const char* eventName,
@@ -31,7 +142,32 @@ public:
   VarValue CallMethod(ActivePexInstance* instance, IGameObject* self,
                       const char* methodName,
                       std::vector<VarValue>& arguments);
+  VarValue CallMethod(ActivePexInstance* instance, IGameObject* self,
+                      const char* methodName, const VarValue* arguments,
+                      size_t numArguments);
 
   VarValue CallStatic(std::string className, std::string functionName,
                       std::vector<VarValue>& arguments);
+  VarValue CallStatic(std::string className, std::string functionName,
+                      const VarValue* arguments, size_t numArguments);
+  VarValue CallStatic(NativeSlot native, const char* className,
+                      const char* functionName, const VarValue* arguments,
+                      size_t numArguments);
+
+  // Binds functions compiled by AotCompiler to the loaded scripts. Entries
+  // whose code differs from the linked code are skipped. Call before any
+  // script runs. Returns the number of functions bound
+  size_t RegisterAotFunctions(const std::vector<AotFunction>& functions);
+
+  // Frees runtime strings no longer referenced by any script variable,
+  // parked script thread or completed latent result. Must not be called
+  // while a script is running. Strings returned to the caller earlier are
+  // invalidated
+  size_t CollectStrings();
+
+  void CountStep()
+  {
+    if (maxSteps && ++numSteps > maxSteps)
+      throw std::runtime_error("Step limit exceeded");
+  }
 };
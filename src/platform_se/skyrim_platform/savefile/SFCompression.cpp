@@ -0,0 +1,178 @@
+#include "SFCompression.h"
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+SaveFile_::CompressionPipeline::Worker::Worker(int level)
+{
+  if (inflateInit(&inflateStream) != Z_OK)
+    throw std::runtime_error("inflateInit() failed");
+  int res = deflateInit(&deflateStream, level);
+  if (res != Z_OK) {
+    inflateEnd(&inflateStream);
+    throw std::runtime_error("deflateInit() failed with code " +
+                             std::to_string(res));
+  }
+}
+
+SaveFile_::CompressionPipeline::Worker::~Worker()
+{
+  inflateEnd(&inflateStream);
+  deflateEnd(&deflateStream);
+}
+
+void SaveFile_::CompressionPipeline::Worker::Decompress(const uint8_t* in,
+                                                        size_t inSize,
+                                                        uint8_t* out,
+                                                        size_t outSize)
+{
+  inflateReset(&inflateStream);
+  inflateStream.next_in = const_cast<uint8_t*>(in);
+  inflateStream.avail_in = uInt(inSize);
+  inflateStream.next_out = out;
+  inflateStream.avail_out = uInt(outSize);
+
+  int res = inflate(&inflateStream, Z_FINISH);
+  if (res != Z_STREAM_END || inflateStream.avail_out != 0)
+    throw std::runtime_error("inflate() failed with code " +
+                             std::to_string(res));
+}
+
+std::vector<uint8_t> SaveFile_::CompressionPipeline::Worker::Compress(
+  const uint8_t* in, size_t inSize)
+{
+  deflateReset(&deflateStream);
+  std::vector<uint8_t> out(deflateBound(&deflateStream, uLong(inSize)));
+  deflateStream.next_in = const_cast<uint8_t*>(in);
+  deflateStream.avail_in = uInt(inSize);
+  deflateStream.next_out = out.data();
+  deflateStream.avail_out = uInt(out.size());
+
+  int res = deflate(&deflateStream, Z_FINISH);
+  if (res != Z_STREAM_END)
+    throw std::runtime_error("deflate() failed with code " +
+                             std::to_string(res));
+  out.resize(deflateStream.total_out);
+  return out;
+}
+
+SaveFile_::CompressionPipeline::CompressionPipeline(int level,
+                                                    size_t numThreads)
+{
+  if (numThreads == 0)
+    numThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (size_t i = 0; i < numThreads; ++i)
+    workers.push_back(std::make_unique<Worker>(level));
+  for (size_t i = 0; i + 1 < numThreads; ++i)
+    threads.emplace_back([this, i] { WorkerThread(i); });
+}
+
+SaveFile_::CompressionPipeline::~CompressionPipeline()
+{
+  {
+    std::lock_guard lock(mutex);
+    stopping = true;
+  }
+  condition.notify_all();
+  for (auto& thread : threads)
+    thread.join();
+}
+
+std::vector<std::vector<uint8_t>> SaveFile_::CompressionPipeline::Decompress(
+  const std::vector<ChangeForm>& forms)
+{
+  std::vector<std::vector<uint8_t>> contents(forms.size());
+  Run(forms.size(), [&](Worker& worker, size_t i) {
+    auto& form = forms[i];
+    if (form.length2 == 0) {
+      contents[i] = form.data.ToVector();
+      return;
+    }
+    contents[i].resize(form.length2);
+    worker.Decompress(form.data.data(), form.data.size(), contents[i].data(),
+                      contents[i].size());
+  });
+  return contents;
+}
+
+void SaveFile_::CompressionPipeline::Compress(
+  std::vector<ChangeForm>& forms, std::vector<std::vector<uint8_t>> contents)
+{
+  if (contents.size() != forms.size())
+    throw std::runtime_error("Expected contents of " +
+                             std::to_string(forms.size()) + " change forms");
+
+  Run(forms.size(), [&](Worker& worker, size_t i) {
+    auto& form = forms[i];
+    auto& formContents = contents[i];
+    if (form.length2 == 0 || formContents.empty()) {
+      form.length2 = 0;
+      form.length1 = uint32_t(formContents.size());
+      form.data = std::move(formContents);
+      return;
+    }
+    form.length2 = uint32_t(formContents.size());
+    form.data = worker.Compress(formContents.data(), formContents.size());
+    form.length1 = uint32_t(form.data.size());
+  });
+}
+
+void SaveFile_::CompressionPipeline::Run(size_t count_, const Task& task_)
+{
+  std::lock_guard runLock(runMutex);
+  {
+    std::lock_guard lock(mutex);
+    task = &task_;
+    count = count_;
+    next = 0;
+    error = nullptr;
+    numBusy = threads.size();
+    ++generation;
+  }
+  condition.notify_all();
+
+  Work(*workers.back());
+
+  std::unique_lock lock(mutex);
+  finished.wait(lock, [&] { return numBusy == 0; });
+  task = nullptr;
+  if (error)
+    std::rethrow_exception(std::exchange(error, nullptr));
+}
+
+void SaveFile_::CompressionPipeline::Work(Worker& worker)
+{
+  for (size_t i; (i = next++) < count;) {
+    try {
+      (*task)(worker, i);
+    } catch (...) {
+      std::lock_guard lock(mutex);
+      if (!error)
+        error = std::current_exception();
+      next = count; // The others stop after their current form
+    }
+  }
+}
+
+void SaveFile_::CompressionPipeline::WorkerThread(size_t index)
+{
+  uint64_t handledGeneration = 0;
+  while (true) {
+    {
+      std::unique_lock lock(mutex);
+      condition.wait(
+        lock, [&] { return stopping || generation != handledGeneration; });
+      if (stopping)
+        return;
+      handledGeneration = generation;
+    }
+
+    Work(*workers[index]);
+
+    std::lock_guard lock(mutex);
+    if (--numBusy == 0)
+      finished.notify_one();
+  }
+}
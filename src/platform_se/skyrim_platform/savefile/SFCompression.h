@@ -0,0 +1,78 @@
+#pragma once
+#include "SFStructure.h"
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <zlib.h>
+
+namespace SaveFile_ {
+// Decompresses and compresses change forms on a pool of worker threads.
+// Compressed forms (length2 != 0) are independent zlib streams, so each one
+// is a task. Every worker keeps its z_stream objects for all the forms it
+// handles, the calling thread works too. Calls from several threads are
+// safe, the pipeline runs them one after another.
+class CompressionPipeline
+{
+public:
+  // 'level' is a zlib compression level. 0 threads means one per core
+  explicit CompressionPipeline(int level = Z_BEST_COMPRESSION,
+                               size_t numThreads = 0);
+  ~CompressionPipeline();
+
+  CompressionPipeline(const CompressionPipeline&) = delete;
+  CompressionPipeline& operator=(const CompressionPipeline&) = delete;
+
+  // The contents of each form: its data, decompressed if it's compressed
+  std::vector<std::vector<uint8_t>> Decompress(
+    const std::vector<ChangeForm>& forms);
+
+  // The reverse of Decompress. Sets the data of forms that were compressed
+  // to their contents compressed, and of the others to their contents
+  void Compress(std::vector<ChangeForm>& forms,
+                std::vector<std::vector<uint8_t>> contents);
+
+  size_t GetNumThreads() const { return threads.size() + 1; }
+
+private:
+  struct Worker
+  {
+    explicit Worker(int level);
+    ~Worker();
+
+    void Decompress(const uint8_t* in, size_t inSize, uint8_t* out,
+                    size_t outSize);
+    std::vector<uint8_t> Compress(const uint8_t* in, size_t inSize);
+
+    z_stream inflateStream = {};
+    z_stream deflateStream = {};
+  };
+
+  using Task = std::function<void(Worker& worker, size_t index)>;
+
+  // Runs task(worker, i) for i in [0, count) and rethrows the first error.
+  // Holds runMutex, so the task must not call back into the pipeline
+  void Run(size_t count, const Task& task);
+  void Work(Worker& worker);
+  void WorkerThread(size_t index);
+
+  std::vector<std::unique_ptr<Worker>> workers; // The caller's is the last
+  std::vector<std::thread> threads;
+
+  // The task state below belongs to one Run at a time
+  std::mutex runMutex;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::condition_variable finished;
+  const Task* task = nullptr;
+  size_t count = 0;
+  std::atomic<size_t> next = 0;
+  uint64_t generation = 0;
+  size_t numBusy = 0;
+  bool stopping = false;
+  std::exception_ptr error;
+};
+}
@@ -5,6 +5,7 @@
 #include "SFStructure.h"
 #include "SFWriter.h"
 
+#include <algorithm>
 #include <cassert>
 #include <filesystem>
 #include <iostream>
@@ -28,17 +29,8 @@ void ChangeFormNPC(std::shared_ptr<SaveFile> structure,
 
     const auto& form = newForm.ToBinary();
 
-    structure->fileLocationTable.formIDArrayCountOffset -= formObj.length1;
-    structure->fileLocationTable.formIDArrayCountOffset += form.second.size();
-
-    structure->fileLocationTable.unknownTable3Offset -= formObj.length1;
-    structure->fileLocationTable.unknownTable3Offset += form.second.size();
-
-    structure->fileLocationTable.globalDataTable3Offset -= formObj.length1;
-    structure->fileLocationTable.globalDataTable3Offset += form.second.size();
-
+    // Writer updates length1 and the offsets
     formObj.length2 = 0;
-    formObj.length1 = form.second.size();
     formObj.data = form.second;
     formObj.changeFlags = form.first;
   }
@@ -58,17 +50,7 @@ void ChangeFormACHR(std::shared_ptr<SaveFile> structure)
     if (!formObj.formID.IsPlayerID())
       continue;
 
-    structure->fileLocationTable.formIDArrayCountOffset -= formObj.length1;
-    structure->fileLocationTable.formIDArrayCountOffset += res.second.size();
-
-    structure->fileLocationTable.unknownTable3Offset -= formObj.length1;
-    structure->fileLocationTable.unknownTable3Offset += res.second.size();
-
-    structure->fileLocationTable.globalDataTable3Offset -= formObj.length1;
-    structure->fileLocationTable.globalDataTable3Offset += res.second.size();
-
     formObj.length2 = 0;
-    formObj.length1 = res.second.size();
     formObj.data = res.second;
     formObj.changeFlags = res.first;
   }
@@ -1,28 +1,24 @@
 #include "SFReader.h"
 #include <cassert>
+#include <cstring>
 #include <fstream>
-#include <iostream>
 #include <stdexcept>
 
 void SaveFile_::Reader::Read()
 {
-  char temp;
-
-  arrayBytes.clear();
-
   std::ifstream File(path, std::ios::binary);
 
   if (File.is_open()) {
 
     File.seekg(0, std::ios_base::end);
-    auto fileSize = File.tellg();
+    auto size = static_cast<size_t>(File.tellg());
     File.seekg(0, std::ios_base::beg);
 
-    std::cout << "File size (in bytes): " << fileSize << std::endl;
+    arrayBytes = std::make_shared<std::vector<uint8_t>>(size);
+    File.read(reinterpret_cast<char*>(arrayBytes->data()), size);
 
-    while (File.get(temp)) {
-      arrayBytes.push_back(temp);
-    }
+    if (!File)
+      throw std::runtime_error("Error read file: " + path);
 
   } else {
     throw std::runtime_error("Error open file: " + path);
@@ -31,36 +27,46 @@ void SaveFile_::Reader::Read()
   File.close();
 };
 
-SaveFile_::Reader::Reader(std::string path)
+SaveFile_::Reader::Reader(std::string path, bool lazy)
 {
-  this->currentReadPositionInFile = 0;
   this->path = path;
+  this->lazy = lazy;
   Read();
-  CreateScriptStructure(arrayBytes);
+  CreateScriptStructure(arrayBytes->data(), arrayBytes->size());
+  structure->buffer = std::move(arrayBytes);
+}
+
+SaveFile_::Reader::Reader(const uint8_t* data, size_t size, bool lazy)
+{
+  this->lazy = lazy;
+  CreateScriptStructure(data, size);
 }
 
-SaveFile_::Reader::Reader(const uint8_t* data, size_t size)
+void SaveFile_::Reader::DecodeGlobalData(GlobalData& globalData)
 {
-  CreateScriptStructure({ data, data + size });
+  Reader reader;
+  reader.data = globalData.encoded.data();
+  reader.dataSize = globalData.encoded.size();
+  reader.FillGlobalDataContents(globalData);
+  assert(reader.currentReadPositionInFile == reader.dataSize);
 }
 
-void SaveFile_::Reader::CreateScriptStructure(std::vector<uint8_t> arrayBytes)
+void SaveFile_::Reader::CreateScriptStructure(const uint8_t* data,
+                                              size_t size)
 {
-  this->arrayBytes = arrayBytes;
+  this->data = data;
+  this->dataSize = size;
   currentReadPositionInFile = 0;
 
-  this->structure = std::make_shared<SaveFile>(SaveFile());
+  this->structure = std::make_shared<SaveFile>();
 
   structure->magic = ReadString(13);
   structure->headerSize = ReadUint32_bit();
   structure->header = FillHeader();
 
-  const size_t sizeScreenData =
-    structure->header.shotWidth * structure->header.shotHeight * 3;
-  structure->screenshotData.resize(sizeScreenData);
-
-  for (auto& byte : structure->screenshotData)
-    byte = Read8_bit();
+  const size_t sizeScreenData = size_t(structure->header.shotWidth) *
+    structure->header.shotHeight * 3;
+  structure->screenshotData = ReadBytes(sizeScreenData);
 
   structure->formVersion = Read8_bit();
   structure->pluginInfoSize = ReadUint32_bit();
@@ -180,107 +186,115 @@ std::vector<SaveFile_::GlobalData> SaveFile_::Reader::FillGlobalData(
     gData.type = ReadUint32_bit();
     gData.length = ReadUint32_bit();
 
-    uint32_t stepAfterReadData =
-      gData.length + this->currentReadPositionInFile;
-
-    switch (gData.type) {
-      case 0:
-        FillMiscStats(gData);
-        break;
-      case 1:
-        FillPlayerLocation(gData);
-        break;
-      case 2:
-        FillTES(gData);
-        break;
-      case 3:
-        FillGlobalVariables(gData);
-        break;
-      case 4:
-        FillCreatedObjects(gData);
-        break;
-      case 5:
-        FillEffects(gData);
-        break;
-      case 6:
-        FillWeather(gData);
-        break;
-      case 7:
-        FillAudio(gData);
-        break;
-      case 8:
-        FillSkyCells(gData);
-        break;
-      case 100:
-        FillProcessList(gData);
-        break;
-      case 101:
-        FillCombat(gData);
-        break;
-      case 102:
-        FillInterface(gData);
-        break;
-      case 103:
-        FillActorCauses(gData);
-        break;
-      case 104:
-        FillMain(gData); /// TODO Unknown format.
-        break;
-      case 105:
-        FillDetectionManager(gData);
-        break;
-      case 106:
-        FillLocationMetaData(gData);
-        break;
-      case 107:
-        FillQuestStaticData(gData);
-        break;
-      case 108:
-        FillStoryTeller(gData);
-        break;
-      case 109:
-        FillMagicFavorites(gData);
-        break;
-      case 110:
-        FillPlayerControls(gData);
-        break;
-      case 111:
-        FillMain(gData); /// TODO Unknown format.
-        break;
-      case 112:
-        FillIngredientShared(gData);
-        break;
-      case 113:
-        FillMenuControls(gData);
-        break;
-      case 114:
-        FillMenuTopicManager(gData);
-        break;
-      case 1000:
-        FillMain(gData); /// TODO
-        break;
-      case 1001:
-        FillMain(gData); /// TODO
-        break;
-      case 1002:
-        FillAnimObjects(gData);
-        break;
-      case 1003:
-        FillTimer(gData);
-        break;
-      case 1004:
-        FillMain(gData); /// TODO Unknown format.
-        break;
-      case 1005:
-        FillMain(gData); /// TODO Always Empty.
-        break;
+    if (lazy) {
+      gData.encoded = ReadBytes(gData.length);
+      continue;
     }
+
+    size_t stepAfterReadData = gData.length + this->currentReadPositionInFile;
+    FillGlobalDataContents(gData);
     assert(stepAfterReadData == this->currentReadPositionInFile);
   }
 
   return globalData;
 }
 
+void SaveFile_::Reader::FillGlobalDataContents(GlobalData& gData)
+{
+  switch (gData.type) {
+    case 0:
+      FillMiscStats(gData);
+      break;
+    case 1:
+      FillPlayerLocation(gData);
+      break;
+    case 2:
+      FillTES(gData);
+      break;
+    case 3:
+      FillGlobalVariables(gData);
+      break;
+    case 4:
+      FillCreatedObjects(gData);
+      break;
+    case 5:
+      FillEffects(gData);
+      break;
+    case 6:
+      FillWeather(gData);
+      break;
+    case 7:
+      FillAudio(gData);
+      break;
+    case 8:
+      FillSkyCells(gData);
+      break;
+    case 100:
+      FillProcessList(gData);
+      break;
+    case 101:
+      FillCombat(gData);
+      break;
+    case 102:
+      FillInterface(gData);
+      break;
+    case 103:
+      FillActorCauses(gData);
+      break;
+    case 104:
+      FillMain(gData); /// TODO Unknown format.
+      break;
+    case 105:
+      FillDetectionManager(gData);
+      break;
+    case 106:
+      FillLocationMetaData(gData);
+      break;
+    case 107:
+      FillQuestStaticData(gData);
+      break;
+    case 108:
+      FillStoryTeller(gData);
+      break;
+    case 109:
+      FillMagicFavorites(gData);
+      break;
+    case 110:
+      FillPlayerControls(gData);
+      break;
+    case 111:
+      FillMain(gData); /// TODO Unknown format.
+      break;
+    case 112:
+      FillIngredientShared(gData);
+      break;
+    case 113:
+      FillMenuControls(gData);
+      break;
+    case 114:
+      FillMenuTopicManager(gData);
+      break;
+    case 1000:
+      FillMain(gData); /// TODO
+      break;
+    case 1001:
+      FillMain(gData); /// TODO
+      break;
+    case 1002:
+      FillAnimObjects(gData);
+      break;
+    case 1003:
+      FillTimer(gData);
+      break;
+    case 1004:
+      FillMain(gData); /// TODO Unknown format.
+      break;
+    case 1005:
+      FillMain(gData); /// TODO Always Empty.
+      break;
+  }
+}
+
 std::vector<SaveFile_::ChangeForm> SaveFile_::Reader::FillChangeForm(
   uint32_t numObject)
 {
@@ -308,10 +322,7 @@ std::vector<SaveFile_::ChangeForm> SaveFile_::Reader::FillChangeForm(
       form.length2 = Read8_bit();
     }
 
-    form.data.resize(form.length1);
-
-    for (auto& byte : form.data)
-      byte = Read8_bit();
+    form.data = ReadBytes(form.length1);
   }
 
   return changeForm;
@@ -1157,86 +1168,76 @@ void SaveFile_::Reader::FillTimer(GlobalData& globalData)
 
 void SaveFile_::Reader::FillMain(GlobalData& globalData)
 {
-  std::vector<uint8_t> items;
-  items.resize(globalData.length);
-
-  for (auto& item : items)
-    item = Read8_bit();
+  globalData.data = std::make_shared<Bytes>(ReadBytes(globalData.length));
+}
 
-  globalData.data = std::make_shared<std::vector<uint8_t>>(items);
+void SaveFile_::Reader::CheckAvailable(size_t size)
+{
+  if (dataSize - currentReadPositionInFile < size)
+    throw std::runtime_error("Unexpected end of save file");
 }
 
 uint8_t SaveFile_::Reader::Read8_bit()
 {
-  return arrayBytes[currentReadPositionInFile++];
+  CheckAvailable(1);
+  return data[currentReadPositionInFile++];
 }
 
-uint16_t SaveFile_::Reader::Read16_bit()
+// .ess is little-endian, like the platforms the game runs on
+template <class T>
+static T ReadScalar(const uint8_t* data, size_t& position)
 {
-  uint8_t bufer[2];
-
-  for (auto& byte : bufer)
-    byte = Read8_bit();
-
-  uint16_t temp = *reinterpret_cast<uint16_t*>(bufer);
-
+  T temp;
+  std::memcpy(&temp, data + position, sizeof(T));
+  position += sizeof(T);
   return temp;
 }
 
-float SaveFile_::Reader::ReadFloat32_bit()
+uint16_t SaveFile_::Reader::Read16_bit()
 {
-  uint8_t bufer[4];
-
-  for (auto& byte : bufer)
-    byte = Read8_bit();
-
-  float temp = *reinterpret_cast<float*>(bufer);
+  CheckAvailable(2);
+  return ReadScalar<uint16_t>(data, currentReadPositionInFile);
+}
 
-  return temp;
+float SaveFile_::Reader::ReadFloat32_bit()
+{
+  CheckAvailable(4);
+  return ReadScalar<float>(data, currentReadPositionInFile);
 }
 
 uint32_t SaveFile_::Reader::ReadUint32_bit()
 {
-  uint8_t bufer[4];
-
-  for (auto& byte : bufer)
-    byte = Read8_bit();
-
-  uint32_t temp = *reinterpret_cast<uint32_t*>(bufer);
-
-  return temp;
+  CheckAvailable(4);
+  return ReadScalar<uint32_t>(data, currentReadPositionInFile);
 }
 
 int32_t SaveFile_::Reader::ReadInt32_bit()
 {
-  uint8_t bufer[4];
-
-  for (auto& byte : bufer)
-    byte = Read8_bit();
-
-  int32_t temp = *reinterpret_cast<int32_t*>(bufer);
-
-  return temp;
+  CheckAvailable(4);
+  return ReadScalar<int32_t>(data, currentReadPositionInFile);
 }
 
 uint64_t SaveFile_::Reader::Read64_bit()
 {
-  uint8_t bufer[8];
-
-  for (auto& byte : bufer)
-    byte = Read8_bit();
+  CheckAvailable(8);
+  return ReadScalar<uint64_t>(data, currentReadPositionInFile);
+}
 
-  uint64_t temp = *reinterpret_cast<uint64_t*>(bufer);
+std::string SaveFile_::Reader::ReadString(int Size)
+{
+  CheckAvailable(Size);
+  std::string temp(
+    reinterpret_cast<const char*>(data + currentReadPositionInFile), Size);
+  currentReadPositionInFile += Size;
 
   return temp;
 }
 
-std::string SaveFile_::Reader::ReadString(int Size)
+SaveFile_::Bytes SaveFile_::Reader::ReadBytes(size_t size)
 {
-  std::string temp = "";
-
-  for (int i = 0; i < Size; i++)
-    temp += (char)Read8_bit();
+  CheckAvailable(size);
+  Bytes temp(data + currentReadPositionInFile, size);
+  currentReadPositionInFile += size;
 
   return temp;
 }
@@ -6,15 +6,36 @@ class Reader
 {
 public:
   std::shared_ptr<SaveFile> GetStructure() { return this->structure; };
-  Reader(std::string path);
-  Reader(const uint8_t* data, size_t size);
+
+  // Reads the file with a single read. The structure keeps the contents.
+  // 'lazy' leaves global data encoded until GlobalData::GetData, so reading
+  // costs little more than indexing the tables and change form headers
+  Reader(std::string path, bool lazy = false);
+
+  // Parses a save from memory without copying it, e.g. a mapped file or an
+  // embedded resource. Screenshot, change form data and the global data the
+  // library doesn't decode point into 'data', which must outlive the
+  // structure
+  Reader(const uint8_t* data, size_t size, bool lazy = false);
+
+  // Decodes GlobalData::encoded into GlobalData::data
+  static void DecodeGlobalData(GlobalData& globalData);
 
 private:
+  Reader() = default;
+
+  bool lazy = false;
+
   std::string path = "";
 
-  int currentReadPositionInFile = 0;
+  size_t currentReadPositionInFile = 0;
+
+  // File contents when reading from disk
+  std::shared_ptr<std::vector<uint8_t>> arrayBytes;
 
-  std::vector<uint8_t> arrayBytes;
+  // Bytes being parsed, either arrayBytes or a caller-owned buffer
+  const uint8_t* data = nullptr;
+  size_t dataSize = 0;
 
   std::shared_ptr<SaveFile> structure;
 
@@ -22,6 +43,7 @@ private:
   PluginInfo FillPluginInfo();
   FileLocationTable FillFileLocationTable();
   std::vector<GlobalData> FillGlobalData(uint32_t numObject);
+  void FillGlobalDataContents(GlobalData& globalData);
   std::vector<ChangeForm> FillChangeForm(uint32_t numObject);
   RefID FillRefID();
   Unknown3Table FillUnknown3Table();
@@ -70,6 +92,10 @@ private:
   float ReadFloat32_bit();
   uint64_t Read64_bit();
   std::string ReadString(int Size);
+  Bytes ReadBytes(size_t size);
+
+  // Truncated files throw std::runtime_error
+  void CheckAvailable(size_t size);
 
   enum VsvalTypes
   {
@@ -81,6 +107,6 @@ private:
   uint32_t ReadVsval_bit();
 
   void Read();
-  void CreateScriptStructure(std::vector<uint8_t> arrayBytes);
+  void CreateScriptStructure(const uint8_t* data, size_t size);
 };
 }
\ No newline at end of file
@@ -0,0 +1,212 @@
+#include "SFSaveTemplate.h"
+#include "SFReader.h"
+#include "SFWriter.h"
+#include <algorithm>
+#include <ostream>
+#include <stdexcept>
+
+namespace {
+
+template <class T>
+std::vector<uint8_t> ToBytes(const std::vector<T>& values)
+{
+  auto bytes = reinterpret_cast<const uint8_t*>(values.data());
+  return { bytes, bytes + values.size() * sizeof(T) };
+}
+
+size_t GetChangeFormHeaderSize(uint8_t type)
+{
+  // The upper 2 bits of the type are the size of the lengths
+  size_t lengthSize = type > 0x7F ? 4 : type > 0x3F ? 2 : 1;
+  return 3 + 4 + 1 + 1 + lengthSize * 2;
+}
+}
+
+SaveFile_::SaveTemplate::SaveTemplate(const uint8_t* data_, size_t size_)
+  : data(data_)
+  , size(size_)
+{
+  save = Reader(data, size, true).GetStructure();
+  for (auto& globalData : save->globalDataTable1)
+    globalData.GetData();
+
+  pluginInfoOffset =
+    13 + 4 + save->headerSize + save->screenshotData.size() + 1;
+  fileLocationTableOffset = pluginInfoOffset + 4 + save->pluginInfoSize;
+
+  auto& table = save->fileLocationTable;
+  size_t offset = table.globalDataTable1Offset;
+  for (auto& globalData : save->globalDataTable1) {
+    globalDataTable1Offsets.push_back(offset);
+    offset += 8 + globalData.length;
+  }
+
+  offset = table.changeFormsOffset;
+  for (auto& form : save->changeForms) {
+    changeFormOffsets.push_back(offset);
+    changeFormSizes.push_back(GetChangeFormHeaderSize(form.type) +
+                              form.length1);
+    offset += changeFormSizes.back();
+  }
+
+  if (offset != table.globalDataTable3Offset ||
+      table.formIDArrayCountOffset + 4 + 4 * size_t(save->formIDArrayCount) >
+        size)
+    throw std::runtime_error("Unexpected layout of the template save");
+}
+
+SaveFile_::RefID SaveFile_::SaveTemplate::GetNewFormRefID(size_t index) const
+{
+  // As uesp.net says, formIDArray indices start at 1
+  size_t refIndex = save->formIDArrayCount + 1 + index;
+  if (refIndex >= 65536)
+    throw std::runtime_error("too many elements in FormIDArray (" +
+                             std::to_string(refIndex) + ")");
+
+  RefID res;
+  res.byte0 = 0;
+  res.byte1 = (refIndex / 256) % 256;
+  res.byte2 = refIndex % 256;
+  return res;
+}
+
+void SaveFile_::SaveTemplate::AddGlobalDataSplice(
+  std::vector<Splice>& splices, size_t index,
+  std::shared_ptr<void> contents) const
+{
+  if (index >= save->globalDataTable1.size())
+    throw std::runtime_error("The template lacks global data " +
+                             std::to_string(index));
+  auto& globalData = save->globalDataTable1[index];
+
+  GlobalData newGlobalData = { globalData.type, 0, contents };
+  splices.push_back({ globalDataTable1Offsets[index], 8 + globalData.length,
+                      Writer::Encode(newGlobalData) });
+}
+
+size_t SaveFile_::SaveTemplate::Output::size() const
+{
+  size_t res = 0;
+  for (auto& piece : pieces)
+    res += piece.size();
+  return res;
+}
+
+void SaveFile_::SaveTemplate::Output::Write(std::ostream& stream) const
+{
+  for (auto& piece : pieces)
+    stream.write(reinterpret_cast<const char*>(piece.data()), piece.size());
+}
+
+std::vector<uint8_t> SaveFile_::SaveTemplate::Output::ToVector() const
+{
+  std::vector<uint8_t> res;
+  res.reserve(size());
+  for (auto& piece : pieces)
+    res.insert(res.end(), piece.begin(), piece.end());
+  return res;
+}
+
+SaveFile_::SaveTemplate::Output SaveFile_::SaveTemplate::Build(
+  const Changes& changes) const
+{
+  std::vector<Splice> splices;
+
+  if (changes.plugins) {
+    PluginInfo pluginInfo;
+    pluginInfo.pluginsName = *changes.plugins;
+    splices.push_back({ pluginInfoOffset, 4 + size_t(save->pluginInfoSize),
+                        Writer::Encode(pluginInfo) });
+  }
+
+  // Global data table 1 has the types at their indices
+  auto& table1 = save->globalDataTable1;
+  if (changes.playerLocation) {
+    AddGlobalDataSplice(
+      splices, PlayerLocation::GlobalDataType,
+      std::make_shared<PlayerLocation>(*changes.playerLocation));
+  }
+  if (changes.weather) {
+    AddGlobalDataSplice(splices, SaveFile::WEATHER_INDEX,
+                        std::make_shared<Weather>(*changes.weather));
+  }
+  if (!changes.globalVariables.empty()) {
+    auto index = SaveFile::GLOBAL_VARIABLES_INDEX;
+    auto templateVariables = index < table1.size()
+      ? static_cast<const GlobalVariables*>(table1[index].data.get())
+      : nullptr;
+    if (!templateVariables)
+      throw std::runtime_error("The template lacks global variables");
+
+    auto variables = std::make_shared<GlobalVariables>(*templateVariables);
+    for (auto [refID, value] : changes.globalVariables) {
+      auto it = std::find_if(
+        variables->globals.begin(), variables->globals.end(),
+        [&](GlobalVariables::GlobalVariable& v) { return v.formID == refID; });
+      if (it == variables->globals.end())
+        throw std::runtime_error("Global Varible not found");
+      it->value = value;
+    }
+    AddGlobalDataSplice(splices, index, variables);
+  }
+
+  for (auto& [index, form] : changes.changeForms) {
+    if (index >= changeFormOffsets.size())
+      throw std::runtime_error("Bad change form index");
+    splices.push_back({ changeFormOffsets[index], changeFormSizes[index],
+                        Writer::Encode(form) });
+  }
+
+  if (!changes.newFormIDs.empty()) {
+    GetNewFormRefID(changes.newFormIDs.size() - 1); // Checks the limit
+
+    std::vector<uint32_t> count = { uint32_t(save->formIDArrayCount +
+                                             changes.newFormIDs.size()) };
+    size_t countOffset = save->fileLocationTable.formIDArrayCountOffset;
+    splices.push_back({ countOffset, 4, ToBytes(count) });
+    splices.push_back(
+      { countOffset + 4 + 4 * size_t(save->formIDArrayCount), 0,
+        ToBytes(changes.newFormIDs) });
+  }
+
+  std::stable_sort(
+    splices.begin(), splices.end(),
+    [](const Splice& a, const Splice& b) { return a.offset < b.offset; });
+
+  // Tables move by the growth of the splices before them
+  auto move = [&](uint32_t offset) {
+    int64_t res = offset;
+    for (auto& splice : splices) {
+      if (splice.offset < offset)
+        res += int64_t(splice.bytes.size()) - int64_t(splice.length);
+    }
+    return static_cast<uint32_t>(res);
+  };
+  auto& table = save->fileLocationTable;
+  std::vector<uint32_t> offsets = {
+    move(table.formIDArrayCountOffset), move(table.unknownTable3Offset),
+    move(table.globalDataTable1Offset), move(table.globalDataTable2Offset),
+    move(table.changeFormsOffset),      move(table.globalDataTable3Offset)
+  };
+
+  Splice fileLocationTable = { fileLocationTableOffset, 4 * offsets.size(),
+                               ToBytes(offsets) };
+  splices.insert(std::upper_bound(splices.begin(), splices.end(),
+                                  fileLocationTable,
+                                  [](const Splice& a, const Splice& b) {
+                                    return a.offset < b.offset;
+                                  }),
+                 fileLocationTable);
+
+  Output output;
+  size_t position = 0;
+  for (auto& splice : splices) {
+    if (splice.offset < position)
+      throw std::runtime_error("Overlapping changes of the template");
+    output.pieces.emplace_back(data + position, splice.offset - position);
+    output.pieces.emplace_back(std::move(splice.bytes));
+    position = splice.offset + splice.length;
+  }
+  output.pieces.emplace_back(data + position, size - position);
+  return output;
+}
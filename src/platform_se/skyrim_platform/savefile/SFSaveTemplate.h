@@ -0,0 +1,80 @@
+#pragma once
+#include "SFStructure.h"
+#include <iosfwd>
+#include <optional>
+#include <utility>
+
+namespace SaveFile_ {
+// A save read once and kept immutable, e.g. the template LoadGame starts
+// from. Build makes a save that differs from it in the records LoadGame
+// edits by splicing new encodings of those records into a copy of the
+// template's bytes. Nothing else is decoded or encoded again, and the file
+// location table is fixed up from the size of the splices.
+class SaveTemplate
+{
+public:
+  // Reads the save in place: 'data' must outlive the template. Global data
+  // table 1 is decoded, the rest of the global data isn't
+  SaveTemplate(const uint8_t* data, size_t size);
+
+  const SaveFile& GetSave() const { return *save; }
+
+  struct Changes
+  {
+    std::optional<std::vector<std::string>> plugins;
+    std::optional<PlayerLocation> playerLocation;
+    std::optional<Weather> weather;
+
+    // Values of global variables, which must exist in the template
+    std::vector<std::pair<RefID, float>> globalVariables;
+
+    // Change forms replacing GetSave().changeForms[index]
+    std::vector<std::pair<size_t, ChangeForm>> changeForms;
+
+    // Appended to SaveFile::formIDArray, see GetNewFormRefID
+    std::vector<uint32_t> newFormIDs;
+  };
+
+  // The RefID of Changes::newFormIDs[index] in built saves
+  RefID GetNewFormRefID(size_t index) const;
+
+  // A built save: views of the template's bytes with the new encodings of
+  // the changed records between them. The template must outlive it
+  class Output
+  {
+  public:
+    size_t size() const;
+    void Write(std::ostream& stream) const;
+    std::vector<uint8_t> ToVector() const;
+
+  private:
+    friend class SaveTemplate;
+    std::vector<Bytes> pieces;
+  };
+
+  // Doesn't copy the template, so it takes the same time for any size of it
+  Output Build(const Changes& changes) const;
+
+private:
+  struct Splice
+  {
+    size_t offset = 0;
+    size_t length = 0; // Of the template's bytes replaced
+    std::vector<uint8_t> bytes;
+  };
+
+  void AddGlobalDataSplice(std::vector<Splice>& splices, size_t index,
+                           std::shared_ptr<void> contents) const;
+
+  const uint8_t* data = nullptr;
+  size_t size = 0;
+  std::shared_ptr<SaveFile> save;
+
+  // Offsets of the parts Build replaces
+  size_t pluginInfoOffset = 0; // Of SaveFile::pluginInfoSize
+  size_t fileLocationTableOffset = 0;
+  std::vector<size_t> globalDataTable1Offsets;
+  std::vector<size_t> changeFormOffsets;
+  std::vector<size_t> changeFormSizes;
+};
+}
@@ -1,5 +1,8 @@
 #include "SFStructure.h"
+#include "SFReader.h"
+#include <cstring>
 #include <stdexcept>
+#include <utility>
 
 SaveFile_::RefID SaveFile_::RefID::CreateRefId(SaveFile& parentSaveFile,
                                                uint32_t formId)
@@ -7,18 +10,9 @@ SaveFile_::RefID SaveFile_::RefID::CreateRefId(SaveFile& parentSaveFile,
   RefID res;
 
   const auto countWas = parentSaveFile.formIDArrayCount;
-  const size_t n = countWas + 1;
-  uint32_t* newFormIDArray = new uint32_t[n];
-
-  memcpy(newFormIDArray, parentSaveFile.formIDArray.data(), countWas);
-  newFormIDArray[countWas] = formId;
-
-  parentSaveFile.formIDArray = { newFormIDArray, newFormIDArray + n };
+  parentSaveFile.formIDArray.push_back(formId);
   parentSaveFile.formIDArrayCount = countWas + 1;
 
-  // fix offset
-  parentSaveFile.fileLocationTable.unknownTable3Offset += 4;
-
   // 255 => 00 00 FF
   // 256 => 00 01 00
   // 65536 => error
@@ -34,8 +28,22 @@ SaveFile_::RefID SaveFile_::RefID::CreateRefId(SaveFile& parentSaveFile,
   return res;
 }
 
+void* SaveFile_::GlobalData::GetData()
+{
+  if (!data && !encoded.empty())
+    Reader::DecodeGlobalData(*this);
+  return data.get();
+}
+
 SaveFile_::ChangeForm* SaveFile_::SaveFile::GetChangeFormByRefID(
-  SaveFile_::RefID& refID, const uint8_t& type)
+  const SaveFile_::RefID& refID, const uint8_t& type)
+{
+  auto form = std::as_const(*this).GetChangeFormByRefID(refID, type);
+  return const_cast<ChangeForm*>(form);
+}
+
+const SaveFile_::ChangeForm* SaveFile_::SaveFile::GetChangeFormByRefID(
+  const SaveFile_::RefID& refID, const uint8_t& type) const
 {
   for (auto& form : this->changeForms) {
     if ((form.type & 0b00111111) == type &&
@@ -54,8 +62,7 @@ SaveFile_::SaveFile::GetGlobalvariableByRefID(SaveFile_::RefID& refID)
   if (gData.type != GLOBAL_VARIABLES_INDEX)
     return nullptr;
 
-  GlobalVariables* globalsVar =
-    reinterpret_cast<GlobalVariables*>(gData.data.get());
+  GlobalVariables* globalsVar = gData.Get<GlobalVariables>();
 
   if (!globalsVar)
     return nullptr;
@@ -68,7 +75,7 @@ SaveFile_::SaveFile::GetGlobalvariableByRefID(SaveFile_::RefID& refID)
   return nullptr;
 }
 
-int64_t SaveFile_::SaveFile::FindIndexInFormIdArray(uint32_t refID)
+int64_t SaveFile_::SaveFile::FindIndexInFormIdArray(uint32_t refID) const
 {
   for (uint32_t i = 0; i < this->formIDArray.size(); ++i) {
     if (this->formIDArray[i] == refID) {
@@ -81,25 +88,7 @@ int64_t SaveFile_::SaveFile::FindIndexInFormIdArray(uint32_t refID)
 void SaveFile_::SaveFile::OverwritePluginInfo(
   std::vector<std::string>& newPlaginNames)
 {
-  uint32_t oldSize = this->pluginInfoSize;
-
-  this->pluginInfoSize = 1;
-  this->pluginInfo.numPlugins = 0;
-  this->pluginInfo.pluginsName.clear();
-
+  // Writer recomputes pluginInfoSize and the offsets
   this->pluginInfo.numPlugins = uint8_t(newPlaginNames.size());
-
-  for (auto& plugin : newPlaginNames) {
-    this->pluginInfo.pluginsName.push_back(plugin);
-    this->pluginInfoSize += uint32_t(2 + plugin.size());
-  }
-
-  uint32_t addSize = this->pluginInfoSize - oldSize;
-
-  this->fileLocationTable.formIDArrayCountOffset += addSize;
-  this->fileLocationTable.unknownTable3Offset += addSize;
-  this->fileLocationTable.globalDataTable1Offset += addSize;
-  this->fileLocationTable.globalDataTable2Offset += addSize;
-  this->fileLocationTable.changeFormsOffset += addSize;
-  this->fileLocationTable.globalDataTable3Offset += addSize;
-}
\ No newline at end of file
+  this->pluginInfo.pluginsName = newPlaginNames;
+}
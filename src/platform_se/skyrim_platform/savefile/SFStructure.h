@@ -61,26 +61,26 @@ struct RefID
 
   static RefID CreateRefId(SaveFile& parentSaveFile, uint32_t formId);
 
-  bool IsPlayerID()
+  bool IsPlayerID() const
   {
     return ((this->byte0 == 0x40) && (this->byte1 == 0x00) &&
             (this->byte2 == 0x14));
   }
 
-  bool IsPlayerBaseID()
+  bool IsPlayerBaseID() const
   {
     return ((this->byte0 == 0x40) && (this->byte1 == 0x00) &&
             (this->byte2 == 0x7));
   }
 
-  bool operator==(RefID& objToCompare)
+  bool operator==(const RefID& objToCompare) const
   {
     return ((this->byte0 == objToCompare.byte0) &&
             (this->byte1 == objToCompare.byte1) &&
             (this->byte2 == objToCompare.byte2));
   }
 
-  bool operator!=(RefID& objToCompare)
+  bool operator!=(const RefID& objToCompare) const
   {
     return ((this->byte0 != objToCompare.byte0) ||
             (this->byte1 != objToCompare.byte1) ||
@@ -88,6 +88,58 @@ struct RefID
   }
 };
 
+// Bytes of a blob the library doesn't decode. They point into the buffer
+// the save was read from until they are assigned or modified, which copies
+// them. The buffer must outlive the views, see Reader
+class Bytes
+{
+public:
+  Bytes() = default;
+  Bytes(const uint8_t* data, size_t size)
+    : view(data)
+    , viewSize(size)
+  {
+  }
+  Bytes(std::vector<uint8_t> bytes)
+    : owned(std::move(bytes))
+  {
+  }
+
+  const uint8_t* data() const { return view ? view : owned.data(); }
+  size_t size() const { return view ? viewSize : owned.size(); }
+  bool empty() const { return size() == 0; }
+  const uint8_t* begin() const { return data(); }
+  const uint8_t* end() const { return data() + size(); }
+
+  uint8_t* MutableData()
+  {
+    Own();
+    return owned.data();
+  }
+
+  void resize(size_t size)
+  {
+    Own();
+    owned.resize(size);
+  }
+
+  std::vector<uint8_t> ToVector() const { return { begin(), end() }; }
+
+private:
+  void Own()
+  {
+    if (view) {
+      owned.assign(view, view + viewSize);
+      view = nullptr;
+      viewSize = 0;
+    }
+  }
+
+  const uint8_t* view = nullptr;
+  size_t viewSize = 0;
+  std::vector<uint8_t> owned;
+};
+
 struct ChangeForm
 {
   enum class Type
@@ -102,11 +154,11 @@ struct ChangeForm
   uint8_t type;
   uint8_t version; // Current as of Skyrim 1.9 is 74. Older values (57, 64, 73)
                    // are also valid
-  uint32_t length1;          // actual type depends on flags
-  uint32_t length2;          // actual type depends on flags. If this value is
-                             // non-zero, data is compressed. This value then
-                             // represents the uncompressed length.
-  std::vector<uint8_t> data; // data[length1]
+  uint32_t length1; // actual type depends on flags
+  uint32_t length2; // actual type depends on flags. If this value is non-zero,
+                    // data is compressed. This value then represents the
+                    // uncompressed length.
+  Bytes data;       // data[length1]
 
   bool Is_NPC_Type() { return ((this->type & 0b00111111) == 9); };
   bool Is_ACHR_Type() { return ((this->type & 0b00111111) == 1); };
@@ -117,6 +169,20 @@ struct GlobalData
   uint32_t type;
   uint32_t length;
   std::shared_ptr<void> data;
+
+  // The record as stored in the file, if the save was read lazily. Records
+  // never decoded are written back byte for byte
+  Bytes encoded;
+
+  // 'data', decoded on first access if the save was read lazily. nullptr
+  // for types the library doesn't know
+  void* GetData();
+
+  template <class T>
+  T* Get()
+  {
+    return static_cast<T*>(GetData());
+  }
 };
 
 struct FileLocationTable
@@ -180,9 +246,9 @@ struct SaveFile
   std::string magic; // Constant: "TESV_SAVEGAME"
   uint32_t headerSize;
   Header header;
-  std::vector<uint8_t> screenshotData; //[3*header.shotWidth*header.showHeight]
-                                       //-> pixel data in RGB
-  uint8_t formVersion;                 // current as of Skyrim 1.9 is 74
+  Bytes screenshotData; //[3*header.shotWidth*header.showHeight]
+                        //-> pixel data in RGB
+  uint8_t formVersion;  // current as of Skyrim 1.9 is 74
   uint32_t pluginInfoSize;
   PluginInfo pluginInfo;
   FileLocationTable fileLocationTable;
@@ -200,9 +266,15 @@ struct SaveFile
   uint32_t unknown3TableSize;
   Unknown3Table unknown3Table;
 
-  ChangeForm* GetChangeFormByRefID(RefID& refID, const uint8_t& type);
+  // Holds the file contents when the Reader read it from disk. Bytes views
+  // point into it
+  std::shared_ptr<const std::vector<uint8_t>> buffer;
+
+  ChangeForm* GetChangeFormByRefID(const RefID& refID, const uint8_t& type);
+  const ChangeForm* GetChangeFormByRefID(const RefID& refID,
+                                         const uint8_t& type) const;
   GlobalVariables::GlobalVariable* GetGlobalvariableByRefID(RefID& refID);
-  int64_t FindIndexInFormIdArray(uint32_t refID);
+  int64_t FindIndexInFormIdArray(uint32_t refID) const;
   void OverwritePluginInfo(std::vector<std::string>& newPlaginNames);
 };
 
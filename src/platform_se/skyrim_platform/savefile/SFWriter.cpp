@@ -1,5 +1,9 @@
 #include "SFWriter.h"
-#include <cassert>
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+static_assert(sizeof(SaveFile_::FileLocationTable) == 100);
 
 SaveFile_::Writer::Writer(std::shared_ptr<SaveFile> saveStructure)
 {
@@ -8,129 +12,171 @@ SaveFile_::Writer::Writer(std::shared_ptr<SaveFile> saveStructure)
 
 bool SaveFile_::Writer::CreateSaveFile(const std::filesystem::path& p)
 {
+  auto data = Serialize();
 
-  writer.open(p, std::ios::binary);
-
-  WriteString(13, saveStructure->magic);
-  Write(saveStructure->headerSize);
-
-  uint32_t stepBeforeHeader = this->currentWritePositionInFile;
-
-  Write(saveStructure->header.version);
-  Write(saveStructure->header.saveNumber);
-  WriteString(saveStructure->header.playerName);
-  Write(saveStructure->header.playerLevel);
-  WriteString(saveStructure->header.playerLocation);
-  WriteString(saveStructure->header.gameDate);
-  WriteString(saveStructure->header.playerRaceEditorId);
-  Write(saveStructure->header.playerSex);
-  Write(saveStructure->header.playerCurExp);
-  Write(saveStructure->header.playerLvlUpExp);
-  Write(saveStructure->header.filetime);
-  Write(saveStructure->header.shotWidth);
-  Write(saveStructure->header.shotHeight);
-
-  assert(this->currentWritePositionInFile ==
-         saveStructure->headerSize + stepBeforeHeader);
-
-  Write(saveStructure->screenshotData);
-  Write(saveStructure->formVersion);
-  Write(saveStructure->pluginInfoSize);
-
-  uint32_t stepBeforePluginInfo = this->currentWritePositionInFile;
-
-  Write(saveStructure->pluginInfo.numPlugins);
-  Write(saveStructure->pluginInfo.pluginsName);
-
-  assert(this->currentWritePositionInFile ==
-         saveStructure->pluginInfoSize + stepBeforePluginInfo);
-
-  Write(saveStructure->fileLocationTable.formIDArrayCountOffset);
-  Write(saveStructure->fileLocationTable.unknownTable3Offset);
-  Write(saveStructure->fileLocationTable.globalDataTable1Offset);
-  Write(saveStructure->fileLocationTable.globalDataTable2Offset);
-  Write(saveStructure->fileLocationTable.changeFormsOffset);
-  Write(saveStructure->fileLocationTable.globalDataTable3Offset);
-  Write(saveStructure->fileLocationTable.globalDataTable1Count);
-  Write(saveStructure->fileLocationTable.globalDataTable2Count);
-  Write(saveStructure->fileLocationTable.globalDataTable3Count);
-  Write(saveStructure->fileLocationTable.changeFormCount);
-  Write(saveStructure->fileLocationTable.unused);
-
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.globalDataTable1Offset);
-  for (auto& item : saveStructure->globalDataTable1)
-    WriteGlobalDataTable(item);
+  std::ofstream file(p, std::ios::binary);
+  file.write(reinterpret_cast<const char*>(data.data()), data.size());
+  file.close();
+
+  return !file.fail();
+}
+
+std::vector<uint8_t> SaveFile_::Writer::Serialize()
+{
+  auto& save = *saveStructure;
+  auto position = [this] { return static_cast<uint32_t>(Position()); };
+
+  buffer.clear();
+  if (save.buffer)
+    buffer.reserve(save.buffer->size()); // Edits rarely change the size much
+
+  WriteString(13, save.magic);
+  save.headerSize = WriteWithSize([&] { WriteHeader(save.header); });
+
+  Write(save.screenshotData);
+  Write(save.formVersion);
+  save.pluginInfoSize =
+    WriteWithSize([&] { WritePluginInfo(save.pluginInfo); });
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.globalDataTable2Offset);
-  for (auto& item : saveStructure->globalDataTable2)
+  // Written again when the offsets are known
+  auto& table = save.fileLocationTable;
+  size_t tablePosition = Position();
+  Write(table);
+
+  table.globalDataTable1Offset = position();
+  for (auto& item : save.globalDataTable1)
     WriteGlobalDataTable(item);
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.changeFormsOffset);
-  for (auto& form : saveStructure->changeForms) {
-    WriteRefID(form.formID);
-    Write(form.changeFlags);
-    Write(form.type);
-    Write(form.version);
-
-    if (form.type > 0x3F && form.type <= 0x7F) {
-      Write((uint16_t)form.length1);
-      Write((uint16_t)form.length2);
-    } else if (form.type > 0x7F) {
-      Write(form.length1);
-      Write(form.length2);
-    } else {
-      Write((uint8_t)form.length1);
-      Write((uint8_t)form.length2);
-    }
+  table.globalDataTable2Offset = position();
+  for (auto& item : save.globalDataTable2)
+    WriteGlobalDataTable(item);
 
-    Write(form.data);
-  }
+  table.changeFormsOffset = position();
+  for (auto& form : save.changeForms)
+    WriteChangeForm(form);
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.globalDataTable3Offset);
-  for (auto& item : saveStructure->globalDataTable3)
+  table.globalDataTable3Offset = position();
+  for (auto& item : save.globalDataTable3)
     WriteGlobalDataTable(item);
 
-  Write(saveStructure
-          ->fixForBag); /// fix for next assert , globalDataTable3Count is
-                        /// currently bugged (as of version 112) that it does
-                        /// not include type 1001 (Papyrus) in the count.
+  Write(save.fixForBag); /// fix for next assert , globalDataTable3Count is
+                         /// currently bugged (as of version 112) that it does
+                         /// not include type 1001 (Papyrus) in the count.
+
+  table.formIDArrayCountOffset = position();
+  save.formIDArrayCount = uint32_t(save.formIDArray.size());
+  Write(save.formIDArrayCount);
+  Write(save.formIDArray);
+
+  save.visitedWorldspaceArrayCount =
+    uint32_t(save.visitedWorldspaceArray.size());
+  Write(save.visitedWorldspaceArrayCount);
+  Write(save.visitedWorldspaceArray);
+
+  table.unknownTable3Offset = position();
+  save.unknown3TableSize = WriteWithSize([&] {
+    save.unknown3Table.count = uint32_t(save.unknown3Table.unknown.size());
+    Write(save.unknown3Table.count);
+    Write(save.unknown3Table.unknown);
+  });
+
+  table.globalDataTable1Count = uint32_t(save.globalDataTable1.size());
+  table.globalDataTable2Count = uint32_t(save.globalDataTable2.size());
+  table.globalDataTable3Count = uint32_t(save.globalDataTable3.size());
+  table.changeFormCount = uint32_t(save.changeForms.size());
+  WriteAt(tablePosition, table);
+
+  return std::move(buffer);
+}
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.formIDArrayCountOffset);
-  Write(saveStructure->formIDArrayCount);
-  Write(saveStructure->formIDArray);
+std::vector<uint8_t> SaveFile_::Writer::Encode(ChangeForm changeForm)
+{
+  Writer writer;
+  writer.WriteChangeForm(changeForm);
+  return std::move(writer.buffer);
+}
 
-  Write(saveStructure->visitedWorldspaceArrayCount);
-  Write(saveStructure->visitedWorldspaceArray);
+std::vector<uint8_t> SaveFile_::Writer::Encode(GlobalData globalData)
+{
+  Writer writer;
+  writer.WriteGlobalDataTable(globalData);
+  return std::move(writer.buffer);
+}
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->fileLocationTable.unknownTable3Offset);
-  Write(saveStructure->unknown3TableSize);
+std::vector<uint8_t> SaveFile_::Writer::Encode(PluginInfo pluginInfo)
+{
+  Writer writer;
+  writer.WriteWithSize([&] { writer.WritePluginInfo(pluginInfo); });
+  return std::move(writer.buffer);
+}
+
+void SaveFile_::Writer::WriteHeader(Header& header)
+{
+  Write(header.version);
+  Write(header.saveNumber);
+  WriteString(header.playerName);
+  Write(header.playerLevel);
+  WriteString(header.playerLocation);
+  WriteString(header.gameDate);
+  WriteString(header.playerRaceEditorId);
+  Write(header.playerSex);
+  Write(header.playerCurExp);
+  Write(header.playerLvlUpExp);
+  Write(header.filetime);
+  Write(header.shotWidth);
+  Write(header.shotHeight);
+}
 
-  uint32_t stepBeforeUnknownTable = this->currentWritePositionInFile;
+void SaveFile_::Writer::WritePluginInfo(PluginInfo& pluginInfo)
+{
+  pluginInfo.numPlugins = uint8_t(pluginInfo.pluginsName.size());
+  Write(pluginInfo.numPlugins);
+  Write(pluginInfo.pluginsName);
+}
 
-  Write(saveStructure->unknown3Table.count);
-  Write(saveStructure->unknown3Table.unknown);
+void SaveFile_::Writer::WriteChangeForm(ChangeForm& form)
+{
+  // The upper 2 bits of the type are the size of the lengths. Widen them if
+  // the data has grown
+  form.length1 = uint32_t(form.data.size());
+  uint32_t maxLength = std::max(form.length1, form.length2);
+  if (form.type <= 0x7F && maxLength > 0xFFFF)
+    form.type = (form.type & 0x3F) | 0x80;
+  else if (form.type <= 0x3F && maxLength > 0xFF)
+    form.type = form.type | 0x40;
 
-  assert(this->currentWritePositionInFile ==
-         saveStructure->unknown3TableSize + stepBeforeUnknownTable);
+  WriteRefID(form.formID);
+  Write(form.changeFlags);
+  Write(form.type);
+  Write(form.version);
 
-  writer.close();
+  if (form.type > 0x3F && form.type <= 0x7F) {
+    Write((uint16_t)form.length1);
+    Write((uint16_t)form.length2);
+  } else if (form.type > 0x7F) {
+    Write(form.length1);
+    Write(form.length2);
+  } else {
+    Write((uint8_t)form.length1);
+    Write((uint8_t)form.length2);
+  }
 
-  return !writer.fail();
+  Write(form.data);
 }
 
 void SaveFile_::Writer::WriteGlobalDataTable(GlobalData& globalData)
 {
   Write(globalData.type);
-  Write(globalData.length);
+  globalData.length =
+    WriteWithSize([&] { WriteGlobalDataContents(globalData); });
+}
 
-  uint32_t stepAfterWriteData =
-    globalData.length + this->currentWritePositionInFile;
+void SaveFile_::Writer::WriteGlobalDataContents(GlobalData& globalData)
+{
+  if (!globalData.data) {
+    Write(globalData.encoded);
+    return;
+  }
 
   switch (globalData.type) {
 
@@ -175,7 +221,7 @@ void SaveFile_::Writer::WriteGlobalDataTable(GlobalData& globalData)
       WriteActorCauses(static_cast<ActorCauses*>(globalData.data.get()));
       break;
     case 104:
-      WriteMain(static_cast<std::vector<uint8_t>*>(
+      WriteMain(static_cast<Bytes*>(
         globalData.data.get())); /// TODO Unknown format.
       break;
     case 105:
@@ -200,7 +246,7 @@ void SaveFile_::Writer::WriteGlobalDataTable(GlobalData& globalData)
       WritePlayerControls(static_cast<PlayerControls*>(globalData.data.get()));
       break;
     case 111:
-      WriteMain(static_cast<std::vector<uint8_t>*>(
+      WriteMain(static_cast<Bytes*>(
         globalData.data.get())); /// TODO Unknown format.
       break;
     case 112:
@@ -215,12 +261,10 @@ void SaveFile_::Writer::WriteGlobalDataTable(GlobalData& globalData)
         static_cast<MenuTopicManager*>(globalData.data.get()));
       break;
     case 1000:
-      WriteMain(
-        static_cast<std::vector<uint8_t>*>(globalData.data.get())); /// TODO
+      WriteMain(static_cast<Bytes*>(globalData.data.get())); /// TODO
       break;
     case 1001:
-      WriteMain(
-        static_cast<std::vector<uint8_t>*>(globalData.data.get())); /// TODO
+      WriteMain(static_cast<Bytes*>(globalData.data.get())); /// TODO
       break;
     case 1002:
       WriteAnimObjects(static_cast<AnimObjects*>(globalData.data.get()));
@@ -229,18 +273,17 @@ void SaveFile_::Writer::WriteGlobalDataTable(GlobalData& globalData)
       WriteTimer(static_cast<Timer*>(globalData.data.get()));
       break;
     case 1004:
-      WriteMain(static_cast<std::vector<uint8_t>*>(
+      WriteMain(static_cast<Bytes*>(
         globalData.data.get())); /// TODO Unknown format.
       break;
     case 1005:
-      WriteMain(static_cast<std::vector<uint8_t>*>(
+      WriteMain(static_cast<Bytes*>(
         globalData.data.get())); /// TODO Always Empty.
       break;
     default:
       assert(0);
       break;
   }
-  assert(stepAfterWriteData == this->currentWritePositionInFile);
 }
 
 void SaveFile_::Writer::WriteMiscStats(MiscStats* miscStats)
@@ -878,7 +921,7 @@ void SaveFile_::Writer::WriteTimer(Timer* timer)
   Write(timer->unknown2);
 }
 
-void SaveFile_::Writer::WriteMain(std::vector<uint8_t>* data)
+void SaveFile_::Writer::WriteMain(Bytes* data)
 {
   Write(*data);
 }
@@ -887,27 +930,24 @@ void SaveFile_::Writer::WriteString(const std::string& str)
 {
   uint16_t length = (uint16_t)str.size();
   Write(length);
-
-  for (int i = 0; i < length; ++i)
-    this->writer.put(str.at(i));
-  currentWritePositionInFile = currentWritePositionInFile + length;
+  buffer.insert(buffer.end(), str.begin(), str.begin() + length);
 }
 
-void SaveFile_::Writer::WriteString(int length, std::string& str)
+void SaveFile_::Writer::WriteString(int length, const std::string& str)
 {
-  for (int i = 0; i < length; ++i)
-    this->writer.put(str.at(i));
-  currentWritePositionInFile = currentWritePositionInFile + length;
+  if (size_t(length) > str.size())
+    throw std::out_of_range("String is shorter than its length");
+  buffer.insert(buffer.end(), str.begin(), str.begin() + length);
 }
 
-void SaveFile_::Writer::WriteRefID(RefID& refID)
+void SaveFile_::Writer::WriteRefID(const RefID& refID)
 {
   Write(refID.byte0);
   Write(refID.byte1);
   Write(refID.byte2);
 }
 
-void SaveFile_::Writer::WriteVsval(uint32_t& vsval)
+void SaveFile_::Writer::WriteVsval(uint32_t vsval)
 {
   if (vsval <= 0x3F) { // value is uint8 _0x3f
     Write(static_cast<uint8_t>(vsval << 2));
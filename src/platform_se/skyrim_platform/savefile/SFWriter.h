@@ -1,34 +1,64 @@
 #pragma once
 #include "SFStructure.h"
+#include <cassert>
+#include <cstring>
 #include <filesystem>
-#include <fstream>
+#include <vector>
 
 namespace SaveFile_ {
+// Serialises a save into memory. Sizes, counts and table offsets are
+// recomputed from what is written and stored back into the structure, so
+// records can be edited without fixing the file location table by hand
 class Writer
 {
 public:
   Writer(std::shared_ptr<SaveFile> saveStructure);
+
+  // Writes the file with a single write
   bool CreateSaveFile(const std::filesystem::path& path);
 
+  // The bytes CreateSaveFile writes
+  std::vector<uint8_t> Serialize();
+
+  // Records as Serialize writes them
+  static std::vector<uint8_t> Encode(ChangeForm changeForm);
+  static std::vector<uint8_t> Encode(GlobalData globalData);
+  // With pluginInfoSize
+  static std::vector<uint8_t> Encode(PluginInfo pluginInfo);
+
 private:
-  std::ofstream writer;
-  std::ifstream ifstr;
+  Writer() = default;
+
+  std::vector<uint8_t> buffer;
   std::shared_ptr<SaveFile> saveStructure;
 
-  uint32_t currentWritePositionInFile = 0;
+  size_t Position() const { return buffer.size(); }
 
   template <class T>
   void Write(const T& data)
   {
-    writer.write((char*)&data, sizeof(data));
-    currentWritePositionInFile = currentWritePositionInFile + sizeof(data);
+    auto bytes = reinterpret_cast<const uint8_t*>(&data);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(data));
+  };
+
+  // Overwrites what was written at 'position'
+  template <class T>
+  void WriteAt(size_t position, const T& data)
+  {
+    assert(position + sizeof(data) <= buffer.size());
+    std::memcpy(buffer.data() + position, &data, sizeof(data));
   };
 
   template <class T>
   void Write(const std::vector<T>& vector)
   {
-    for (auto& item : vector)
-      Writer::Write(item);
+    auto bytes = reinterpret_cast<const uint8_t*>(vector.data());
+    buffer.insert(buffer.end(), bytes, bytes + vector.size() * sizeof(T));
+  };
+
+  void Write(const Bytes& bytes)
+  {
+    buffer.insert(buffer.end(), bytes.begin(), bytes.end());
   };
 
   void Write(const std::vector<std::string>& vector)
@@ -37,6 +67,22 @@ private:
       WriteString(item);
   };
 
+  // Writes the uint32_t size of what 'write' writes before it
+  template <class F>
+  uint32_t WriteWithSize(F write)
+  {
+    size_t sizePosition = Position();
+    Write(uint32_t(0));
+    write();
+    auto size = static_cast<uint32_t>(Position() - sizePosition - 4);
+    WriteAt(sizePosition, size);
+    return size;
+  }
+
+  void WriteHeader(Header& header);
+  void WritePluginInfo(PluginInfo& pluginInfo);
+  void WriteChangeForm(ChangeForm& changeForm);
+
   void WriteMiscStats(MiscStats* miscStats);
   void WritePlayerLocation(PlayerLocation* playerLocation);
   void WriteTES(TES* tes);
@@ -84,13 +130,14 @@ private:
   void WriteAnimObjects(AnimObjects* animObjects);
   void WriteTimer(Timer* timer);
   // Synchronized Animations
-  void WriteMain(std::vector<uint8_t>* data);
+  void WriteMain(Bytes* data);
 
   void WriteString(const std::string& str);
-  void WriteString(int length, std::string& str);
+  void WriteString(int length, const std::string& str);
 
-  void WriteRefID(RefID& refID);
-  void WriteVsval(uint32_t& vsval);
+  void WriteRefID(const RefID& refID);
+  void WriteVsval(uint32_t vsval);
   void WriteGlobalDataTable(GlobalData& globalData);
+  void WriteGlobalDataContents(GlobalData& globalData);
 };
 }
\ No newline at end of file